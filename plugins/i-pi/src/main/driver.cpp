@@ -182,6 +182,9 @@ int main(int argc, char** argv) {
                 readbuffer(socket, (char*)&nat, sizeof(int));
 
                 if (bsize == 0) {
+                    if (nat != int(systems[0].GetNumRealSites())) {
+                        throw std::runtime_error("Number of atoms does not match the MBX system.");
+                    }
                     bsize = 3 * nat;
                     buffer = std::vector<double>(3 * nat);
                 } else if (bsize != 3 * nat) {
@@ -210,7 +213,7 @@ int main(int argc, char** argv) {
             }
 
             rid_old = rid;
-            systems[0].SetRealXyz(buffer);
+            systems[0].SetRealXyz(buffer.data());
 
             if (json_box.size()) {
                 systems[0].SetPBC(box);
@@ -219,7 +222,7 @@ int main(int argc, char** argv) {
             }
 
             energy = systems[0].Energy(true) / 627.509;
-            buffer = systems[0].GetRealGrads();
+            systems[0].GetRealGrads(buffer.data());
             for (size_t i = 0; i < buffer.size(); i++) {
                 //        buffer[i] = -buffer[i] / 627.509;
                 buffer[i] = -buffer[i] / 1.8897259886 / 627.509;
@@ -109,7 +109,32 @@ public:
      * your force.
      */
     bool usesPeriodicBoundaryConditions() const {
-        return false;
+        return usePeriodic;
+    }
+    /**
+     * Set whether the force uses periodic boundary conditions. When it does, the periodic box
+     * vectors of the Context are passed to MBX at every evaluation.
+     *
+     * @param periodic  true if the box vectors of the Context should be used
+     */
+    void setUsesPeriodicBoundaryConditions(bool periodic) {
+        usePeriodic = periodic;
+    }
+
+    /**
+     * Set an MBX json configuration file (cutoffs, Ewald parameters, dipole solver...) that the
+     * kernels read after the MBX system has been initialized. An empty name keeps the MBX defaults.
+     *
+     * @param jsonFile  the path of the json file
+     */
+    void setJsonFile(const std::string& jsonFile) {
+        json_file = jsonFile;
+    }
+    /**
+     * Get the MBX json configuration file of the force.
+     */
+    const std::string& getJsonFile() const {
+        return json_file;
     }
 
     std::vector<std::string> mbnrg_monomer_names;
@@ -119,6 +144,8 @@ public:
 protected:
     OpenMM::ForceImpl* createImpl() const;
 private:
+    bool usePeriodic;
+    std::string json_file;
 //    class BondInfo;
 //    std::vector<BondInfo> bonds;
 };
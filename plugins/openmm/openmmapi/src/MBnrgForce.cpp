@@ -38,7 +38,7 @@ using namespace MBnrgPlugin;
 using namespace OpenMM;
 using namespace std;
 
-MBnrgForce::MBnrgForce() {
+MBnrgForce::MBnrgForce() : usePeriodic(false) {
 }
 
 //int MBnrgForce::addBond(int particle1, int particle2, double length, double k) {
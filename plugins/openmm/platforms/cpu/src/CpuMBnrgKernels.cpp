@@ -0,0 +1,147 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuMBnrgKernels.h"
+#include "MBnrgForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/ContextImpl.h"
+#include "openmm/reference/ReferencePlatform.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace MBnrgPlugin;
+using namespace OpenMM;
+using namespace std;
+
+// The CPU platform keeps the positions and forces in the data of the reference platform it derives from
+static vector<Vec3>& extractPositions(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    return *((vector<Vec3>*) data->positions);
+}
+
+static vector<Vec3>& extractForces(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    return *((vector<Vec3>*) data->forces);
+}
+
+void CpuCalcMBnrgForceKernel::initialize(const System& system, const MBnrgForce& force) {
+    int numSites = 0;
+    for (size_t i = 0; i < force.sites.size(); i++)
+        numSites += force.sites[i];
+    if (numSites != system.getNumParticles())
+        throw OpenMMException("MBnrgForce: the monomer list has " + to_string(numSites) + " sites but the System has "
+                              + to_string(system.getNumParticles()) + " particles");
+
+    usePeriodic = force.usesPeriodicBoundaryConditions();
+    mbnrg_initialize(force);
+}
+
+double CpuCalcMBnrgForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+#ifdef _OPENMP
+    if (numThreads > 0)
+        omp_set_num_threads(numThreads);
+#endif
+
+    vector<Vec3>& pos = extractPositions(context);
+    vector<Vec3>& force = extractForces(context);
+
+    const double nmtoang = 10.0;
+    for (size_t i = 0; i < real_particles.size(); i++) {
+        const Vec3& p = pos[real_particles[i]];
+        xyz[3*i + 0] = p[0] * nmtoang;
+        xyz[3*i + 1] = p[1] * nmtoang;
+        xyz[3*i + 2] = p[2] * nmtoang;
+    }
+    mbnrg_system.SetRealXyz(xyz.data());
+
+    // Energy() makes the monomers whole and places the virtual sites in this box
+    if (usePeriodic) {
+        Vec3 boxVectors[3];
+        context.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                box[3*i + j] = boxVectors[i][j] * nmtoang;
+        mbnrg_system.SetBox(box);
+    }
+
+    const double kcaltokj = 4.184;
+    const double kcalperAngtokjpernm = kcaltokj*10;
+    double energy = mbnrg_system.Energy(includeForces) * kcaltokj;
+
+    if (includeForces) {
+        mbnrg_system.GetRealGrads(grad.data());
+        for (size_t i = 0; i < real_particles.size(); i++) {
+            Vec3& f = force[real_particles[i]];
+            f[0] -= grad[3*i + 0]*kcalperAngtokjpernm;
+            f[1] -= grad[3*i + 1]*kcalperAngtokjpernm;
+            f[2] -= grad[3*i + 2]*kcalperAngtokjpernm;
+        }
+    }
+
+    return energy;
+}
+
+void CpuCalcMBnrgForceKernel::copyParametersToContext(ContextImpl& context, const MBnrgForce& force) { }
+
+void CpuCalcMBnrgForceKernel::mbnrg_initialize(const MBnrgForce& force) {
+
+    size_t pos = 0;
+    real_particles.clear();
+    for (size_t i = 0; i < force.mbnrg_monomer_names.size(); i++) {
+      std::vector<double> coords(force.atoms[i]*3, 0.0);
+      mbnrg_system.AddMonomer(coords, force.at_names[i], force.mbnrg_monomer_names[i]);
+      for (int j = 0; j < force.atoms[i]; j++)
+        real_particles.push_back(pos + j);
+      pos += force.sites[i];
+    }
+
+    mbnrg_system.Initialize();
+
+    // Without a configuration file use the ASPC predictor, which keeps the induced dipoles
+    // of the previous steps as the initial guess of the dipole solver
+    if (force.getJsonFile().empty()) {
+      mbnrg_system.SetDipoleMethod("aspc");
+    } else {
+      std::string json_file = force.getJsonFile();
+      mbnrg_system.SetUpFromJson(&json_file[0]);
+    }
+
+    // A box from the configuration file is replaced at every step by the one of the context,
+    // and dropped for a force without periodic boundary conditions
+    if (!usePeriodic)
+      mbnrg_system.SetBox();
+
+    xyz.assign(3*real_particles.size(), 0.0);
+    grad.assign(3*real_particles.size(), 0.0);
+    box.assign(9, 0.0);
+}
@@ -0,0 +1,157 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the CPU implementation of MBnrgForce.
+ */
+
+#include "MBnrgForce.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace MBnrgPlugin;
+using namespace OpenMM;
+using namespace std;
+
+extern "C" OPENMM_EXPORT void registerMBnrgCpuKernelFactories();
+
+// Water tetramer in nm, 3 atoms and the M site (placed by MBX) per monomer
+static vector<Vec3> tetramerPositions() {
+    vector<Vec3> positions(16);
+    positions[0 ] = Vec3(-5.271868960e-01, -5.118438792e-01, -6.444759217e-03);
+    positions[1 ] = Vec3(-5.042973646e-01, -5.970187860e-01,  3.087563258e-02);
+    positions[2 ] = Vec3(-6.213650520e-01, -5.178381524e-01, -2.319150410e-02);
+    positions[3 ] = Vec3(0.0,0.0,0.0);
+    positions[4 ] = Vec3( 8.724746036e-01, -4.070724332e-01, -4.940333813e-02);
+    positions[5 ] = Vec3( 8.584254966e-01, -5.018093793e-01, -5.260720525e-02);
+    positions[6 ] = Vec3( 9.675007155e-01, -3.976482166e-01, -4.152170230e-02);
+    positions[7 ] = Vec3(0.0,0.0,0.0);
+    positions[8 ] = Vec3( 4.642386244e-01,  4.884658192e-01, -7.931968681e-02);
+    positions[9 ] = Vec3( 5.588814045e-01,  5.043530554e-01, -8.123070367e-02);
+    positions[10] = Vec3( 4.256517072e-01,  5.749582788e-01, -9.490054795e-02);
+    positions[11] = Vec3(0.0,0.0,0.0);
+    positions[12] = Vec3( 1.957774296e-01,  1.649823825e-01, -2.680393863e-01);
+    positions[13] = Vec3( 2.279807956e-01,  1.053814129e-01, -3.360605419e-01);
+    positions[14] = Vec3( 1.074407823e-01,  1.883791633e-01, -2.974171237e-01);
+    positions[15] = Vec3(0.0,0.0,0.0);
+    return positions;
+}
+
+static MBnrgForce* tetramerForce(System& system) {
+    for (int i = 0; i < 16; i++)
+        system.addParticle(1.0);
+    MBnrgForce* force = new MBnrgForce();
+    force->addMonomerList(vector<string>(4, "HOH"));
+    system.addForce(force);
+    return force;
+}
+
+void testForce() {
+    System system;
+    tetramerForce(system);
+    vector<Vec3> positions = tetramerPositions();
+
+    VerletIntegrator integ(1.0);
+    Platform& platform = Platform::getPlatformByName("CPU");
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Energy | State::Forces);
+
+    // Evaluating again at the same positions, with the dipole history of the
+    // previous calls, gives the same energy
+
+    State state2 = context.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(state.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-6);
+
+    // Validate the forces by moving each real particle along each axis, and see if the energy changes by the correct amount.
+
+    double offset = 1e-5;
+    for (int i = 0; i < 16; i++) {
+        if (i % 4 == 3)
+            continue;
+        for (int j = 0; j < 3; j++) {
+            vector<Vec3> offsetPos = positions;
+            offsetPos[i][j] = positions[i][j]-offset;
+            context.setPositions(offsetPos);
+            double e1 = context.getState(State::Energy).getPotentialEnergy();
+            offsetPos[i][j] = positions[i][j]+offset;
+            context.setPositions(offsetPos);
+            double e2 = context.getState(State::Energy).getPotentialEnergy();
+            ASSERT_EQUAL_TOL(state.getForces()[i][j], (e1-e2)/(2*offset), 1e-3);
+        }
+    }
+}
+
+void testPeriodic() {
+    System system;
+    MBnrgForce* force = tetramerForce(system);
+    force->setUsesPeriodicBoundaryConditions(true);
+    const double L = 2.5;
+    system.setDefaultPeriodicBoxVectors(Vec3(L, 0, 0), Vec3(0, L, 0), Vec3(0, 0, L));
+    vector<Vec3> positions = tetramerPositions();
+
+    VerletIntegrator integ(1.0);
+    Platform& platform = Platform::getPlatformByName("CPU");
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Energy | State::Forces);
+
+    // Translating one monomer by a box vector does not change anything
+
+    for (int i = 4; i < 8; i++)
+        positions[i][0] += L;
+    context.setPositions(positions);
+    State shifted = context.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(state.getPotentialEnergy(), shifted.getPotentialEnergy(), 1e-6);
+    for (int i = 0; i < 16; i++)
+        ASSERT_EQUAL_VEC(state.getForces()[i], shifted.getForces()[i], 1e-5);
+}
+
+int main() {
+    try {
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+        registerMBnrgCpuKernelFactories();
+        testForce();
+        testPeriodic();
+    }
+    catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Done" << std::endl;
+    return 0;
+}
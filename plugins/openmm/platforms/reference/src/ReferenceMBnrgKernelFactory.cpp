@@ -44,7 +44,8 @@ extern "C" OPENMM_EXPORT void registerPlatforms() {
 extern "C" OPENMM_EXPORT void registerKernelFactories() {
     for (int i = 0; i < Platform::getNumPlatforms(); i++) {
         Platform& platform = Platform::getPlatform(i);
-        if (dynamic_cast<ReferencePlatform*>(&platform) != NULL) {
+        // The CPU platform derives from the reference one but has its own kernel
+        if (platform.getName() == "Reference") {
             ReferenceMBnrgKernelFactory* factory = new ReferenceMBnrgKernelFactory();
             platform.registerKernelFactory(CalcMBnrgForceKernel::Name(), factory);
         }
@@ -33,35 +33,35 @@
 #include "MBnrgForce.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/ContextImpl.h"
-#include "openmm/reference/RealVec.h"
 #include "openmm/reference/ReferencePlatform.h"
 
 using namespace MBnrgPlugin;
 using namespace OpenMM;
 using namespace std;
 
-static vector<RealVec>& extractPositions(ContextImpl& context) {
+static vector<Vec3>& extractPositions(ContextImpl& context) {
     ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
-    return *((vector<RealVec>*) data->positions);
+    return *((vector<Vec3>*) data->positions);
 }
 
-static vector<RealVec>& extractForces(ContextImpl& context) {
+static vector<Vec3>& extractForces(ContextImpl& context) {
     ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
-    return *((vector<RealVec>*) data->forces);
+    return *((vector<Vec3>*) data->forces);
 }
 
 void ReferenceCalcMBnrgForceKernel::initialize(const System& system, const MBnrgForce& force) {
 
     // Can do nothing here (MB-nrg)
 
+    usePeriodic = force.usesPeriodicBoundaryConditions();
     mbnrg_initialize(force);
     mbsys_initialized = true;
 
 }
 
 double ReferenceCalcMBnrgForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
-    vector<RealVec>& pos = extractPositions(context);
-    vector<RealVec>& force = extractForces(context);
+    vector<Vec3>& pos = extractPositions(context);
+    vector<Vec3>& force = extractForces(context);
 
     double nmtoang = 10.0;
     std::vector<double> xyz_context(3*pos.size());
@@ -72,17 +72,28 @@ double ReferenceCalcMBnrgForceKernel::execute(ContextImpl& context, bool include
     }
 
 
-    mbnrg_system.SetOriginalOrderSysXyz(xyz_context);
+    mbnrg_system.SetXyz(xyz_context);
+
+    // Energy() makes the monomers whole and places the virtual sites in this box
+    if (usePeriodic) {
+      Vec3 boxVectors[3];
+      context.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+      std::vector<double> box(9);
+      for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+          box[3*i + j] = boxVectors[i][j] * nmtoang;
+      mbnrg_system.SetBox(box);
+    }
     
     double kcaltokj = 4.184;
     double kcalperAngtokjpernm = kcaltokj*10;
-    std::vector<double> grad(3*force.size(),0.0);
-    double energy = mbnrg_system.Energy(grad,true) * kcaltokj;
+    double energy = mbnrg_system.Energy(true) * kcaltokj;
+    std::vector<double> grad = mbnrg_system.GetGrads();
     
     for (size_t i = 0; i < force.size(); i++) {
-      force[i][0] = -grad[3*i + 0]*kcalperAngtokjpernm;
-      force[i][1] = -grad[3*i + 1]*kcalperAngtokjpernm;
-      force[i][2] = -grad[3*i + 2]*kcalperAngtokjpernm;
+      force[i][0] -= grad[3*i + 0]*kcalperAngtokjpernm;
+      force[i][1] -= grad[3*i + 1]*kcalperAngtokjpernm;
+      force[i][2] -= grad[3*i + 2]*kcalperAngtokjpernm;
     }
 
     return energy;
@@ -101,4 +112,14 @@ void ReferenceCalcMBnrgForceKernel::mbnrg_initialize(const MBnrgForce& force) {
     }
     
     mbnrg_system.Initialize();
+
+    if (!force.getJsonFile().empty()) {
+      std::string json_file = force.getJsonFile();
+      mbnrg_system.SetUpFromJson(&json_file[0]);
+    }
+
+    // A box from the configuration file is replaced at every step by the one of the context,
+    // and dropped for a force without periodic boundary conditions
+    if (!usePeriodic)
+      mbnrg_system.SetBox();
 }
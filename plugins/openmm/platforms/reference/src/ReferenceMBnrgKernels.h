@@ -44,7 +44,8 @@ namespace MBnrgPlugin {
  */
 class ReferenceCalcMBnrgForceKernel : public CalcMBnrgForceKernel {
 public:
-    ReferenceCalcMBnrgForceKernel(std::string name, const OpenMM::Platform& platform) : CalcMBnrgForceKernel(name, platform) {
+    ReferenceCalcMBnrgForceKernel(std::string name, const OpenMM::Platform& platform)
+        : CalcMBnrgForceKernel(name, platform), mbsys_initialized(false), usePeriodic(false) {
     }
     /**
      * Initialize the kernel.
@@ -74,6 +75,7 @@ private:
     void mbnrg_initialize(const MBnrgForce& force);
     bblock::System mbnrg_system;
     bool mbsys_initialized;
+    bool usePeriodic;
 
 //    int numBonds;
 //    std::vector<int> particle1, particle2;
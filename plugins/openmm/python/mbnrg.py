@@ -79,6 +79,7 @@ class MBnrgForceGenerator:
         for i in residue_index_pair:
             v.push_back(i[0])
         force.addMonomerList(v)
+        force.setUsesPeriodicBoundaryConditions(nonbondedMethod in [app.PME, app.Ewald, app.CutoffPeriodic])
         
 # Here is where I will need to add the information of monomers
 # Then add it to the force class, so it knows everything it needs
@@ -43,6 +43,10 @@ public:
 
     void updateParametersInContext(OpenMM::Context& context);
     int addMonomerList(std::vector<std::string> openmmMonomers);
+    bool usesPeriodicBoundaryConditions() const;
+    void setUsesPeriodicBoundaryConditions(bool periodic);
+    void setJsonFile(const std::string& jsonFile);
+    const std::string& getJsonFile() const;
 
     /*
      * The reference parameters to this function are output values.
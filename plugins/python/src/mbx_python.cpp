@@ -0,0 +1,218 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bblock/system.h"
+#include "json/json.h"
+
+namespace py = pybind11;
+
+namespace {
+
+// Inputs accept anything convertible to doubles; C-contiguous float64 arrays are read in place
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> InputArray;
+// Outputs must already be C-contiguous float64 arrays, so that MBX writes into the caller memory
+typedef py::array_t<double, py::array::c_style> OutputArray;
+
+/**
+ * Returns the data of a caller-supplied output array. The array must be a writable
+ * C-contiguous float64 array of n elements; anything else would make pybind11 write
+ * into a temporary copy, so it is rejected instead.
+ */
+double *OutputData(py::object obj, size_t n, const std::string &name) {
+    if (!OutputArray::check_(obj)) {
+        throw py::type_error(name + " must be a C-contiguous float64 numpy array");
+    }
+    OutputArray arr = py::reinterpret_borrow<OutputArray>(obj);
+    if (!arr.writeable()) {
+        throw py::value_error(name + " is not writable");
+    }
+    if (static_cast<size_t>(arr.size()) != n) {
+        throw py::value_error(name + " has " + std::to_string(arr.size()) + " elements, " + std::to_string(n) +
+                              " are needed");
+    }
+    return arr.mutable_data();
+}
+
+std::vector<double> ToVector(const InputArray &arr) { return std::vector<double>(arr.data(), arr.data() + arr.size()); }
+
+py::array_t<double> ToArray(const std::vector<double> &v) {
+    return py::array_t<double>(static_cast<py::ssize_t>(v.size()), v.data());
+}
+
+/**
+ * Evaluates the energy of the current configuration, and writes the gradients (kcal/mol/A),
+ * the virial and the induced dipoles into the arrays that were passed. The GIL is released
+ * during the evaluation, so other Python threads keep running.
+ */
+double Energy(bblock::System &sys, py::object grads, py::object virial, py::object dipoles) {
+    double *g = grads.is_none() ? nullptr : OutputData(grads, 3 * sys.GetNumRealSites(), "grads");
+    double *v = virial.is_none() ? nullptr : OutputData(virial, 9, "virial");
+    double *mu = dipoles.is_none() ? nullptr : OutputData(dipoles, 3 * sys.GetNumSites(), "dipoles");
+
+    double energy;
+    {
+        py::gil_scoped_release release;
+        energy = sys.Energy(g != nullptr || v != nullptr);
+        if (g) sys.GetRealGrads(g);
+        if (v) {
+            std::vector<double> tmp = sys.GetVirial();
+            std::copy(tmp.begin(), tmp.end(), v);
+        }
+        if (mu) {
+            std::vector<double> tmp = sys.GetInducedDipoles();
+            std::copy(tmp.begin(), tmp.end(), mu);
+        }
+    }
+
+    return energy;
+}
+
+/**
+ * Evaluates a batch of frames of the same system in one call. frames holds nframes
+ * configurations of the real sites, and boxes, if given, one 9 component box per frame.
+ * The gradients and virials of each frame go to the optional output arrays, frame after frame.
+ * @return The energy of each frame
+ */
+py::array_t<double> Energies(bblock::System &sys, InputArray frames, py::object boxes, py::object grads,
+                             py::object virials) {
+    const size_t nxyz = 3 * sys.GetNumRealSites();
+    if (nxyz == 0 || frames.size() % nxyz != 0) {
+        throw py::value_error("frames must hold a multiple of " + std::to_string(nxyz) + " coordinates");
+    }
+    const size_t nframes = frames.size() / nxyz;
+
+    InputArray box_arr;
+    if (!boxes.is_none()) {
+        box_arr = py::cast<InputArray>(boxes);
+        if (static_cast<size_t>(box_arr.size()) != 9 * nframes) {
+            throw py::value_error("boxes must hold 9 components per frame");
+        }
+    }
+    double *g = grads.is_none() ? nullptr : OutputData(grads, nxyz * nframes, "grads");
+    double *v = virials.is_none() ? nullptr : OutputData(virials, 9 * nframes, "virials");
+
+    py::array_t<double> energies(static_cast<py::ssize_t>(nframes));
+    double *e = energies.mutable_data();
+    const double *xyz = frames.data();
+    const double *box = boxes.is_none() ? nullptr : box_arr.data();
+    {
+        py::gil_scoped_release release;
+        for (size_t f = 0; f < nframes; f++) {
+            sys.SetRealXyz(xyz + f * nxyz);
+            if (box) sys.SetPBC(std::vector<double>(box + 9 * f, box + 9 * (f + 1)));
+            e[f] = sys.Energy(g != nullptr || v != nullptr);
+            if (g) sys.GetRealGrads(g + f * nxyz);
+            if (v) {
+                std::vector<double> tmp = sys.GetVirial();
+                std::copy(tmp.begin(), tmp.end(), v + 9 * f);
+            }
+        }
+    }
+
+    return energies;
+}
+
+}  // namespace
+
+PYBIND11_MODULE(mbx, m) {
+    m.doc() = "Python bindings of the MBX many-body energy library";
+
+    py::class_<bblock::System>(m, "System")
+        .def(py::init<>())
+        .def(
+            "add_monomer",
+            [](bblock::System &sys, InputArray xyz, std::vector<std::string> atoms, std::string id) {
+                sys.AddMonomer(ToVector(xyz), atoms, id);
+            },
+            py::arg("xyz"), py::arg("atoms"), py::arg("id"))
+        .def(
+            "add_monomers",
+            [](bblock::System &sys, InputArray xyz, const std::vector<std::string> &atoms,
+               const std::vector<std::string> &ids, const std::vector<size_t> &nat) {
+                sys.AddMonomers(ToVector(xyz), atoms, ids, nat);
+            },
+            py::arg("xyz"), py::arg("atoms"), py::arg("ids"), py::arg("nat"))
+        .def("initialize", &bblock::System::Initialize)
+        .def(
+            "set_up_from_json",
+            [](bblock::System &sys, std::string json_file) { sys.SetUpFromJson(&json_file[0]); },
+            py::arg("json_file"))
+        .def(
+            "set_up_from_json_string",
+            [](bblock::System &sys, const std::string &text) { sys.SetUpFromJson(nlohmann::json::parse(text)); },
+            py::arg("text"))
+        .def("get_num_monomers", &bblock::System::GetNumMon)
+        .def("get_num_sites", &bblock::System::GetNumSites)
+        .def("get_num_real_sites", &bblock::System::GetNumRealSites)
+        .def(
+            "set_real_xyz",
+            [](bblock::System &sys, InputArray xyz) {
+                if (static_cast<size_t>(xyz.size()) != 3 * sys.GetNumRealSites()) {
+                    throw py::value_error("xyz must hold " + std::to_string(3 * sys.GetNumRealSites()) + " coordinates");
+                }
+                sys.SetRealXyz(xyz.data());
+            },
+            py::arg("xyz"))
+        .def("get_real_xyz", [](bblock::System &sys) { return ToArray(sys.GetRealXyz()); })
+        .def(
+            "set_pbc",
+            [](bblock::System &sys, py::object box) {
+                sys.SetPBC(box.is_none() ? std::vector<double>() : ToVector(py::cast<InputArray>(box)));
+            },
+            py::arg("box") = py::none())
+        .def("get_box", [](bblock::System &sys) { return ToArray(sys.GetBox()); })
+        .def("set_dipole_method", &bblock::System::SetDipoleMethod, py::arg("method"))
+        .def("reset_dipole_history", &bblock::System::ResetDipoleHistory)
+        .def("get_state", [](bblock::System &sys) { return py::bytes(sys.GetState()); })
+        .def(
+            "set_state", [](bblock::System &sys, const std::string &state) { sys.SetState(state); },
+            py::arg("state"))
+        .def("save_state", &bblock::System::SaveState, py::arg("path"))
+        .def("load_state", &bblock::System::LoadState, py::arg("path"))
+        .def("energy", &Energy, py::arg("grads") = py::none(), py::arg("virial") = py::none(),
+             py::arg("dipoles") = py::none())
+        .def("energies", &Energies, py::arg("frames"), py::arg("boxes") = py::none(), py::arg("grads") = py::none(),
+             py::arg("virials") = py::none())
+        .def("get_real_grads", [](bblock::System &sys) { return ToArray(sys.GetRealGrads()); })
+        .def("get_virial", [](bblock::System &sys) { return ToArray(sys.GetVirial()); })
+        .def("get_induced_dipoles", [](bblock::System &sys) { return ToArray(sys.GetInducedDipoles()); });
+}
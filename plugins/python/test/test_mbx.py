@@ -0,0 +1,111 @@
+import threading
+import unittest
+
+import numpy as np
+
+import mbx
+
+# Water dimer (A) and its MB-pol energy (kcal/mol)
+DIMER_XYZ = np.array([-1.5510, -0.1145,  0.0000,
+                      -1.9343,  0.7625,  0.0000,
+                      -0.5997,  0.0407,  0.0000,
+                       1.3506,  0.1114,  0.0000,
+                       1.6803, -0.3763, -0.7585,
+                       1.6803, -0.3763,  0.7585])
+DIMER_ENERGY = -4.9390686615
+
+
+def make_dimer():
+    sys = mbx.System()
+    sys.add_monomer(DIMER_XYZ[:9], ["O", "H", "H"], "h2o")
+    sys.add_monomer(DIMER_XYZ[9:], ["O", "H", "H"], "h2o")
+    sys.initialize()
+    return sys
+
+
+class TestSystem(unittest.TestCase):
+
+    def test_energy(self):
+        sys = make_dimer()
+        self.assertAlmostEqual(sys.energy(), DIMER_ENERGY, places=6)
+
+    def test_add_monomers(self):
+        sys = mbx.System()
+        sys.add_monomers(DIMER_XYZ, ["O", "H", "H"] * 2, ["h2o", "h2o"], [3, 3])
+        sys.initialize()
+        self.assertAlmostEqual(sys.energy(), DIMER_ENERGY, places=6)
+
+    def test_outputs_are_written_in_place(self):
+        sys = make_dimer()
+        grads = np.zeros(18)
+        virial = np.zeros(9)
+        dipoles = np.zeros(3 * sys.get_num_sites())
+        sys.energy(grads=grads, virial=virial, dipoles=dipoles)
+        np.testing.assert_allclose(grads, sys.get_real_grads(), atol=1e-12)
+        np.testing.assert_allclose(virial, sys.get_virial(), atol=1e-12)
+        np.testing.assert_allclose(dipoles, sys.get_induced_dipoles(), atol=1e-12)
+        self.assertGreater(np.abs(dipoles).max(), 0.0)
+
+    def test_gradients(self):
+        sys = make_dimer()
+        grads = np.zeros(18)
+        sys.energy(grads=grads)
+        h = 1e-5
+        for i in range(18):
+            xyz = DIMER_XYZ.copy()
+            xyz[i] += h
+            sys.set_real_xyz(xyz)
+            ep = sys.energy()
+            xyz[i] -= 2 * h
+            sys.set_real_xyz(xyz)
+            em = sys.energy()
+            self.assertAlmostEqual(grads[i], (ep - em) / (2 * h), places=4)
+
+    def test_bad_output_arrays(self):
+        sys = make_dimer()
+        with self.assertRaises(TypeError):
+            sys.energy(grads=np.zeros(18, dtype=np.float32))
+        with self.assertRaises(TypeError):
+            sys.energy(grads=np.zeros(36)[::2])
+        with self.assertRaises(ValueError):
+            sys.energy(grads=np.zeros(17))
+
+    def test_batch(self):
+        sys = make_dimer()
+        rng = np.random.RandomState(7)
+        frames = DIMER_XYZ + 0.02 * rng.standard_normal((4, 18))
+        boxes = np.tile([20.0, 0, 0, 0, 20.0, 0, 0, 0, 20.0], (4, 1))
+        grads = np.zeros((4, 6, 3))
+        virials = np.zeros((4, 9))
+        energies = sys.energies(frames, boxes=boxes, grads=grads, virials=virials)
+        for f in range(4):
+            g = np.zeros(18)
+            sys.set_real_xyz(frames[f])
+            sys.set_pbc(boxes[f])
+            self.assertAlmostEqual(energies[f], sys.energy(grads=g), places=8)
+            np.testing.assert_allclose(grads[f].ravel(), g, atol=1e-8)
+
+    def test_threads(self):
+        # Energy() releases the GIL, so independent systems can run side by side
+        systems = [make_dimer() for _ in range(2)]
+        results = [None, None]
+
+        def run(k):
+            results[k] = systems[k].energy()
+
+        threads = [threading.Thread(target=run, args=(k,)) for k in range(2)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for e in results:
+            self.assertAlmostEqual(e, DIMER_ENERGY, places=6)
+
+    def test_errors(self):
+        sys = mbx.System()
+        with self.assertRaises(RuntimeError):
+            sys.energy()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -34,15 +34,226 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 #include "sys_tools.h"
 
+#include <limits>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "tools/math_tools.h"
+
 /**
  * @file sys_tools.cpp
  * @brief Contains the implementation of all the functions defined in the header.
  */
 
+namespace {
+
+typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, kdtutils::PointCloud<double>>,
+                                            kdtutils::PointCloud<double>, 3 /* dim */>
+    ClusterTree;
+
+// Monomers within the search radius of each monomer, found in the kd-tree
+// the first time they are needed. Lists are sorted by monomer index, have
+// each monomer once (closest image) and exclude the monomer itself.
+class NeighborCache {
+   public:
+    NeighborCache(const kdtutils::PointCloud<double> &ptc, const ClusterTree &tree, size_t nmon, double radius2)
+        : ptc_(ptc), tree_(tree), nmon_(nmon), radius2_(radius2), neighbors_(nmon), done_(nmon, false) {}
+
+    const std::vector<std::pair<size_t, double>> &Get(size_t i) {
+        if (done_[i]) return neighbors_[i];
+
+        std::vector<std::pair<size_t, double>> &ni = neighbors_[i];
+        double point[3] = {ptc_.pts[i].x, ptc_.pts[i].y, ptc_.pts[i].z};
+        nanoflann::SearchParams params;
+        params.sorted = false;
+        tree_.radiusSearch(point, radius2_, ni, params);
+
+        // Bring the periodic images back to the original index
+        for (size_t j = 0; j < ni.size(); j++) ni[j].first %= nmon_;
+
+        // Keep the closest image of each monomer
+        std::sort(ni.begin(), ni.end());
+        size_t n = 0;
+        for (size_t j = 0; j < ni.size(); j++) {
+            if (ni[j].first == i) continue;
+            if (n > 0 && ni[n - 1].first == ni[j].first) continue;
+            ni[n++] = ni[j];
+        }
+        ni.resize(n);
+
+        done_[i] = true;
+        return ni;
+    }
+
+   private:
+    const kdtutils::PointCloud<double> &ptc_;
+    const ClusterTree &tree_;
+    size_t nmon_;
+    double radius2_;
+    std::vector<std::vector<std::pair<size_t, double>>> neighbors_;
+    std::vector<bool> done_;
+};
+
+// Squared distance from a sorted neighbor list, or -1 if not a neighbor
+double NeighborDistance(const std::vector<std::pair<size_t, double>> &neighbors, size_t j) {
+    std::vector<std::pair<size_t, double>>::const_iterator it =
+        std::lower_bound(neighbors.begin(), neighbors.end(), std::make_pair(j, -1.0));
+    if (it == neighbors.end() || it->first != j) return -1.0;
+    return it->second;
+}
+
+// Index of a trimer type in the ntypes^3 table, with the types sorted
+size_t TrimerKey(size_t t1, size_t t2, size_t t3, size_t ntypes) {
+    if (t1 > t2) std::swap(t1, t2);
+    if (t2 > t3) std::swap(t2, t3);
+    if (t1 > t2) std::swap(t1, t2);
+    return (t1 * ntypes + t2) * ntypes + t3;
+}
+
+// Dimers with i < j within the largest cutoff, and trimers with i < j < k
+// and at least two of the three distances within the cutoff of the type of
+// the trimer, cutoffs[TrimerKey(...)]. Trimers are returned grouped by type,
+// and in the order they were found within each group.
+void FindClusters(size_t n_max, const std::vector<double> &cutoffs, const std::vector<size_t> &mon_type,
+                  size_t ntypes, size_t istart, size_t iend, size_t nmon, bool use_pbc,
+                  const std::vector<double> &box, const std::vector<double> &xyz_orig,
+                  const std::vector<size_t> &first_index, std::vector<size_t> &dimers,
+                  std::vector<size_t> &trimers) {
+    dimers.clear();
+    if (n_max > 2) trimers.clear();
+    if (iend <= istart) return;
+
+    // Obtain xyz vector with the positions of first atom of each monomer
+    size_t nmon2 = nmon - istart;
+    std::vector<double> xyz(3 * nmon2);
+    for (size_t i = istart; i < nmon; i++) {
+        xyz[3 * (i - istart)] = xyz_orig[3 * first_index[i]];
+        xyz[3 * (i - istart) + 1] = xyz_orig[3 * first_index[i] + 1];
+        xyz[3 * (i - istart) + 2] = xyz_orig[3 * first_index[i] + 2];
+    }
+
+    // Obtain the data in the structure needed by the kd-tree
+    kdtutils::PointCloud<double> ptc = kdtutils::XyzToCloud(xyz, use_pbc, box);
+
+    // Build the tree
+    ClusterTree index(3 /*dim*/, ptc, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */));
+    index.buildIndex();
+
+    // Squared radii. The tree is searched with the largest one.
+    std::vector<double> cutoffs2(cutoffs.size());
+    double radius2 = 0.0;
+    for (size_t c = 0; c < cutoffs.size(); c++) {
+        cutoffs2[c] = cutoffs[c] * cutoffs[c];
+        radius2 = std::max(radius2, cutoffs2[c]);
+    }
+    NeighborCache neighbors(ptc, index, nmon2, radius2);
+
+    // Type of each trimer found, to group them at the end
+    std::vector<size_t> keys;
+
+    // Marks the neighbors of the current i, and their distance to it
+    std::vector<size_t> mark(nmon2, 0);
+
+    for (size_t i = 0; i < iend - istart; i++) {
+        const std::vector<std::pair<size_t, double>> &ni = neighbors.Get(i);
+        std::vector<std::pair<size_t, double>>::const_iterator first =
+            std::upper_bound(ni.begin(), ni.end(), std::make_pair(i, std::numeric_limits<double>::max()));
+
+        for (std::vector<std::pair<size_t, double>>::const_iterator it = first; it != ni.end(); ++it) {
+            dimers.push_back(i + istart);
+            dimers.push_back(it->first + istart);
+        }
+
+        if (n_max < 3) continue;
+
+        for (size_t n = 0; n < ni.size(); n++) mark[ni[n].first] = i + 1;
+
+        for (std::vector<std::pair<size_t, double>>::const_iterator itj = first; itj != ni.end(); ++itj) {
+            size_t j = itj->first;
+            const std::vector<std::pair<size_t, double>> &nj = neighbors.Get(j);
+
+            // Trimers in which both j and k are close to i. Each one is
+            // found once, from the smaller of j and k.
+            for (std::vector<std::pair<size_t, double>>::const_iterator itk = itj + 1; itk != ni.end(); ++itk) {
+                size_t k = itk->first;
+                size_t key = TrimerKey(mon_type[i + istart], mon_type[j + istart], mon_type[k + istart], ntypes);
+                double rc2 = cutoffs2[key];
+                size_t nclose = (itj->second < rc2) + (itk->second < rc2);
+                if (nclose < 2) {
+                    double djk = NeighborDistance(nj, k);
+                    if (djk >= 0.0 && djk < rc2) nclose++;
+                }
+                if (nclose < 2) continue;
+                trimers.push_back(i + istart);
+                trimers.push_back(j + istart);
+                trimers.push_back(k + istart);
+                keys.push_back(key);
+            }
+
+            // Trimers in which k is close to j but not to i. Since k is not
+            // a neighbor of i, the trimer can only be found from j.
+            std::vector<std::pair<size_t, double>>::const_iterator itk =
+                std::upper_bound(nj.begin(), nj.end(), std::make_pair(i, std::numeric_limits<double>::max()));
+            for (; itk != nj.end(); ++itk) {
+                size_t k = itk->first;
+                if (mark[k] == i + 1) continue;
+                size_t jel = std::min(j, k);
+                size_t kel = std::max(j, k);
+                size_t key = TrimerKey(mon_type[i + istart], mon_type[j + istart], mon_type[k + istart], ntypes);
+                double rc2 = cutoffs2[key];
+                if (itj->second >= rc2 || itk->second >= rc2) continue;
+                trimers.push_back(i + istart);
+                trimers.push_back(jel + istart);
+                trimers.push_back(kel + istart);
+                keys.push_back(key);
+            }
+        }
+    }
+
+    if (n_max < 3 || ntypes < 2) return;
+
+    // Group the trimers by type, keeping the order within each type
+    std::vector<size_t> start(ntypes * ntypes * ntypes + 1, 0);
+    for (size_t t = 0; t < keys.size(); t++) start[keys[t] + 1]++;
+    for (size_t c = 1; c < start.size(); c++) start[c] += start[c - 1];
+
+    std::vector<size_t> sorted(trimers.size());
+    for (size_t t = 0; t < keys.size(); t++) {
+        size_t pos = 3 * start[keys[t]]++;
+        sorted[pos] = trimers[3 * t];
+        sorted[pos + 1] = trimers[3 * t + 1];
+        sorted[pos + 2] = trimers[3 * t + 2];
+    }
+    trimers.swap(sorted);
+}
+
+// Spreads the 21 lowest bits of v so that there are two zero bits
+// between each of them
+uint64_t SpreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Morton (Z-order) key of a point with coordinates in [0,1)
+uint64_t MortonKey(double x, double y, double z) {
+    const double scale = 2097152.0;  // 2^21
+    uint64_t ix = std::min<double>(std::max<double>(x * scale, 0.0), scale - 1.0);
+    uint64_t iy = std::min<double>(std::max<double>(y * scale, 0.0), scale - 1.0);
+    uint64_t iz = std::min<double>(std::max<double>(z * scale, 0.0), scale - 1.0);
+    return SpreadBits(ix) | (SpreadBits(iy) << 1) | (SpreadBits(iz) << 2);
+}
+
+}  // namespace
+
 namespace systools {
 
 std::vector<std::pair<std::string, size_t>> OrderMonomers(
-    std::vector<std::string> &mon, std::vector<size_t> sites, std::vector<size_t> nats,
+    std::vector<std::string> &mon, const std::vector<size_t> &sites, const std::vector<size_t> &nats,
     std::vector<size_t> &original2current_order, std::vector<std::pair<size_t, size_t>> &original_order,
     std::vector<std::pair<size_t, size_t>> &original_order_realSites) {
     // Make sure that mons, sites and nat have the same size and are
@@ -59,73 +270,140 @@ std::vector<std::pair<std::string, size_t>> OrderMonomers(
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
-    // Create copy of the input monomers
-    std::vector<std::string> monomers = mon;
+    const size_t nmon = mon.size();
 
-    // Make sure that the output vectors are cleared
-    original2current_order.clear();
-    mon.clear();
-    original_order.clear();
-    original_order_realSites.clear();
+    // Assign a type index to each monomer, in order of first appearance.
+    // Consecutive monomers are usually of the same type, so the last
+    // type is checked before the map.
+    std::unordered_map<std::string, size_t> type_index;
+    std::vector<std::pair<std::string, size_t>> montypes;
+    std::vector<size_t> mon_type(nmon);
+    for (size_t i = 0; i < nmon; i++) {
+        if (i > 0 && mon[i] == mon[i - 1]) {
+            mon_type[i] = mon_type[i - 1];
+        } else {
+            auto it = type_index.find(mon[i]);
+            if (it == type_index.end()) {
+                it = type_index.insert(std::make_pair(mon[i], montypes.size())).first;
+                montypes.push_back(std::make_pair(mon[i], 0));
+            }
+            mon_type[i] = it->second;
+        }
+        montypes[mon_type[i]].second++;
+    }
 
-    // Defining the vector with different monomer types
-    std::vector<std::string> montypes;
+    // Add them from less mons to more mons. Types with the same number
+    // of monomers keep the order in which they first appear.
+    std::vector<size_t> type_order(montypes.size());
+    for (size_t t = 0; t < montypes.size(); t++) type_order[t] = t;
+    std::stable_sort(type_order.begin(), type_order.end(),
+                     [&montypes](size_t a, size_t b) { return montypes[a].second < montypes[b].second; });
 
-    // Resize the input-internal relation vector
-    original2current_order = std::vector<size_t>(monomers.size(), 0);
+    // Position of the first monomer of each type in the internal order
+    std::vector<std::pair<std::string, size_t>> mon_types_count;
+    mon_types_count.reserve(montypes.size());
+    std::vector<size_t> next(montypes.size());
+    size_t offset = 0;
+    for (size_t k = 0; k < type_order.size(); k++) {
+        mon_types_count.push_back(montypes[type_order[k]]);
+        next[type_order[k]] = offset;
+        offset += montypes[type_order[k]].second;
+    }
 
-    // Look for number the different monomers
-    for (size_t i = 0; i < monomers.size(); i++) {
-        if (std::find(montypes.begin(), montypes.end(), monomers[i]) == montypes.end()) montypes.push_back(monomers[i]);
+    // Place every monomer in its slot
+    original2current_order.assign(nmon, 0);
+    original_order.resize(nmon);
+    original_order_realSites.resize(nmon);
+    size_t site_pos = 0;
+    size_t nat_pos = 0;
+    for (size_t i = 0; i < nmon; i++) {
+        size_t j = next[mon_type[i]]++;
+        // Fill in order relation information
+        original_order[j] = std::make_pair(i, site_pos);
+        original_order_realSites[j] = std::make_pair(i, nat_pos);
+        original2current_order[i] = j;
+        // Update loop variables
+        site_pos += sites[i];
+        nat_pos += nats[i];
     }
 
-    // For each type, count how many of it are there
-    std::vector<std::pair<std::string, size_t>> mon_types_count;
-    std::vector<std::pair<std::string, size_t>> montypetmp;
-    for (size_t i = 0; i < montypes.size(); i++) {
-        size_t nm = std::count(monomers.begin(), monomers.end(), montypes[i]);
-        montypetmp.push_back(std::make_pair(montypes[i], nm));
+    // Rewrite the monomer ids in the internal order
+    mon.clear();
+    mon.reserve(nmon);
+    for (size_t k = 0; k < mon_types_count.size(); k++) {
+        mon.insert(mon.end(), mon_types_count[k].second, mon_types_count[k].first);
     }
 
-    // Add them from less mons to more mons
-    while (montypetmp.size() > 0) {
-        // Look which is the monomer type with less monomers
-        std::pair<std::string, size_t> minmon = montypetmp[0];
-        size_t min_ind = 0;
-        for (size_t i = 1; i < montypetmp.size(); i++) {
-            if (montypetmp[i].second < minmon.second) {
-                minmon = montypetmp[i];
-                min_ind = i;
+    // Return the result
+    return mon_types_count;
+}
+
+std::vector<size_t> SpatialOrder(const std::vector<std::pair<std::string, size_t>> &mon_type_count,
+                                 const std::vector<double> &xyz, const std::vector<size_t> &first_index,
+                                 const std::vector<double> &box) {
+    const size_t nmon = first_index.size();
+    size_t nmon_types = 0;
+    for (size_t k = 0; k < mon_type_count.size(); k++) nmon_types += mon_type_count[k].second;
+    if (nmon_types != nmon) {
+        std::string text = "Number of monomers in mon_type_count (" + std::to_string(nmon_types) +
+                           ") does not match the size of first_index (" + std::to_string(nmon) + ")";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // Position of each monomer (its first site) in units of the box,
+    // folded into [0,1). Without box, the bounding box of all the
+    // monomers is used instead.
+    std::vector<double> pos(3 * nmon);
+    for (size_t i = 0; i < nmon; i++) {
+        std::copy(xyz.begin() + 3 * first_index[i], xyz.begin() + 3 * first_index[i] + 3, pos.begin() + 3 * i);
+    }
+
+    if (box.size()) {
+        std::vector<double> box_inv = InvertUnitCell(box);
+        for (size_t i = 0; i < nmon; i++) {
+            double r[3] = {pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]};
+            for (size_t j = 0; j < 3; j++) {
+                double s = r[0] * box_inv[j] + r[1] * box_inv[3 + j] + r[2] * box_inv[6 + j];
+                pos[3 * i + j] = s - std::floor(s);
             }
         }
-
-        // Add the monomers of the minimum type
-        mon_types_count.push_back(minmon);
-        std::string monid = montypetmp[min_ind].first;
-        size_t site_pos = 0;
-        size_t nat_pos = 0;
-        for (size_t i = 0; i < monomers.size(); i++) {
-            if (monomers[i] == monid) {
-                // Fill in order relation information
-                original_order.push_back(std::make_pair(i, site_pos));
-                original_order_realSites.push_back(std::make_pair(i, nat_pos));
-                mon.push_back(monid);
-                original2current_order[i] = mon.size() - 1;
+    } else {
+        double lo[3], hi[3];
+        for (size_t j = 0; j < 3; j++) lo[j] = hi[j] = pos[j];
+        for (size_t i = 1; i < nmon; i++) {
+            for (size_t j = 0; j < 3; j++) {
+                lo[j] = std::min(lo[j], pos[3 * i + j]);
+                hi[j] = std::max(hi[j], pos[3 * i + j]);
             }
-            // Update loop variables
-            site_pos += sites[i];
-            nat_pos += nats[i];
         }
+        // Same scale in all directions, so the curve is not stretched
+        double len = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+        len = len > 0.0 ? len : 1.0;
+        for (size_t i = 0; i < nmon; i++) {
+            for (size_t j = 0; j < 3; j++) pos[3 * i + j] = (pos[3 * i + j] - lo[j]) / len;
+        }
+    }
 
-        // Delete the monomer type we have just done
-        montypetmp.erase(montypetmp.begin() + min_ind, montypetmp.begin() + min_ind + 1);
+    // Sort each monomer type block by key. Ties keep the current order.
+    std::vector<size_t> perm(nmon);
+    std::vector<std::pair<uint64_t, size_t>> keys;
+    size_t fi_mon = 0;
+    for (size_t k = 0; k < mon_type_count.size(); k++) {
+        size_t n = mon_type_count[k].second;
+        keys.resize(n);
+        for (size_t m = 0; m < n; m++) {
+            size_t i = fi_mon + m;
+            keys[m] = std::make_pair(MortonKey(pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]), i);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (size_t m = 0; m < n; m++) perm[fi_mon + m] = keys[m].second;
+        fi_mon += n;
     }
 
-    // Return the result
-    return mon_types_count;
+    return perm;
 }
 
-size_t SetUpMonomers(std::vector<std::string> mon, std::vector<size_t> &sites, std::vector<size_t> &nat,
+size_t SetUpMonomers(const std::vector<std::string> &mon, std::vector<size_t> &sites, std::vector<size_t> &nat,
                      std::vector<size_t> &fi_at) {
     // Make sure that mons, sites and nat have the same size and are
     // not empty
@@ -144,10 +422,18 @@ size_t SetUpMonomers(std::vector<std::string> mon, std::vector<size_t> &sites, s
     nat.clear();
     fi_at.clear();
 
+    sites.reserve(mon.size());
+    nat.reserve(mon.size());
+    fi_at.reserve(mon.size());
+
     size_t count = 0;
     size_t ats = 0;
     for (size_t i = 0; i < mon.size(); i++) {
-        if (mon[i] == "h2o") {
+        if (i > 0 && mon[i] == mon[i - 1]) {
+            // Same type as the previous monomer
+            sites.push_back(sites[i - 1]);
+            nat.push_back(nat[i - 1]);
+        } else if (mon[i] == "h2o") {
             // Filling things for water.
             // Site Info
             // TODO Maybe we can read this from a database
@@ -201,8 +487,8 @@ size_t SetUpMonomers(std::vector<std::string> mon, std::vector<size_t> &sites, s
     return count;
 }
 
-void FixMonomerCoordinates(std::vector<double> &xyz, std::vector<double> box, std::vector<size_t> nat,
-                           std::vector<size_t> first_index) {
+void FixMonomerCoordinates(std::vector<double> &xyz, const std::vector<double> &box, const std::vector<size_t> &nat,
+                           const std::vector<size_t> &first_index) {
     // TODO assuming for now orthorombic box:
     // box = {a,0,0,0,b,0,0,0,c)
 
@@ -433,8 +719,8 @@ bool ComparePair(std::pair<size_t, double> a, std::pair<size_t, double> b) { ret
 //}
 
 void AddClusters(size_t n_max, double cutoff, size_t istart, size_t iend, size_t nmon, bool use_pbc,
-                 std::vector<double> box, std::vector<double> xyz_orig, std::vector<size_t> first_index,
-                 std::vector<size_t> &dimers, std::vector<size_t> &trimers) {
+                 const std::vector<double> &box, const std::vector<double> &xyz_orig,
+                 const std::vector<size_t> &first_index, std::vector<size_t> &dimers, std::vector<size_t> &trimers) {
     // istart is the monomer position for which we will look all dimers and
     // trimers that contain it. iend is the last monomer position.
     // This means, if istart is 0 and iend is 2, we will look for all dimers
@@ -446,115 +732,26 @@ void AddClusters(size_t n_max, double cutoff, size_t istart, size_t iend, size_t
     // in in the monomer vector
     // dimers and trimers will be filled with the dimers and trimers found
 
-    // Obtain xyz vector with the positions of first atom of each monomer
-    std::vector<double> xyz;
-    for (size_t i = istart; i < nmon; i++) {
-        xyz.push_back(xyz_orig[3 * first_index[i]]);
-        xyz.push_back(xyz_orig[3 * first_index[i] + 1]);
-        xyz.push_back(xyz_orig[3 * first_index[i] + 2]);
-    }
-
-    size_t nmon2 = nmon - istart;
-
-    // Obtain the data in the structure needed by the kd-tree
-    kdtutils::PointCloud<double> ptc = kdtutils::XyzToCloud(xyz, use_pbc, box);
-
-    // Build the tree
-    typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, kdtutils::PointCloud<double>>,
-                                                kdtutils::PointCloud<double>, 3 /* dim */>
-        my_kd_tree_t;
-    my_kd_tree_t index(3 /*dim*/, ptc, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */));
-    index.buildIndex();
-
-    // Perform a radial search within the cutoff
-    dimers.clear();
-    if (n_max > 2) trimers.clear();
-
-    std::vector<size_t> idone;
-    std::set<std::pair<size_t, size_t>> donej;
-    for (size_t i = 0; i < iend - istart; i++) {
-        // Define the query point
-        double point[3];
-        point[0] = ptc.pts[i].x;
-        point[1] = ptc.pts[i].y;
-        point[2] = ptc.pts[i].z;
-
-        // Perform the search
-        std::vector<std::pair<size_t, double>> ret_matches;
-        nanoflann::SearchParams params;
-        const size_t nMatches = index.radiusSearch(point, cutoff * cutoff, ret_matches, params);
-
-        for (size_t j = 0; j < nMatches; j++) {
-            size_t pos = ret_matches[j].first / nmon2;
-            ret_matches[j].first -= nmon2 * pos;
-        }
-
-        std::sort(ret_matches.begin(), ret_matches.end(), ComparePair);
-        std::set<std::pair<size_t, size_t>> donek;
-
-        // Add the pairs that are not in the dimer vector
-        for (size_t j = 0; j < nMatches; j++) {
-            std::pair<std::set<std::pair<size_t, size_t>>::iterator, bool> retdim;
-            if (ret_matches[j].first > i) {
-                retdim = donej.insert(std::make_pair(i, ret_matches[j].first));
-                if (retdim.second) {
-                    dimers.push_back(i + istart);
-                    dimers.push_back(ret_matches[j].first + istart);
-                }
-
-                // Add trimers if requested
-                if (n_max > 2) {
-                    std::pair<std::set<std::pair<size_t, size_t>>::iterator, bool> ret;
-                    for (size_t k = 0; k < nMatches; k++) {
-                        if (ret_matches[k].first > ret_matches[j].first) {
-                            ret = donek.insert(std::make_pair(ret_matches[j].first, ret_matches[k].first));
-                            if (ret.second) {
-                                trimers.push_back(i + istart);
-                                trimers.push_back(ret_matches[j].first + istart);
-                                trimers.push_back(ret_matches[k].first + istart);
-                            }
-                        }
-                    }
-                    // Define query point, which is each of the points 'j' inside the
-                    // radius of 'i'
-                    double point2[3];
-                    point2[0] = ptc.pts[ret_matches[j].first].x;
-                    point2[1] = ptc.pts[ret_matches[j].first].y;
-                    point2[2] = ptc.pts[ret_matches[j].first].z;
-                    std::vector<std::pair<size_t, double>> ret_matches2;
-                    nanoflann::SearchParams params2;
-                    const size_t nMatches2 = index.radiusSearch(point2, cutoff * cutoff, ret_matches2, params2);
-
-                    for (size_t k = 0; k < nMatches2; k++) {
-                        size_t pos2 = ret_matches2[k].first / nmon2;
-                        ret_matches2[k].first -= nmon2 * pos2;
-                    }
+    // All monomers are of the same type for the search
+    std::vector<size_t> mon_type(nmon, 0);
+    std::vector<double> cutoffs(1, cutoff);
+    FindClusters(n_max, cutoffs, mon_type, 1, istart, iend, nmon, use_pbc, box, xyz_orig, first_index, dimers,
+                 trimers);
+}
 
-                    std::sort(ret_matches2.begin(), ret_matches2.end(), ComparePair);
-
-                    // Add the trimers that fulfil i > j > k, to avoid double counting
-                    // We will add all trimers that fulfill the condition:
-                    // At least 2 of the three distances must be smaller than the cutoff
-                    for (size_t k = 0; k < nMatches2; k++) {
-                        if (ret_matches2[k].first > i) {
-                            size_t jel = ret_matches[j].first;
-                            size_t kel = ret_matches2[k].first;
-                            if (ret_matches[j].first > ret_matches2[k].first) {
-                                jel = ret_matches2[k].first;
-                                kel = ret_matches[j].first;
-                            }
-                            ret = donek.insert(std::make_pair(jel, kel));
-                            if (ret.second && kel > jel) {
-                                trimers.push_back(i + istart);
-                                trimers.push_back(jel + istart);
-                                trimers.push_back(kel + istart);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+void AddTrimers(const std::vector<double> &cutoffs, const std::vector<size_t> &mon_type, size_t ntypes,
+                size_t istart, size_t iend, size_t nmon, bool use_pbc, const std::vector<double> &box,
+                const std::vector<double> &xyz_orig, const std::vector<size_t> &first_index,
+                std::vector<size_t> &trimers) {
+    if (cutoffs.size() != ntypes * ntypes * ntypes || mon_type.size() < nmon) {
+        std::string text = "Trimer cutoffs must have ntypes^3 = " + std::to_string(ntypes * ntypes * ntypes) +
+                           " elements and there must be one type per monomer.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
     }
+
+    std::vector<size_t> dimers;
+    FindClusters(3, cutoffs, mon_type, ntypes, istart, iend, nmon, use_pbc, box, xyz_orig, first_index, dimers,
+                 trimers);
 }
 
 void GetExcluded(std::string mon, excluded_set_type &exc12, excluded_set_type &exc13, excluded_set_type &exc14) {
@@ -612,7 +809,17 @@ void GetExcluded(std::string mon, excluded_set_type &exc12, excluded_set_type &e
     // =====>> END SECTION EXCLUDED <<=====
 }
 
-bool IsExcluded(excluded_set_type exc, size_t a, size_t b) {
+void GetExcludedByType(const std::vector<std::pair<std::string, size_t> > &mon_type_count,
+                       std::vector<excluded_set_type> &exc12, std::vector<excluded_set_type> &exc13,
+                       std::vector<excluded_set_type> &exc14) {
+    exc12.assign(mon_type_count.size(), excluded_set_type());
+    exc13.assign(mon_type_count.size(), excluded_set_type());
+    exc14.assign(mon_type_count.size(), excluded_set_type());
+    for (size_t mt = 0; mt < mon_type_count.size(); mt++)
+        GetExcluded(mon_type_count[mt].first, exc12[mt], exc13[mt], exc14[mt]);
+}
+
+bool IsExcluded(const excluded_set_type &exc, size_t a, size_t b) {
     return ((exc.find(std::make_pair(a, b)) != exc.end()) || (exc.find(std::make_pair(b, a)) != exc.end()));
 }
 
@@ -638,8 +845,9 @@ double GetAdd(bool is12, bool is13, bool is14, std::string mon) {
     return aDD;
 }
 
-std::vector<double> ResetOrder3N(std::vector<double> coords, std::vector<std::pair<size_t, size_t>> original_order,
-                                 std::vector<size_t> first_index, std::vector<size_t> sites) {
+std::vector<double> ResetOrder3N(const std::vector<double> &coords,
+                                 const std::vector<std::pair<size_t, size_t>> &original_order,
+                                 const std::vector<size_t> &first_index, const std::vector<size_t> &sites) {
     // Define new vector
     std::vector<double> new_coords(coords.size());
     // Loop over monomers in the system, and fill in the right coordinates
@@ -653,8 +861,9 @@ std::vector<double> ResetOrder3N(std::vector<double> coords, std::vector<std::pa
     return new_coords;
 }
 
-std::vector<double> ResetOrderReal3N(std::vector<double> coords, std::vector<std::pair<size_t, size_t>> original_order,
-                                     size_t numats, std::vector<size_t> first_index, std::vector<size_t> nats) {
+std::vector<double> ResetOrderReal3N(const std::vector<double> &coords,
+                                     const std::vector<std::pair<size_t, size_t>> &original_order, size_t numats,
+                                     const std::vector<size_t> &first_index, const std::vector<size_t> &nats) {
     // Define new vector
     std::vector<double> new_coords(3 * numats);
     // Loop over monomers in the system, and fill in the right coordinates
@@ -672,48 +881,18 @@ void SetVSites(std::vector<double> &xyz, std::string mon_id, size_t n_mon, size_
     size_t fstind_3 = 3 * fst_ind;
 
     if (mon_id == "h2o") {
-        // Some useful constants
-        size_t nmns = n_mon * 3;
-        size_t nmns2 = nmns * 2;
-        size_t nmns3 = nmns * 3;
-
-        // TODO Not vectorized
-        // Reorganize data so is contigious
-        std::vector<double> xyz2(nmns * nsites, 0.0);
-        for (size_t nv = 0; nv < n_mon; nv++) {
-            size_t nvns3 = nv * nsites * 3;
-            for (size_t i = 0; i < nsites; i++) {
-                size_t i3 = 3 * i;
-                size_t i3nm = i3 * n_mon;
-                for (size_t j = 0; j < 3; j++) {
-                    xyz2[nv + j * n_mon + i3nm] = xyz[nvns3 + i3 + j + fstind_3];
-                }
-            }
-        }
-
-        // TODO Check why is multiversioning. Should not.
-        // Obtain M-site coordinates from different sites for water
-        for (size_t i = 0; i < 3; i++) {
-            size_t inm = i * n_mon;
-            for (size_t nv = 0; nv < n_mon; nv++) {
-                xyz2[nmns3 + inm + nv] =
-                    gamma1 * xyz2[0 + inm + nv] + gamma2 * (xyz2[nmns + inm + nv] + xyz2[nmns2 + inm + nv]);
-            }
-        }
-
-        // TODO Not vectorized
-        // Return the M-site coordinates to the original xyz vector
+        // M-site of each water from its oxygen and hydrogens, in place
         for (size_t nv = 0; nv < n_mon; nv++) {
-            size_t nvns3 = nv * nsites * 3;
-            for (size_t j = 0; j < 3; j++) {
-                xyz[nvns3 + 9 + j + fstind_3] = xyz2[nv + j * n_mon + 9 * n_mon];
-            }
+            double *w = xyz.data() + fstind_3 + 3 * nsites * nv;
+            for (size_t j = 0; j < 3; j++) w[9 + j] = gamma1 * w[j] + gamma2 * (w[3 + j] + w[6 + j]);
         }
     }
 }
 
-void SetCharges(std::vector<double> xyz, std::vector<double> &charges, std::string mon_id, size_t n_mon, size_t nsites,
-                size_t fst_ind, std::vector<double> &chg_der) {
+bool IsGeometryDependent(const std::string &mon_id) { return mon_id == "h2o"; }
+
+void SetCharges(const std::vector<double> &xyz, std::vector<double> &charges, std::string mon_id, size_t n_mon,
+                size_t nsites, size_t fst_ind, std::vector<double> &chg_der) {
     // Constant that calculates charge
     const double CHARGECON = 1.0;
     // const double CHARGECON = constants::CHARGECON;
@@ -768,66 +947,25 @@ void SetCharges(std::vector<double> xyz, std::vector<double> &charges, std::stri
 
         // Note, for now, assuming only water has site dependant charges
     } else if (mon_id == "h2o") {
-        // chgtmp = M, H1, H2 according to ttm4.cpp
-        std::vector<double> chgtmp;
         size_t fstind_3 = 3 * fst_ind;
 
-        chg_der = std::vector<double>(27 * n_mon, 0.0);
+        chg_der.assign(27 * n_mon, 0.0);
 
         // Calculate individual monomer's charges
         for (size_t nv = 0; nv < n_mon; nv++) {
             size_t ns3 = nsites * 3;
             size_t shift = 27 * nv;
 
-            // Getting front and end of xyz vector of 1 monomer in system
-            std::vector<double> atomcoords(xyz);
-            std::vector<double> chgtmpnv((nsites - 1));
+            // Charges of M, H1 and H2 according to ttm4.cpp
+            double chgtmp[3];
+            ps::dms_nasa(0.0, 0.0, 0.0, xyz.data() + (nv * ns3) + fstind_3, chgtmp, chg_der.data() + shift);
 
-            // Calculating charge
-            ps::dms_nasa(0.0, 0.0, 0.0, atomcoords.data() + (nv * ns3) + fstind_3, chgtmpnv.data(),
-                         chg_der.data() + shift);
-            // Inserting the found charges into chgtmp vector before calculating
-            // new charge values
-            chgtmp.insert(chgtmp.end(), chgtmpnv.begin(), chgtmpnv.end());
-        }
-
-        // Creating vector with contiguous data
-        std::vector<double> chg2(n_mon * nsites, 0.0);
-
-        // TODO Multiversioning
-        // Reorganizing sites
-        for (size_t nv = 0; nv < n_mon; nv++) {
-            // looping over sites -- H1 and H2
-            for (size_t i = 1; i < nsites - 1; i++) {
-                chg2[nv + i * n_mon] = chgtmp[i + nv * (nsites - 1)];
-            }
-
-            // looping over M
-            chg2[nv + 3 * n_mon] = chgtmp[nv * 3];
-        }
-
-        std::vector<double> chg2temp = chg2;
-
-        // calculating charge
-        for (size_t nv = 0; nv < n_mon; nv++) {
-            size_t hy1 = n_mon + nv;
-            size_t hy2 = 2 * n_mon + nv;
-            size_t msite = 3 * n_mon + nv;
-
-            // Hydrogen1
-            chg2[hy1] = CHARGECON * (chg2temp[hy1] + gamma21 * (chg2temp[hy1] + chg2temp[hy2]));
-            // Hydrogen2
-            chg2[hy2] = CHARGECON * (chg2temp[hy2] + gamma21 * (chg2temp[hy1] + chg2temp[hy2]));
-            // M
-            chg2[msite] = CHARGECON * (chg2temp[msite] / (1.0 - gammaM));
-        }
-
-        // TODO multiversioning
-        // Return all coordinates to the original vector
-        for (size_t nv = 0; nv < n_mon; nv++) {
-            for (size_t j = 0; j < nsites; j++) {
-                charges[nv * nsites + j + fst_ind] = chg2[nv + n_mon * j];
-            }
+            // O, H1, H2 and M, written in place
+            double *chg = charges.data() + fst_ind + nv * nsites;
+            chg[0] = 0.0;
+            chg[1] = CHARGECON * (chgtmp[1] + gamma21 * (chgtmp[1] + chgtmp[2]));
+            chg[2] = CHARGECON * (chgtmp[2] + gamma21 * (chgtmp[1] + chgtmp[2]));
+            chg[3] = CHARGECON * (chgtmp[0] / (1.0 - gammaM));
         }
     }
 }
@@ -1097,9 +1235,9 @@ void RedistributeVirtGrads2Real(const std::string mon, const size_t nmon, const
     }
 }
 
-void ChargeDerivativeForce(const std::string mon, const size_t nmon, const size_t fi_crd, const size_t fi_sites,
-                           const std::vector<double> phi, std::vector<double> &grad,
-                           const std::vector<double> chg_grad, double* crd, std::vector<double> *qdvirial) {
+void ChargeDerivativeForce(const std::string &mon, const size_t nmon, const size_t fi_crd, const size_t fi_sites,
+                           const std::vector<double> &phi, std::vector<double> &grad,
+                           const std::vector<double> &chg_grad, double* crd, std::vector<double> *qdvirial) {
     // If water, extracted from patridge-schwneke paper
     if (mon == "h2o") {
         for (size_t mm = 0; mm < nmon; mm++) {
@@ -1148,15 +1286,15 @@ void ChargeDerivativeForce(const std::string mon, const size_t nmon, const size_
             }
 
             if (qdvirial != 0) {
-                std::vector<double> temp_pos = { crd[mm*1], crd[mm + nmon], crd[mm +2*nmon], crd[mm + 3*nmon], 
+                double temp_pos[9] = { crd[mm*1], crd[mm + nmon], crd[mm +2*nmon], crd[mm + 3*nmon], 
                                        crd[mm+4*nmon], crd[mm+5*nmon], crd[mm+6*nmon], crd[mm+7*nmon], crd[mm+8*nmon]};
 
-                std::vector<double> chgtmpnv_test((3));
-                std::vector<double> chgder_test((27));
+                double chgtmpnv_test[3];
+                double chgder_test[27];
 
-                std::vector<double> aux_data(6,0.0); // declare array to store auxillary output from dms_nasa_vir
+                double aux_data[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0}; // declare array to store auxillary output from dms_nasa_vir
 
-                ps::dms_nasa(0.0, 0.0, 0.0, temp_pos.data(), chgtmpnv_test.data(),chgder_test.data(), &aux_data); // get them aux data (charge derivateves with respect to internal coords)
+                ps::dms_nasa(0.0, 0.0, 0.0, temp_pos, chgtmpnv_test,chgder_test, aux_data); // get them aux data (charge derivateves with respect to internal coords)
                      
                 // get the charge derivatives in internal coordinates ( r12 = rOH1, r13=rOH2, cos = cos(theta))
                 double dp1dr12 = aux_data[0];  // pass data onto variables
@@ -1167,9 +1305,9 @@ void ChargeDerivativeForce(const std::string mon, const size_t nmon, const size_
                 double dp2dcos = aux_data[5];
 
 
-                std::vector<double> dqdr12(4, 0.0);
-                std::vector<double> dqdr13(4, 0.0);
-                std::vector<double> dqdcos(4, 0.0);
+                double dqdr12[4] = {0.0, 0.0, 0.0, 0.0};
+                double dqdr13[4] = {0.0, 0.0, 0.0, 0.0};
+                double dqdcos[4] = {0.0, 0.0, 0.0, 0.0};
 
                 double gamma = gammaM;
     
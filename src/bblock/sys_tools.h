@@ -98,6 +98,8 @@ const double gamma21 = gamma2 / gamma1;
  * the efficiency in the parallel loops. It will put all the equivalent
  * monomers together, one after the other one, from less frquent to
  * more frequent.
+ * Monomer types with the same number of monomers keep the order in which
+ * they first appear. The cost is linear in the number of monomers.
  * @param[in,out] mon List of monomers in the input order that will be
  * cleared and replaced by the list of monomers in the internal order.
  * @param[in] sites Vector of size_t with the number of sites of each
@@ -133,10 +135,30 @@ const double gamma21 = gamma2 / gamma1;
  * number of monomers.
  */
 std::vector<std::pair<std::string, size_t>> OrderMonomers(
-    std::vector<std::string> &mon, std::vector<size_t> sites, std::vector<size_t> nats,
+    std::vector<std::string> &mon, const std::vector<size_t> &sites, const std::vector<size_t> &nats,
     std::vector<size_t> &original2current_order, std::vector<std::pair<size_t, size_t>> &original_order,
     std::vector<std::pair<size_t, size_t>> &original_order_realSites);
 
+/**
+ * @brief Orders the monomers of each type along a space filling curve
+ *
+ * Sorts the monomers inside each monomer type block by the Morton
+ * (Z-order) key of their first site, so monomers that are close in space
+ * are also close in memory. With a box, the positions are folded into the
+ * unit cell; without it, the bounding box of the monomers is used.
+ * Monomers never leave their type block.
+ * @param[in] mon_type_count Vector of pairs with the monomer type id and
+ * the number of monomers of that type, in the internal order
+ * @param[in] xyz Coordinates of all the sites of the system
+ * @param[in] first_index Index of the first site of each monomer
+ * @param[in] box Box of the system. Empty for no periodic boundary conditions.
+ * @return Permutation of the monomers. The monomer that goes to position
+ * i is the one that currently is at position perm[i].
+ */
+std::vector<size_t> SpatialOrder(const std::vector<std::pair<std::string, size_t>> &mon_type_count,
+                                 const std::vector<double> &xyz, const std::vector<size_t> &first_index,
+                                 const std::vector<double> &box);
+
 /**
  * @brief Function that fills the sites, atoms and first index of
  * the system given the list of monomer ids
@@ -153,7 +175,7 @@ std::vector<std::pair<std::string, size_t>> OrderMonomers(
  * index of the monomers in the same order as the mon vector
  * @return Total number of sites
  */
-size_t SetUpMonomers(std::vector<std::string> mon, std::vector<size_t> &sites, std::vector<size_t> &nat,
+size_t SetUpMonomers(const std::vector<std::string> &mon, std::vector<size_t> &sites, std::vector<size_t> &nat,
                      std::vector<size_t> &fi_at);
 
 /**
@@ -170,8 +192,8 @@ size_t SetUpMonomers(std::vector<std::string> mon, std::vector<size_t> &sites, s
  * @param[in] nat Vector with the number of atoms of each monomer
  * @param[in] first_index Vector with the first index of each monomer
  */
-void FixMonomerCoordinates(std::vector<double> &xyz, std::vector<double> box, std::vector<size_t> nat,
-                           std::vector<size_t> first_index);
+void FixMonomerCoordinates(std::vector<double> &xyz, const std::vector<double> &box, const std::vector<size_t> &nat,
+                           const std::vector<size_t> &first_index);
 
 /**
  * @brief This function finds the monomer 2 mirror image that is closer to
@@ -262,8 +284,37 @@ void GetCloseNeighbors(size_t nmax, std::vector<double> point, std::vector<doubl
  * between the first atom of both monomers
  */
 void AddClusters(size_t n_max, double cutoff, size_t istart, size_t iend, size_t nmon, bool use_pbc,
-                 std::vector<double> box, std::vector<double> xyz_orig, std::vector<size_t> first_index,
-                 std::vector<size_t> &dimers, std::vector<size_t> &trimers);
+                 const std::vector<double> &box, const std::vector<double> &xyz_orig,
+                 const std::vector<size_t> &first_index, std::vector<size_t> &dimers, std::vector<size_t> &trimers);
+
+/**
+ * @brief Finds the trimers within the cutoff of their type.
+ *
+ * Same search as AddClusters with n_max = 3, but a trimer is only kept
+ * if at least two of its three distances are smaller than the cutoff
+ * of its combination of monomer types. The trimers are returned as
+ * <i,j,k> with k > j > i, grouped by type in the order of the cutoff
+ * table, so that trimers of the same type are contiguous.
+ * @param[in] cutoffs Cutoff of each trimer type, ntypes^3 elements.
+ * The cutoff of the types t1 <= t2 <= t3 is cutoffs[(t1 * ntypes + t2) * ntypes + t3]
+ * @param[in] mon_type Type of each monomer, from 0 to ntypes - 1
+ * @param[in] ntypes Number of monomer types
+ * @param[in] istart Minimum value of index i
+ * @param[in] iend Maximum value of index i (not included in the clusters)
+ * @param[in] nmon Number of monomers
+ * @param[in] use_pbc Boolean that states if we are in PBC or not
+ * @param[in] box Vector of 9 components with the three main vectors
+ * of the box
+ * @param[in] xyz_orig Coordinates of the system
+ * @param[in] first_index First index of the monomers in the system
+ * @param[out] trimers Vector of unsigned integers with the trimers
+ * @warning The distance between monomers is computed as the distance
+ * between the first atom of both monomers
+ */
+void AddTrimers(const std::vector<double> &cutoffs, const std::vector<size_t> &mon_type, size_t ntypes,
+                size_t istart, size_t iend, size_t nmon, bool use_pbc, const std::vector<double> &box,
+                const std::vector<double> &xyz_orig, const std::vector<size_t> &first_index,
+                std::vector<size_t> &trimers);
 
 /**
  * @brief Sets the excluded pairs for a given monomer
@@ -279,6 +330,20 @@ void AddClusters(size_t n_max, double cutoff, size_t istart, size_t iend, size_t
  */
 void GetExcluded(std::string mon, excluded_set_type &exc12, excluded_set_type &exc13, excluded_set_type &exc14);
 
+/**
+ * @brief Sets the excluded pairs of each monomer type
+ *
+ * The excluded pairs only depend on the monomer id, so they can be set
+ * once per type and looked up in every energy call.
+ * @param[in] mon_type_count Monomer types and number of monomers of each type
+ * @param[out] exc12 Set of pairs with the 1-2 excluded atoms of each type
+ * @param[out] exc13 Set of pairs with the 1-3 excluded atoms of each type
+ * @param[out] exc14 Set of pairs with the 1-4 excluded atoms of each type
+ */
+void GetExcludedByType(const std::vector<std::pair<std::string, size_t> > &mon_type_count,
+                       std::vector<excluded_set_type> &exc12, std::vector<excluded_set_type> &exc13,
+                       std::vector<excluded_set_type> &exc14);
+
 /**
  * @brief Helper function to compare a pair of an unsigned integer and a
  * double.
@@ -309,7 +374,7 @@ bool ComparePair(std::pair<size_t, double> a, std::pair<size_t, double> b);
  * @param[in] b Atom index 2
  * @return True if the pair a,b or b,a is in exc
  */
-bool IsExcluded(excluded_set_type exc, size_t a, size_t b);
+bool IsExcluded(const excluded_set_type &exc, size_t a, size_t b);
 
 /**
  * @brief Gets the thole damping for dipole dipole
@@ -340,8 +405,9 @@ double GetAdd(bool is12, bool is13, bool is14, std::string mon);
  * @param[in] sites Vector with the number of sites of each monomer
  * @return The reordered vector that includes ALL sites
  */
-std::vector<double> ResetOrder3N(std::vector<double> coords, std::vector<std::pair<size_t, size_t>> original_order,
-                                 std::vector<size_t> first_index, std::vector<size_t> sites);
+std::vector<double> ResetOrder3N(const std::vector<double> &coords,
+                                 const std::vector<std::pair<size_t, size_t>> &original_order,
+                                 const std::vector<size_t> &first_index, const std::vector<size_t> &sites);
 
 /**
  * @brief Reorders a vector of 3N coordinates, where N is the number
@@ -359,8 +425,9 @@ std::vector<double> ResetOrder3N(std::vector<double> coords, std::vector<std::pa
  * @param[in] nats Vector with the number of real atoms of each monomer
  * @return The reordered vector that includes only the real sites
  */
-std::vector<double> ResetOrderReal3N(std::vector<double> coords, std::vector<std::pair<size_t, size_t>> original_order,
-                                     size_t numats, std::vector<size_t> first_index, std::vector<size_t> nats);
+std::vector<double> ResetOrderReal3N(const std::vector<double> &coords,
+                                     const std::vector<std::pair<size_t, size_t>> &original_order, size_t numats,
+                                     const std::vector<size_t> &first_index, const std::vector<size_t> &nats);
 
 /**
  * @brief Reorders a vector of N elements, where N is the number
@@ -378,8 +445,8 @@ std::vector<double> ResetOrderReal3N(std::vector<double> coords, std::vector<std
  * @return The reordered vector that includes ALL sites
  */
 template <typename T>
-std::vector<T> ResetOrderN(std::vector<T> vector_T, std::vector<std::pair<size_t, size_t>> original_order,
-                           std::vector<size_t> first_index, std::vector<size_t> sites) {
+std::vector<T> ResetOrderN(const std::vector<T> &vector_T, const std::vector<std::pair<size_t, size_t>> &original_order,
+                           const std::vector<size_t> &first_index, const std::vector<size_t> &sites) {
     std::vector<T> new_vector_T(vector_T.size());
     for (size_t i = 0; i < sites.size(); i++) {
         size_t ini = first_index[i];
@@ -408,8 +475,9 @@ std::vector<T> ResetOrderN(std::vector<T> vector_T, std::vector<std::pair<size_t
  * @return The reordered vector that includes only the real sites
  */
 template <typename T>
-std::vector<T> ResetOrderRealN(std::vector<T> vector_T, std::vector<std::pair<size_t, size_t>> original_order,
-                               size_t numats, std::vector<size_t> first_index, std::vector<size_t> nats) {
+std::vector<T> ResetOrderRealN(const std::vector<T> &vector_T,
+                               const std::vector<std::pair<size_t, size_t>> &original_order, size_t numats,
+                               const std::vector<size_t> &first_index, const std::vector<size_t> &nats) {
     std::vector<T> new_vector_T(numats);
     for (size_t i = 0; i < nats.size(); i++) {
         size_t ini = first_index[i];
@@ -435,6 +503,19 @@ std::vector<T> ResetOrderRealN(std::vector<T> vector_T, std::vector<std::pair<si
  */
 void SetVSites(std::vector<double> &xyz, std::string mon_id, size_t n_mon, size_t nsites, size_t fst_ind);
 
+/**
+ * @brief Tells if the charges or the virtual sites of a monomer type
+ * depend on its geometry
+ *
+ * Only water (M-site and DMS charges) does for now. The charges of all
+ * the other monomer types, and the polarizabilities and polarizability
+ * factors of all of them, are constants.
+ * @param[in] mon_id Id of the monomer
+ * @return True if the charges or virtual sites must be recomputed when
+ * the coordinates change
+ */
+bool IsGeometryDependent(const std::string &mon_id);
+
 /**
  * @brief Sets the charges of a system. If there are osition dependent charges,
  * it also calculates them.
@@ -452,8 +533,8 @@ void SetVSites(std::vector<double> &xyz, std::string mon_id, size_t n_mon, size_
  * @param[out] chg_der Vector of doubles that will be filled with the charge
  * gradients of the position dependent charges
  */
-void SetCharges(std::vector<double> xyz, std::vector<double> &charges, std::string mon_id, size_t n_mon, size_t nsites,
-                size_t fst_ind, std::vector<double> &chg_der);
+void SetCharges(const std::vector<double> &xyz, std::vector<double> &charges, std::string mon_id, size_t n_mon,
+                size_t nsites, size_t fst_ind, std::vector<double> &chg_der);
 
 /**
  * @brief Sets the polarizability factors of a system.
@@ -513,9 +594,9 @@ void RedistributeVirtGrads2Real(const std::string mon, const size_t nmon, const
  * @param[in,out] grad Gradients of the system
  * @param[in] chg_grad Charge derivatives
  */
-void ChargeDerivativeForce(const std::string mon, const size_t nmon, const size_t fi_crd, const size_t fi_sites,
-                           const std::vector<double> phi, std::vector<double> &grad,
-                           const std::vector<double> chg_grad, double *crd = 0, std::vector<double> *qdvirial = 0);
+void ChargeDerivativeForce(const std::string &mon, const size_t nmon, const size_t fi_crd, const size_t fi_sites,
+                           const std::vector<double> &phi, std::vector<double> &grad,
+                           const std::vector<double> &chg_grad, double *crd = 0, std::vector<double> *qdvirial = 0);
 
 }  // namespace systools
 #endif  // SYS_TOOLS_H
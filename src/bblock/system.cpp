@@ -33,6 +33,14 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "system.h"
+#include "potential/electrostatics/ewald_error.h"
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <stdint.h>
 
 //#define DEBUG
 //#define TIMING
@@ -54,7 +62,53 @@ namespace bblock {  // Building Block :: System
 
 ////////////////////////////////////////////////////////////////////////////////
 
-System::System() { initialized_ = false; }
+// Ids of the scratch buffers kept in workspace_
+enum SystemBuffer {
+    kXyz1,
+    kXyz2,
+    kXyz3,
+    kGrad1,
+    kGrad2,
+    kGrad3,
+    kGradPool,
+    kVirialPool,
+    kEnergyPool,
+    kVirial,
+    kElecGrad,
+    kElecVirial,
+    kNNScratch,
+    kNumSystemBuffers
+};
+
+// Moves the per-site data of the monomers to their new positions, given
+// the permutation of the monomers perm (see systools::SpatialOrder).
+// All the monomers that are swapped must have the same number of sites.
+template <typename T>
+void PermuteSites(const std::vector<size_t> &perm, const std::vector<size_t> &first_index,
+                  const std::vector<size_t> &sites, size_t stride, std::vector<T> &v) {
+    std::vector<T> old(v);
+    for (size_t i = 0; i < perm.size(); i++) {
+        size_t from = stride * first_index[perm[i]];
+        std::copy(old.begin() + from, old.begin() + from + stride * sites[i], v.begin() + stride * first_index[i]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+System::System() {
+    initialized_ = false;
+    reorder_frequency_ = 0;
+    calls_since_reorder_ = 0;
+    input_order_ = false;
+    real_input_order_ = false;
+    elec_treecode_theta_ = 0.0;
+    elec_treecode_radius_ = 9.0;
+    dipole_tensor_memory_ = 0.0;
+    elec_threads_ = 0;
+    compute_virial_ = true;
+    elec_cutoff_ = 0.0;
+    monomer_pairs_set_ = false;
+}
 System::~System() {}
 
 size_t System::GetNumMol() { return nummol; }
@@ -141,17 +195,55 @@ std::vector<std::string> System::GetRealAtomNames() {
 
 std::vector<double> System::GetXyz() { return systools::ResetOrder3N(xyz_, initial_order_, first_index_, sites_); }
 
+void System::GetXyz(double *xyz) { CopyToInputOrder3N(xyz_.data(), false, xyz); }
+
 std::vector<double> System::GetRealXyz() {
     SetPBC(box_);
     return systools::ResetOrderReal3N(xyz_, initial_order_realSites_, numat_, first_index_, nat_);
 }
 
+void System::GetRealXyz(double *xyz) {
+    SetPBC(box_);
+    CopyToInputOrder3N(xyz_.data(), true, xyz);
+}
+
 std::vector<double> System::GetGrads() { return systools::ResetOrder3N(grad_, initial_order_, first_index_, sites_); }
 
+void System::GetGrads(double *grads) { CopyToInputOrder3N(grad_.data(), false, grads); }
+
 std::vector<double> System::GetRealGrads() {
     return systools::ResetOrderReal3N(grad_, initial_order_realSites_, numat_, first_index_, nat_);
 }
 
+void System::GetRealGrads(double *grads) { CopyToInputOrder3N(grad_.data(), true, grads); }
+
+bool System::IsInputOrder() { return input_order_; }
+
+void System::CopyToInputOrder3N(const double *src, bool real, double *dst) {
+    if (real ? real_input_order_ : input_order_) {
+        std::copy(src, src + 3 * (real ? numat_ : numsites_), dst);
+        return;
+    }
+
+    const std::vector<std::pair<size_t, size_t> > &order = real ? initial_order_realSites_ : initial_order_;
+    const std::vector<size_t> &nsites = real ? nat_ : sites_;
+    for (size_t i = 0; i < nsites.size(); i++) {
+        const double *ini = src + 3 * first_index_[i];
+        std::copy(ini, ini + 3 * nsites[i], dst + 3 * order[i].second);
+    }
+}
+
+void System::SetInputOrderFlags() {
+    input_order_ = true;
+    for (size_t i = 0; i < initial_order_.size(); i++) {
+        if (initial_order_[i].second != first_index_[i]) {
+            input_order_ = false;
+            break;
+        }
+    }
+    real_input_order_ = input_order_ && numat_ == numsites_;
+}
+
 std::vector<double> System::GetCharges() { return systools::ResetOrderN(chg_, initial_order_, first_index_, sites_); }
 
 std::vector<double> System::GetRealCharges() {
@@ -189,6 +281,19 @@ std::vector<std::string> System::GetMonId() {
 
 std::vector<double> System::GetVirial() {return virial_;}
 
+std::vector<double> System::GetInducedDipoles() {
+    return systools::ResetOrder3N(electrostaticE_.GetInducedDipoles(), initial_order_, first_index_, sites_);
+}
+
+void System::GetElectrostaticPotentialAndField(const std::vector<double> &points, std::vector<double> &phi,
+                                               std::vector<double> &field) {
+    if (!initialized_) {
+        std::string text = "System has not been initialized. The electrostatic potential cannot be computed.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    electrostaticE_.GetPotentialAndField(points, phi, field);
+}
+
 std::vector<double> System::GetBox() { return box_;}
 
 size_t System::GetMaxEval1b() { return maxNMonEval_;}
@@ -197,18 +302,38 @@ size_t System::GetMaxEval2b() { return maxNDimEval_;}
 
 size_t System::GetMaxEval3b() { return maxNTriEval_;}
 
+size_t System::GetNumBufferResizes() {
+    return workspace_.GetNumBufferResizes() + dispersionE_.GetNumBufferResizes() +
+           buckinghamE_.GetNumBufferResizes() + electrostaticE_.GetNumBufferResizes();
+}
+
 double System::GetDipoleTolerance() { return diptol_;}
 
 std::string System::GetDipoleMethod() { return dipole_method_;}
 
+double System::GetDipoleTensorMemory() { return dipole_tensor_memory_; }
+
+size_t System::GetElectrostaticsThreads() { return elec_threads_; }
+
+bool System::GetComputeVirial() { return compute_virial_; }
+
+size_t System::GetMonomerReordering() { return reorder_frequency_; }
+
 size_t System::GetMaxIterationsDipoles() { return maxItDip_;}
 
+void System::GetElectrostaticsTreecode(double &theta, double &near_radius) {
+    theta = elec_treecode_theta_;
+    near_radius = elec_treecode_radius_;
+}
+
 void System::GetEwaldParamsElectrostatics(double &alpha, double &grid_density, size_t &spline_order) {
     alpha = elec_alpha_; 
     grid_density = elec_grid_density_;
     spline_order = elec_spline_order_;
 }
 
+double System::GetElectrostaticsCutoff() { return elec_cutoff_ > 0 ? elec_cutoff_ : cutoff2b_; }
+
 void System::GetEwaldParamsDispersion(double &alpha, double &grid_density, size_t &spline_order) {
     alpha = disp_alpha_; 
     grid_density = disp_grid_density_;
@@ -389,13 +514,43 @@ void System::SetDipoleTol(double tol) { diptol_ = tol; }
 void System::SetDipoleMaxIt(size_t maxit) { maxItDip_ = maxit; }
 void System::SetDipoleMethod(std::string method) { dipole_method_ = method; }
 
-void System::SetPBC(std::vector<double> box) {
+void System::SetDipoleTensorMemory(double max_memory_mb) {
+    dipole_tensor_memory_ = max_memory_mb;
+    electrostaticE_.SetDipoleTensor(max_memory_mb);
+}
+
+void System::SetElectrostaticsThreads(size_t nthreads) { elec_threads_ = nthreads; }
+
+void System::SetComputeVirial(bool compute_virial) {
+    compute_virial_ = compute_virial;
+    std::fill(virial_.begin(), virial_.end(), 0.0);
+}
+
+void System::SetMonomerReordering(size_t frequency) {
+    reorder_frequency_ = frequency;
+    calls_since_reorder_ = 0;
+    if (initialized_ && reorder_frequency_) {
+        ReorderMonomers();
+        SetPBC(box_);
+    }
+}
+
+void System::SetBox(const std::vector<double> &box) {
     // Check that the box has 0 or 9 components
     if (box.size() != 9 && box.size() != 0) {
         std::string text = "Box size of " + std::to_string(box.size()) + " is not acceptable.";
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
+    // Set the box and the bool to use or not pbc
+    use_pbc_ = box.size();
+    box_ = box;
+    monomer_pairs_set_ = false;
+}
+
+void System::SetPBC(const std::vector<double> &box) {
+    SetBox(box);
+
 #ifdef DEBUG
     std::cerr << "Entered SetPBC():\n";
     std::cerr << "Coordinate before fixing monomers:\n";
@@ -405,10 +560,6 @@ void System::SetPBC(std::vector<double> box) {
     std::cerr << std::endl;
 #endif
 
-    // Set the box and the bool to use or not pbc
-    use_pbc_ = box.size();
-    box_ = box;
-
     // If we use PBC, we need to make sure that the monomer atoms are all
     // close to the central atom (1st atom of each monomer)
     if (use_pbc_) {
@@ -424,14 +575,15 @@ void System::SetPBC(std::vector<double> box) {
     std::cerr << std::endl;
 #endif
 
-    // Reset the virtual site positions, charges, pols and polfacs
+    // Reset the virtual site positions and the position dependent charges
     SetVSites();
     SetCharges();
-    SetPols();
-    SetPolfacs();
+
+    // Share the transposed coordinates of the real atoms between the terms
+    real_sites_.Gather(xyz_.data());
 }
 
-void System::SetXyz(std::vector<double> xyz) {
+void System::SetXyz(const std::vector<double> &xyz) {
     // Make sure that the xyz of input has the right size
     if (xyz.size() != 3 * numsites_) {
         std::string text =
@@ -439,17 +591,24 @@ void System::SetXyz(std::vector<double> xyz) {
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
+    SetXyz(xyz.data());
+}
+
+void System::SetXyz(const double *xyz) {
+    if (input_order_) {
+        std::copy(xyz, xyz + 3 * numsites_, xyz_.begin());
+        return;
+    }
+
     // Copy each coordinate in the apropriate place in the internal
     // xyz vector
     for (size_t i = 0; i < sites_.size(); i++) {
-        size_t ini = 3 * initial_order_[i].second;
-        size_t fin = ini + 3 * sites_[i];
-        size_t ini_new = 3 * first_index_[i];
-        std::copy(xyz.begin() + ini, xyz.begin() + fin, xyz_.begin() + ini_new);
+        const double *ini = xyz + 3 * initial_order_[i].second;
+        std::copy(ini, ini + 3 * sites_[i], xyz_.begin() + 3 * first_index_[i]);
     }
 }
 
-void System::SetRealXyz(std::vector<double> xyz) {
+void System::SetRealXyz(const std::vector<double> &xyz) {
     // Make sure that the xyz of input has the right size
     if (xyz.size() != 3 * numat_) {
         std::string text =
@@ -457,17 +616,25 @@ void System::SetRealXyz(std::vector<double> xyz) {
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
+    SetRealXyz(xyz.data());
+}
+
+void System::SetRealXyz(const double *xyz) {
+    if (real_input_order_) {
+        std::copy(xyz, xyz + 3 * numat_, xyz_.begin());
+        return;
+    }
+
     // Copy each coordinate in the apropriate place in the internal
     // xyz vector
     for (size_t i = 0; i < nat_.size(); i++) {
-        size_t ini = 3 * initial_order_realSites_[i].second;
-        size_t fin = ini + 3 * nat_[i];
-        size_t ini_new = 3 * first_index_[i];
-        std::copy(xyz.begin() + ini, xyz.begin() + fin, xyz_.begin() + ini_new);
+        const double *ini = xyz + 3 * initial_order_realSites_[i].second;
+        std::copy(ini, ini + 3 * nat_[i], xyz_.begin() + 3 * first_index_[i]);
     }
 }
 
-void System::AddMonomer(std::vector<double> xyz, std::vector<std::string> atoms, std::string id) {
+void System::AddMonomer(const std::vector<double> &xyz, const std::vector<std::string> &atoms,
+                        const std::string &id) {
     // If the system has been initialized, adding a monomer is not possible
     if (initialized_) {
         std::string text = std::string("The system has already been initialized. ") +
@@ -476,13 +643,38 @@ void System::AddMonomer(std::vector<double> xyz, std::vector<std::string> atoms,
     }
 
     // Adding coordinates
-    for (auto i = xyz.begin(); i != xyz.end(); i++) xyz_.push_back(*i);
+    xyz_.insert(xyz_.end(), xyz.begin(), xyz.end());
     // Adding atom names
-    for (auto i = atoms.begin(); i != atoms.end(); i++) atoms_.push_back(*i);
+    atoms_.insert(atoms_.end(), atoms.begin(), atoms.end());
     // Adding id
     monomers_.push_back(id);
 }
 
+void System::AddMonomers(const std::vector<double> &xyz, const std::vector<std::string> &atoms,
+                         const std::vector<std::string> &ids, const std::vector<size_t> &nat) {
+    // If the system has been initialized, adding monomers is not possible
+    if (initialized_) {
+        std::string text = std::string("The system has already been initialized. ") +
+                           std::string("Adding new monomers is not possible");
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // Check that the arrays are consistent with each other
+    size_t natoms = 0;
+    for (size_t i = 0; i < nat.size(); i++) natoms += nat[i];
+    if (ids.size() != nat.size() || atoms.size() != natoms || xyz.size() != 3 * natoms) {
+        std::string text = std::string("Inconsistent sizes: ids(") + std::to_string(ids.size()) +
+                           std::string("), nat(") + std::to_string(nat.size()) + std::string(") adding up to ") +
+                           std::to_string(natoms) + std::string(" atoms, atoms(") + std::to_string(atoms.size()) +
+                           std::string(") and xyz(") + std::to_string(xyz.size()) + std::string(")");
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    xyz_.insert(xyz_.end(), xyz.begin(), xyz.end());
+    atoms_.insert(atoms_.end(), atoms.begin(), atoms.end());
+    monomers_.insert(monomers_.end(), ids.begin(), ids.end());
+}
+
 void System::AddMolecule(std::vector<size_t> molec) { molecules_.push_back(molec); }
 
 std::vector<std::pair<std::string, std::string> > System::GetTTMnrgPairs() { return buck_pairs_;}
@@ -491,6 +683,8 @@ std::vector<std::vector<std::string> > System::Get2bIgnorePoly() {return ignore_
 
 std::vector<std::vector<std::string> > System::Get3bIgnorePoly() {return ignore_3b_poly_;}
 
+std::vector<std::string> System::GetNNModels() { return nn_potentials_.GetFiles(); }
+
 void System::AddTTMnrgPair(std::string mon1, std::string mon2) {
     std::pair<std::string, std::string> p = mon2 < mon1 ? std::make_pair(mon2, mon1) : std::make_pair(mon1, mon2);
 
@@ -548,6 +742,23 @@ void System::Set3bIgnorePoly(std::vector<std::vector<std::string> > ignore_3b) {
     }
 }
 
+void System::SetNNModels(std::vector<std::string> files) {
+    nn::NNPotentials previous = nn_potentials_;
+    nn_potentials_.SetModels(files);
+
+    // The models may change the range of the dimers and trimers, and must
+    // match the monomers of the system. The old models are kept otherwise.
+    if (initialized_) {
+        try {
+            SetPolynomialRanges();
+        } catch (...) {
+            nn_potentials_ = previous;
+            SetPolynomialRanges();
+            throw;
+        }
+    }
+}
+
 void System::Initialize() {
     // If we try to reinitialize the system, we will get an exception
     if (initialized_) {
@@ -566,7 +777,8 @@ void System::Initialize() {
     /////////////
 
     // Setting 2B cutoff
-    // Affects the 2B dispersion and 2B polynomials
+    // Affects the 2B dispersion and 2B polynomials. The polynomials
+    // are further limited to their own range (see SetPolynomialRanges)
     // TODO make it effective for electrostatics too
     cutoff2b_ = 50.0;
 
@@ -597,10 +809,19 @@ void System::Initialize() {
     // and monomer id, such as number of sites, and orders the monomers
     AddMonomerInfo();
 
+    // Sort the monomers in space if requested before the initialization
+    if (reorder_frequency_) ReorderMonomers();
+
     // Setting the number of molecules and number of monomers
     nummol = molecules_.size();
     nummon_ = monomers_.size();
 
+    // Range of the polynomials, used in the search for dimers and trimers
+    SetPolynomialRanges();
+
+    // Real atoms in the layout of dispersion and buckingham. Filled in SetPBC.
+    real_sites_.SetLayout(mon_type_count_, nat_, first_index_);
+
     ////////////////////
     // ELECTROSTATICS //
     ////////////////////
@@ -614,6 +835,9 @@ void System::Initialize() {
     // Sets the default method to calculate induced dipoles to ASPC
     dipole_method_ = "cg";
 
+    // Charges, pols and polfacs that stay constant
+    SetStaticSiteParameters();
+
     // Setting PBC to false by default
     SetPBC();
 
@@ -628,6 +852,9 @@ void System::Initialize() {
     // TODO: Do grads set to true for now. Needs to be fixed
     electrostaticE_.Initialize(chg_, chggrad_, polfac_, pol_, xyz_, monomers_, sites_, first_index_, mon_type_count_,
                                true, diptol_, maxItDip_, dipole_method_);
+    electrostaticE_.SetTreecode(elec_treecode_theta_, elec_treecode_radius_);
+    electrostaticE_.SetDipoleTensor(dipole_tensor_memory_);
+    electrostaticE_.SetExternalCharges(external_xyz_, external_chg_);
 
     // TODO Is this OK? Order of GetReal is input order.
     std::vector<double> xyz_real = GetRealXyz();
@@ -635,6 +862,9 @@ void System::Initialize() {
     dispersionE_.Initialize(c6_lr_, xyz_real, monomers_, nat_, mon_type_count_, true, box_);
     buckinghamE_.Initialize(xyz_real, monomers_, nat_, mon_type_count_, true, box_);
 
+    // Scratch buffers for the energy evaluation. Sized in the first call.
+    workspace_ = tools::Workspace(kNumSystemBuffers);
+
     // We are done. Setting initialized_ to true
     initialized_ = true;
 }
@@ -749,6 +979,19 @@ void System::SetUpFromJson(nlohmann::json j) {
     maxItDip_ = dipole_max_it;
     mbx_j_["MBX"]["dipole_max_it"] = dipole_max_it;
 
+    // Try to get the memory limit of the stored dipole tensors
+    // Default: 0 (not stored)
+    double dipole_tensor_memory;
+    try {
+        dipole_tensor_memory = j["MBX"]["dipole_tensor_memory"];
+    } catch (...) {
+        dipole_tensor_memory = 0.0;
+        std::cerr << "**WARNING** \"dipole_tensor_memory\" is not defined in json file. Using "
+                  << dipole_tensor_memory << "\n";
+    }
+    SetDipoleTensorMemory(dipole_tensor_memory);
+    mbx_j_["MBX"]["dipole_tensor_memory"] = dipole_tensor_memory;
+
     // Try to get dispersion PME alpha
     // Default: 0.6
     double alpha_disp;
@@ -819,6 +1062,79 @@ void System::SetUpFromJson(nlohmann::json j) {
 
     SetEwaldElectrostatics(alpha_elec, grid_density_elec, spline_order_elec);
 
+    // Try to get the real space cutoff of the electrostatics
+    // Default: 0.0 (same as the two-body cutoff)
+    double cutoff_elec;
+    try {
+        cutoff_elec = j["MBX"]["cutoff_elec"];
+    } catch (...) {
+        cutoff_elec = 0.0;
+        std::cerr << "**WARNING** \"cutoff_elec\" is not defined in json file. Using " << cutoff_elec << "\n";
+    }
+    SetElectrostaticsCutoff(cutoff_elec);
+    mbx_j_["MBX"]["cutoff_elec"] = cutoff_elec;
+
+    // Try to get the target accuracy of the Ewald tuning of the electrostatics
+    // Default: 0.0 (no tuning)
+    double ewald_accuracy_elec;
+    try {
+        ewald_accuracy_elec = j["MBX"]["ewald_accuracy_elec"];
+    } catch (...) {
+        ewald_accuracy_elec = 0.0;
+        std::cerr << "**WARNING** \"ewald_accuracy_elec\" is not defined in json file. Using " << ewald_accuracy_elec
+                  << "\n";
+    }
+    mbx_j_["MBX"]["ewald_accuracy_elec"] = ewald_accuracy_elec;
+
+    // Try to get the opening angle of the electrostatics treecode
+    // Default: 0.0 (direct sum)
+    double elec_treecode_theta;
+    try {
+        elec_treecode_theta = j["MBX"]["elec_treecode_theta"];
+    } catch (...) {
+        elec_treecode_theta = 0.0;
+        std::cerr << "**WARNING** \"elec_treecode_theta\" is not defined in json file. Using " << elec_treecode_theta
+                  << "\n";
+    }
+    mbx_j_["MBX"]["elec_treecode_theta"] = elec_treecode_theta;
+
+    // Try to get the near radius of the electrostatics treecode
+    // Default: 9.0
+    double elec_treecode_radius;
+    try {
+        elec_treecode_radius = j["MBX"]["elec_treecode_radius"];
+    } catch (...) {
+        elec_treecode_radius = 9.0;
+        std::cerr << "**WARNING** \"elec_treecode_radius\" is not defined in json file. Using "
+                  << elec_treecode_radius << "\n";
+    }
+    SetElectrostaticsTreecode(elec_treecode_theta, elec_treecode_radius);
+    mbx_j_["MBX"]["elec_treecode_radius"] = elec_treecode_radius;
+
+    // Try to get the number of threads of the concurrent electrostatics
+    // Default: 0 (terms one after the other)
+    size_t elec_threads;
+    try {
+        elec_threads = j["MBX"]["elec_threads"];
+    } catch (...) {
+        elec_threads = 0;
+        std::cerr << "**WARNING** \"elec_threads\" is not defined in json file. Using " << elec_threads << "\n";
+    }
+    SetElectrostaticsThreads(elec_threads);
+    mbx_j_["MBX"]["elec_threads"] = elec_threads;
+
+    // Try to get if the virial has to be computed
+    // Default: true
+    bool compute_virial;
+    try {
+        compute_virial = j["MBX"]["compute_virial"];
+    } catch (...) {
+        compute_virial = true;
+        std::cerr << "**WARNING** \"compute_virial\" is not defined in json file. Using true\n";
+    }
+    SetComputeVirial(compute_virial);
+    mbx_j_["MBX"]["compute_virial"] = compute_virial;
+
     std::vector<std::pair<std::string, std::string> > ttm_pairs;
     try {
         std::vector<std::pair<std::string, std::string>> ttm_pairs2 = j["MBX"]["ttm_pairs"];
@@ -852,7 +1168,41 @@ void System::SetUpFromJson(nlohmann::json j) {
     Set3bIgnorePoly(ignore_3b_poly);
     mbx_j_["MBX"]["ignore_3b_poly"] = ignore_3b_poly_;
 
+    std::vector<std::string> nn_models;
+    try {
+        std::vector<std::string> nn_models2 = j["MBX"]["nn_models"];
+        nn_models = nn_models2;
+    } catch (...) {
+        nn_models.clear();
+        std::cerr << "**WARNING** \"nn_models\" is not defined in json file. Using empty list.\n";
+    }
+    SetNNModels(nn_models);
+    mbx_j_["MBX"]["nn_models"] = nn_models;
+
     SetPBC(box_);
+
+    // The tuning needs the box and the charges, so it is done once the rest is set
+    if (ewald_accuracy_elec > 0) {
+        if (initialized_ && !box_.empty()) {
+            TuneEwaldElectrostatics(ewald_accuracy_elec);
+        } else {
+            std::cerr << "**WARNING** \"ewald_accuracy_elec\" needs an initialized system with a box. "
+                      << "The Ewald parameters are not tuned.\n";
+        }
+    }
+
+    // Try to get the frequency of the spatial reordering of the monomers
+    // Default: 0 (no reordering)
+    size_t reorder_frequency;
+    try {
+        reorder_frequency = j["MBX"]["reorder_frequency"];
+    } catch (...) {
+        reorder_frequency = 0;
+        std::cerr << "**WARNING** \"reorder_frequency\" is not defined in json file. Using " << reorder_frequency
+                  << "\n";
+    }
+    SetMonomerReordering(reorder_frequency);
+    mbx_j_["MBX"]["reorder_frequency"] = reorder_frequency;
 }
 
 nlohmann::json System::GetJsonConfig() {
@@ -882,7 +1232,8 @@ void System::SetUpFromJson(char *json_file) {
        "spline_order_disp" : 6,
        "ttm_pairs" : [],
        "ignore_2b_poly" : [],
-       "ignore_3b_poly" : []
+       "ignore_3b_poly" : [],
+       "nn_models" : []
    } ,
    "i-pi" : {
        "port" : 34543,
@@ -916,7 +1267,8 @@ void System::SetUpFromJson(char *json_file) {
                 {"spline_order_disp",  6},
                 {"ttm_pairs" , nlohmann::json::array()},
                 {"ignore_2b_poly" , nlohmann::json::array()},
-                {"ignore_3b_poly" , nlohmann::json::array()}
+                {"ignore_3b_poly" , nlohmann::json::array()},
+                {"nn_models" , nlohmann::json::array()}
             }
         } ,
         {
@@ -956,9 +1308,9 @@ void System::AddMonomerInfo() {
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
-    // Copy xyz_ and clear it.
-    std::vector<double> xyz = xyz_;
-    xyz_.clear();
+    // Take the input xyz_ and leave it empty.
+    std::vector<double> xyz;
+    xyz.swap(xyz_);
 
     // If the size of xyz is not 3* size(atoms_), the system has
     // not been defined properly
@@ -969,9 +1321,9 @@ void System::AddMonomerInfo() {
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
-    // Copy the atoms_ vector and clear it
-    std::vector<std::string> atoms = atoms_;
-    atoms_.clear();
+    // Take the input atoms_ and leave it empty
+    std::vector<std::string> atoms;
+    atoms.swap(atoms_);
 
     // Adding the number of sites of each monomer and storing the first index
     std::vector<size_t> fi_at;
@@ -1053,8 +1405,11 @@ void System::AddMonomerInfo() {
 
     size_t count = 0;
     first_index_.clear();
+    first_index_.reserve(monomers_.size());
     std::vector<size_t> tmpsites;
     std::vector<size_t> tmpnats;
+    tmpsites.reserve(monomers_.size());
+    tmpnats.reserve(monomers_.size());
     // Loop over all the monomers
     for (size_t i = 0; i < monomers_.size(); i++) {
         // For each monomer, copy the coordinates and atoms of the input
@@ -1074,8 +1429,9 @@ void System::AddMonomerInfo() {
     }
 
     // Set sites_ and nat_
-    sites_ = tmpsites;
-    nat_ = tmpnats;
+    sites_.swap(tmpsites);
+    nat_.swap(tmpnats);
+    SetInputOrderFlags();
 
     // Initialize gradients, charges, pols and polfacs to the right size
     grad_ = std::vector<double>(3 * numsites_, 0.0);
@@ -1084,6 +1440,61 @@ void System::AddMonomerInfo() {
     polfac_ = std::vector<double>(numsites_, 0.0);
 }
 
+void System::SetPolynomialRanges() {
+    size_t ntypes = mon_type_count_.size();
+
+    // Number of atoms of the monomers of each type, checked against the models
+    std::vector<size_t> type_nats(ntypes);
+    for (size_t i = 0, fi_mon = 0; i < ntypes; fi_mon += mon_type_count_[i].second, i++) {
+        type_nats[i] = nat_[fi_mon];
+    }
+
+    // The batches look the models up in these tables, which are left
+    // empty if there are no models
+    const bool use_nn = !nn_potentials_.Empty();
+    nn::NNClusterModel no_model = {nn::NNClusterModel::kNone, {0, 0, 0}};
+    nn_models2b_.assign(use_nn ? ntypes * ntypes : 0, no_model);
+    nn_models3b_.assign(use_nn ? ntypes * ntypes * ntypes : 0, no_model);
+
+    poly_range2b_ = 0.0;
+    poly_ranges3b_.assign(ntypes * ntypes * ntypes, 0.0);
+    for (size_t i = 0; i < ntypes; i++) {
+        const std::string &m1 = mon_type_count_[i].first;
+        for (size_t j = i; j < ntypes; j++) {
+            const std::string &m2 = mon_type_count_[j].first;
+            const nn::NNModel *model = 0;
+            if (use_nn) {
+                nn_models2b_[i * ntypes + j] = nn_potentials_.GetClusterModel({m1, m2}, {type_nats[i], type_nats[j]});
+                if (nn_models2b_[i * ntypes + j].index != nn::NNClusterModel::kNone) {
+                    model = &nn_potentials_.GetModel(nn_models2b_[i * ntypes + j]);
+                }
+            }
+            poly_range2b_ = std::max(poly_range2b_, model ? model->GetCutoff() : e2b::get_2b_cutoff(m1, m2));
+            for (size_t k = j; k < ntypes; k++) {
+                const std::string &m3 = mon_type_count_[k].first;
+                const size_t t = (i * ntypes + j) * ntypes + k;
+                const nn::NNModel *model = 0;
+                if (use_nn) {
+                    nn_models3b_[t] =
+                        nn_potentials_.GetClusterModel({m1, m2, m3}, {type_nats[i], type_nats[j], type_nats[k]});
+                    if (nn_models3b_[t].index != nn::NNClusterModel::kNone) {
+                        model = &nn_potentials_.GetModel(nn_models3b_[t]);
+                    }
+                }
+                poly_ranges3b_[t] = model ? model->GetCutoff() : e3b::get_3b_cutoff(m1, m2, m3);
+            }
+        }
+    }
+
+    // Monomers are ordered by type
+    mon_type_index_.clear();
+    for (size_t i = 0; i < ntypes; i++) {
+        mon_type_index_.insert(mon_type_index_.end(), mon_type_count_[i].second, i);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void System::AddClusters(size_t nmax, double cutoff, size_t istart, size_t iend) {
     // istart is the monomer position for which we will look all dimers and
     // trimers that contain it. iend is the last monomer position.
@@ -1123,6 +1534,69 @@ std::vector<size_t> System::AddClustersParallel(size_t nmax, double cutoff, size
     return trimers;
 }
 
+void System::AddTrimers(const std::vector<double> &cutoffs, size_t istart, size_t iend, std::vector<size_t> &trimers) {
+    systools::AddTrimers(cutoffs, mon_type_index_, mon_type_count_.size(), istart, iend, monomers_.size(), use_pbc_,
+                         box_, xyz_, first_index_, trimers);
+}
+
+void System::ReorderMonomers() { PermuteMonomers(systools::SpatialOrder(mon_type_count_, xyz_, first_index_, box_)); }
+
+void System::PermuteMonomers(const std::vector<size_t> &perm) {
+    // Monomers only move inside their type block, so monomers_, sites_,
+    // nat_ and first_index_ stay the same
+    std::vector<std::pair<size_t, size_t> > order = initial_order_;
+    std::vector<std::pair<size_t, size_t> > order_real = initial_order_realSites_;
+    for (size_t i = 0; i < perm.size(); i++) {
+        initial_order_[i] = order[perm[i]];
+        initial_order_realSites_[i] = order_real[perm[i]];
+        original2current_order_[initial_order_[i].first] = i;
+    }
+    SetInputOrderFlags();
+
+    PermuteSites(perm, first_index_, sites_, 3, xyz_);
+    PermuteSites(perm, first_index_, sites_, 1, atoms_);
+    PermuteSites(perm, first_index_, sites_, 3, grad_);
+    for (std::map<std::string, TermGroup>::iterator it = term_groups_.begin(); it != term_groups_.end(); ++it) {
+        if (it->second.grad.size() == 3 * numsites_) PermuteSites(perm, first_index_, sites_, 3, it->second.grad);
+    }
+
+    // The dipoles of the last call follow the monomers. The ones of
+    // previous steps are dropped.
+    electrostaticE_.PermuteMonomers(perm);
+    monomer_pairs_set_ = false;
+}
+
+double System::GetMaxMonomerExtent() {
+    double max_extent2 = 0.0;
+    for (size_t i = 0; i < nummon_; i++) {
+        const double *x0 = xyz_.data() + 3 * first_index_[i];
+        for (size_t j = 1; j < sites_[i]; j++) {
+            const double *xj = x0 + 3 * j;
+            double d2 = (xj[0] - x0[0]) * (xj[0] - x0[0]) + (xj[1] - x0[1]) * (xj[1] - x0[1]) +
+                        (xj[2] - x0[2]) * (xj[2] - x0[2]);
+            max_extent2 = std::max(max_extent2, d2);
+        }
+    }
+    return std::sqrt(max_extent2);
+}
+
+void System::SetUpMonomerPairs() {
+    if (monomer_pairs_set_) return;
+    monomer_pairs_set_ = true;
+    monomer_pairs_.clear();
+
+    double radius = 0.0;
+    if (buck_pairs_.size()) radius = cutoff2b_;
+    if (elec_treecode_theta_ > 0 && box_.empty()) radius = std::max(radius, elec_treecode_radius_);
+    if (radius == 0.0) return;
+
+    // The search uses the first site of each monomer, so the radius is
+    // extended by twice the largest distance of a site to the first site
+    std::vector<size_t> trimers;
+    systools::AddClusters(2, radius + 2.0 * GetMaxMonomerExtent(), 0, nummon_, nummon_, use_pbc_, box_, xyz_,
+                          first_index_, monomer_pairs_, trimers);
+}
+
 double System::Energy(bool do_grads) {
     // Check if system has been initialized
     // If not, throw exception
@@ -1132,6 +1606,12 @@ double System::Energy(bool do_grads) {
         throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
+    // Keep the monomers sorted in space as they move
+    if (reorder_frequency_ && ++calls_since_reorder_ == reorder_frequency_) {
+        ReorderMonomers();
+        calls_since_reorder_ = 0;
+    }
+
     // Reset energy and grads in system to 0
     energy_ = 0.0;
     std::fill(grad_.begin(), grad_.end(), 0.0);
@@ -1159,36 +1639,49 @@ double System::Energy(bool do_grads) {
     auto t2 = std::chrono::high_resolution_clock::now();
 #endif
 
-    // double e2b = 0.0;
-    double e2b = Get2B(do_grads);
+    double e2b, edisp, ebuck, e3b, Eelec;
+#ifdef TIMING
+    auto t2a = t2, t2b = t2, t3 = t2, t4 = t2;
+#endif
+    // Electrostatics at the same time as the rest, if there are threads for both
+    bool concurrent = false;
+#ifdef _OPENMP
+    concurrent = elec_threads_ > 0 && elec_threads_ < static_cast<size_t>(omp_get_max_threads());
+#endif
+    if (concurrent) {
+        GetTermsConcurrently(do_grads, e2b, edisp, ebuck, e3b, Eelec);
+    } else {
+        // e2b = 0.0;
+        e2b = Get2B(do_grads);
 
 #ifdef TIMING
-    auto t2a = std::chrono::high_resolution_clock::now();
+        t2a = std::chrono::high_resolution_clock::now();
 #endif
 
-    // double edisp = 0.0;
-    double edisp = GetDispersion(do_grads);
+        // edisp = 0.0;
+        edisp = GetDispersion(do_grads);
 
 #ifdef TIMING
-    auto t2b = std::chrono::high_resolution_clock::now();
+        t2b = std::chrono::high_resolution_clock::now();
 #endif
 
-    // double ebuck = 0.0;
-    double ebuck = GetBuckingham(do_grads);
+        // ebuck = 0.0;
+        ebuck = GetBuckingham(do_grads);
 #ifdef TIMING
-    auto t3 = std::chrono::high_resolution_clock::now();
+        t3 = std::chrono::high_resolution_clock::now();
 #endif
 
-    // double e3b = 0.0;
-    double e3b = Get3B(do_grads);
+        // e3b = 0.0;
+        e3b = Get3B(do_grads);
 
 #ifdef TIMING
-    auto t4 = std::chrono::high_resolution_clock::now();
+        t4 = std::chrono::high_resolution_clock::now();
 #endif
 
-    // Electrostatic energy
-    double Eelec = GetElectrostatics(do_grads);
-    // double Eelec = 0.0;
+        // Electrostatic energy
+        Eelec = GetElectrostatics(do_grads);
+        // Eelec = 0.0;
+    }
 
 #ifdef TIMING
     auto t5 = std::chrono::high_resolution_clock::now();
@@ -1255,6 +1748,8 @@ double System::Get1B(bool do_grads) {
     size_t current_coord = 0;
     double e1b = 0.0;
 
+    workspace_.SetNumThreads(1);
+
     for (size_t k = 0; k < mon_type_count_.size(); k++) {
         // Useful variables
         size_t istart = 0;
@@ -1266,8 +1761,8 @@ double System::Get1B(bool do_grads) {
             std::string mon = mon_type_count_[k].first;
 
             // XYZ with real sites
-            std::vector<double> xyz(ncoord, 0.0);
-            std::vector<double> grad2(ncoord, 0.0);
+            std::vector<double> &xyz = workspace_.Get(kXyz1, ncoord);
+            std::vector<double> &grad2 = workspace_.Get(kGrad1, ncoord);
 
             // Set up real coordinates
             for (size_t i = istart; i < iend; i++) {
@@ -1278,7 +1773,7 @@ double System::Get1B(bool do_grads) {
 
             // Get energy of the chunk as function of monomer
             if (do_grads) {
-                e1b += e1b::get_1b_energy(mon, nmon, xyz, grad2, allMonGood_, &virial_);
+                e1b += e1b::get_1b_energy(mon, nmon, xyz, grad2, allMonGood_, compute_virial_ ? &virial_ : 0);
 
                 // Reorganize gradients
                 for (size_t i = 0; i < nmon; i++) {
@@ -1353,9 +1848,28 @@ double System::Get2B(bool do_grads) {
 
     // Vector pools that allow compatibility between
     // serial and parallel implementation
-    std::vector<double> e2b_pool(num_threads, 0.0);
-    std::vector<std::vector<double>> grad_pool(num_threads, std::vector<double>(3 * numsites_, 0.0));
-    std::vector<std::vector<double>> virial_pool(num_threads, std::vector<double>(9, 0.0)); // declare virial pool
+    workspace_.SetNumThreads(num_threads);
+    std::vector<double> &e2b_pool = workspace_.Get(kEnergyPool, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        workspace_.Get(kGradPool, 3 * numsites_, i);
+        workspace_.Get(kVirialPool, 9, i); // declare virial pool
+    }
+
+    // Dimers further apart than the range of the polynomials do not contribute
+    double poly_cutoff = std::min(cutoff2b_, poly_range2b_);
+
+    // Largest batch of dimers, used to size the coordinate buffers
+    size_t max_nat = *std::max_element(nat_.begin(), nat_.end());
+
+    // Room for the largest batch of any chunk, so that the threads do not grow the buffers in the loop
+    size_t max_batch_ncoord = 3 * max_nat * std::min(maxNDimEval_, step * nummon_);
+    for (int i = 0; i < num_threads; i++) {
+        workspace_.Reserve(kXyz1, max_batch_ncoord, i);
+        workspace_.Reserve(kXyz2, max_batch_ncoord, i);
+        workspace_.Reserve(kGrad1, max_batch_ncoord, i);
+        workspace_.Reserve(kGrad2, max_batch_ncoord, i);
+        workspace_.Reserve(kVirial, 9, i);
+    }
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic) private(rank)
 #endif  // _OPENMP
@@ -1381,10 +1895,10 @@ double System::Get2B(bool do_grads) {
 // This call will get the dimers that have as first index a monomer
 // with index between isatrt and iend (iend not included)
 #ifdef _OPENMP
-        std::vector<size_t> dimers = AddClustersParallel(2, cutoff2b_, istart, iend);
+        std::vector<size_t> dimers = AddClustersParallel(2, poly_cutoff, istart, iend);
 #else
-        AddClusters(2, cutoff2b_, istart, iend);
-        std::vector<size_t> dimers = dimers_;
+        AddClusters(2, poly_cutoff, istart, iend);
+        const std::vector<size_t> &dimers = dimers_;
 #endif
 
         // In order to continue, we need at least one dimer
@@ -1398,11 +1912,14 @@ double System::Get2B(bool do_grads) {
         // but we don't need the electrostatic virtual site for teh 2B
         // polynomials. Thus, we need to create a pair of vectors with the right
         // coordinates to pass to polynomials and dispersion
-        std::vector<double> xyz1;
-        std::vector<double> xyz2;
-        std::vector<double> grad1;
-        std::vector<double> grad2;
-        std::vector<double> virial(9,0.0); // declare virial tensor
+        size_t max_ncoord = 3 * max_nat * std::min(maxNDimEval_, dimers.size() / 2);
+        std::vector<double> &xyz1 = workspace_.Reserve(kXyz1, max_ncoord, rank);
+        std::vector<double> &xyz2 = workspace_.Reserve(kXyz2, max_ncoord, rank);
+        std::vector<double> &grad1 = workspace_.Reserve(kGrad1, max_ncoord, rank);
+        std::vector<double> &grad2 = workspace_.Reserve(kGrad2, max_ncoord, rank);
+        std::vector<double> &virial = workspace_.Get(kVirial, 9, rank); // declare virial tensor
+        std::vector<double> &grad_pool = workspace_.At(kGradPool, rank);
+        std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
 
         // Define the two monomer ids that we are currently looking at
         std::string m1 = monomers_[dimers[0]];
@@ -1457,40 +1974,59 @@ double System::Get2B(bool do_grads) {
                 // Check if this pair needs to use MB-nrg
                 bool use_poly = true;
                 for (size_t i2b = 0; i2b < ignore_2b_poly_.size(); i2b++) {
-                    std::vector<std::string> v1 = ignore_2b_poly_[i2b];
-                    std::vector<std::string> v2 = {m1, m2};
-                    std::sort(v1.begin(), v1.end());
-                    std::sort(v2.begin(), v2.end());
+                    const std::vector<std::string> &v1 = ignore_2b_poly_[i2b];
 
-                    if (v1 == v2) {
+                    if (v1.size() == 2 && ((v1[0] == m1 && v1[1] == m2) || (v1[0] == m2 && v1[1] == m1))) {
                         use_poly = false;
                         break;
                     }
                 }
 
                 if (use_poly) {
+                    // A neural network model of the pair replaces its polynomial
+                    const nn::NNClusterModel *nn_model = 0;
+                    if (nn_models2b_.size()) {
+                        nn_model = &nn_models2b_[mon_type_index_[dimers[2 * nd_tot]] * mon_type_count_.size() +
+                                                 mon_type_index_[dimers[2 * nd_tot + 1]]];
+                        if (nn_model->index == nn::NNClusterModel::kNone) nn_model = 0;
+                    }
+                    const double *nn_xyz[2] = {xyz1.data(), xyz2.data()};
                     if (do_grads) {
-                        // POLYNOMIALS
-                        e2b_pool[rank] += e2b::get_2b_energy(m1, m2, nd, xyz1, xyz2, grad1, grad2, &virial);
+                        if (nn_model) {
+                            double *nn_grad[2] = {grad1.data(), grad2.data()};
+                            std::vector<double> &scratch =
+                                workspace_.Get(kNNScratch, nn_potentials_.GetModel(*nn_model).GetScratchSize(), rank);
+                            e2b_pool[rank] += nn_potentials_.Eval(*nn_model, nd, nn_xyz, nn_grad,
+                                                                  compute_virial_ ? &virial : 0, scratch);
+                        } else {
+                            // POLYNOMIALS
+                            e2b_pool[rank] += e2b::get_2b_energy(m1, m2, nd, xyz1, xyz2, grad1, grad2,
+                                                                 compute_virial_ ? &virial : 0);
+                        }
 			
-                        for (size_t k = 0; k < 9; k++){	        // accumulate virial tensor from pool
-                   
-                            virial_pool[rank][k] += virial[k];
-                        }                                     
+                        if (compute_virial_) {
+                            for (size_t k = 0; k < 9; k++){	        // accumulate virial tensor from pool
+                                virial_pool[k] += virial[k];
+                            }
+                        }
                         // Update gradients in system
                         size_t i0 = nd_tot * 2;
                         for (size_t k = 0; k < nd; k++) {
                             // Monomer 1
                             for (size_t j = 0; j < 3 * nat_[dimers[i0 + 2 * k]]; j++) {
-                                grad_pool[rank][3 * first_index_[dimers[i0 + 2 * k]] + j] +=
+                                grad_pool[3 * first_index_[dimers[i0 + 2 * k]] + j] +=
                                     grad1[k * 3 * nat_[dimers[i0 + 2 * k]] + j];
                             }
                             // Monomer 2
                             for (size_t j = 0; j < 3 * nat_[dimers[i0 + 2 * k + 1]]; j++) {
-                                grad_pool[rank][3 * first_index_[dimers[i0 + 2 * k + 1]] + j] +=
+                                grad_pool[3 * first_index_[dimers[i0 + 2 * k + 1]] + j] +=
                                     grad2[k * 3 * nat_[dimers[i0 + 2 * k + 1]] + j];
                             }
                         }
+                    } else if (nn_model) {
+                        std::vector<double> &scratch =
+                            workspace_.Get(kNNScratch, nn_potentials_.GetModel(*nn_model).GetScratchSize(), rank);
+                        e2b_pool[rank] += nn_potentials_.Eval(*nn_model, nd, nn_xyz, 0, 0, scratch);
                     } else {
                         e2b_pool[rank] += e2b::get_2b_energy(m1, m2, nd, xyz1, xyz2);
                     }
@@ -1527,8 +2063,9 @@ double System::Get2B(bool do_grads) {
 
         // Condensate gradients
         for (int i = 0; i < num_threads; i++) {
+            const std::vector<double> &grad_pool = workspace_.At(kGradPool, i);
             for (size_t j = first_grad; j < last_grad; j++) {
-                grad_[j] += grad_pool[i][j];
+                grad_[j] += grad_pool[j];
             }
         }
 
@@ -1542,8 +2079,9 @@ double System::Get2B(bool do_grads) {
     }
     // Condensate virial                         
     for (int i = 0; i < num_threads; i++) { 
+        const std::vector<double> &virial_pool = workspace_.At(kVirialPool, i);
         for (size_t j = 0; j < 9; j++){          
-            virial_[j] += virial_pool[i][j];     
+            virial_[j] += virial_pool[j];     
         }                                        
     }                                            
 
@@ -1600,9 +2138,31 @@ double System::Get3B(bool do_grads) {
 
     // Vector pools that allow compatibility between
     // serial and parallel implementation
-    std::vector<double> e3b_pool(num_threads, 0.0);
-    std::vector<std::vector<double>> grad_pool(num_threads, std::vector<double>(3 * numsites_, 0.0));
-    std::vector<std::vector<double>> virial_pool(num_threads, std::vector<double>(9, 0.0)); // declare virial pool
+    workspace_.SetNumThreads(num_threads);
+    std::vector<double> &e3b_pool = workspace_.Get(kEnergyPool, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        workspace_.Get(kGradPool, 3 * numsites_, i);
+        workspace_.Get(kVirialPool, 9, i); // declare virial pool
+    }
+
+    // Trimers further apart than the range of their polynomial do not contribute
+    std::vector<double> poly_cutoffs(poly_ranges3b_.size());
+    for (size_t t = 0; t < poly_ranges3b_.size(); t++) poly_cutoffs[t] = std::min(cutoff3b_, poly_ranges3b_[t]);
+
+    // Largest batch of trimers, used to size the coordinate buffers
+    size_t max_nat = *std::max_element(nat_.begin(), nat_.end());
+
+    // Room for the largest batch of any chunk, so that the threads do not grow the buffers in the loop
+    size_t max_batch_ncoord = 3 * max_nat * std::min(maxNTriEval_, step * nummon_ * nummon_);
+    for (int i = 0; i < num_threads; i++) {
+        workspace_.Reserve(kXyz1, max_batch_ncoord, i);
+        workspace_.Reserve(kXyz2, max_batch_ncoord, i);
+        workspace_.Reserve(kXyz3, max_batch_ncoord, i);
+        workspace_.Reserve(kGrad1, max_batch_ncoord, i);
+        workspace_.Reserve(kGrad2, max_batch_ncoord, i);
+        workspace_.Reserve(kGrad3, max_batch_ncoord, i);
+        workspace_.Reserve(kVirial, 9, i);
+    }
 
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic) private(rank)
@@ -1625,10 +2185,11 @@ double System::Get3B(bool do_grads) {
         size_t iend = std::min(istart + step, nummon_);
 
 #ifdef _OPENMP
-        std::vector<size_t> trimers = AddClustersParallel(3, cutoff3b_, istart, iend);
+        std::vector<size_t> trimers;
+        AddTrimers(poly_cutoffs, istart, iend, trimers);
 #else
-        AddClusters(3, cutoff3b_, istart, iend);
-        std::vector<size_t> trimers = trimers_;
+        AddTrimers(poly_cutoffs, istart, iend, trimers_);
+        const std::vector<size_t> &trimers = trimers_;
 #endif
 
         // In order to continue, we need at least one dimer
@@ -1642,9 +2203,12 @@ double System::Get3B(bool do_grads) {
         // but we don't need the electrostatic virtual site for teh 2B
         // polynomials. Thus, we need to create a pair of vectors with the right
         // coordinates to pass to polynomials and dispersion
-        std::vector<double> coord1;
-        std::vector<double> coord2;
-        std::vector<double> coord3;
+        size_t max_ncoord = 3 * max_nat * std::min(maxNTriEval_, trimers.size() / 3);
+        std::vector<double> &coord1 = workspace_.Reserve(kXyz1, max_ncoord, rank);
+        std::vector<double> &coord2 = workspace_.Reserve(kXyz2, max_ncoord, rank);
+        std::vector<double> &coord3 = workspace_.Reserve(kXyz3, max_ncoord, rank);
+        std::vector<double> &grad_pool = workspace_.At(kGradPool, rank);
+        std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
         std::string m1 = monomers_[trimers[0]];
         std::string m2 = monomers_[trimers[1]];
         std::string m3 = monomers_[trimers[2]];
@@ -1698,61 +2262,76 @@ double System::Get3B(bool do_grads) {
                 // Check if this pair needs to use MB-nrg
                 bool use_poly = true;
                 for (size_t i3b = 0; i3b < ignore_3b_poly_.size(); i3b++) {
-                    std::vector<std::string> v1 = ignore_3b_poly_[i3b];
-                    std::vector<std::string> v2 = {m1, m2, m3};
-                    std::sort(v1.begin(), v1.end());
-                    std::sort(v2.begin(), v2.end());
+                    const std::vector<std::string> &v1 = ignore_3b_poly_[i3b];
+                    const std::string v2[3] = {m1, m2, m3};
 
-                    if (v1 == v2) {
+                    if (v1.size() == 3 && std::is_permutation(v1.begin(), v1.end(), v2)) {
                         use_poly = false;
                         break;
                     }
                 }
 
                 if (use_poly) {
-                    std::vector<double> xyz1(coord1.size(), 0.0);
-                    std::vector<double> xyz2(coord2.size(), 0.0);
-                    std::vector<double> xyz3(coord3.size(), 0.0);
-                    std::copy(coord1.begin(), coord1.end(), xyz1.begin());
-                    std::copy(coord2.begin(), coord2.end(), xyz2.begin());
-                    std::copy(coord3.begin(), coord3.end(), xyz3.begin());
-
+                    // A neural network model of the trimer replaces its polynomial
+                    const nn::NNClusterModel *nn_model = 0;
+                    if (nn_models3b_.size()) {
+                        const size_t ntypes = mon_type_count_.size();
+                        nn_model = &nn_models3b_[(mon_type_index_[trimers[3 * nt_tot]] * ntypes +
+                                                  mon_type_index_[trimers[3 * nt_tot + 1]]) * ntypes +
+                                                 mon_type_index_[trimers[3 * nt_tot + 2]]];
+                        if (nn_model->index == nn::NNClusterModel::kNone) nn_model = 0;
+                    }
+                    const double *nn_xyz[3] = {coord1.data(), coord2.data(), coord3.data()};
                     if (do_grads) {
-                        // POLYNOMIALS
-                        std::vector<double> grad1(coord1.size(), 0.0);
-                        std::vector<double> grad2(coord2.size(), 0.0);
-                        std::vector<double> grad3(coord3.size(), 0.0);
-                        std::vector<double> virial(9,0.0); // declare virial tensor
-                        // POLYNOMIALS
-                        e3b_pool[rank] += e3b::get_3b_energy(m1, m2, m3, nt, xyz1, xyz2, xyz3, grad1, grad2, grad3, &virial);
+                        std::vector<double> &grad1 = workspace_.Get(kGrad1, coord1.size(), rank);
+                        std::vector<double> &grad2 = workspace_.Get(kGrad2, coord2.size(), rank);
+                        std::vector<double> &grad3 = workspace_.Get(kGrad3, coord3.size(), rank);
+                        std::vector<double> &virial = workspace_.Get(kVirial, 9, rank); // declare virial tensor
+                        if (nn_model) {
+                            double *nn_grad[3] = {grad1.data(), grad2.data(), grad3.data()};
+                            std::vector<double> &scratch =
+                                workspace_.Get(kNNScratch, nn_potentials_.GetModel(*nn_model).GetScratchSize(), rank);
+                            e3b_pool[rank] += nn_potentials_.Eval(*nn_model, nt, nn_xyz, nn_grad,
+                                                                  compute_virial_ ? &virial : 0, scratch);
+                        } else {
+                            // POLYNOMIALS
+                            e3b_pool[rank] += e3b::get_3b_energy(m1, m2, m3, nt, coord1, coord2, coord3, grad1,
+                                                                 grad2, grad3, compute_virial_ ? &virial : 0);
+                        }
 
                         // Update gradients
                         size_t i0 = nt_tot * 3;
                         for (size_t k = 0; k < nt; k++) {
                             // Monomer 1
                             for (size_t j = 0; j < 3 * nat_[trimers[i0 + 3 * k]]; j++) {
-                                grad_pool[rank][3 * first_index_[trimers[i0 + 3 * k]] + j] +=
+                                grad_pool[3 * first_index_[trimers[i0 + 3 * k]] + j] +=
                                     grad1[k * 3 * nat_[trimers[i0 + 3 * k]] + j];
                             }
                             // Monomer 2
                             for (size_t j = 0; j < 3 * nat_[trimers[i0 + 3 * k + 1]]; j++) {
-                                grad_pool[rank][3 * first_index_[trimers[i0 + 3 * k + 1]] + j] +=
+                                grad_pool[3 * first_index_[trimers[i0 + 3 * k + 1]] + j] +=
                                     grad2[k * 3 * nat_[trimers[i0 + 3 * k + 1]] + j];
                             }
                             // Monomer 3
                             for (size_t j = 0; j < 3 * nat_[trimers[i0 + 3 * k + 2]]; j++) {
-                                grad_pool[rank][3 * first_index_[trimers[i0 + 3 * k + 2]] + j] +=
+                                grad_pool[3 * first_index_[trimers[i0 + 3 * k + 2]] + j] +=
                                     grad3[k * 3 * nat_[trimers[i0 + 3 * k + 2]] + j];
                             }
                         }
                         // Virial Tensor
-                        for (size_t j=0; j<9; j++) {
-                            virial_pool[rank][j] += virial[j];
+                        if (compute_virial_) {
+                            for (size_t j=0; j<9; j++) {
+                                virial_pool[j] += virial[j];
+                            }
                         }
 
+                    } else if (nn_model) {
+                        std::vector<double> &scratch =
+                            workspace_.Get(kNNScratch, nn_potentials_.GetModel(*nn_model).GetScratchSize(), rank);
+                        e3b_pool[rank] += nn_potentials_.Eval(*nn_model, nt, nn_xyz, 0, 0, scratch);
                     } else {
                         // POLYNOMIALS
-                        e3b_pool[rank] += e3b::get_3b_energy(m1, m2, m3, nt, xyz1, xyz2, xyz3);
+                        e3b_pool[rank] += e3b::get_3b_energy(m1, m2, m3, nt, coord1, coord2, coord3);
                     }
                 }
 
@@ -1785,8 +2364,9 @@ double System::Get3B(bool do_grads) {
 
         // Condensate gradients
         for (int i = 0; i < num_threads; i++) {
+            const std::vector<double> &grad_pool = workspace_.At(kGradPool, i);
             for (size_t j = first_grad; j < last_grad; j++) {
-                grad_[j] += grad_pool[i][j];
+                grad_[j] += grad_pool[j];
             }
         }
 
@@ -1800,8 +2380,9 @@ double System::Get3B(bool do_grads) {
     }
     // Condensate virial                         
     for (int i = 0; i < num_threads; i++) {  
+        const std::vector<double> &virial_pool = workspace_.At(kVirialPool, i);
         for (size_t j = 0; j < 9; j++){          
-            virial_[j] += virial_pool[i][j];   
+            virial_[j] += virial_pool[j];   
         }                                        
     }                                            
 
@@ -1810,15 +2391,37 @@ double System::Get3B(bool do_grads) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void System::SetStaticSiteParameters() {
+    // Constant charges for each monomer type
+    size_t fi_mon = 0;
+    for (size_t k = 0; k < mon_type_count_.size(); k++) {
+        std::string mon = mon_type_count_[k].first;
+        size_t nmon = mon_type_count_[k].second;
+        size_t nsites = sites_[fi_mon];
+
+        if (!systools::IsGeometryDependent(mon)) {
+            systools::SetCharges(xyz_, chg_, mon, nmon, nsites, first_index_[fi_mon], chggrad_);
+        }
+        fi_mon += nmon;
+    }
+
+    SetPols();
+    SetPolfacs();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void System::SetCharges() {
-    // Set charges for each monomer type
+    // Set the position dependent charges for each monomer type
     size_t fi_mon = 0;
     for (size_t k = 0; k < mon_type_count_.size(); k++) {
         std::string mon = mon_type_count_[k].first;
         size_t nmon = mon_type_count_[k].second;
         size_t nsites = sites_[fi_mon];
 
-        systools::SetCharges(xyz_, chg_, mon, nmon, nsites, first_index_[fi_mon], chggrad_);
+        if (systools::IsGeometryDependent(mon)) {
+            systools::SetCharges(xyz_, chg_, mon, nmon, nsites, first_index_[fi_mon], chggrad_);
+        }
         fi_mon += nmon;
     }
 
@@ -1940,7 +2543,7 @@ void System::SetVSites() {
         size_t nmon = mon_type_count_[k].second;
         size_t nsites = sites_[fi_mon];
 
-        systools::SetVSites(xyz_, mon, nmon, nsites, first_index_[fi_mon]);
+        if (systools::IsGeometryDependent(mon)) systools::SetVSites(xyz_, mon, nmon, nsites, first_index_[fi_mon]);
         fi_mon += nmon;
     }
 
@@ -2025,6 +2628,153 @@ double System::Electrostatics(bool do_grads) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void System::CheckTerms(const std::vector<std::string> &terms) {
+    const std::vector<std::string> valid = {"1b", "2b", "3b", "dispersion", "buckingham", "electrostatics"};
+    for (size_t i = 0; i < terms.size(); i++) {
+        if (std::find(valid.begin(), valid.end(), terms[i]) == valid.end()) {
+            std::string text = "Term \"" + terms[i] + "\" is not valid. Possible values are 1b, 2b, 3b, " +
+                               "dispersion, buckingham and electrostatics.";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void System::SetTermGroup(std::string name, std::vector<std::string> terms) {
+    CheckTerms(terms);
+
+    TermGroup group;
+    group.terms = terms;
+    term_groups_[name] = group;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TermGroup &System::FindTermGroup(const std::string &name) {
+    std::map<std::string, TermGroup>::iterator it = term_groups_.find(name);
+    if (it == term_groups_.end()) {
+        std::string text = "Term group \"" + name + "\" has not been defined.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    return it->second;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<std::string> System::GetTermGroup(std::string name) { return FindTermGroup(name).terms; }
+
+////////////////////////////////////////////////////////////////////////////////
+
+double System::GroupEnergy(std::string name, bool do_grads) {
+    TermGroup &group = FindTermGroup(name);
+    group.energy = EvaluateTerms(group.terms, do_grads, group.grad, group.virial);
+    if (!do_grads) group.grad.clear();
+
+    return group.energy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double System::GetGroupEnergy(std::string name) { return FindTermGroup(name).energy; }
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<double> System::GetGroupRealGrads(std::string name) {
+    const TermGroup &group = FindTermGroup(name);
+    if (group.grad.size() != 3 * numsites_) {
+        std::string text = "Term group \"" + name + "\" has not been evaluated with gradients.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    return systools::ResetOrderReal3N(group.grad, initial_order_realSites_, numat_, first_index_, nat_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::vector<double> System::GetGroupVirial(std::string name) { return FindTermGroup(name).virial; }
+
+////////////////////////////////////////////////////////////////////////////////
+
+double System::TermsEnergy(std::vector<std::string> terms, bool do_grads, std::vector<double> &real_grad,
+                           std::vector<double> &virial) {
+    CheckTerms(terms);
+
+    std::vector<double> grad;
+    std::vector<double> vir(9, 0.0);
+    double e = EvaluateTerms(terms, do_grads, grad, vir);
+
+    if (virial.size() != 9) virial.assign(9, 0.0);
+    for (size_t i = 0; i < 9; i++) virial[i] += vir[i];
+
+    if (do_grads) {
+        if (real_grad.size() != 3 * numat_) real_grad.assign(3 * numat_, 0.0);
+        std::vector<double> g = systools::ResetOrderReal3N(grad, initial_order_realSites_, numat_, first_index_, nat_);
+        for (size_t i = 0; i < g.size(); i++) real_grad[i] += g[i];
+    }
+
+    return e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double System::EvaluateTerms(const std::vector<std::string> &terms, bool do_grads, std::vector<double> &grad,
+                             std::vector<double> &virial) {
+    // Check if system has been initialized
+    // If not, throw exception
+    if (!initialized_) {
+        std::string text = std::string("System has not been initialized. ") +
+                           std::string("Energy calculation not possible.");
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // The Get* functions accumulate in grad_ and virial_. Use the buffers
+    // of the caller instead, so the state of the system is not modified.
+    grad.assign(3 * numsites_, 0.0);
+    virial.assign(9, 0.0);
+    std::swap(grad, grad_);
+    std::swap(virial, virial_);
+
+    SetPBC(box_);
+
+    // Same order as in Energy()
+    const char *order[] = {"1b", "2b", "dispersion", "buckingham", "3b", "electrostatics"};
+    double e = 0.0;
+    try {
+        for (size_t t = 0; t < 6; t++) {
+            if (std::find(terms.begin(), terms.end(), order[t]) == terms.end()) continue;
+
+            if (t == 0) {
+                allMonGood_ = true;
+                e += Get1B(do_grads);
+                // If monomers are too distorted, skip the rest, as in Energy()
+                if (!allMonGood_) break;
+            } else if (t == 1) {
+                e += Get2B(do_grads);
+            } else if (t == 2) {
+                e += GetDispersion(do_grads);
+            } else if (t == 3) {
+                e += GetBuckingham(do_grads);
+            } else if (t == 4) {
+                e += Get3B(do_grads);
+            } else {
+                e += GetElectrostatics(do_grads);
+            }
+        }
+    } catch (...) {
+        std::swap(grad, grad_);
+        std::swap(virial, virial_);
+        throw;
+    }
+
+    std::swap(grad, grad_);
+    std::swap(virial, virial_);
+
+    return e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void System::SetEwaldElectrostatics(double alpha, double grid_density, int spline_order) {
     elec_alpha_ = alpha;
     elec_grid_density_ = grid_density;
@@ -2036,6 +2786,22 @@ void System::SetEwaldElectrostatics(double alpha, double grid_density, int splin
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void System::SetElectrostaticsTreecode(double theta, double near_radius) {
+    electrostaticE_.SetTreecode(theta, near_radius);
+    elec_treecode_theta_ = theta;
+    elec_treecode_radius_ = near_radius;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void System::SetExternalCharges(const std::vector<double> &xyz, const std::vector<double> &chg) {
+    electrostaticE_.SetExternalCharges(xyz, chg);
+    external_xyz_ = xyz;
+    external_chg_ = chg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void System::SetEwaldDispersion(double alpha, double grid_density, int spline_order) {
     disp_alpha_ = alpha;
     disp_grid_density_ = grid_density;
@@ -2047,6 +2813,122 @@ void System::SetEwaldDispersion(double alpha, double grid_density, int spline_or
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void System::SetElectrostaticsCutoff(double cutoff) { elec_cutoff_ = cutoff; }
+
+////////////////////////////////////////////////////////////////////////////////
+
+void System::TuneEwaldElectrostatics(double accuracy) {
+    if (!initialized_) {
+        std::string text = "System has not been initialized. Ewald tuning not possible.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (box_.empty()) {
+        std::string text = "Ewald tuning needs a box.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (accuracy <= 0) {
+        std::string text = "The target accuracy of the Ewald tuning must be positive.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    double q2 = 0.0;
+    size_t nsites = 0;
+    for (size_t i = 0; i < chg_.size(); i++) {
+        if (chg_[i] == 0) continue;
+        q2 += chg_[i] * chg_[i];
+        nsites++;
+    }
+    if (nsites == 0) {
+        std::string text = "Ewald tuning needs charged sites.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    double volume = box_[0] * box_[4] * box_[8];
+
+    // The accuracy is relative to the force between two sites with the RMS
+    // charge. The real and reciprocal space errors are added in quadrature.
+    double ref_force = elec::EwaldReferenceForce(q2, nsites);
+    double target = accuracy * ref_force / std::sqrt(2.0);
+
+    // Cutoffs go down in steps of 1 Angstrom, but not below 5 Angstrom
+    double max_cutoff = std::min(cutoff2b_, 0.5 * std::min(box_[0], std::min(box_[4], box_[8])));
+    std::vector<double> cutoffs(1, max_cutoff);
+    for (double rc = max_cutoff - 1.0; rc >= 5.0; rc -= 1.0) cutoffs.push_back(rc);
+
+    // ASPC would keep the trial dipoles in its history. The dipoles of the
+    // last evaluation are restored after the trials.
+    std::string trial_method = dipole_method_ == "aspc" ? "cg" : dipole_method_;
+    std::vector<double> grad(3 * numsites_);
+    std::vector<double> mu, mu_hist;
+    size_t hist_num = electrostaticE_.GetDipoleHistory(mu, mu_hist);
+
+    double best_time = std::numeric_limits<double>::max();
+    double best_cutoff = 0.0, best_alpha = 0.0, best_density = 0.0, best_error = 0.0;
+    size_t best_order = 0;
+    for (size_t c = 0; c < cutoffs.size(); c++) {
+        double alpha = elec::EwaldAlphaForError(target, q2, nsites, volume, cutoffs[c]);
+        double real_error = elec::EwaldRealSpaceError(q2, nsites, volume, alpha, cutoffs[c]);
+        for (size_t order = 4; order <= 7; order++) {
+            // Smallest density, in steps of 0.1 points per Angstrom
+            double density = 0.0;
+            double rec_error = 0.0;
+            for (size_t k = 1; k <= 100; k++) {
+                rec_error = elec::PMEReciprocalError(q2, nsites, box_, alpha, 0.1 * k, order);
+                if (rec_error <= target) {
+                    density = 0.1 * k;
+                    break;
+                }
+            }
+            if (density == 0.0) continue;
+
+            // Time the candidate. The first call also sets up the PME grid.
+            electrostaticE_.SetEwaldAlpha(alpha);
+            electrostaticE_.SetEwaldGridDensity(density);
+            electrostaticE_.SetEwaldSplineOrder(order);
+            double time = std::numeric_limits<double>::max();
+            for (size_t trial = 0; trial < 2; trial++) {
+                electrostaticE_.SetNewParameters(xyz_, chg_, chggrad_, pol_, polfac_, trial_method, true, box_,
+                                                 cutoffs[c]);
+                std::fill(grad.begin(), grad.end(), 0.0);
+                auto t1 = std::chrono::steady_clock::now();
+                electrostaticE_.GetElectrostatics(grad);
+                auto t2 = std::chrono::steady_clock::now();
+                time = std::min(time, std::chrono::duration<double>(t2 - t1).count());
+            }
+
+            if (time < best_time) {
+                best_time = time;
+                best_cutoff = cutoffs[c];
+                best_alpha = alpha;
+                best_density = density;
+                best_order = order;
+                best_error = std::sqrt(real_error * real_error + rec_error * rec_error) / ref_force;
+            }
+        }
+    }
+    electrostaticE_.SetDipoleHistory(mu, mu_hist, hist_num);
+
+    if (best_order == 0) {
+        std::string text = "No PME grid meets the target accuracy of the Ewald tuning.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    SetElectrostaticsCutoff(best_cutoff);
+    SetEwaldElectrostatics(best_alpha, best_density, best_order);
+    mbx_j_["MBX"]["cutoff_elec"] = best_cutoff;
+    mbx_j_["MBX"]["alpha_ewald_elec"] = best_alpha;
+    mbx_j_["MBX"]["grid_density_elec"] = best_density;
+    mbx_j_["MBX"]["spline_order_elec"] = best_order;
+
+    std::cerr << "Ewald electrostatics tuned for a relative RMS force error of " << accuracy
+              << " (relative to the force between two sites with the RMS charge 1 Angstrom apart): cutoff = "
+              << best_cutoff
+              << ", alpha = " << best_alpha << ", grid density = " << best_density
+              << ", spline order = " << best_order << " (estimated error " << best_error << ", "
+              << 1000 * best_time << " ms per evaluation)\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void System::SetEwald(double alpha, double grid_density, int spline_order) {
     SetEwaldElectrostatics(alpha, grid_density, spline_order);
     SetEwaldDispersion(alpha, grid_density, spline_order);
@@ -2055,70 +2937,305 @@ void System::SetEwald(double alpha, double grid_density, int spline_order) {
 ////////////////////////////////////////////////////////////////////////////////
 
 double System::GetElectrostatics(bool do_grads) {
-    electrostaticE_.SetNewParameters(xyz_, chg_, chggrad_, pol_, polfac_, dipole_method_, do_grads, box_, cutoff2b_);
+    SetUpElectrostatics(do_grads);
+    return electrostaticE_.GetElectrostatics(grad_, compute_virial_ ? &virial_ : 0);
+}
+
+void System::SetUpElectrostatics(bool do_grads) {
+    electrostaticE_.SetNewParameters(xyz_, chg_, chggrad_, pol_, polfac_, dipole_method_, do_grads, box_,
+                                     GetElectrostaticsCutoff());
     electrostaticE_.SetDipoleTolerance(diptol_);
     electrostaticE_.SetDipoleMaxIt(maxItDip_); 
 
-    return electrostaticE_.GetElectrostatics(grad_,&virial_);
+    // The treecode computes the site pairs within the near radius exactly.
+    // Give it the monomer pairs that can have such sites, so it does not
+    // loop over all pairs.
+    if (elec_treecode_theta_ > 0 && box_.empty()) {
+        SetUpMonomerPairs();
+        electrostaticE_.SetPairList(monomer_pairs_);
+    }
+}
+
+void System::GetTermsConcurrently(bool do_grads, double &e2b, double &edisp, double &ebuck, double &e3b,
+                                  double &eelec) {
+#ifdef _OPENMP
+    // 2B, buckingham and 3B share the cluster lists and the scratch buffers
+    // of the system, so they stay together. The electrostatics only need
+    // their own buffers once they are set up.
+    const size_t nthreads = omp_get_max_threads();
+    const size_t nrest = nthreads - elec_threads_;
+    SetUpElectrostatics(do_grads);
+    workspace_.SetNumThreads(nthreads);
+    std::vector<double> &elec_grad = workspace_.Get(kElecGrad, grad_.size());
+    std::vector<double> &elec_virial = workspace_.Get(kElecVirial, 9);
+
+    // Exceptions cannot leave a task
+    std::exception_ptr elec_error, rest_error;
+
+    // Each side opens its own parallel regions inside the task
+    const int max_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(std::max(max_levels, 2));
+#pragma omp parallel num_threads(2)
+    {
+#pragma omp single
+        {
+#pragma omp task shared(elec_grad, elec_virial, eelec, elec_error)
+            {
+                omp_set_num_threads(static_cast<int>(elec_threads_));
+                try {
+                    eelec = electrostaticE_.GetElectrostatics(elec_grad, compute_virial_ ? &elec_virial : 0);
+                } catch (...) {
+                    elec_error = std::current_exception();
+                }
+            }
+
+            omp_set_num_threads(static_cast<int>(nrest));
+            try {
+                e2b = Get2B(do_grads);
+                edisp = GetDispersion(do_grads);
+                ebuck = GetBuckingham(do_grads);
+                e3b = Get3B(do_grads);
+            } catch (...) {
+                rest_error = std::current_exception();
+            }
+#pragma omp taskwait
+        }
+    }
+    omp_set_max_active_levels(max_levels);
+
+    if (rest_error) std::rethrow_exception(rest_error);
+    if (elec_error) std::rethrow_exception(elec_error);
+
+    // Electrostatics last, as in Energy()
+    for (size_t i = 0; i < grad_.size(); i++) grad_[i] += elec_grad[i];
+    for (size_t i = 0; i < 9; i++) virial_[i] += elec_virial[i];
+#else
+    e2b = Get2B(do_grads);
+    edisp = GetDispersion(do_grads);
+    ebuck = GetBuckingham(do_grads);
+    e3b = Get3B(do_grads);
+    eelec = GetElectrostatics(do_grads);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 double System::GetDispersion(bool do_grads) {
-    std::vector<double> xyz_real(3 * numat_);
+    dispersionE_.SetNewParameters(real_sites_, do_grads, cutoff2b_, box_);
+    return dispersionE_.GetDispersion(grad_, compute_virial_ ? &virial_ : 0);
+}
 
-    size_t count = 0;
-    for (size_t i = 0; i < nummon_; i++) {
-        for (size_t j = 0; j < 3 * nat_[i]; j++) {
-            xyz_real[count + j] = xyz_[first_index_[i] * 3 + j];
-        }
-        count += 3 * nat_[i];
-    }
+////////////////////////////////////////////////////////////////////////////////
 
-    dispersionE_.SetNewParameters(xyz_real, do_grads, cutoff2b_, box_);
-    std::vector<double> real_grad(3 * numat_, 0.0);
-    double e = dispersionE_.GetDispersion(real_grad, &virial_);
+double System::GetBuckingham(bool do_grads) {
+    buckinghamE_.SetNewParameters(real_sites_, buck_pairs_, do_grads, cutoff2b_, box_);
 
-    count = 0;
-    for (size_t i = 0; i < nummon_; i++) {
-        for (size_t j = 0; j < 3 * nat_[i]; j++) {
-            grad_[first_index_[i] * 3 + j] += real_grad[count + j];
-        }
-        count += 3 * nat_[i];
+    // Give the repulsion the monomer pairs within the cutoff, so that it does
+    // not loop over all pairs. The list is shared with the treecode.
+    if (buck_pairs_.size()) {
+        SetUpMonomerPairs();
+        buckinghamE_.SetPairList(monomer_pairs_);
     }
-    return e;
+
+    return buckinghamE_.GetRepulsion(grad_, compute_virial_ ? &virial_ : 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-double System::GetBuckingham(bool do_grads) {
-    std::vector<double> xyz_real(3 * numat_);
+void System::ResetDipoleHistory() { electrostaticE_.ResetAspcHistory(); }
 
-    size_t count = 0;
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Identifies the blobs of GetState
+const char kStateMagic[] = "MBXSTATE";
+const uint32_t kStateVersion = 1;
+
+template <typename T>
+void AppendState(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void AppendState(std::string &out, const std::vector<double> &v) {
+    AppendState(out, static_cast<uint64_t>(v.size()));
+    out.append(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(double));
+}
+
+void AppendState(std::string &out, const std::string &str) {
+    AppendState(out, static_cast<uint64_t>(str.size()));
+    out.append(str);
+}
+
+void ReadStateBytes(const std::string &in, size_t &pos, void *out, size_t n) {
+    if (n > in.size() - pos) {
+        std::string text = "The state is truncated: " + std::to_string(n) + " bytes needed at position " +
+                           std::to_string(pos) + " of " + std::to_string(in.size());
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (n) std::memcpy(out, in.data() + pos, n);
+    pos += n;
+}
+
+template <typename T>
+void ReadState(const std::string &in, size_t &pos, T &value) {
+    ReadStateBytes(in, pos, &value, sizeof(T));
+}
+
+void ReadState(const std::string &in, size_t &pos, std::vector<double> &v) {
+    uint64_t n;
+    ReadState(in, pos, n);
+    if (n > (in.size() - pos) / sizeof(double)) {
+        std::string text = "The state is truncated: vector of " + std::to_string(n) + " doubles";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    v.resize(n);
+    ReadStateBytes(in, pos, v.data(), n * sizeof(double));
+}
+
+void ReadState(const std::string &in, size_t &pos, std::string &str) {
+    uint64_t n;
+    ReadState(in, pos, n);
+    if (n > in.size() - pos) {
+        std::string text = "The state is truncated: string of " + std::to_string(n) + " characters";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    str = in.substr(pos, n);
+    pos += n;
+}
+
+}  // namespace
+
+std::string System::GetState() {
+    if (!initialized_) {
+        std::string text = "System has not been initialized. Getting the state is not possible.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    std::vector<double> mu, mu_hist;
+    uint64_t hist_num = electrostaticE_.GetDipoleHistory(mu, mu_hist);
+
+    std::string state(kStateMagic, sizeof(kStateMagic) - 1);
+    AppendState(state, kStateVersion);
+
+    // Input index of each monomer in the internal order
+    AppendState(state, static_cast<uint64_t>(nummon_));
+    for (size_t i = 0; i < nummon_; i++) AppendState(state, static_cast<uint64_t>(initial_order_[i].first));
+    AppendState(state, static_cast<uint64_t>(calls_since_reorder_));
+
+    AppendState(state, mbx_j_.is_null() ? std::string() : mbx_j_.dump());
+    AppendState(state, box_);
+
+    AppendState(state, hist_num);
+    AppendState(state, mu);
+    AppendState(state, mu_hist);
+
+    return state;
+}
+
+void System::SetState(const std::string &state) {
+    if (!initialized_) {
+        std::string text = "System has not been initialized. Setting the state is not possible.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // Read everything before changing anything
+    size_t pos = 0;
+    std::string magic(sizeof(kStateMagic) - 1, ' ');
+    ReadStateBytes(state, pos, &magic[0], magic.size());
+    uint32_t version = 0;
+    if (magic == kStateMagic) ReadState(state, pos, version);
+    if (version != kStateVersion) {
+        std::string text = "Not a state of this version of the system (version " + std::to_string(version) + ")";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    uint64_t nmon;
+    ReadState(state, pos, nmon);
+    if (nmon != nummon_) {
+        std::string text = "The state has " + std::to_string(nmon) + " monomers, but the system has " +
+                           std::to_string(nummon_);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    std::vector<size_t> order(nummon_);
     for (size_t i = 0; i < nummon_; i++) {
-        for (size_t j = 0; j < 3 * nat_[i]; j++) {
-            xyz_real[count + j] = xyz_[first_index_[i] * 3 + j];
+        uint64_t k;
+        ReadState(state, pos, k);
+        order[i] = k;
+    }
+    uint64_t calls_since_reorder;
+    ReadState(state, pos, calls_since_reorder);
+
+    std::string config;
+    std::vector<double> box;
+    uint64_t hist_num;
+    std::vector<double> mu, mu_hist;
+    ReadState(state, pos, config);
+    ReadState(state, pos, box);
+    ReadState(state, pos, hist_num);
+    ReadState(state, pos, mu);
+    ReadState(state, pos, mu_hist);
+
+    // The saved order must be a permutation of the monomers that keeps
+    // each monomer in the block of its type
+    std::vector<bool> seen(nummon_, false);
+    for (size_t i = 0; i < nummon_; i++) {
+        if (order[i] >= nummon_ || seen[order[i]] || monomers_[original2current_order_[order[i]]] != monomers_[i]) {
+            std::string text = "The monomers of the state do not match the monomers of the system";
+            throw CUException(__func__, __FILE__, __LINE__, text);
         }
-        count += 3 * nat_[i];
+        seen[order[i]] = true;
+    }
+    if (mu.size() != 3 * numsites_) {
+        std::string text = "The dipoles of the state do not match the sites of the system";
+        throw CUException(__func__, __FILE__, __LINE__, text);
     }
 
-    buckinghamE_.SetNewParameters(xyz_real, buck_pairs_, do_grads, cutoff2b_, box_);
-    std::vector<double> real_grad(3 * numat_, 0.0);
-    double e = buckinghamE_.GetRepulsion(real_grad, &virial_);
+    // Configuration. The Ewald parameters in it are already tuned.
+    if (!config.empty()) {
+        nlohmann::json j = nlohmann::json::parse(config);
+        double ewald_accuracy_elec = 0.0;
+        if (j["MBX"].find("ewald_accuracy_elec") != j["MBX"].end()) {
+            ewald_accuracy_elec = j["MBX"]["ewald_accuracy_elec"];
+            j["MBX"]["ewald_accuracy_elec"] = 0.0;
+        }
+        SetUpFromJson(j);
+        if (ewald_accuracy_elec > 0) mbx_j_["MBX"]["ewald_accuracy_elec"] = ewald_accuracy_elec;
+    }
 
-    count = 0;
+    // Internal order. SetUpFromJson may have sorted the monomers again.
+    std::vector<size_t> perm(nummon_);
+    bool same_order = true;
     for (size_t i = 0; i < nummon_; i++) {
-        for (size_t j = 0; j < 3 * nat_[i]; j++) {
-            grad_[first_index_[i] * 3 + j] += real_grad[count + j];
-        }
-        count += 3 * nat_[i];
+        perm[i] = original2current_order_[order[i]];
+        same_order = same_order && perm[i] == i;
     }
-    return e;
+    if (!same_order) PermuteMonomers(perm);
+    calls_since_reorder_ = calls_since_reorder;
+
+    SetPBC(box);
+    electrostaticE_.SetDipoleHistory(mu, mu_hist, hist_num);
 }
 
-////////////////////////////////////////////////////////////////////////////////
+void System::SaveState(const std::string &path) {
+    std::string state = GetState();
+    std::ofstream ofs(path.c_str(), std::ios::binary);
+    ofs.write(state.data(), state.size());
+    if (!ofs) {
+        std::string text = "Could not write the state to " + path;
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+}
 
-void System::ResetDipoleHistory() { electrostaticE_.ResetAspcHistory(); }
+void System::LoadState(const std::string &path) {
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    if (!ifs) {
+        std::string text = "Could not open " + path + " for reading the state";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    std::string state((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    SetState(state);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
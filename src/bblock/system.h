@@ -42,6 +42,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <map>
 
 // Tools
 #include "kdtree/nanoflann.hpp"
@@ -50,6 +51,8 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "bblock/sys_tools.h"
 #include "tools/definitions.h"
 #include "tools/custom_exceptions.h"
+#include "tools/workspace.h"
+#include "tools/site_store.h"
 
 // Potential
 // 1B
@@ -64,6 +67,8 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "potential/buckingham/buckingham.h"
 // ELECTROSTATICS
 #include "potential/electrostatics/electrostatics.h"
+// NEURAL NETWORKS
+#include "potential/neural_networks/nn_potentials.h"
 
 /**
  * @file system.h
@@ -77,6 +82,36 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
  */
 namespace bblock {
 
+/**
+ * Group of energy terms that are evaluated together. Used in multiple
+ * time step integrators (e.g. RESPA), where the fast terms are evaluated
+ * every step and the slow terms every few steps.
+ * Each group keeps the energy, gradients and virial of its last evaluation.
+ */
+struct TermGroup {
+    /**
+     * Terms of the group. Possible values are "1b", "2b", "3b",
+     * "dispersion", "buckingham" and "electrostatics"
+     */
+    std::vector<std::string> terms;
+
+    /**
+     * Energy of the last evaluation of the group
+     */
+    double energy = 0.0;
+
+    /**
+     * Gradients of the last evaluation of the group, in the internal order
+     * of the system. Empty if the group has not been evaluated with gradients
+     */
+    std::vector<double> grad;
+
+    /**
+     * Virial of the last evaluation of the group
+     */
+    std::vector<double> virial = std::vector<double>(9, 0.0);
+};
+
 /**
  * The System class is the core class of the whole software.
  * It contains the calls to the enegy functions
@@ -213,6 +248,13 @@ class System {
      */
     std::vector<double> GetXyz();
 
+    /**
+     * Writes the coordinates of all sites, including the electrostatic
+     * virtual sites, in the input order into a caller-owned array.
+     * @param[out] xyz Array of 3*GetNumSites() doubles
+     */
+    void GetXyz(double *xyz);
+
     /**
      * Gets the coordinates of the system in the input order.
      * It will return the coordinates of only real sites.
@@ -220,6 +262,13 @@ class System {
      */
     std::vector<double> GetRealXyz();
 
+    /**
+     * Writes the coordinates of the real sites in the input order
+     * into a caller-owned array.
+     * @param[out] xyz Array of 3*GetNumRealSites() doubles
+     */
+    void GetRealXyz(double *xyz);
+
     /**
      * Gets the gradients of the system in the input order.
      * It will return the gradients of all sites, including the
@@ -228,6 +277,13 @@ class System {
      */
     std::vector<double> GetGrads();
 
+    /**
+     * Writes the gradients of all sites, including the electrostatic
+     * virtual sites, in the input order into a caller-owned array.
+     * @param[out] grads Array of 3*GetNumSites() doubles
+     */
+    void GetGrads(double *grads);
+
     /**
      * Gets the gradients of the system in the input order.
      * It will return the gradients of only real sites.
@@ -235,6 +291,24 @@ class System {
      */
     std::vector<double> GetRealGrads();
 
+    /**
+     * Writes the gradients of the real sites in the input order into a
+     * caller-owned array. Drivers that call this every step avoid the
+     * allocation of GetRealGrads().
+     * @param[out] grads Array of 3*GetNumRealSites() doubles
+     */
+    void GetRealGrads(double *grads);
+
+    /**
+     * Tells if the internal order of the sites is the input order. In that
+     * case the pointer versions of SetXyz() and GetGrads() are a single
+     * copy. The real site versions also need a system without virtual sites.
+     * This happens when the monomers are input grouped by type in the order
+     * MBX uses, and monomer reordering is off.
+     * @return True if the internal order is the input order
+     */
+    bool IsInputOrder();
+
     /**
      * Gets the charges of the system. It includes the charges of ALL sites,
      * including the virtual sites such as the M-sites
@@ -340,12 +414,40 @@ class System {
      */
     std::vector<std::vector<std::string> > Get3bIgnorePoly();
 
+    /**
+     * Gets the files of the neural network models used for the 2b and 3b terms
+     * @return Paths of the model files
+     */
+    std::vector<std::string> GetNNModels();
+
     /**
      * Gets the virial tensor
-     * @return A vector of doubles of 9 elements with the virial
+     * @return A vector of doubles of 9 elements with the virial.
+     * All zeros if the virial is not computed (see SetComputeVirial).
      */
     std::vector<double> GetVirial();
 
+    /**
+     * Gets the induced dipoles of the last electrostatics evaluation in the input order.
+     * It will return the dipoles of all sites, including the electrostatic virtual sites.
+     * @return A vector of doubles with the induced dipoles (e*A) as mu1x mu1y mu1z mu2x...
+     */
+    std::vector<double> GetInducedDipoles();
+
+    /**
+     * Computes the electrostatic potential and field of the system at a set
+     * of points, such as the grid and the nuclei of a QM region. They come
+     * from the charges and the induced dipoles of the last energy evaluation,
+     * which are not solved again, so a call costs about one PME interpolation.
+     * The external charges are not included.
+     * @param[in] points Coordinates of the points (x1 y1 z1 x2 ...). They must
+     * not coincide with a site.
+     * @param[out] phi Potential at each point, in kcal/mol/e
+     * @param[out] field Electric field at each point, in kcal/mol/(e*A)
+     */
+    void GetElectrostaticPotentialAndField(const std::vector<double> &points, std::vector<double> &phi,
+                                           std::vector<double> &field);
+
     /**
      * Gets the box in the system
      * @return Box in system
@@ -370,6 +472,20 @@ class System {
      */
     size_t GetMaxEval3b();
 
+    /**
+     * Gets the number of times the scratch buffers used in the energy
+     * evaluation, in the system and in the dispersion, buckingham and
+     * electrostatics classes, had to grow. The buffers are sized in the
+     * first call, so two consecutive energy calls on the same system
+     * should leave this number unchanged. After the first call, the
+     * charges, the virtual sites, the electrostatics, the dispersion and
+     * the buckingham terms do not allocate at all. The neighbor searches
+     * and the n-body polynomials still allocate on every call, and those
+     * allocations are not counted.
+     * @return Number of times the scratch buffers grew
+     */
+    size_t GetNumBufferResizes();
+
     /**
      * Gets the current dipole tolerance in the system
      * @return Current dipole tolerance
@@ -388,6 +504,31 @@ class System {
      */
     std::string GetDipoleMethod();
 
+    /**
+     * Gets the memory limit of the stored dipole interaction tensors
+     * @return Memory limit in MB. 0 if the tensors are not stored.
+     */
+    double GetDipoleTensorMemory();
+
+    /**
+     * Gets the number of threads that compute the electrostatics at the
+     * same time as the other terms
+     * @return Number of threads. 0 if the terms are computed one after the other.
+     */
+    size_t GetElectrostaticsThreads();
+
+    /**
+     * Gets if the virial is computed with the gradients
+     * @return True if the virial is computed
+     */
+    bool GetComputeVirial();
+
+    /**
+     * Gets the frequency of the spatial reordering of the monomers
+     * @return Number of energy calls between reorderings. 0 if disabled.
+     */
+    size_t GetMonomerReordering();
+
     /**
      * Gets the Ewald parameters for electrostatics
      * @param[out] alpha Ewald alpha
@@ -396,6 +537,12 @@ class System {
      */
     void GetEwaldParamsElectrostatics(double &alpha, double &grid_density, size_t &spline_order);
 
+    /**
+     * Gets the real space cutoff of the electrostatics
+     * @return The cutoff. Same as the two-body cutoff unless set otherwise.
+     */
+    double GetElectrostaticsCutoff();
+
     /**
      * Gets the Ewald parameters for dispersion
      * @param[out] alpha Ewald alpha
@@ -404,6 +551,13 @@ class System {
      */
     void GetEwaldParamsDispersion(double &alpha, double &grid_density, size_t &spline_order);
 
+    /**
+     * Gets the parameters of the treecode used for the gas phase electrostatics
+     * @param[out] theta Opening angle of the treecode. 0 if it is not used.
+     * @param[out] near_radius Distance up to which the site pairs are computed exactly
+     */
+    void GetElectrostaticsTreecode(double &theta, double &near_radius);
+
 
     /////////////////////////////////////////////////////////////////////////////
     // Modifiers ////////////////////////////////////////////////////////////////
@@ -415,7 +569,14 @@ class System {
      * @param[in] xyz Is a vector of doubles that contains the coordinates of
      * the whole system as x1y1z1x2y2z2x3y3z3..., including the virtual sites
      */
-    void SetXyz(std::vector<double> xyz);
+    void SetXyz(const std::vector<double> &xyz);
+
+    /**
+     * Sets the xyz of all sites, including the virtual sites, from a
+     * caller-owned array in the input order. The size is not checked.
+     * @param[in] xyz Array of 3*GetNumSites() doubles as x1y1z1x2y2z2...
+     */
+    void SetXyz(const double *xyz);
 
     /**
      * Sets the xyz of the system. It assumes that only the real coordinates
@@ -423,7 +584,14 @@ class System {
      * @param[in] xyz Is a vector of doubles that contains the coordinates of
      * the real atoms as x1y1z1x2y2z2x3y3z3...
      */
-    void SetRealXyz(std::vector<double> xyz);
+    void SetRealXyz(const std::vector<double> &xyz);
+
+    /**
+     * Sets the xyz of the real sites from a caller-owned array in the
+     * input order. The size is not checked.
+     * @param[in] xyz Array of 3*GetNumRealSites() doubles as x1y1z1x2y2z2...
+     */
+    void SetRealXyz(const double *xyz);
 
     // TODO Keep in mind that the order must be consistent with
     // the database!!
@@ -439,7 +607,22 @@ class System {
      * The id must also match with the database.
      * Please read the documentation carefully.
      */
-    void AddMonomer(std::vector<double> xyz, std::vector<std::string> atoms, std::string id);
+    void AddMonomer(const std::vector<double> &xyz, const std::vector<std::string> &atoms, const std::string &id);
+
+    /**
+     * Adds many monomers to the system at once. The arrays are the
+     * concatenation of what AddMonomer would take for each monomer, so
+     * building a large system costs one append instead of one per monomer.
+     * @param[in] xyz Is a vector of doubles with the coordinates of the real
+     * atoms of all the monomers, as x1y1z1x2y2z2...
+     * @param[in] atoms Is a vector of strings with the atom names of all the
+     * monomers
+     * @param[in] ids Is a vector of strings with the id of each monomer
+     * @param[in] nat Is a vector with the number of atoms of each monomer
+     * @warning Same restrictions as AddMonomer apply to each monomer.
+     */
+    void AddMonomers(const std::vector<double> &xyz, const std::vector<std::string> &atoms,
+                     const std::vector<std::string> &ids, const std::vector<size_t> &nat);
 
     /**
      * Adds a molecule to the system. A molecule, in the context of this
@@ -492,6 +675,20 @@ class System {
      */
     void Set3bIgnorePoly(std::vector<std::vector<std::string> > ignore_3b);
 
+    /**
+     * Sets the neural network models of the 2b and 3b terms. Each file holds
+     * the model of one type of dimer or trimer (see nn::NNModel), which is
+     * used instead of its polynomial. Dimers and trimers listed in
+     * ignore_2b_poly and ignore_3b_poly are skipped for the models too.
+     * Throws CUException if a file cannot be read, if two files are for
+     * the same type of cluster, or if the number of atoms of a monomer of a
+     * model does not match the monomers of that type in the system. The
+     * latter is checked here if the system is initialized, and in
+     * Initialize otherwise. The models are not changed if this throws.
+     * @param[in] files Paths of the model files
+     */
+    void SetNNModels(std::vector<std::string> files);
+
     /**
      * Initializes the system once the monomer information is inputed. The
      * system, once created, cannot be modified in terms of monomer composition.
@@ -577,12 +774,91 @@ class System {
      */
     void SetDipoleMethod(std::string method);
 
+    /**
+     * Stores the damped dipole interaction tensors of the real space pairs
+     * in the first iteration of the induced dipoles of each step, so the
+     * rest of the iterations are sparse matrix-vector products. Each pair
+     * within the cutoff takes 56 bytes; if they do not fit in the limit, the
+     * dipoles are computed without storing them.
+     * @param[in] max_memory_mb Memory limit in MB. 0 disables it.
+     */
+    void SetDipoleTensorMemory(double max_memory_mb);
+
+    /**
+     * Computes the electrostatics at the same time as the other terms in
+     * Energy(). The electrostatics run on nthreads OpenMP threads, and the
+     * rest of the threads compute the 2B, dispersion, buckingham and 3B
+     * terms, so the serial phases of each side (PME setup and FFTs,
+     * reductions) are overlapped with work on the other one. If nthreads is
+     * not smaller than the number of OpenMP threads, or OpenMP is not used,
+     * the terms are computed one after the other.
+     * @param[in] nthreads Number of threads of the electrostatics.
+     * 0 computes the terms one after the other with all the threads.
+     */
+    void SetElectrostaticsThreads(size_t nthreads);
+
+    /**
+     * Sets if the virial is computed with the gradients. Runs that do not
+     * need the pressure (NVT, NVE) can turn it off: the kernels then run
+     * their variant without the virial accumulations, and GetVirial()
+     * returns zeros. Energies and gradients do not change.
+     * @param[in] compute_virial True to compute the virial (default)
+     */
+    void SetComputeVirial(bool compute_virial);
+
     /**
      * Resets the dipole history when using ASPC. If other method is used,
      * this function does nothing.
      */
     void ResetDipoleHistory();
 
+    /**
+     * Gets the part of the state of the system that is lost when a run is
+     * restarted: the internal order of the monomers, the induced dipoles
+     * and the ASPC dipole history, the box and the json configuration.
+     * The coordinates are not included. The result is a binary blob, in the
+     * byte order of the machine, that can be given to SetState.
+     * @return Binary blob with the state of the system
+     */
+    std::string GetState();
+
+    /**
+     * Restores a state obtained with GetState, so the first step after a
+     * restart uses the dipole history of the run that was saved. The system
+     * must be initialized, with the same monomers in the same input order.
+     * If the state has a json configuration, it is applied with
+     * SetUpFromJson before anything else, reusing the Ewald parameters
+     * that were tuned instead of tuning them again.
+     * @param[in] state Binary blob obtained with GetState
+     */
+    void SetState(const std::string &state);
+
+    /**
+     * Writes the state of the system (see GetState) to a file
+     * @param[in] path Name of the file
+     */
+    void SaveState(const std::string &path);
+
+    /**
+     * Restores the state of the system (see SetState) from a file
+     * written with SaveState
+     * @param[in] path Name of the file
+     */
+    void LoadState(const std::string &path);
+
+    /**
+     * Keeps the monomers of each type sorted along a space filling curve,
+     * so monomers that are close in space are also close in memory.
+     * The internal order is not visible from outside: all the input and
+     * output functions keep using the input order.
+     * If the system is already initialized, the monomers are sorted
+     * right away. Otherwise, they are sorted in Initialize().
+     * The ASPC dipole history is reset every time they are sorted.
+     * @param[in] frequency Monomers are sorted again every frequency calls
+     * to Energy(). 0 disables the reordering.
+     */
+    void SetMonomerReordering(size_t frequency);
+
     /**
      * Tells the system if we are in Periodic Boundary Conditions (PBC)
      * or not. If the box is not passed as argument, it is set to
@@ -591,7 +867,17 @@ class System {
      * @param[in] box Optional argument. Is a 9 component vector of double with
      * the three main vectors of the cell: {v1x v1y v1z v2x v2y v2z v3x v3y v3z}
      */
-    void SetPBC(std::vector<double> box = {});
+    void SetPBC(const std::vector<double> &box = {});
+
+    /**
+     * Sets the box without touching the coordinates. The monomers are made
+     * whole and the virtual sites and charges are set at the next call to
+     * Energy(), so codes that set the coordinates and the box before every
+     * evaluation do not need to call SetPBC too.
+     * @param[in] box Box vectors {v1x v1y v1z v2x v2y v2z v3x v3y v3z}, or
+     * empty for no PBC
+     */
+    void SetBox(const std::vector<double> &box = {});
 
     /**
      * Sets the values for alpha, the grid density and the spline order when using PME to get the reciprocal space
@@ -622,6 +908,57 @@ to be the same.
      */
     void SetEwaldDispersion(double alpha, double grid_density, int spline_order);
 
+    /**
+     * Sets the real space cutoff of the electrostatics. With PBC, the Ewald
+     * sum does not depend on it, but the errors of the real and reciprocal
+     * space parts do.
+     * @param[in] cutoff Cutoff in Angstrom. 0 uses the two-body cutoff.
+     */
+    void SetElectrostaticsCutoff(double cutoff);
+
+    /**
+     * Chooses the real space cutoff and the Ewald alpha, grid density and
+     * spline order of the electrostatics that give a relative RMS force error
+     * below the target at the smallest cost. For each candidate cutoff, alpha
+     * is set by the real space error, and the smallest grid density that
+     * meets the reciprocal space error is found for each spline order. Each
+     * candidate is then timed on the current configuration, and the fastest
+     * one is kept and stored in the json configuration.
+     * The errors are estimated for the charges only, and are relative to
+     * the force between two sites with the RMS charge (sum of q_i^2 / N)
+     * 1 Angstrom apart. The induced dipoles of the last evaluation are
+     * kept. The cutoffs tried go down
+     * from the smaller of the two-body cutoff and half the box length.
+     * The system must be initialized and have a box.
+     * @param[in] accuracy Target relative RMS force error, e.g. 1E-5
+     */
+    void TuneEwaldElectrostatics(double accuracy);
+
+    /**
+     * Uses a Barnes-Hut treecode for the electrostatics of systems without
+     * PBC. The site pairs closer than near_radius are computed exactly, with
+     * Thole damping, and the rest with multipole expansions of the octree cells.
+     * Ignored if the system has a box.
+     * @param[in] theta Opening angle. Smaller values are more accurate.
+     * 0 disables the treecode.
+     * @param[in] near_radius Distance up to which the site pairs are computed
+     * exactly, in Angstrom. "elec_treecode_radius" in the json file.
+     */
+    void SetElectrostaticsTreecode(double theta, double near_radius = 9.0);
+
+    /**
+     * Sets point charges that are not part of the system, such as the atoms
+     * of a QM region in electrostatic embedding. They polarize the system, and
+     * the electrostatic energy and gradients include their interaction with
+     * the charges and dipoles of the system, with the same cutoff and Ewald
+     * sum, but without Thole damping and without virial. The gradient on each
+     * external charge is minus the charge times the field given by
+     * GetElectrostaticPotentialAndField at its position.
+     * @param[in] xyz Coordinates of the charges (x1 y1 z1 x2 ...)
+     * @param[in] chg Charges in e. Empty vectors remove them.
+     */
+    void SetExternalCharges(const std::vector<double> &xyz, const std::vector<double> &chg);
+
     /////////////////////////////////////////////////////////////////////////////
     // Energy Functions /////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////////////
@@ -694,7 +1031,105 @@ to be the same.
      */
     double Buckingham(bool do_grads);
 
+    /////////////////////////////////////////////////////////////////////////////
+    // Term groups (multiple time step) /////////////////////////////////////////
+    /////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Defines (or redefines) a group of energy terms that will be evaluated
+     * together with GroupEnergy(). A term should only be in one of the groups
+     * used by the integrator, otherwise it will be counted twice.
+     * @param[in] name Name of the group (e.g. "fast" or "slow")
+     * @param[in] terms Terms in the group. Possible values are "1b", "2b",
+     * "3b", "dispersion", "buckingham" and "electrostatics"
+     */
+    void SetTermGroup(std::string name, std::vector<std::string> terms);
+
+    /**
+     * Returns the terms of a group
+     * @param[in] name Name of the group
+     * @return Terms of the group
+     */
+    std::vector<std::string> GetTermGroup(std::string name);
+
+    /**
+     * Evaluates the terms of a group. The energy, gradients and virial are
+     * stored in the group, and can be retrieved with GetGroupEnergy(),
+     * GetGroupRealGrads() and GetGroupVirial(). The gradients, virial and
+     * energy of the system, and those of the other groups, are not modified.
+     * @param[in] name Name of the group
+     * @param[in] do_grads If true, the gradients will be computed. Otherwise,
+     * the gradient calculation will not be performed
+     * @return Energy of the group in kcal/mol
+     */
+    double GroupEnergy(std::string name, bool do_grads);
+
+    /**
+     * Returns the energy of the last evaluation of a group
+     * @param[in] name Name of the group
+     * @return Energy of the group in kcal/mol
+     */
+    double GetGroupEnergy(std::string name);
+
+    /**
+     * Returns the gradients of the real sites of the last evaluation of a
+     * group, in the input order
+     * @param[in] name Name of the group
+     * @return Gradients of the real sites
+     */
+    std::vector<double> GetGroupRealGrads(std::string name);
+
+    /**
+     * Returns the virial of the last evaluation of a group
+     * @param[in] name Name of the group
+     * @return Virial tensor (9 components)
+     */
+    std::vector<double> GetGroupVirial(std::string name);
+
+    /**
+     * Evaluates a subset of the energy terms and accumulates the gradients
+     * of the real sites and the virial in the given buffers.
+     * The gradients, virial and energy of the system are not modified.
+     * @param[in] terms Terms to evaluate. Possible values are "1b", "2b",
+     * "3b", "dispersion", "buckingham" and "electrostatics"
+     * @param[in] do_grads If true, the gradients will be computed. Otherwise,
+     * the gradient calculation will not be performed
+     * @param[in,out] real_grad Gradients of the real sites in the input order.
+     * Resized to 3 * number of real sites if needed. Gradients are added.
+     * @param[in,out] virial Virial tensor. Resized to 9 if needed.
+     * The virial of the terms is added.
+     * @return Energy of the terms in kcal/mol
+     */
+    double TermsEnergy(std::vector<std::string> terms, bool do_grads, std::vector<double> &real_grad,
+                       std::vector<double> &virial);
+
    private:
+    /**
+     * Throws an exception if one of the terms is not a valid term name
+     * @param[in] terms Terms to check
+     */
+    void CheckTerms(const std::vector<std::string> &terms);
+
+    /**
+     * Gets a term group. Throws an exception if it has not been defined.
+     * @param[in] name Name of the group
+     * @return The group
+     */
+    TermGroup &FindTermGroup(const std::string &name);
+
+    /**
+     * Evaluates a subset of the energy terms. The gradients (internal order,
+     * all sites) and the virial are written into grad and virial, which are
+     * swapped with the system buffers for the duration of the call.
+     * @param[in] terms Terms to evaluate
+     * @param[in] do_grads If true, the gradients will be computed
+     * @param[out] grad Gradients in the internal order of the system
+     * @param[out] virial Virial tensor
+     * @return Energy of the terms
+     */
+    double EvaluateTerms(const std::vector<std::string> &terms, bool do_grads, std::vector<double> &grad,
+                         std::vector<double> &virial);
+
     /**
      * Fills the dimers_(i,j) and/or trimers_(i,j,k) vectors, with
      * i < j < k. These i,j,k are the index of the corresponding monomer
@@ -720,6 +1155,54 @@ to be the same.
      */
     std::vector<size_t> AddClustersParallel(size_t nmax, double cutoff, size_t istart, size_t iend);
 
+    /**
+     * Fills trimers with the trimers (i,j,k), i < j < k, with i >= istart
+     * and i < iend, that have at least two distances within the cutoff of
+     * their monomer types. Trimers of the same types are contiguous.
+     * @param[in] cutoffs Cutoff of each combination of monomer types,
+     * indexed as poly_ranges3b_
+     * @param[in] istart Minimum index of i
+     * @param[in] iend Maximum index (iend not included) of index i
+     * @param[out] trimers Vector of size_t with dimention ntrimers * 3
+     */
+    void AddTrimers(const std::vector<double> &cutoffs, size_t istart, size_t iend, std::vector<size_t> &trimers);
+
+    /**
+     * Sorts the monomers of each type along a space filling curve
+     * (see systools::SpatialOrder) and updates the coordinates, gradients
+     * and the relation with the input order accordingly. The static site
+     * parameters are the same for all the monomers of a type, so they are
+     * not touched. Virtual sites and position dependent charges are not
+     * updated; SetPBC must be called afterwards.
+     */
+    void ReorderMonomers();
+
+    /**
+     * Moves the monomers to a new internal order and updates the
+     * coordinates, gradients and the relation with the input order, as
+     * ReorderMonomers does. The induced dipoles of the last call are moved
+     * with the monomers and the ASPC dipole history is reset.
+     * @param[in] perm The monomer that goes to position i is the one that
+     * currently is at position perm[i]. Monomers must stay in their type block.
+     */
+    void PermuteMonomers(const std::vector<size_t> &perm);
+
+    /**
+     * Gets the largest distance of a site of a monomer to the first
+     * site of the same monomer. Used to extend the cutoffs of the
+     * monomer searches, which only look at the first sites.
+     * @return Largest distance in the system
+     */
+    double GetMaxMonomerExtent();
+
+    /**
+     * Builds monomer_pairs_ with one kd-tree search, if it has not been
+     * built since the last call to SetPBC. The search radius covers both
+     * the buckingham cutoff and the near radius of the treecode, extended
+     * by twice the largest monomer extent.
+     */
+    void SetUpMonomerPairs();
+
     /**
      * Fills in the monomer information of the monomers that have been
      * added to the system.
@@ -727,8 +1210,38 @@ to be the same.
     void AddMonomerInfo();
 
     /**
-     * Sets the charges of the system, including the
-     * position dependent charges
+     * Sets input_order_ and real_input_order_ from the current relation
+     * between the internal order and the input order.
+     */
+    void SetInputOrderFlags();
+
+    /**
+     * Copies 3 values per site from the internal order to the input order.
+     * @param[in] src Internal order array (all sites)
+     * @param[in] real If true, only the real sites are copied
+     * @param[out] dst Input order array
+     */
+    void CopyToInputOrder3N(const double *src, bool real, double *dst);
+
+    /**
+     * Sets poly_range2b_ and poly_ranges3b_ from the outer radii of the
+     * polynomials, or of the neural network models that replace them, of all
+     * the combinations of monomer types in the system, and the type index
+     * of each monomer. Also sets nn_models2b_ and nn_models3b_.
+     */
+    void SetPolynomialRanges();
+
+    /**
+     * Sets the site parameters that do not depend on the geometry: the
+     * charges of all the monomer types but the geometry dependent ones
+     * (see systools::IsGeometryDependent), the polarizabilities and the
+     * polarizability factors. Called once in Initialize.
+     */
+    void SetStaticSiteParameters();
+
+    /**
+     * Sets the position dependent charges of the system. The rest
+     * are set in SetStaticSiteParameters.
      */
     void SetCharges();
 
@@ -789,6 +1302,28 @@ to be the same.
      */
     double GetElectrostatics(bool do_grads);
 
+    /**
+     * Sets up the electrostatics for a new evaluation, without computing
+     * them. Everything that GetElectrostatics does on the data of the
+     * system is done here.
+     * @param[in] do_grads If true, the gradients will be computed
+     */
+    void SetUpElectrostatics(bool do_grads);
+
+    /**
+     * Computes the 2B, dispersion, buckingham, 3B and electrostatic terms,
+     * the electrostatics on elec_threads_ threads at the same time as the
+     * rest on the other threads. Same results as calling them one after
+     * the other, as Energy() does otherwise.
+     * @param[in] do_grads If true, the gradients will be computed
+     * @param[out] e2b 2B energy
+     * @param[out] edisp Dispersion energy
+     * @param[out] ebuck Buckingham energy
+     * @param[out] e3b 3B energy
+     * @param[out] eelec Electrostatic energy
+     */
+    void GetTermsConcurrently(bool do_grads, double &e2b, double &edisp, double &ebuck, double &e3b, double &eelec);
+
     /**
      * Private function to internally get the dispersion energy.
      * Gradients of the system will be updated.
@@ -870,6 +1405,21 @@ to be the same.
      */
     size_t elec_spline_order_;
 
+    /**
+     * Real space cutoff for electrostatics. 0 if it is the two-body cutoff.
+     */
+    double elec_cutoff_;
+
+    /**
+     * Opening angle of the electrostatics treecode. 0 if not used.
+     */
+    double elec_treecode_theta_;
+
+    /**
+     * Distance up to which the electrostatics are exact with the treecode
+     */
+    double elec_treecode_radius_;
+
     /**
      * Ewald alpha for dispersion
      */
@@ -899,6 +1449,28 @@ to be the same.
      */
     double cutoff3b_;
 
+    /**
+     * Largest outer radius of the 2B polynomials of the monomer types in
+     * the system. Dimers for the polynomials are searched within
+     * min(cutoff2b_, poly_range2b_), while dispersion and buckingham
+     * keep using cutoff2b_.
+     */
+    double poly_range2b_;
+
+    /**
+     * Outer radius of the 3B polynomial of each combination of monomer
+     * types t1 <= t2 <= t3 in mon_type_count_, at (t1 * ntypes + t2) * ntypes + t3.
+     * Trimers of those types are searched within min(cutoff3b_, radius),
+     * and the ones without polynomial (radius 0) are not searched at all.
+     */
+    std::vector<double> poly_ranges3b_;
+
+    /**
+     * Index in mon_type_count_ of the type of each monomer, in the
+     * internal order of the system
+     */
+    std::vector<size_t> mon_type_index_;
+
     /**
      * Stores the energy of the system
      */
@@ -911,6 +1483,17 @@ to be the same.
      */
     bool initialized_;
 
+    /**
+     * Number of calls to Energy() between two spatial reorderings of the
+     * monomers. 0 if the monomers are not reordered.
+     */
+    size_t reorder_frequency_;
+
+    /**
+     * Number of calls to Energy() since the last spatial reordering
+     */
+    size_t calls_since_reorder_;
+
     /**
      * If set to tru, the box and periodic boundary conditions will be used and
      * taken into account for the clusters, energy calculations, and any
@@ -935,16 +1518,53 @@ to be the same.
      **/
     buck::Buckingham buckinghamE_;
 
+    /**
+     * Coordinates of the real atoms in the layout of dispersion and
+     * buckingham, filled once per evaluation in SetPBC. Both classes read
+     * them from here and add their gradients directly into grad_.
+     */
+    tools::SiteStore real_sites_;
+
     /**
      * Electrostatic class that will be used to get the electrostatic energy
      */
     elec::Electrostatics electrostaticE_;
 
+    /**
+     * Scratch buffers used in the 1b, 2b, 3b, dispersion and buckingham
+     * evaluations. They are reused between energy calls.
+     */
+    tools::Workspace workspace_;
+
     /**
      * Method used in order to calculate the induced dipoles
      */
     std::string dipole_method_;
 
+    /**
+     * Memory limit in MB of the stored dipole interaction tensors.
+     * 0 if they are not stored.
+     */
+    double dipole_tensor_memory_;
+
+    /**
+     * Coordinates (xyzxyz...) and charges of the point charges that are
+     * not part of the system
+     */
+    std::vector<double> external_xyz_;
+    std::vector<double> external_chg_;
+
+    /**
+     * Number of threads that compute the electrostatics at the same time
+     * as the other terms. 0 if the terms are computed one after the other.
+     */
+    size_t elec_threads_;
+
+    /**
+     * Whether the virial is computed with the gradients
+     */
+    bool compute_virial_;
+
     /**
      * Vector that contains, in the internal order of the system, the
      * number of sites of each monomer
@@ -980,6 +1600,17 @@ to be the same.
      */
     std::vector<size_t> trimers_;
 
+    /**
+     * Monomer pairs shared by the buckingham repulsion and the
+     * electrostatics treecode. Same layout as dimers_.
+     */
+    std::vector<size_t> monomer_pairs_;
+
+    /**
+     * True if monomer_pairs_ matches the current coordinates
+     */
+    bool monomer_pairs_set_;
+
     /**
      * Vector that stores the gradients of the system in the onternal order
      * of the system.
@@ -1076,6 +1707,23 @@ to be the same.
      */
     std::vector<std::vector<std::string> > ignore_3b_poly_;
 
+    /**
+     * Neural network models that replace the polynomials of some dimers and trimers
+     */
+    nn::NNPotentials nn_potentials_;
+
+    /**
+     * Neural network model of each combination of monomer types t1 <= t2,
+     * at t1 * ntypes + t2. Empty if there are no models.
+     */
+    std::vector<nn::NNClusterModel> nn_models2b_;
+
+    /**
+     * Neural network model of each combination of monomer types, indexed
+     * as poly_ranges3b_. Empty if there are no models.
+     */
+    std::vector<nn::NNClusterModel> nn_models3b_;
+
     /**
      * Vector that contains the relation between the input monomer
      * order and the internal monomer order. The position i of this
@@ -1101,6 +1749,13 @@ to be the same.
      */
     std::vector<std::pair<size_t, size_t> > initial_order_realSites_;
 
+    /**
+     * True when the internal site order is the input order (see IsInputOrder()),
+     * and when, in addition, there are no virtual sites
+     */
+    bool input_order_;
+    bool real_input_order_;
+
     /**
      * Vector that contains the virial tensor
      */
@@ -1110,6 +1765,11 @@ to be the same.
      * Json configuration object
      */
     nlohmann::json mbx_j_;
+
+    /**
+     * Groups of terms used by GroupEnergy(). Key is the name of the group.
+     */
+    std::map<std::string, TermGroup> term_groups_;
 };
 
 }  // namespace bblock
@@ -58,12 +58,14 @@ void ReadNrg(char* filename, std::vector<bblock::System>& systems) {
 
     // Read systems until EOF
     while (true) {
-        // Read system from file
-        bblock::System sys;
-        ReadSystem(lineno, ifs, sys);
-
-        // Store system in system vector
-        systems.push_back(sys);
+        // Read system from file straight into the system vector
+        systems.emplace_back();
+        try {
+            ReadSystem(lineno, ifs, systems.back());
+        } catch (...) {
+            systems.pop_back();
+            throw;
+        }
         sysno++;
 
         // Check if next line ends file
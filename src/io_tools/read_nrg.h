@@ -65,6 +65,8 @@ namespace tools {
  * Given the filename and a system vector to put the systems in,
  * reads all the systems, saving them in the vector in the order in
  * wich they are in the input
+ * Each system is built in place at the end of the vector. Reserving the
+ * vector beforehand avoids copying the systems already read.
  * @param[in] filename Name of the file to read
  * @param[out] systems Vector of systems that will be filled with
  * the information in the file
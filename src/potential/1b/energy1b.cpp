@@ -36,7 +36,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 namespace e1b {
 
-double get_1b_energy(std::string mon1, size_t nm, std::vector<double> xyz1, bool &good) {
+double get_1b_energy(std::string mon1, size_t nm, const std::vector<double> &xyz1, bool &good) {
     std::vector<double> energies;
     // Look for the proper call to energy depending on the monomer id
     if (mon1 == "h2o") {
@@ -69,7 +69,7 @@ double get_1b_energy(std::string mon1, size_t nm, std::vector<double> xyz1, bool
     return e;
 }
 
-double get_1b_energy(std::string mon1, size_t nm, std::vector<double> xyz1, std::vector<double> &grad1, bool &good, std::vector<double> *virial) {
+double get_1b_energy(std::string mon1, size_t nm, const std::vector<double> &xyz1, std::vector<double> &grad1, bool &good, std::vector<double> *virial) {
     std::vector<double> energies;
     // Look for the proper call to energy depending on the monomer id
     if (mon1 == "h2o") {
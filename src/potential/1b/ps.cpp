@@ -39,6 +39,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "ps.h"
 #include "tools/macros.h"
 #include "tools/constants.h"
+#include "tools/cpu_dispatch.h"
 
 namespace {
 
@@ -343,7 +344,9 @@ static double c5z[245];
 
 namespace ps {
 
-std::vector<double> pot_nasa(const double* rr, double* dr, size_t nw, std::vector<double> *virial) {
+// Body of pot_nasa, inlined in one variant per instruction set
+static MBX_ALWAYS_INLINE std::vector<double> pot_nasa_kernel(const double* rr, double* dr, size_t nw,
+                                                             std::vector<double> *virial) {
     // Declare vectors with the distances, and grads
     double ROH1[3 * nw], ROH2[3 * nw], RHH[3 * nw];
     double dROH1[nw], dROH2[nw], dRHH[nw];
@@ -593,6 +596,10 @@ std::vector<double> pot_nasa(const double* rr, double* dr, size_t nw, std::vecto
     return tot_e;
 }
 
+std::vector<double> pot_nasa(const double* rr, double* dr, size_t nw, std::vector<double> *virial) {
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return pot_nasa_kernel(rr, dr, nw, virial); });
+}
+
 // double pot_nasa(const double* RESTRICT rr, double* RESTRICT dr)
 //{
 //    double ROH1[3], ROH2[3], RHH[3], dROH1(0), dROH2(0), dRHH(0);
@@ -713,7 +720,7 @@ std::vector<double> pot_nasa(const double* rr, double* dr, size_t nw, std::vecto
 //}
 //
 void dms_nasa(const double& RESTRICT dms_param1, const double& RESTRICT dms_param2, const double& RESTRICT dms_param3,
-              const double* RESTRICT rr, double* RESTRICT q3, double* RESTRICT dq3, std::vector<double> *aux_data) {
+              const double* RESTRICT rr, double* RESTRICT q3, double* RESTRICT dq3, double *aux_data) {
     const double ath0 = 1.82400520401572996557;
     const double costhe = -0.24780227221366464506;
     bool ttm3 = false; // This is not used I think, but just for safety...
@@ -861,12 +868,12 @@ void dms_nasa(const double& RESTRICT dms_param1, const double& RESTRICT dms_para
     if (dq3 == 0) return;
 
     if ( aux_data != 0 ) {
-        (*aux_data)[0] = dp1dr1;
-        (*aux_data)[1] = dp1dr2;
-        (*aux_data)[2] = dp2dr1;
-        (*aux_data)[3] = dp2dr2;
-        (*aux_data)[4] = dp1dcabc;
-        (*aux_data)[5] = dp2dcabc;
+        aux_data[0] = dp1dr1;
+        aux_data[1] = dp1dr2;
+        aux_data[2] = dp2dr1;
+        aux_data[3] = dp2dr2;
+        aux_data[4] = dp1dcabc;
+        aux_data[5] = dp2dcabc;
     }
 
     const double f1q1r13 = (dp1dr1 - (dp1dcabc * costh / dROH1)) / dROH1;
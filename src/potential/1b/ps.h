@@ -85,9 +85,12 @@ std::vector<double> pot_nasa(const double* rr, double* dr, size_t nw, std::vecto
  * @param[out] dq3 Charge derivates of the water molecule
  * @param[in] ttm3 Boolean specifying if we are using TTM3.
  * Should be set to false in this software.
+ * @param[out] aux_data If not null, 6 values with the derivatives of the
+ * charges of the hydrogens with respect to the two OH distances and the cosine
+ * of the angle
  */
 void dms_nasa(const double& dms_param1, const double& dms_param2, const double& dms_param3, const double* rr,
-              double* q3, double* dq3, std::vector<double> *aux_data = 0);
+              double* q3, double* dq3, double *aux_data = 0);
               
 
 }  // namespace ps
@@ -41,52 +41,53 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 namespace e2b {
 
-double get_2b_energy(std::string mon1, std::string mon2, size_t nm, std::vector<double> xyz1, std::vector<double> xyz2) {
+double get_2b_energy(std::string mon1, std::string mon2, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2) {
+    // Work on pointers so the ordering below does not copy the coordinates
+    const double *x1 = xyz1.data();
+    const double *x2 = xyz2.data();
+
     // Order the two monomer names and corresponding xyz
     if (mon2 < mon1) {
-        std::string tmp = mon1;
-        mon1 = mon2;
-        mon2 = tmp;
-        std::vector<double> tmp2 = std::move(xyz1);
-        xyz1 = std::move(xyz2);
-        xyz2 = std::move(tmp2);
+        std::swap(mon1, mon2);
+        std::swap(x1, x2);
     }
 
     // Water water
     if (mon1 == "h2o" and mon2 == "h2o") {
         x2o::x2b_v9x pot;
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
         // Ion water
     } else if ((mon1 == "ar" or mon1 == "f" or mon1 == "cl" or mon1 == "br" or mon1 == "cs") and mon2 == "h2o") {
         // The order is bc the poly were generated this way
         // First water and then ion
         h2o_ion::x2b_h2o_ion_v2x pot(mon2, mon1);
-        return pot.eval(xyz2.data(), xyz1.data(), nm);
+        return pot.eval(x2, x1, nm);
         // More ion water
     } else if (mon1 == "h2o" and (mon2 == "i" or mon2 == "li" or mon2 == "na" or mon2 == "k" or mon2 == "rb")) {
         h2o_ion::x2b_h2o_ion_v2x pot(mon1, mon2);
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
 
         // =====>> BEGIN SECTION 2B_NO_GRADIENT <<=====
         // =====>> PASTE YOUR CODE BELOW <<=====
     } else if (mon1 == "ch4" && mon2 == "ch4") {
         x2b_A1B4_A1B4_deg4_exp0::x2b_A1B4_A1B4_v1x pot(mon1,mon2);
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
     } else if (mon1 == "co2" and mon2 == "co2") {
         x2b_A1B2_A1B2_deg5::x2b_A1B2_A1B2_v1x pot(mon1,mon2);
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
     } else if (mon1 == "co2" and mon2 == "h2o") {
         x2b_A1B2Z2_C1D2_deg4::x2b_A1B2Z2_C1D2_v1x pot(mon2,mon1);
-        return pot.eval(xyz2.data(), xyz1.data(), nm);
+        return pot.eval(x2, x1, nm);
     } else if (mon1 == "ch4" and mon2 == "h2o") {
         x2b_A1B2Z2_C1D4_deg3_exp0::x2b_A1B2Z2_C1D4_v1x pot(mon2,mon1);
-        return pot.eval(xyz2.data(), xyz1.data(), nm);
+        return pot.eval(x2, x1, nm);
     } else if (mon1 == "nh3" and mon2 == "nh3") {
         mbnrg_A1B3_A1B3_deg5::mbnrg_A1B3_A1B3_deg5_v1 pot(mon1, mon2);
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
     } else if (mon1 == "ar" and mon2 == "cs") {
         mbnrg_A1_B1_deg15::mbnrg_A1_B1_deg15_v1 pot(mon1, mon2);
-        return pot.eval(xyz1.data(), xyz2.data(), nm);
+        return pot.eval(x1, x2, nm);
         // =====>> END SECTION 2B_NO_GRADIENT <<=====
 
     } else {
@@ -94,70 +95,103 @@ double get_2b_energy(std::string mon1, std::string mon2, size_t nm, std::vector<
     }
 }
 
-double get_2b_energy(std::string mon1, std::string mon2, size_t nm, std::vector<double> xyz1, std::vector<double> xyz2,
-                     std::vector<double> &grad1, std::vector<double> &grad2, std::vector<double> *virial) {
+double get_2b_energy(std::string mon1, std::string mon2, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, std::vector<double> &grad1, std::vector<double> &grad2,
+                     std::vector<double> *virial) {
+    // Work on pointers so the ordering below does not copy the coordinates
+    // and the gradients end up in the caller's buffers in the original order
+    const double *x1 = xyz1.data();
+    const double *x2 = xyz2.data();
+    double *g1 = grad1.data();
+    double *g2 = grad2.data();
+
     // Order the two monomer names and corresponding xyz
-    bool swaped = false;
     if (mon2 < mon1) {
-        std::string tmp = std::move(mon1);
-        mon1 = std::move(mon2);
-        mon2 = std::move(tmp);
-        std::vector<double> tmp2 = std::move(xyz1);
-        xyz1 = std::move(xyz2);
-        xyz2 = std::move(tmp2);
-        tmp2 = std::move(grad1);
-        grad1 = std::move(grad2);
-        grad2 = std::move(tmp2);
-        swaped = true;
+        std::swap(mon1, mon2);
+        std::swap(x1, x2);
+        std::swap(g1, g2);
     }
 
     double energy = 0.0;
     // Note: in the conditional, mon2 >= mon1 ALWAYS
     if (mon1 == "h2o" and mon2 == "h2o") {
         x2o::x2b_v9x pot;
-        energy = pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy = pot.eval(x1, x2, g1, g2, nm, virial);
     } else if ((mon1 == "ar" or mon1 == "f" or mon1 == "cl" or mon1 == "br" or mon1 == "cs") and mon2 == "h2o") {
         // The order is bc the poly were generated this way
         // First water and then ion
         h2o_ion::x2b_h2o_ion_v2x pot(mon2, mon1);
-        energy = pot.eval(xyz2.data(), xyz1.data(), grad2.data(), grad1.data(), nm, virial);
+        energy = pot.eval(x2, x1, g2, g1, nm, virial);
     } else if (mon1 == "h2o" and (mon2 == "i" or mon2 == "li" or mon2 == "na" or mon2 == "k" or mon2 == "rb")) {
         h2o_ion::x2b_h2o_ion_v2x pot(mon1, mon2);
-        energy = pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy = pot.eval(x1, x2, g1, g2, nm, virial);
 
         // =====>> BEGIN SECTION 2B_GRADIENT <<=====
         // ====>> PASTE YOUR CODE BELOW <<====
     } else if (mon1 == "ch4" && mon2 == "ch4") {
         x2b_A1B4_A1B4_deg4_exp0::x2b_A1B4_A1B4_v1x pot(mon1,mon2);
-        energy = pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy = pot.eval(x1, x2, g1, g2, nm, virial);
     } else if (mon1 == "co2" and mon2 == "co2") {
         x2b_A1B2_A1B2_deg5::x2b_A1B2_A1B2_v1x pot(mon1,mon2);
-        energy = pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy = pot.eval(x1, x2, g1, g2, nm, virial);
     } else if (mon1 == "co2" and mon2 == "h2o") {
         x2b_A1B2Z2_C1D2_deg4::x2b_A1B2Z2_C1D2_v1x pot(mon2,mon1);
-        energy = pot.eval(xyz2.data(), xyz1.data(), grad2.data(), grad1.data(), nm, virial);
+        energy = pot.eval(x2, x1, g2, g1, nm, virial);
     } else if (mon1 == "ch4" and mon2 == "h2o") {
         x2b_A1B2Z2_C1D4_deg3_exp0::x2b_A1B2Z2_C1D4_v1x pot(mon2,mon1);
-        energy = pot.eval(xyz2.data(), xyz1.data(), grad2.data(), grad1.data(), nm, virial);
+        energy = pot.eval(x2, x1, g2, g1, nm, virial);
     } else if (mon1 == "nh3" and mon2 == "nh3") {
         mbnrg_A1B3_A1B3_deg5::mbnrg_A1B3_A1B3_deg5_v1 pot(mon1, mon2);
-        energy =  pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy =  pot.eval(x1, x2, g1, g2, nm, virial);
     } else if (mon1 == "ar" and mon2 == "cs") {
         mbnrg_A1_B1_deg15::mbnrg_A1_B1_deg15_v1 pot(mon1, mon2);
-        energy =  pot.eval(xyz1.data(), xyz2.data(), grad1.data(), grad2.data(), nm, virial);
+        energy =  pot.eval(x1, x2, g1, g2, nm, virial);
         // =====>> END SECTION 2B_GRADIENT <<=====
     } else {
         energy = 0.0;
     }
 
-    // Reseting gradients in original order if necessary
-    if (swaped) {
-        std::vector<double> tmp2 = std::move(grad2);
-        grad2 = std::move(grad1);
-        grad1 = std::move(tmp2);
-    }
-
     return energy;
 }
 
+double get_2b_cutoff(std::string mon1, std::string mon2) {
+    // Order the two monomer names
+    if (mon2 < mon1) std::swap(mon1, mon2);
+
+    if (mon1 == "h2o" and mon2 == "h2o") {
+        return x2o::x2b_v9x::r2f;
+    } else if ((mon1 == "ar" or mon1 == "f" or mon1 == "cl" or mon1 == "br" or mon1 == "cs") and mon2 == "h2o") {
+        h2o_ion::x2b_h2o_ion_v2x pot(mon2, mon1);
+        return pot.r2f;
+    } else if (mon1 == "h2o" and (mon2 == "i" or mon2 == "li" or mon2 == "na" or mon2 == "k" or mon2 == "rb")) {
+        h2o_ion::x2b_h2o_ion_v2x pot(mon1, mon2);
+        return pot.r2f;
+
+        // =====>> BEGIN SECTION 2B_CUTOFF <<=====
+        // =====>> PASTE YOUR CODE BELOW <<=====
+    } else if (mon1 == "ch4" && mon2 == "ch4") {
+        x2b_A1B4_A1B4_deg4_exp0::x2b_A1B4_A1B4_v1x pot(mon1, mon2);
+        return pot.GetOuterRadius();
+    } else if (mon1 == "co2" and mon2 == "co2") {
+        x2b_A1B2_A1B2_deg5::x2b_A1B2_A1B2_v1x pot(mon1, mon2);
+        return pot.GetOuterRadius();
+    } else if (mon1 == "co2" and mon2 == "h2o") {
+        x2b_A1B2Z2_C1D2_deg4::x2b_A1B2Z2_C1D2_v1x pot(mon2, mon1);
+        return pot.GetOuterRadius();
+    } else if (mon1 == "ch4" and mon2 == "h2o") {
+        x2b_A1B2Z2_C1D4_deg3_exp0::x2b_A1B2Z2_C1D4_v1x pot(mon2, mon1);
+        return pot.GetOuterRadius();
+    } else if (mon1 == "nh3" and mon2 == "nh3") {
+        mbnrg_A1B3_A1B3_deg5::mbnrg_A1B3_A1B3_deg5_v1 pot(mon1, mon2);
+        return pot.GetOuterRadius();
+    } else if (mon1 == "ar" and mon2 == "cs") {
+        mbnrg_A1_B1_deg15::mbnrg_A1_B1_deg15_v1 pot(mon1, mon2);
+        return pot.GetOuterRadius();
+        // =====>> END SECTION 2B_CUTOFF <<=====
+
+    } else {
+        return 0.0;
+    }
+}
+
 }  // namespace e2b
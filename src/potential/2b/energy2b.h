@@ -76,7 +76,8 @@ namespace e2b {
  * @param[in] xyz2 coordinates of the monomer 2
  * @return Sum of the two-body energies of all the dimers passed as arguments
  */
-double get_2b_energy(std::string m1, std::string m2, size_t nm, std::vector<double> xyz1, std::vector<double> xyz2);
+double get_2b_energy(std::string m1, std::string m2, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2);
 
 /**
  * @brief Gets the two body energy for a given set of dimers
@@ -94,8 +95,20 @@ double get_2b_energy(std::string m1, std::string m2, size_t nm, std::vector<doub
  * @param[in,out] virial. Virial will be updated
  * @return Sum of the two-body energies of all the dimers passed as arguments
  */
-double get_2b_energy(std::string m1, std::string m2, size_t nm, std::vector<double> xyz1, std::vector<double> xyz2,
-                     std::vector<double> &grad1, std::vector<double> &grad2, std::vector<double> *virial = 0);
+double get_2b_energy(std::string m1, std::string m2, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, std::vector<double> &grad1, std::vector<double> &grad2, std::vector<double> *virial = 0);
+
+/**
+ * @brief Gets the outer radius of the two body polynomial of a dimer
+ *
+ * The polynomials are zero when the distance between the first sites
+ * of the two monomers is larger than this radius, so dimers further
+ * apart do not need to be evaluated.
+ * @param[in] m1 Monomer 1 id
+ * @param[in] m2 Monomer 2 id
+ * @return Outer radius of the polynomial, or 0 if there is no polynomial for this dimer
+ */
+double get_2b_cutoff(std::string m1, std::string m2);
 
 }  // namespace e2b
 #endif
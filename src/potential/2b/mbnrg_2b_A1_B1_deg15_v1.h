@@ -27,6 +27,9 @@ struct mbnrg_A1_B1_deg15_v1 {
     double eval(const double *xyz1, const double *xyz2, const size_t n);
     double eval(const double *xyz1, const double *xyz2, double *grad1, double *grad2 , const size_t n,std::vector<double> *virial=0);
 
+
+    // Distance between the first sites beyond which the polynomial is zero
+    double GetOuterRadius() const { return m_ro; }
   private:
     double m_k_x_inter_A_B_0;
     double m_d_x_inter_A_B_0;
@@ -33,10 +33,12 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "poly-2b-A1B2Z2_C-v1x.h"
+#include "tools/cpu_dispatch.h"
 
 namespace h2o_ion {
 
-std::vector<double> poly_2b_h2o_ion_v1x::eval(const size_t nd, const double a[429], const double* x) {
+// Body of eval, inlined in one variant per instruction set
+static MBX_ALWAYS_INLINE std::vector<double> eval_kernel(const size_t nd, const double a[429], const double* x) {
     std::vector<double> energy(nd, 0.0);
 #pragma omp simd
     for (size_t nv = 0; nv < nd; nv++) {
@@ -622,4 +624,8 @@ std::vector<double> poly_2b_h2o_ion_v1x::eval(const size_t nd, const double a[42
     return energy;
 }
 
+std::vector<double> poly_2b_h2o_ion_v1x::eval(const size_t nd, const double a[429], const double* x) {
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return eval_kernel(nd, a, x); });
+}
+
 }  // namespace h2o_ion
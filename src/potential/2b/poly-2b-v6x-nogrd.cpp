@@ -33,12 +33,14 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "potential/2b/poly-2b-v6x.h"
+#include "tools/cpu_dispatch.h"
 
 namespace x2o {
 
 // note: x contains the distances:
 // d1(mon1) d1(mon2) ... d1(monnd) d2(mon1) d2(mon2) ...
-std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const double* x) {
+// Body of eval, inlined in one variant per instruction set
+static MBX_ALWAYS_INLINE std::vector<double> eval_kernel(const size_t nd, const double* a, const double* x) {
     std::vector<double> energy(nd, 0.0);
     for (size_t nv = 0; nv < nd; nv++) {
         const double t1 = a[510];
@@ -6148,4 +6150,8 @@ std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const do
     return energy;
 }
 
+std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const double* x) {
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return eval_kernel(nd, a, x); });
+}
+
 }  // namespace x2o
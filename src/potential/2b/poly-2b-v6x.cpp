@@ -33,10 +33,12 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "potential/2b/poly-2b-v6x.h"
+#include "tools/cpu_dispatch.h"
 
 namespace x2o {
 
-std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const double* x, double* g) {
+// Body of eval, inlined in one variant per instruction set
+static MBX_ALWAYS_INLINE std::vector<double> eval_kernel(const size_t nd, const double* a, const double* x, double* g) {
     std::vector<double> energy(nd, 0.0);
     for (size_t nv = 0; nv < nd; nv++) {
         double df[4138];
@@ -14032,4 +14034,8 @@ std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const do
     return energy;
 }
 
+std::vector<double> poly_2b_v6x::eval(const size_t nd, const double* a, const double* x, double* g) {
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return eval_kernel(nd, a, x, g); });
+}
+
 }  // namespace x2o
@@ -32,6 +32,9 @@ struct x2b_A1B4_A1B4_v1x {
     double eval(const double* xyz1, const double* xyz2, const size_t ndim) const;
     double eval(const double* xyz1, const double* xyz2, double* grad1, double* grad2, const size_t ndim, std::vector<double> *virial = 0) const;
     
+
+    // Distance between the first sites beyond which the polynomial is zero
+    double GetOuterRadius() const { return m_r2f; }
 private:
 
     double m_k_intra_AB;
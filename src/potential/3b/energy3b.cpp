@@ -37,40 +37,45 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 namespace e3b {
 
-double get_3b_energy(std::string mon1, std::string mon2, std::string mon3, size_t nm, std::vector<double> xyz1,
-                     std::vector<double> xyz2, std::vector<double> xyz3) {
+double get_3b_energy(std::string mon1, std::string mon2, std::string mon3, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, const std::vector<double> &xyz3) {
+    // Work on pointers so the ordering below does not copy the coordinates
+    const double *x1 = xyz1.data();
+    const double *x2 = xyz2.data();
+    const double *x3 = xyz3.data();
+
     // Order the three monomer names and corresponding xyz
     // Check if mon1 is the largest
     if (mon1 > mon2 and mon1 > mon3) {
         std::swap(mon1, mon3);
-        std::swap(xyz1, xyz3);
+        std::swap(x1, x3);
     // Check if mon2 is the largest
     } else if (mon2 > mon1 and mon2 > mon3) {
         std::swap(mon2, mon3);
-        std::swap(xyz2, xyz3);
+        std::swap(x2, x3);
     }
 
     // At this point mon3 is always the largest
     // Now sort mon1 and mon2
     if (mon1 > mon2) {
         std::swap(mon1, mon2);
-        std::swap(xyz1, xyz2);
+        std::swap(x1, x2);
     }
 
     if (mon1 == "h2o" and mon2 == "h2o" and mon3 == "h2o") {
         x2o::x3b_v2x pot;
-        return pot.eval(xyz1.data(), xyz2.data(), xyz3.data(), nm);
+        return pot.eval(x1, x2, x3, nm);
     } else if (mon1 == "h2o" and mon2 == "h2o" and (mon3 == "li" or mon3 == "na" or mon3 == "k" or mon3 == "rb")) {
         x3b_h2o_ion_v1x_deg4_filtered pot(mon3);
-        return pot(xyz1.data(), xyz2.data(), xyz3.data(), nm);
+        return pot(x1, x2, x3, nm);
     } else if (mon1 == "cs" and mon2 == "h2o" and mon3 == "h2o") {
         x3b_h2o_ion_v1x_deg4_filtered pot(mon1);
-        return pot(xyz2.data(), xyz3.data(), xyz1.data(), nm);
+        return pot(x2, x3, x1, nm);
     // =====>> BEGIN SECTION 3B_NO_GRADIENT <<=====
     // =====>> PASTE YOUR CODE BELOW <<=====
     } else if (mon1 == "ch4" and mon2 == "h2o" and mon3 == "h2o") {
         mbnrg_A1B4_C1D2_C1D2_deg3::mbnrg_A1B4_C1D2_C1D2_deg3_v1 pot(mon1, mon2, mon3);
-        return pot.eval(xyz1.data(), xyz2.data(), xyz3.data(), nm);
+        return pot.eval(x1, x2, x3, nm);
 
     // =====>> END SECTION 3B_NO_GRADIENT <<=====
     } else {
@@ -78,73 +83,88 @@ double get_3b_energy(std::string mon1, std::string mon2, std::string mon3, size_
     }
 }
 
-double get_3b_energy(std::string mon1, std::string mon2, std::string mon3, size_t nm, std::vector<double> xyz1,
-                     std::vector<double> xyz2, std::vector<double> xyz3, std::vector<double> &grad1,
+double get_3b_energy(std::string mon1, std::string mon2, std::string mon3, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, const std::vector<double> &xyz3, std::vector<double> &grad1,
                      std::vector<double> &grad2, std::vector<double> &grad3, std::vector<double> *virial) {
-    size_t index1(1), index2(2), index3(3);
+    // Work on pointers so the ordering below does not copy the coordinates
+    // and the gradients end up in the caller's buffers in the original order
+    const double *x1 = xyz1.data();
+    const double *x2 = xyz2.data();
+    const double *x3 = xyz3.data();
+    double *g1 = grad1.data();
+    double *g2 = grad2.data();
+    double *g3 = grad3.data();
 
     // Order the three monomer names and corresponding xyz
     // Check if mon1 is the largest
     if (mon1 > mon2 and mon1 > mon3) {
         std::swap(mon1, mon3);
-        std::swap(xyz1, xyz3);
-        std::swap(grad1, grad3);
-        std::swap(index1, index3);
+        std::swap(x1, x3);
+        std::swap(g1, g3);
     // Check if mon2 is the largest
     } else if (mon2 > mon1 and mon2 > mon3) {
         std::swap(mon2, mon3);
-        std::swap(xyz2, xyz3);
-        std::swap(grad2, grad3);
-        std::swap(index2, index3);
+        std::swap(x2, x3);
+        std::swap(g2, g3);
     }
 
     // At this point mon3 is always the largest
     // Now sort mon1 and mon2
     if (mon1 > mon2) {
         std::swap(mon1, mon2);
-        std::swap(xyz1, xyz2);
-        std::swap(grad1, grad2);
-        std::swap(index1, index2);
+        std::swap(x1, x2);
+        std::swap(g1, g2);
     }
     
     double energy = 0.0;
     // Note: in the conditional, mon2 >= mon1 ALWAYS
     if (mon1 == "h2o" and mon2 == "h2o" and mon3 == "h2o") {
         x2o::x3b_v2x pot;
-        energy = pot.eval(xyz1.data(), xyz2.data(), xyz3.data(), grad1.data(), grad2.data(), grad3.data(), nm, virial);
+        energy = pot.eval(x1, x2, x3, g1, g2, g3, nm, virial);
     } else if (mon1 == "h2o" and mon2 == "h2o" and (mon3 == "li" or mon3 == "na" or mon3 == "k" or mon3 == "rb")) {
         x3b_h2o_ion_v1x_deg4_filtered pot(mon3);
-        energy = pot(xyz1.data(), xyz2.data(), xyz3.data(), grad1.data(), grad2.data(), grad3.data(), nm, virial);
+        energy = pot(x1, x2, x3, g1, g2, g3, nm, virial);
     } else if (mon1 == "cs" and mon2 == "h2o" and mon3 == "h2o") {
         x3b_h2o_ion_v1x_deg4_filtered pot(mon1);
-        energy = pot(xyz2.data(), xyz3.data(), xyz1.data(), grad2.data(), grad3.data(), grad1.data(), nm, virial);
+        energy = pot(x2, x3, x1, g2, g3, g1, nm, virial);
     // =====>> BEGIN SECTION 3B_GRADIENT <<=====
     // =====>> PASTE YOUR CODE BELOW <<=====
     } else if (mon1 == "ch4" and mon2 == "h2o" and mon3 == "h2o") {
         mbnrg_A1B4_C1D2_C1D2_deg3::mbnrg_A1B4_C1D2_C1D2_deg3_v1 pot(mon1, mon2, mon3);
-        energy =  pot.eval(xyz1.data(), xyz2.data(), xyz3.data(), grad1.data(), grad2.data(), grad3.data(), nm, virial);
+        energy =  pot.eval(x1, x2, x3, g1, g2, g3, nm, virial);
 
     // =====>> END SECTION 3B_GRADIENT <<=====
     } else {
         energy = 0.0;
     }
 
-    if (index1 != 1) {
-        if (index2 == 1) {
-            std::swap(index1, index2);
-            std::swap(grad1, grad2);
-        } else if (index3 == 1) {
-            std::swap(index1, index3);
-            std::swap(grad1, grad3);
-        }  // else { error
-    }
+    return energy;
+}
 
-    if (index2 != 2) {
-        std::swap(index2, index3);
-        std::swap(grad2, grad3);
-    }
+double get_3b_cutoff(std::string mon1, std::string mon2, std::string mon3) {
+    // Order the three monomer names
+    if (mon1 > mon2) std::swap(mon1, mon2);
+    if (mon2 > mon3) std::swap(mon2, mon3);
+    if (mon1 > mon2) std::swap(mon1, mon2);
 
-    return energy;
+    if (mon1 == "h2o" and mon2 == "h2o" and mon3 == "h2o") {
+        return x2o::x3b_v2x::r3f;
+    } else if (mon1 == "h2o" and mon2 == "h2o" and (mon3 == "li" or mon3 == "na" or mon3 == "k" or mon3 == "rb")) {
+        x3b_h2o_ion_v1x_deg4_filtered pot(mon3);
+        return pot.m_r3f;
+    } else if (mon1 == "cs" and mon2 == "h2o" and mon3 == "h2o") {
+        x3b_h2o_ion_v1x_deg4_filtered pot(mon1);
+        return pot.m_r3f;
+    // =====>> BEGIN SECTION 3B_CUTOFF <<=====
+    // =====>> PASTE YOUR CODE BELOW <<=====
+    } else if (mon1 == "ch4" and mon2 == "h2o" and mon3 == "h2o") {
+        mbnrg_A1B4_C1D2_C1D2_deg3::mbnrg_A1B4_C1D2_C1D2_deg3_v1 pot(mon1, mon2, mon3);
+        return pot.GetOuterRadius();
+
+    // =====>> END SECTION 3B_CUTOFF <<=====
+    } else {
+        return 0.0;
+    }
 }
 
 }  // namespace e3b
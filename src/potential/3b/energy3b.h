@@ -74,8 +74,8 @@ namespace e3b {
  * @param[in] xyz3 coordinates of the monomer 3
  * @return Sum of the three-body energies of all the trimers passed as arguments
  */
-double get_3b_energy(std::string m1, std::string m2, std::string m3, size_t nm, std::vector<double> xyz1,
-                     std::vector<double> xyz2, std::vector<double> xyz3);
+double get_3b_energy(std::string m1, std::string m2, std::string m3, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, const std::vector<double> &xyz3);
 
 /**
  * @brief Gets the three body energy for a given set of trimers
@@ -95,9 +95,21 @@ double get_3b_energy(std::string m1, std::string m2, std::string m3, size_t nm,
  * @param[in,out] grad3 gradients of the monomer 3. Gradients will be updated
  * @return Sum of the three-body energies of all the trimers passed as arguments
  */
-double get_3b_energy(std::string m1, std::string m2, std::string m3, size_t nm, std::vector<double> xyz1,
-                     std::vector<double> xyz2, std::vector<double> xyz3, std::vector<double> &grd1,
+double get_3b_energy(std::string m1, std::string m2, std::string m3, size_t nm, const std::vector<double> &xyz1,
+                     const std::vector<double> &xyz2, const std::vector<double> &xyz3, std::vector<double> &grd1,
                      std::vector<double> &grd2, std::vector<double> &grd3,std::vector<double> *virial = 0);
 
+/**
+ * @brief Gets the outer radius of the three body polynomial of a trimer
+ *
+ * The polynomials are zero unless at least two of the distances between
+ * the first sites of the monomers are smaller than this radius.
+ * @param[in] m1 Monomer 1 id
+ * @param[in] m2 Monomer 2 id
+ * @param[in] m3 Monomer 3 id
+ * @return Outer radius of the polynomial, or 0 if there is no polynomial for this trimer
+ */
+double get_3b_cutoff(std::string m1, std::string m2, std::string m3);
+
 }  // namespace e3b
 #endif
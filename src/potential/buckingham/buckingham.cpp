@@ -36,78 +36,126 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 namespace buck {
 
+// Ids of the scratch buffers kept in workspace_
+enum BuckBuffer { kGrad1Pool = 0, kGrad2Pool, kEnergyPool, kVirialPool, kNumBuckBuffers };
+
 void Buckingham::Initialize(const std::vector<double> &sys_xyz,
                             const std::vector<std::string> &mon_id, const std::vector<size_t> &num_atoms,
                             const std::vector<std::pair<std::string, size_t> > &mon_type_count,
                             const bool do_grads = true, const std::vector<double> &box = {}) {
-    sys_xyz_ = sys_xyz;
     mon_id_ = mon_id;
     num_atoms_ = num_atoms;
     mon_type_count_ = mon_type_count;
+    systools::GetExcludedByType(mon_type_count_, exc12_, exc13_, exc14_);
     do_grads_ = do_grads;
     box_ = box;
     box_inverse_ = box.size() ? InvertUnitCell(box) : std::vector<double>{};
     use_pbc_ = box.size();
     
 
-    natoms_ = sys_xyz_.size() / 3;
+    natoms_ = sys_xyz.size() / 3;
     size_t natoms3 = 3 * natoms_;
-    xyz_ = std::vector<double>(natoms3, 0.0);
     grad_ = std::vector<double>(natoms3, 0.0);
     sys_grad_ = std::vector<double>(natoms3, 0.0);
     virial_ = std::vector<double>(9,0.0);
+    workspace_ = tools::Workspace(kNumBuckBuffers);
+    buck_pairs_.clear();
+    use_pair_list_ = false;
+
+    // Atoms of each monomer are consecutive in the vectors given to SetNewParameters
+    std::vector<size_t> first_index(num_atoms_.size(), 0);
+    for (size_t m = 1; m < num_atoms_.size(); m++) first_index[m] = first_index[m - 1] + num_atoms_[m - 1];
+    own_sites_.SetLayout(mon_type_count_, num_atoms_, first_index);
+    own_sites_.Gather(sys_xyz.data());
+    sites_ = &own_sites_;
+    xyz_ = own_sites_.GetXyz().data();
+
+    SetUpPairParameters();
+    GetExpTable();
+}
+
+void Buckingham::SetUpPairParameters() {
+    size_t ntypes = mon_type_count_.size();
+    do_buck_ = std::vector<bool>(ntypes * ntypes, false);
+    pair_a_b_ = std::vector<std::vector<double> >(ntypes * ntypes);
+
+    size_t fi_mon1 = 0;
+    for (size_t mt1 = 0; mt1 < ntypes; mt1++) {
+        size_t ns1 = num_atoms_[fi_mon1];
+        size_t fi_mon2 = 0;
+        for (size_t mt2 = 0; mt2 < ntypes; mt2++) {
+            size_t ns2 = num_atoms_[fi_mon2];
+            std::vector<double> &a_b = pair_a_b_[mt1 * ntypes + mt2];
+            a_b = std::vector<double>(2 * ns1 * ns2, 0.0);
+            for (size_t i = 0; i < ns1; i++) {
+                for (size_t j = 0; j < ns2; j++) {
+                    do_buck_[mt1 * ntypes + mt2] = GetBuckParams(mon_id_[fi_mon1], mon_id_[fi_mon2], i, j, buck_pairs_,
+                                                                 a_b[2 * (i * ns2 + j)], a_b[2 * (i * ns2 + j) + 1]);
+                }
+            }
+            fi_mon2 += mon_type_count_[mt2].second;
+        }
+        fi_mon1 += mon_type_count_[mt1].second;
+    }
+}
+
+void Buckingham::SetPairList(const std::vector<size_t> &pairs) {
+    use_pair_list_ = pairs.size();
+    if (!use_pair_list_) return;
 
-    ReorderData();
+    // Count the neighbors of each monomer and store them as a compressed list
+    size_t nmon = num_atoms_.size();
+    neighbor_start_.assign(nmon + 1, 0);
+    for (size_t k = 0; k < pairs.size(); k += 2) {
+        neighbor_start_[std::min(pairs[k], pairs[k + 1]) + 1]++;
+    }
+    for (size_t m = 0; m < nmon; m++) {
+        neighbor_start_[m + 1] += neighbor_start_[m];
+    }
+    neighbors_.resize(pairs.size() / 2);
+    std::vector<size_t> next(neighbor_start_.begin(), neighbor_start_.end() - 1);
+    for (size_t k = 0; k < pairs.size(); k += 2) {
+        size_t m1 = std::min(pairs[k], pairs[k + 1]);
+        neighbors_[next[m1]++] = std::max(pairs[k], pairs[k + 1]);
+    }
+    for (size_t m = 0; m < nmon; m++) {
+        std::sort(neighbors_.begin() + neighbor_start_[m], neighbors_.begin() + neighbor_start_[m + 1]);
+    }
 }
 
 void Buckingham::SetNewParameters(const std::vector<double> &xyz, 
                                   const std::vector<std::pair<std::string,std::string> > &buck_pairs, 
                                   bool do_grads = true, const double cutoff = 100.0, 
                                   const std::vector<double> &box = {}) {
-    sys_xyz_ = xyz;
+    if (xyz.size() != 3 * natoms_) {
+        std::string text = "Expected " + std::to_string(3 * natoms_) + " coordinates, got " +
+                           std::to_string(xyz.size()) + ".";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    own_sites_.Gather(xyz.data());
+    SetNewParameters(own_sites_, buck_pairs, do_grads, cutoff, box);
+}
+
+void Buckingham::SetNewParameters(const tools::SiteStore &sites,
+                                  const std::vector<std::pair<std::string,std::string> > &buck_pairs,
+                                  bool do_grads, const double cutoff, const std::vector<double> &box) {
+    if (sites.GetNumSites() != natoms_) {
+        std::string text = "The store has " + std::to_string(sites.GetNumSites()) + " sites, but there are " +
+                           std::to_string(natoms_) + " atoms.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    sites_ = &sites;
+    xyz_ = sites.GetXyz().data();
     box_ = box;
     box_inverse_ = box.size() ? InvertUnitCell(box) : std::vector<double>{};
     use_pbc_ = box.size();
     do_grads_ = do_grads;
     cutoff_ = cutoff;
-    buck_pairs_ = buck_pairs;
-    std::fill(grad_.begin(), grad_.end(), 0.0);
-
-    ReorderData();
-}
-
-void Buckingham::ReorderData() {
-    // Organize xyz so we have
-    // x1_1 x1_2 ... y1_1 y1_2... z1_1 z1_2 ... x2_1 x2_2 ...
-    // where xN_M is read as coordinate x of site N of monomer M
-    // for the first monomer type. Then follows the second, and so on.
-    // As an example, for a water dimer (OHHM), the system xyz would be
-    // sys_xyz = {Ox, Oy, Oz, Hx, Hy, Hz, Hx, Hy, ...}
-    // And after reordering,
-    // xyz = {Ox, Ox, Oy, Oy, Oz, Oz, Hx, Hx, Hy, Hy, Hz, Hz, Hx, Hx, ... ...}
-
-    size_t fi_mon = 0;
-    size_t fi_crd = 0;
-    size_t fi_sites = 0;
-    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
-        size_t ns = num_atoms_[fi_mon];
-        size_t nmon = mon_type_count_[mt].second;
-        size_t nmon2 = nmon * 2;
-        for (size_t m = 0; m < nmon; m++) {
-            size_t mns = m * ns;
-            size_t mns3 = mns * 3;
-            for (size_t i = 0; i < ns; i++) {
-                size_t inmon = i * nmon;
-                size_t inmon3 = 3 * inmon;
-                xyz_[inmon3 + m + fi_crd] = sys_xyz_[fi_crd + mns3 + 3 * i];
-                xyz_[inmon3 + m + fi_crd + nmon] = sys_xyz_[fi_crd + mns3 + 3 * i + 1];
-                xyz_[inmon3 + m + fi_crd + nmon2] = sys_xyz_[fi_crd + mns3 + 3 * i + 2];
-            }
-        }
-        fi_mon += nmon;
-        fi_sites += nmon * ns;
-        fi_crd += nmon * ns * 3;
+    if (buck_pairs != buck_pairs_) {
+        buck_pairs_ = buck_pairs;
+        SetUpPairParameters();
     }
+    std::fill(grad_.begin(), grad_.end(), 0.0);
 }
 
 double Buckingham::GetRepulsion(std::vector<double> &grad, std::vector<double> *virial) {
@@ -134,29 +182,8 @@ double Buckingham::GetRepulsion(std::vector<double> &grad, std::vector<double> *
         (*virial)[8] += virial_[8];
     }
 
-    size_t fi_mon = 0;
-    size_t fi_crd = 0;
-    size_t fi_sites = 0;
-    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
-        size_t ns = num_atoms_[fi_mon];
-        size_t nmon = mon_type_count_[mt].second;
-        size_t nmon2 = nmon * 2;
-        for (size_t m = 0; m < nmon; m++) {
-            size_t mns = m * ns;
-            size_t mns3 = mns * 3;
-            for (size_t i = 0; i < ns; i++) {
-                size_t inmon = i * nmon;
-                size_t inmon3 = 3 * inmon;
-
-                grad[fi_crd + mns3 + 3 * i] += grad_[inmon3 + m + fi_crd];
-                grad[fi_crd + mns3 + 3 * i + 1] += grad_[inmon3 + m + fi_crd + nmon];
-                grad[fi_crd + mns3 + 3 * i + 2] += grad_[inmon3 + m + fi_crd + nmon2];
-            }
-        }
-        fi_mon += nmon;
-        fi_sites += nmon * ns;
-        fi_crd += nmon * ns * 3;
-    }
+    // Gradients go straight to the sites of the store
+    sites_->ScatterAdd(grad_.data(), grad.data());
 
     return rep_energy_;
 }
@@ -172,6 +199,7 @@ void Buckingham::CalculateRepulsion() {
         if (omp_get_thread_num() == 0) nthreads = omp_get_num_threads();
     }
 #endif
+    workspace_.SetNumThreads(nthreads);
 
     // This part looks at sites inside the same monomer
     // Reset first indexes
@@ -179,30 +207,29 @@ void Buckingham::CalculateRepulsion() {
     size_t fi_crd = 0;
     size_t fi_sites = 0;
 
-    // Excluded sets
-    excluded_set_type exc12;
-    excluded_set_type exc13;
-    excluded_set_type exc14;
+    size_t ntypes = mon_type_count_.size();
 
     // Loop over each monomer type
-    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+    for (size_t mt = 0; mt < ntypes; mt++) {
 
         size_t ns = num_atoms_[fi_mon];
         size_t nmon = mon_type_count_[mt].second;
         size_t nmon2 = 2 * nmon;
 
         // Check if buckingham needs to be done. Otherwise, skip.
-        double dummy_a;
-        double dummy_b;
-        bool do_buck = GetBuckParams(mon_id_[fi_mon], mon_id_[fi_mon], 0, 0, buck_pairs_, dummy_a, dummy_b);
-        if (do_buck) {
+        if (do_buck_[mt * ntypes + mt]) {
+            const std::vector<double> &a_b = pair_a_b_[mt * ntypes + mt];
 
             // Obtain excluded pairs for monomer type mt
-            systools::GetExcluded(mon_id_[fi_mon], exc12, exc13, exc14);
+            const excluded_set_type &exc12 = exc12_[mt];
+            const excluded_set_type &exc13 = exc13_[mt];
+            const excluded_set_type &exc14 = exc14_[mt];
     
-            std::vector<std::vector<double> > grad_pool(nthreads,std::vector<double>(nmon * ns * 3,0.0));
-            std::vector<double> energy_pool(nthreads,0.0);
-            std::vector<std::vector<double> > virial_pool(nthreads,std::vector<double>(9,0.0));
+            std::vector<double> &energy_pool = workspace_.Get(kEnergyPool, nthreads);
+            for (size_t i = 0; i < nthreads; i++) {
+                workspace_.Get(kGrad1Pool, nmon * ns * 3, i);
+                workspace_.Get(kVirialPool, 9, i);
+            }
             
             // Loop over each pair of sites
             for (size_t i = 0; i < ns - 1; i++) {
@@ -217,8 +244,8 @@ void Buckingham::CalculateRepulsion() {
     
                     if (is_excluded) continue;
     
-                    double a, b;
-                    GetBuckParams(mon_id_[fi_mon], mon_id_[fi_mon], i, j, buck_pairs_, a, b);
+                    double a = a_b[2 * (i * ns + j)];
+                    double b = a_b[2 * (i * ns + j) + 1];
     
     #ifdef _OPENMP
     #pragma omp parallel for schedule(dynamic)
@@ -228,30 +255,35 @@ void Buckingham::CalculateRepulsion() {
     #ifdef _OPENMP
                         rank = omp_get_thread_num();
     #endif
+                        std::vector<double> &grad_pool = workspace_.At(kGrad1Pool, rank);
+                        std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                         double p1[3], g1[3];
                         p1[0] = xyz_[fi_crd + inmon3 + m];
                         p1[1] = xyz_[fi_crd + inmon3 + nmon + m];
                         p1[2] = xyz_[fi_crd + inmon3 + nmon2 + m];
                         std::fill(g1, g1 + 3, 0.0);
-                        energy_pool[rank] += Repulsion(a, b, p1, xyz_.data() + fi_crd, g1, grad_pool[rank].data(), 
+                        energy_pool[rank] += Repulsion(a, b, p1, xyz_ + fi_crd, g1, grad_pool.data(), 
                                               nmon, nmon, m, m + 1, i, j, 
-                                              do_grads_, cutoff_, box_, box_inverse_, &virial_pool[rank]);
+                                              do_grads_, cutoff_, box_, box_inverse_,
+                                              calc_virial_ ? &virial_pool : 0);
     
-                        grad_pool[rank][inmon3 + m] += g1[0];
-                        grad_pool[rank][inmon3 + nmon + m] += g1[1];
-                        grad_pool[rank][inmon3 + nmon2 + m] += g1[2];
+                        grad_pool[inmon3 + m] += g1[0];
+                        grad_pool[inmon3 + nmon + m] += g1[1];
+                        grad_pool[inmon3 + nmon2 + m] += g1[2];
                     }
                 }
             }
     
             // Compress data in phi and grad
             for (size_t rank = 0; rank < nthreads; rank++) {
-                size_t kend = grad_pool[rank].size();
+                std::vector<double> &grad_pool = workspace_.At(kGrad1Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+                size_t kend = grad_pool.size();
                 for (size_t k = 0; k < kend; k++) {
-                    grad_[fi_crd + k] += grad_pool[rank][k];
+                    grad_[fi_crd + k] += grad_pool[k];
                 }
                 for (size_t k = 0; k<9;k++) {
-                     virial_[k] -= virial_pool[rank][k]; // -= bc the atomindeces are switched relative to dlpoly
+                     virial_[k] -= virial_pool[k]; // -= bc the atomindeces are switched relative to dlpoly
                 }
                 rep_energy_ += energy_pool[rank];
             }
@@ -273,7 +305,7 @@ void Buckingham::CalculateRepulsion() {
     size_t fi_crd2 = 0;
 
     // Loop over all monomer types
-    for (size_t mt1 = 0; mt1 < mon_type_count_.size(); mt1++) {
+    for (size_t mt1 = 0; mt1 < ntypes; mt1++) {
         size_t ns1 = num_atoms_[fi_mon1];
         size_t nmon1 = mon_type_count_[mt1].second;
         size_t nmon12 = nmon1 * 2;
@@ -283,25 +315,25 @@ void Buckingham::CalculateRepulsion() {
 
         // For each monomer type mt1, loop over all the other monomer types
         // mt2 >= mt1 to avoid double counting
-        for (size_t mt2 = mt1; mt2 < mon_type_count_.size(); mt2++) {
+        for (size_t mt2 = mt1; mt2 < ntypes; mt2++) {
 
             size_t ns2 = num_atoms_[fi_mon2];
             size_t nmon2 = mon_type_count_[mt2].second;
 
-            double dummy_a;
-            double dummy_b;
-            bool do_buck = GetBuckParams(mon_id_[fi_mon1], mon_id_[fi_mon2], 0, 0, buck_pairs_, dummy_a, dummy_b);
-            if (do_buck) {
+            if (do_buck_[mt1 * ntypes + mt2]) {
+                const std::vector<double> &a_b = pair_a_b_[mt1 * ntypes + mt2];
 
                 // Check if monomer types 1 and 2 are the same
                 // If so, same monomer won't be done, since it has been done in
                 // previous loop.
                 bool same = (mt1 == mt2);
     
-                std::vector<std::vector<double> > grad1_pool(nthreads, std::vector<double>(nmon1 * ns1 * 3,0.0));
-                std::vector<std::vector<double> > grad2_pool(nthreads, std::vector<double>(nmon2 * ns2 * 3,0.0));
-                std::vector<double> energy_pool(nthreads,0.0);
-                std::vector<std::vector<double> > virial_pool(nthreads,std::vector<double>(9,0.0));
+                std::vector<double> &energy_pool = workspace_.Get(kEnergyPool, nthreads);
+                for (size_t i = 0; i < nthreads; i++) {
+                    workspace_.Get(kGrad1Pool, nmon1 * ns1 * 3, i);
+                    workspace_.Get(kGrad2Pool, nmon2 * ns2 * 3, i);
+                    workspace_.Get(kVirialPool, 9, i);
+                }
     #ifdef _OPENMP
     #pragma omp parallel for schedule(dynamic)
     #endif
@@ -310,42 +342,69 @@ void Buckingham::CalculateRepulsion() {
     #ifdef _OPENMP
                     rank = omp_get_thread_num();
     #endif
+                    std::vector<double> &grad1_pool = workspace_.At(kGrad1Pool, rank);
+                    std::vector<double> &grad2_pool = workspace_.At(kGrad2Pool, rank);
+                    std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                     size_t m2init = same ? m1 + 1 : 0;
+
+                    // With a pair list, only the neighbors of m1 of type mt2 are visited.
+                    // They are stored with indexes larger than m1, so "same" needs no check.
+                    const size_t *neigh_begin = 0;
+                    size_t nneigh = 0;
+                    if (use_pair_list_) {
+                        const size_t *first = neighbors_.data() + neighbor_start_[fi_mon1 + m1];
+                        const size_t *last = neighbors_.data() + neighbor_start_[fi_mon1 + m1 + 1];
+                        neigh_begin = std::lower_bound(first, last, fi_mon2);
+                        nneigh = std::lower_bound(neigh_begin, last, fi_mon2 + nmon2) - neigh_begin;
+                        if (nneigh == 0) continue;
+                    }
+
                     for (size_t i = 0; i < ns1; i++) {
                         size_t inmon1 = i * nmon1;
                         size_t inmon13 = inmon1 * 3;
-                        std::vector<double> xyz_sitei(3);
-                        std::vector<double> g1(3, 0.0);
+                        double xyz_sitei[3];
+                        double g1[3] = {0.0, 0.0, 0.0};
                         xyz_sitei[0] = xyz_[fi_crd1 + inmon13 + m1];
                         xyz_sitei[1] = xyz_[fi_crd1 + inmon13 + nmon1 + m1];
                         xyz_sitei[2] = xyz_[fi_crd1 + inmon13 + 2 * nmon1 + m1];
     
                         for (size_t j = 0; j < ns2; j++) {
-                            double a, b;
-                            GetBuckParams(mon_id_[fi_mon1], mon_id_[fi_mon2], i, j, buck_pairs_, a, b);
-                            energy_pool[rank] +=
-                                Repulsion(a, b, xyz_sitei.data(), xyz_.data() + fi_crd2, g1.data(),
-                                      grad2_pool[rank].data(), nmon1, nmon2, m2init, nmon2,
-                                      i, j, do_grads_, cutoff_, box_, box_inverse_,&virial_pool[rank]);
+                            double a = a_b[2 * (i * ns2 + j)];
+                            double b = a_b[2 * (i * ns2 + j) + 1];
+                            if (use_pair_list_) {
+                                energy_pool[rank] += RepulsionList(
+                                    a, b, xyz_sitei, xyz_ + fi_crd2, g1, grad2_pool.data(), nmon2, j,
+                                    neigh_begin, nneigh, fi_mon2, do_grads_, cutoff_, box_, box_inverse_,
+                                    calc_virial_ ? &virial_pool : 0);
+                            } else {
+                                energy_pool[rank] +=
+                                    Repulsion(a, b, xyz_sitei, xyz_ + fi_crd2, g1,
+                                          grad2_pool.data(), nmon1, nmon2, m2init, nmon2,
+                                          i, j, do_grads_, cutoff_, box_, box_inverse_,
+                                          calc_virial_ ? &virial_pool : 0);
+                            }
                         }
-                        grad1_pool[rank][inmon13 + m1] += g1[0];
-                        grad1_pool[rank][inmon13 + nmon1 + m1] += g1[1];
-                        grad1_pool[rank][inmon13 + nmon12 + m1] += g1[2];
+                        grad1_pool[inmon13 + m1] += g1[0];
+                        grad1_pool[inmon13 + nmon1 + m1] += g1[1];
+                        grad1_pool[inmon13 + nmon12 + m1] += g1[2];
                     }
                 }
     
                 // Compress data in Efq and phi
                 for (size_t rank = 0; rank < nthreads; rank++) {
-                    size_t kend1 = grad1_pool[rank].size();
-                    size_t kend2 = grad2_pool[rank].size();
+                    std::vector<double> &grad1_pool = workspace_.At(kGrad1Pool, rank);
+                    std::vector<double> &grad2_pool = workspace_.At(kGrad2Pool, rank);
+                    std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+                    size_t kend1 = grad1_pool.size();
+                    size_t kend2 = grad2_pool.size();
                     for (size_t k = 0; k < kend1; k++) {
-                        grad_[fi_crd1 + k] += grad1_pool[rank][k];
+                        grad_[fi_crd1 + k] += grad1_pool[k];
                     }
                     for (size_t k = 0; k < kend2; k++) {
-                        grad_[fi_crd2 + k] += grad2_pool[rank][k];
+                        grad_[fi_crd2 + k] += grad2_pool[k];
                     }
                     for (size_t k = 0; k<9;k++) {
-                        virial_[k] -= virial_pool[rank][k]; // -= bc the atomindeces are switched relative to dlpoly
+                        virial_[k] -= virial_pool[k]; // -= bc the atomindeces are switched relative to dlpoly
                     }
 
                     rep_energy_ += energy_pool[rank];
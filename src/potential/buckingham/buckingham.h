@@ -45,6 +45,8 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "tools/definitions.h"
 #include "bblock/sys_tools.h"
 #include "tools/math_tools.h"
+#include "tools/workspace.h"
+#include "tools/site_store.h"
 
 //#include "helpme.h"
 
@@ -67,6 +69,24 @@ class Buckingham {
                           bool do_grads, const double cutoff,
                           const std::vector<double> &box);
 
+    /**
+     * @brief Sets the new coordinates from a store shared with other terms.
+     *
+     * The store must hold the atoms of the monomers given in Initialize, and
+     * is not copied, so it has to be alive until GetRepulsion returns. The
+     * gradients of GetRepulsion are then added at the first indexes of the
+     * store instead of in the order of the atoms.
+     *
+     * @param[in] sites Coordinates of the atoms
+     * @param[in] buck_pairs Pairs of monomer types that use the repulsion
+     * @param[in] do_grads If true, the gradients will be computed
+     * @param[in] cutoff Cutoff of the interactions
+     * @param[in] box Box of the system, empty if not periodic
+     */
+    void SetNewParameters(const tools::SiteStore &sites,
+                          const std::vector<std::pair<std::string,std::string> > &buck_pairs,
+                          bool do_grads, const double cutoff, const std::vector<double> &box);
+
     /**
      * @brief Sets the cutoff for dispersion interactions
      *
@@ -74,23 +94,60 @@ class Buckingham {
      */
     void SetCutoff(double cutoff);
 
+    /**
+     * @brief Sets the monomer pairs used in the intermolecular repulsion.
+     *
+     * Pairs are given as consecutive monomer indexes in the order of the
+     * coordinates, like the dimers of the 2B search. Pairs not in the list
+     * are skipped. An empty vector goes back to looping over all pairs.
+     *
+     * @param[in] pairs Monomer pairs {m1, m2, m1', m2', ...}
+     */
+    void SetPairList(const std::vector<size_t> &pairs);
+
+    /**
+     * @brief Gets the number of times the scratch buffers had to grow
+     *
+     * @return Number of times the scratch buffers grew since initialization
+     */
+    size_t GetNumBufferResizes() const { return workspace_.GetNumBufferResizes(); }
+
    private:
-    void ReorderData();
+    void SetUpPairParameters();
     void CalculateRepulsion();
 
-    // System xyz, not ordered XYZ. xyzxyz...(mon1)xyzxyz...(mon2) ...
-    std::vector<double> sys_xyz_;
-    // System xyz, ordered XYZ. xx..yy..zz(mon1) xx..yy..zz(mon2) ...
-    std::vector<double> xyz_;
+    // Coordinates given to SetNewParameters as a vector, xyzxyz...(mon1)xyzxyz...(mon2) ...
+    tools::SiteStore own_sites_;
+    // Store the coordinates are read from, own_sites_ or a shared one
+    const tools::SiteStore *sites_ = 0;
+    // System xyz, ordered XYZ. xx..yy..zz(mon1) xx..yy..zz(mon2) ..., from sites_
+    const double *xyz_ = 0;
     // Name of the monomers (h2o, f...)
     std::vector<std::string> mon_id_;
     // Number of sites of each mon
     std::vector<size_t> num_atoms_;
     // monomers of each type.
     std::vector<std::pair<std::string, size_t> > mon_type_count_;
+    // Excluded pairs 1-2, 1-3 and 1-4 of each monomer type
+    std::vector<excluded_set_type> exc12_;
+    std::vector<excluded_set_type> exc13_;
+    std::vector<excluded_set_type> exc14_;
 
     // pairs that will use the buckingham
     std::vector<std::pair<std::string,std::string> > buck_pairs_;
+    // Whether each pair of monomer types uses buckingham: do_buck_[mt1 * ntypes + mt2]
+    std::vector<bool> do_buck_;
+    // A and b of every pair of sites, for each pair of monomer types.
+    // pair_a_b_[mt1 * ntypes + mt2][2 * (i * ns2 + j)] is the A between site i
+    // of type mt1 and site j of type mt2, and the next element is the b.
+    std::vector<std::vector<double> > pair_a_b_;
+
+    // Neighbors of each monomer with larger index, when a pair list is used.
+    // Neighbors of monomer m are neighbors_[neighbor_start_[m] .. neighbor_start_[m + 1]),
+    // sorted.
+    bool use_pair_list_ = false;
+    std::vector<size_t> neighbor_start_;
+    std::vector<size_t> neighbors_;
 
     // Bool that if true will perform the gradients calculation.
     bool do_grads_;
@@ -119,6 +176,8 @@ class Buckingham {
     bool use_pbc_;
     // dispersion cutoff
     double cutoff_;
+    // Scratch buffers reused between calls
+    tools::Workspace workspace_;
 };
 
 }  // namespace disp
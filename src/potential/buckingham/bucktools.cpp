@@ -40,106 +40,273 @@ namespace buck {
 
 //----------------------------------------------------------------------------//
 
-double Repulsion(const double a, const double b, const double* p1, const double* xyz2,
-             double* grad1, double* grad2, const size_t nmon1, const size_t nmon2,
-             const size_t start2, const size_t end2, const size_t atom_index1, const size_t atom_index2,
-             bool do_grads, const double cutoff,                                 
-             const std::vector<double>& box, const std::vector<double>& box_inverse,std::vector<double> *virial) {
+ExpTable::ExpTable(const double xmax, const double dx) {
+    size_t n = static_cast<size_t>(std::ceil(xmax / dx));
+    dx_ = dx;
+    inv_dx_ = 1.0 / dx;
+    nintervals_ = n;
+    table_ = std::vector<double>(n + 1, 0.0);
+    for (size_t k = 0; k < n; k++) table_[k] = std::exp(-(k * dx));
+}
+
+//----------------------------------------------------------------------------//
+
+const ExpTable& GetExpTable() {
+    static const ExpTable table;
+    return table;
+}
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+// Minimum image convention for the distance vector (dx, dy, dz)
+inline void MinimumImage(const double* boxptr, const double* boxinv, double& dx, double& dy, double& dz) {
+    double tmp1 = boxinv[0] * dx + boxinv[1] * dy + boxinv[2] * dz;
+    double tmp2 = boxinv[3] * dx + boxinv[4] * dy + boxinv[5] * dz;
+    double tmp3 = boxinv[6] * dx + boxinv[7] * dy + boxinv[8] * dz;
+
+    tmp1 -= std::floor(tmp1 + 0.5);
+    tmp2 -= std::floor(tmp2 + 0.5);
+    tmp3 -= std::floor(tmp3 + 0.5);
+
+    dx = boxptr[0] * tmp1 + boxptr[1] * tmp2 + boxptr[2] * tmp3;
+    dy = boxptr[3] * tmp1 + boxptr[4] * tmp2 + boxptr[5] * tmp3;
+    dz = boxptr[6] * tmp1 + boxptr[7] * tmp2 + boxptr[8] * tmp3;
+}
+
+// Switched repulsion a exp(-b r) of a pair at distance r <= cutoff.
+// Returns the energy, and in grad the derivative divided by -r.
+inline double RepulsionPair(const double a, const double b, const double r, const double cutoff,
+                            const ExpTable& exp_table, double& grad) {
+    const double fac = a * exp_table.Eval(b * r);
+
+    double ttsw_grad = 0;
+    const double ttsw = switch_function(r, cutoff - 1.0, cutoff, ttsw_grad);
+
+    // TODO check that this is correct and gradients are properly calculated
+    // in switch area
+    // Complciated due to the small energy/grad in this area.
+    grad = ttsw * (b * fac / r) - ttsw_grad * fac / r;
+
+    return ttsw * fac;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+// Body of Repulsion. Without kVirial the virial accumulations are compiled out.
+template <bool kVirial>
+double RepulsionKernel(const double a, const double b, const double* p1, const double* xyz2, double* grad1,
+                       double* grad2, const size_t nmon1, const size_t nmon2, const size_t start2, const size_t end2,
+                       const size_t atom_index1, const size_t atom_index2, bool do_grads, const double cutoff,
+                       const std::vector<double>& box, const std::vector<double>& box_inverse,
+                       std::vector<double> *virial) {
 
     size_t nmon22 = nmon2 * 2;
 
     size_t shift2 = atom_index2 * nmon2 * 3;
 
     bool use_pbc = box.size();
-    double g1[3], g2[3 * nmon2];
-    std::fill(g1, g1 + 3, 0.0);
+    double g2[3 * nmon2];
     std::fill(g2, g2 + 3 * nmon2, 0.0);
     const double* boxinv = box_inverse.data();
     const double* boxptr = box.data();
+    const ExpTable& exp_table = GetExpTable();
+
+    // Accumulate in scalars so that the loop can be vectorized over nv
     double repulsion_energy = 0;
+    double g1x = 0, g1y = 0, g1z = 0;
+    double vxx = 0, vxy = 0, vxz = 0, vyy = 0, vyz = 0, vzz = 0;
+#pragma omp simd reduction(+ : repulsion_energy, g1x, g1y, g1z, vxx, vxy, vxz, vyy, vyz, vzz)
     for (size_t nv = start2; nv < end2; nv++) {
         double dx = p1[0] - xyz2[shift2 + nv];
         double dy = p1[1] - xyz2[nmon2 + shift2 + nv];
         double dz = p1[2] - xyz2[nmon22 + shift2 + nv];
 
         // Apply minimum image convetion
-        if (use_pbc) {
-            double tmp1 = boxinv[0] * dx + boxinv[1] * dy + boxinv[2] * dz;
-            double tmp2 = boxinv[3] * dx + boxinv[4] * dy + boxinv[5] * dz;
-            double tmp3 = boxinv[6] * dx + boxinv[7] * dy + boxinv[8] * dz;
-
-            tmp1 -= std::floor(tmp1 + 0.5);
-            tmp2 -= std::floor(tmp2 + 0.5);
-            tmp3 -= std::floor(tmp3 + 0.5);
-
-            dx = boxptr[0] * tmp1 + boxptr[1] * tmp2 + boxptr[2] * tmp3;
-            dy = boxptr[3] * tmp1 + boxptr[4] * tmp2 + boxptr[5] * tmp3;
-            dz = boxptr[6] * tmp1 + boxptr[7] * tmp2 + boxptr[8] * tmp3;
-        }
+        if (use_pbc) MinimumImage(boxptr, boxinv, dx, dy, dz);
 
         const double rsq = dx * dx + dy * dy + dz * dz;
         const double r = std::sqrt(rsq);
 
-        const double inv_r = 1.0 / r;
-
-        // If using cutoff, check for distances and get proper dispersion
+        // If using cutoff, check for distances and get proper repulsion
         if (r <= cutoff) {
-            const double br = -b * r;
-            const double fac = a * exp(br);
-
-            double ttsw_grad = 0;
-            const double ttsw = switch_function(r, cutoff - 1.0, cutoff, ttsw_grad);
-
-            repulsion_energy += ttsw * fac;
+            double grad;
+            repulsion_energy += RepulsionPair(a, b, r, cutoff, exp_table, grad);
 
             if (do_grads) {
-                // TODO check that this is correct and gradients are properly calculated
-                // in switch area
-                // Complciated due to the small energy/grad in this area.
-                const double grad = ttsw * (b * inv_r * fac) - ttsw_grad * fac / r ;
-
-                g1[0] -= dx * grad;
+                g1x -= dx * grad;
                 g2[nv] += dx * grad;
 
-                g1[1] -= dy * grad;
+                g1y -= dy * grad;
                 g2[nmon2 + nv] += dy * grad;
 
-                g1[2] -= dz * grad;
+                g1z -= dz * grad;
                 g2[nmon22 + nv] += dz * grad;
 
-                if (virial != 0) {
-
-		    (*virial)[0] -= dx * dx * grad;
-                    (*virial)[1] -= dx * dy * grad;
-                    (*virial)[2] -= dx * dz * grad;
-                    (*virial)[4] -= dy * dy * grad;
-                    (*virial)[5] -= dy * dz * grad;
-                    (*virial)[8] -= dz * dz * grad;
-                    
-                    (*virial)[3] = (*virial)[1];
-                    (*virial)[6] = (*virial)[2];
-                    (*virial)[7] = (*virial)[5];
-
+                if (kVirial) {
+                    vxx -= dx * dx * grad;
+                    vxy -= dx * dy * grad;
+                    vxz -= dx * dz * grad;
+                    vyy -= dy * dy * grad;
+                    vyz -= dy * dz * grad;
+                    vzz -= dz * dz * grad;
                 }
             }
         }
     }
 
     if (do_grads) {
-        grad1[0] += g1[0];
-        grad1[1] += g1[1];
-        grad1[2] += g1[2];
+        grad1[0] += g1x;
+        grad1[1] += g1y;
+        grad1[2] += g1z;
         for (size_t i = start2; i < end2; i++) {
             grad2[shift2 + i] += g2[i];
             grad2[shift2 + nmon2 + i] += g2[nmon2 + i];
             grad2[shift2 + nmon22 + i] += g2[nmon22 + i];
         }
+
+        if (kVirial) {
+            (*virial)[0] += vxx;
+            (*virial)[1] += vxy;
+            (*virial)[2] += vxz;
+            (*virial)[4] += vyy;
+            (*virial)[5] += vyz;
+            (*virial)[8] += vzz;
+
+            (*virial)[3] = (*virial)[1];
+            (*virial)[6] = (*virial)[2];
+            (*virial)[7] = (*virial)[5];
+        }
+    }
+
+    return repulsion_energy;
+}
+
+}  // namespace
+
+double Repulsion(const double a, const double b, const double* p1, const double* xyz2,
+             double* grad1, double* grad2, const size_t nmon1, const size_t nmon2,
+             const size_t start2, const size_t end2, const size_t atom_index1, const size_t atom_index2,
+             bool do_grads, const double cutoff,                                 
+             const std::vector<double>& box, const std::vector<double>& box_inverse,std::vector<double> *virial) {
+    if (virial != 0) {
+        return RepulsionKernel<true>(a, b, p1, xyz2, grad1, grad2, nmon1, nmon2, start2, end2, atom_index1, atom_index2,
+                                     do_grads, cutoff, box, box_inverse, virial);
+    }
+    return RepulsionKernel<false>(a, b, p1, xyz2, grad1, grad2, nmon1, nmon2, start2, end2, atom_index1, atom_index2,
+                                  do_grads, cutoff, box, box_inverse, virial);
+}
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+// Body of RepulsionList. Without kVirial the virial accumulations are compiled out.
+template <bool kVirial>
+double RepulsionListKernel(const double a, const double b, const double* p1, const double* xyz2, double* grad1,
+                           double* grad2, const size_t nmon2, const size_t atom_index2, const size_t* neighbors,
+                           const size_t nneighbors, const size_t offset2, bool do_grads, const double cutoff,
+                           const std::vector<double>& box, const std::vector<double>& box_inverse,
+                           std::vector<double>* virial) {
+    size_t nmon22 = nmon2 * 2;
+
+    size_t shift2 = atom_index2 * nmon2 * 3;
+
+    bool use_pbc = box.size();
+    const double* boxinv = box_inverse.data();
+    const double* boxptr = box.data();
+    const ExpTable& exp_table = GetExpTable();
+
+    // Neighbors are all different monomers, so the scatter into grad2 has no conflicts
+    double repulsion_energy = 0;
+    double g1x = 0, g1y = 0, g1z = 0;
+    double vxx = 0, vxy = 0, vxz = 0, vyy = 0, vyz = 0, vzz = 0;
+#pragma omp simd reduction(+ : repulsion_energy, g1x, g1y, g1z, vxx, vxy, vxz, vyy, vyz, vzz)
+    for (size_t k = 0; k < nneighbors; k++) {
+        const size_t nv = neighbors[k] - offset2;
+        double dx = p1[0] - xyz2[shift2 + nv];
+        double dy = p1[1] - xyz2[nmon2 + shift2 + nv];
+        double dz = p1[2] - xyz2[nmon22 + shift2 + nv];
+
+        // Apply minimum image convetion
+        if (use_pbc) MinimumImage(boxptr, boxinv, dx, dy, dz);
+
+        const double rsq = dx * dx + dy * dy + dz * dz;
+        const double r = std::sqrt(rsq);
+
+        if (r <= cutoff) {
+            double grad;
+            repulsion_energy += RepulsionPair(a, b, r, cutoff, exp_table, grad);
+
+            if (do_grads) {
+                g1x -= dx * grad;
+                grad2[shift2 + nv] += dx * grad;
+
+                g1y -= dy * grad;
+                grad2[shift2 + nmon2 + nv] += dy * grad;
+
+                g1z -= dz * grad;
+                grad2[shift2 + nmon22 + nv] += dz * grad;
+
+                if (kVirial) {
+                    vxx -= dx * dx * grad;
+                    vxy -= dx * dy * grad;
+                    vxz -= dx * dz * grad;
+                    vyy -= dy * dy * grad;
+                    vyz -= dy * dz * grad;
+                    vzz -= dz * dz * grad;
+                }
+            }
+        }
+    }
+
+    if (do_grads) {
+        grad1[0] += g1x;
+        grad1[1] += g1y;
+        grad1[2] += g1z;
+
+        if (kVirial) {
+            (*virial)[0] += vxx;
+            (*virial)[1] += vxy;
+            (*virial)[2] += vxz;
+            (*virial)[4] += vyy;
+            (*virial)[5] += vyz;
+            (*virial)[8] += vzz;
+
+            (*virial)[3] = (*virial)[1];
+            (*virial)[6] = (*virial)[2];
+            (*virial)[7] = (*virial)[5];
+        }
     }
 
     return repulsion_energy;
 }
 
-bool GetBuckParams(std::string mon_id1, std::string mon_id2, size_t index1, size_t index2, std::vector<std::pair<std::string,std::string> > buck_pairs, double& out_a, double& out_b) {
+}  // namespace
+
+double RepulsionList(const double a, const double b, const double* p1, const double* xyz2, double* grad1,
+                     double* grad2, const size_t nmon2, const size_t atom_index2, const size_t* neighbors,
+                     const size_t nneighbors, const size_t offset2, bool do_grads, const double cutoff,
+                     const std::vector<double>& box, const std::vector<double>& box_inverse,
+                     std::vector<double>* virial) {
+    if (virial != 0) {
+        return RepulsionListKernel<true>(a, b, p1, xyz2, grad1, grad2, nmon2, atom_index2, neighbors, nneighbors,
+                                         offset2, do_grads, cutoff, box, box_inverse, virial);
+    }
+    return RepulsionListKernel<false>(a, b, p1, xyz2, grad1, grad2, nmon2, atom_index2, neighbors, nneighbors, offset2,
+                                      do_grads, cutoff, box, box_inverse, virial);
+}
+
+//----------------------------------------------------------------------------//
+
+bool GetBuckParams(std::string mon_id1, std::string mon_id2, size_t index1, size_t index2,
+                   const std::vector<std::pair<std::string, std::string> >& buck_pairs, double& out_a,
+                   double& out_b) {
     // Order the two monomer names and corresponding xyz
     if (mon_id2 < mon_id1) {
         std::string tmp = mon_id1;
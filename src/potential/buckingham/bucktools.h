@@ -39,18 +39,84 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <string>
+#include <vector>
 
 #include "tools/math_tools.h"
 
 namespace buck {
 
+/**
+ * @brief Tabulated exponential exp(-x) for x >= 0.
+ *
+ * exp(-x) is split as exp(-x_k) * exp(-t), with x_k the grid point below x.
+ * exp(-x_k) is read from the table and exp(-t), 0 <= t < dx, is evaluated
+ * from its Taylor series, which keeps the relative error below 1e-13.
+ * Past the end of the table the result is zero.
+ */
+class ExpTable {
+   public:
+    /**
+     * @brief Builds the table.
+     *
+     * @param[in] xmax Largest tabulated argument
+     * @param[in] dx Grid spacing. Must be small enough for the Taylor series
+     */
+    ExpTable(const double xmax = 64.0, const double dx = 1.0 / 64);
+
+    /**
+     * @brief Evaluates exp(-x)
+     *
+     * @param[in] x Argument (>= 0)
+     * @return exp(-x)
+     */
+    inline double Eval(const double x) const {
+        const double s = std::min(x * inv_dx_, nintervals_);
+        const size_t k = static_cast<size_t>(s);
+        const double t = x - k * dx_;
+        const double p = 1.0 - t * (1.0 - t * (0.5 - t * (1.0 / 6 - t * (1.0 / 24 - t * (1.0 / 120)))));
+        return table_[k] * p;
+    }
+
+   private:
+    // Grid spacing and its inverse
+    double dx_;
+    double inv_dx_;
+    // Number of tabulated intervals
+    double nintervals_;
+    // exp(-x_k) at the grid points, followed by a zero
+    std::vector<double> table_;
+};
+
+/**
+ * @brief Returns the table shared by all the repulsion kernels.
+ *
+ * The table is built the first time this function is called.
+ */
+const ExpTable& GetExpTable();
+
 double Repulsion(const double a, const double b, const double* p1, const double* xyz2,
              double* grad1, double* grad2, const size_t nmon1, const size_t nmon2,
              const size_t start2, const size_t end2, const size_t atom_index1, const size_t atom_index2,
              bool do_grads, const double cutoff, 
              const std::vector<double>& box, const std::vector<double>& box_inverse, std::vector<double> *virial=0);
 
-bool GetBuckParams(std::string mon_id1, std::string mon_id2, size_t index1, size_t index2, std::vector<std::pair<std::string,std::string> > buck_pairs, double& out_a, double& out_b);
+/**
+ * @brief Repulsion between one site and the same site of a list of monomers.
+ *
+ * Same as Repulsion, but only the monomers of type 2 with indexes
+ * neighbors[k] - offset2, k in [0, nneighbors), are considered, and
+ * their gradients are added directly to grad2.
+ */
+double RepulsionList(const double a, const double b, const double* p1, const double* xyz2, double* grad1,
+                     double* grad2, const size_t nmon2, const size_t atom_index2, const size_t* neighbors,
+                     const size_t nneighbors, const size_t offset2, bool do_grads, const double cutoff,
+                     const std::vector<double>& box, const std::vector<double>& box_inverse,
+                     std::vector<double>* virial = 0);
+
+bool GetBuckParams(std::string mon_id1, std::string mon_id2, size_t index1, size_t index2,
+                   const std::vector<std::pair<std::string, std::string> >& buck_pairs, double& out_a,
+                   double& out_b);
 
 }  // namespace buck
 
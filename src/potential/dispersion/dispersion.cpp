@@ -37,15 +37,18 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 
 namespace disp {
 
+// Ids of the scratch buffers kept in workspace_
+enum DispBuffer { kPhi1Pool = 0, kPhi2Pool, kGrad1Pool, kGrad2Pool, kEnergyPool, kVirialPool, kRecVirial, kNumDispBuffers };
+
 void Dispersion::Initialize(const std::vector<double> sys_c6_long_range, const std::vector<double> &sys_xyz,
                             const std::vector<std::string> &mon_id, const std::vector<size_t> &num_atoms,
                             const std::vector<std::pair<std::string, size_t> > &mon_type_count,
                             const bool do_grads = true, const std::vector<double> &box = {}) {
     sys_c6_long_range_ = sys_c6_long_range;
-    sys_xyz_ = sys_xyz;
     mon_id_ = mon_id;
     num_atoms_ = num_atoms;
     mon_type_count_ = mon_type_count;
+    systools::GetExcludedByType(mon_type_count_, exc12_, exc13_, exc14_);
     do_grads_ = do_grads;
     box_ = box;
     box_inverse_ = box.size() ? InvertUnitCell(box) : std::vector<double>{};
@@ -54,19 +57,72 @@ void Dispersion::Initialize(const std::vector<double> sys_c6_long_range, const s
     natoms_ = sys_c6_long_range_.size();
     size_t natoms3 = 3 * natoms_;
     phi_ = std::vector<double>(natoms_, 0.0);
-    xyz_ = std::vector<double>(natoms3, 0.0);
     grad_ = std::vector<double>(natoms3, 0.0);
     virial_ = std::vector<double>(9,0.0);
     sys_grad_ = std::vector<double>(natoms3, 0.0);
     c6_long_range_ = std::vector<double>(natoms_, 0.0);
     sys_phi_ = std::vector<double>(natoms_, 0.0);
-    
+    workspace_ = tools::Workspace(kNumDispBuffers);
+
+    // Atoms of each monomer are consecutive in the vectors given to SetNewParameters
+    std::vector<size_t> first_index(num_atoms_.size(), 0);
+    for (size_t m = 1; m < num_atoms_.size(); m++) first_index[m] = first_index[m - 1] + num_atoms_[m - 1];
+    own_sites_.SetLayout(mon_type_count_, num_atoms_, first_index);
+    own_sites_.Gather(sys_xyz.data());
+    sites_ = &own_sites_;
+    xyz_ = own_sites_.GetXyz().data();
+
+    // Look up the C6 and d6 of each pair type once, and build the damping table
+    SetUpPairParameters();
+    GetTangToenniesTable();
+
     ReorderData();
 }
 
+void Dispersion::SetUpPairParameters() {
+    size_t ntypes = mon_type_count_.size();
+    pair_c6_d6_ = std::vector<std::vector<double> >(ntypes * ntypes);
+
+    size_t fi_mon1 = 0;
+    for (size_t mt1 = 0; mt1 < ntypes; mt1++) {
+        size_t ns1 = num_atoms_[fi_mon1];
+        size_t fi_mon2 = 0;
+        for (size_t mt2 = 0; mt2 < ntypes; mt2++) {
+            size_t ns2 = num_atoms_[fi_mon2];
+            std::vector<double> &c6_d6 = pair_c6_d6_[mt1 * ntypes + mt2];
+            c6_d6 = std::vector<double>(2 * ns1 * ns2, 0.0);
+            for (size_t i = 0; i < ns1; i++) {
+                for (size_t j = 0; j < ns2; j++) {
+                    GetC6(mon_id_[fi_mon1], mon_id_[fi_mon2], i, j, c6_d6[2 * (i * ns2 + j)],
+                          c6_d6[2 * (i * ns2 + j) + 1]);
+                }
+            }
+            fi_mon2 += mon_type_count_[mt2].second;
+        }
+        fi_mon1 += mon_type_count_[mt1].second;
+    }
+}
+
 void Dispersion::SetNewParameters(const std::vector<double> &xyz, bool do_grads = true, const double cutoff = 100.0,
                                   const std::vector<double> &box = {}) {
-    sys_xyz_ = xyz;
+    if (xyz.size() != 3 * natoms_) {
+        std::string text = "Expected " + std::to_string(3 * natoms_) + " coordinates, got " +
+                           std::to_string(xyz.size()) + ".";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    own_sites_.Gather(xyz.data());
+    SetNewParameters(own_sites_, do_grads, cutoff, box);
+}
+
+void Dispersion::SetNewParameters(const tools::SiteStore &sites, bool do_grads, const double cutoff,
+                                  const std::vector<double> &box) {
+    if (sites.GetNumSites() != natoms_) {
+        std::string text = "The store has " + std::to_string(sites.GetNumSites()) + " sites, but there are " +
+                           std::to_string(natoms_) + " atoms.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    sites_ = &sites;
+    xyz_ = sites.GetXyz().data();
     box_ = box;
     box_inverse_ = box.size() ? InvertUnitCell(box) : std::vector<double>{};
     use_pbc_ = box.size();
@@ -75,42 +131,28 @@ void Dispersion::SetNewParameters(const std::vector<double> &xyz, bool do_grads
     std::fill(grad_.begin(), grad_.end(), 0.0);
     std::fill(phi_.begin(), phi_.end(), 0.0);
     std::fill(virial_.begin(), virial_.end(),0.0);
-
-    ReorderData();
 }
 
 void Dispersion::ReorderData() {
-    // Organize xyz so we have
-    // x1_1 x1_2 ... y1_1 y1_2... z1_1 z1_2 ... x2_1 x2_2 ...
-    // where xN_M is read as coordinate x of site N of monomer M
-    // for the first monomer type. Then follows the second, and so on.
-    // As an example, for a water dimer (OHHM), the system xyz would be
-    // sys_xyz = {Ox, Oy, Oz, Hx, Hy, Hz, Hx, Hy, ...}
-    // And after reordering,
-    // xyz = {Ox, Ox, Oy, Oy, Oz, Oz, Hx, Hx, Hy, Hy, Hz, Hz, Hx, Hx, ... ...}
+    // Organize the long range C6 as the coordinates in the site store,
+    // c6_1 c6_1 ... c6_2 c6_2 ...
+    // where c6_N is the C6 of site N of each monomer of the first monomer
+    // type. Then follows the second, and so on.
 
     size_t fi_mon = 0;
-    size_t fi_crd = 0;
     size_t fi_sites = 0;
     for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
         size_t ns = num_atoms_[fi_mon];
         size_t nmon = mon_type_count_[mt].second;
-        size_t nmon2 = nmon * 2;
         for (size_t m = 0; m < nmon; m++) {
             size_t mns = m * ns;
-            size_t mns3 = mns * 3;
             for (size_t i = 0; i < ns; i++) {
                 size_t inmon = i * nmon;
-                size_t inmon3 = 3 * inmon;
-                xyz_[inmon3 + m + fi_crd] = sys_xyz_[fi_crd + mns3 + 3 * i];
-                xyz_[inmon3 + m + fi_crd + nmon] = sys_xyz_[fi_crd + mns3 + 3 * i + 1];
-                xyz_[inmon3 + m + fi_crd + nmon2] = sys_xyz_[fi_crd + mns3 + 3 * i + 2];
                 c6_long_range_[fi_sites + m + inmon] = sys_c6_long_range_[fi_sites + mns + i];
             }
         }
         fi_mon += nmon;
         fi_sites += nmon * ns;
-        fi_crd += nmon * ns * 3;
     }
 }
 
@@ -125,7 +167,6 @@ double Dispersion::GetDispersion(std::vector<double> &grad,std::vector<double> *
     CalculateDispersion();
 
     size_t fi_mon = 0;
-    size_t fi_crd = 0;
     size_t fi_sites = 0;
      
     if (calc_virial_) {
@@ -143,26 +184,20 @@ double Dispersion::GetDispersion(std::vector<double> &grad,std::vector<double> *
     for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
         size_t ns = num_atoms_[fi_mon];
         size_t nmon = mon_type_count_[mt].second;
-        size_t nmon2 = nmon * 2;
         for (size_t m = 0; m < nmon; m++) {
             size_t mns = m * ns;
-            size_t mns3 = mns * 3;
             for (size_t i = 0; i < ns; i++) {
                 size_t inmon = i * nmon;
-                size_t inmon3 = 3 * inmon;
-
                 sys_phi_[fi_sites + mns + i] = phi_[fi_sites + m + inmon];
-
-                grad[fi_crd + mns3 + 3 * i] += grad_[inmon3 + m + fi_crd];
-                grad[fi_crd + mns3 + 3 * i + 1] += grad_[inmon3 + m + fi_crd + nmon];
-                grad[fi_crd + mns3 + 3 * i + 2] += grad_[inmon3 + m + fi_crd + nmon2];
             }
         }
         fi_mon += nmon;
         fi_sites += nmon * ns;
-        fi_crd += nmon * ns * 3;
     }
 
+    // Gradients go straight to the sites of the store
+    sites_->ScatterAdd(grad_.data(), grad.data());
+
     return disp_energy_;
 }
 
@@ -180,6 +215,7 @@ void Dispersion::CalculateDispersion() {
         if (omp_get_thread_num() == 0) nthreads = omp_get_num_threads();
     }
 #endif
+    workspace_.SetNumThreads(nthreads);
 
     // This part looks at sites inside the same monomer
     // Reset first indexes
@@ -187,31 +223,26 @@ void Dispersion::CalculateDispersion() {
     size_t fi_crd = 0;
     size_t fi_sites = 0;
 
-    // Excluded sets
-    excluded_set_type exc12;
-    excluded_set_type exc13;
-    excluded_set_type exc14;
+    size_t ntypes = mon_type_count_.size();
 
     // Loop over each monomer type
-    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+    for (size_t mt = 0; mt < ntypes; mt++) {
         size_t ns = num_atoms_[fi_mon];
         size_t nmon = mon_type_count_[mt].second;
         size_t nmon2 = 2 * nmon;
+        const std::vector<double> &c6_d6 = pair_c6_d6_[mt * ntypes + mt];
 
         // Obtain excluded pairs for monomer type mt
-        systools::GetExcluded(mon_id_[fi_mon], exc12, exc13, exc14);
+        const excluded_set_type &exc12 = exc12_[mt];
+        const excluded_set_type &exc13 = exc13_[mt];
+        const excluded_set_type &exc14 = exc14_[mt];
 
         // For parallel region
-        std::vector<std::vector<double> > phi_pool;
-        std::vector<std::vector<double> > grad_pool;
-        std::vector<double> energy_pool(nthreads,0.0);
-        std::vector<std::vector<double> > virial_pool;
-
-
+        std::vector<double> &energy_pool = workspace_.Get(kEnergyPool, nthreads);
         for (size_t i = 0; i < nthreads; i++) {
-            phi_pool.push_back(std::vector<double>(nmon * ns,0.0));
-            grad_pool.push_back(std::vector<double>(nmon * ns * 3,0.0));
-            virial_pool.push_back(std::vector<double>(9,0.0));
+            workspace_.Get(kPhi1Pool, nmon * ns, i);
+            workspace_.Get(kGrad1Pool, nmon * ns * 3, i);
+            workspace_.Get(kVirialPool, 9, i);
         }
         // Loop over each pair of sites
         for (size_t i = 0; i < ns - 1; i++) {
@@ -223,10 +254,10 @@ void Dispersion::CalculateDispersion() {
                 bool is13 = systools::IsExcluded(exc13, i, j);
                 bool is14 = systools::IsExcluded(exc14, i, j);
                 double disp_scale_factor = (is12 || is13 || is14) ? 0 : 1;
-                double c6, d6;
+                double c6 = c6_d6[2 * (i * ns + j)];
+                double d6 = c6_d6[2 * (i * ns + j) + 1];
                 double c6i = c6_long_range_[fi_sites + i * nmon];
                 double c6j = c6_long_range_[fi_sites + j * nmon];
-                GetC6(mon_id_[fi_mon], mon_id_[fi_mon], i, j, c6, d6);
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic)
 #endif
@@ -235,36 +266,43 @@ void Dispersion::CalculateDispersion() {
 #ifdef _OPENMP
                     rank = omp_get_thread_num();
 #endif
+                    std::vector<double> &phi_pool = workspace_.At(kPhi1Pool, rank);
+                    std::vector<double> &grad_pool = workspace_.At(kGrad1Pool, rank);
+                    std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                     double p1[3], g1[3];
                     double phi_i = 0.0;
                     p1[0] = xyz_[fi_crd + inmon3 + m];
                     p1[1] = xyz_[fi_crd + inmon3 + nmon + m];
                     p1[2] = xyz_[fi_crd + inmon3 + nmon2 + m];
                     std::fill(g1, g1 + 3, 0.0);
-                    energy_pool[rank] += disp6(c6, d6, c6i, c6j, p1, xyz_.data() + fi_crd, g1, grad_pool[rank].data(), phi_i,
-                                          phi_pool[rank].data(), nmon, nmon, m, m + 1, i, j, disp_scale_factor,
-                                          do_grads_, cutoff_, ewald_alpha_, box_, box_inverse_, &virial_pool[rank]);
-
-                    grad_pool[rank][inmon3 + m] += g1[0];
-                    grad_pool[rank][inmon3 + nmon + m] += g1[1];
-                    grad_pool[rank][inmon3 + nmon2 + m] += g1[2];
-                    phi_pool[rank][inmon + m] += phi_i;
+                    energy_pool[rank] += disp6(c6, d6, c6i, c6j, p1, xyz_ + fi_crd, g1, grad_pool.data(), phi_i,
+                                          phi_pool.data(), nmon, nmon, m, m + 1, i, j, disp_scale_factor,
+                                          do_grads_, cutoff_, ewald_alpha_, box_, box_inverse_,
+                                          calc_virial_ ? &virial_pool : 0);
+
+                    grad_pool[inmon3 + m] += g1[0];
+                    grad_pool[inmon3 + nmon + m] += g1[1];
+                    grad_pool[inmon3 + nmon2 + m] += g1[2];
+                    phi_pool[inmon + m] += phi_i;
                 }
             }
         }
 
         // Compress data in phi and grad and virial
         for (size_t rank = 0; rank < nthreads; rank++) {
-            size_t kend = phi_pool[rank].size();
+            std::vector<double> &phi_pool = workspace_.At(kPhi1Pool, rank);
+            std::vector<double> &grad_pool = workspace_.At(kGrad1Pool, rank);
+            std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+            size_t kend = phi_pool.size();
             for (size_t k = 0; k < kend; k++) {
-                phi_[fi_sites + k] += phi_pool[rank][k];
+                phi_[fi_sites + k] += phi_pool[k];
             }
-            kend = grad_pool[rank].size();
+            kend = grad_pool.size();
             for (size_t k = 0; k < kend; k++) {
-                grad_[fi_crd + k] += grad_pool[rank][k];
+                grad_[fi_crd + k] += grad_pool[k];
             }
             for (size_t k = 0; k < 9; k++) {
-                virial_[k] += virial_pool[rank][k];
+                virial_[k] += virial_pool[k];
             }
             disp_energy_ += energy_pool[rank];
         }
@@ -302,20 +340,16 @@ void Dispersion::CalculateDispersion() {
             // If so, same monomer won't be done, since it has been done in
             // previous loop.
             bool same = (mt1 == mt2);
+            const std::vector<double> &c6_d6 = pair_c6_d6_[mt1 * ntypes + mt2];
 
             // For parallel region
-            std::vector<std::vector<double> > phi1_pool;
-            std::vector<std::vector<double> > phi2_pool;
-            std::vector<std::vector<double> > grad1_pool;
-            std::vector<std::vector<double> > grad2_pool;
-            std::vector<double> energy_pool(nthreads,0.0);
-            std::vector<std::vector<double> > virial_pool;
+            std::vector<double> &energy_pool = workspace_.Get(kEnergyPool, nthreads);
             for (size_t i = 0; i < nthreads; i++) {
-                phi1_pool.push_back(std::vector<double>(nmon1 * ns1,0.0));
-                phi2_pool.push_back(std::vector<double>(nmon2 * ns2,0.0));
-                grad1_pool.push_back(std::vector<double>(nmon1 * ns1 * 3,0.0));
-                grad2_pool.push_back(std::vector<double>(nmon2 * ns2 * 3,0.0));
-                virial_pool.push_back(std::vector<double>(9,0.0));
+                workspace_.Get(kPhi1Pool, nmon1 * ns1, i);
+                workspace_.Get(kPhi2Pool, nmon2 * ns2, i);
+                workspace_.Get(kGrad1Pool, nmon1 * ns1 * 3, i);
+                workspace_.Get(kGrad2Pool, nmon2 * ns2 * 3, i);
+                workspace_.Get(kVirialPool, 9, i);
             }
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic)
@@ -325,13 +359,18 @@ void Dispersion::CalculateDispersion() {
 #ifdef _OPENMP
                 rank = omp_get_thread_num();
 #endif
+                std::vector<double> &phi1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &grad1_pool = workspace_.At(kGrad1Pool, rank);
+                std::vector<double> &grad2_pool = workspace_.At(kGrad2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                 size_t m2init = same ? m1 + 1 : 0;
                 for (size_t i = 0; i < ns1; i++) {
                     size_t inmon1 = i * nmon1;
                     size_t inmon13 = inmon1 * 3;
                     double c6i = c6_long_range_[fi_sites1 + i * nmon1];
-                    std::vector<double> xyz_sitei(3);
-                    std::vector<double> g1(3, 0.0);
+                    double xyz_sitei[3];
+                    double g1[3] = {0.0, 0.0, 0.0};
                     double phi_i = 0.0;
                     xyz_sitei[0] = xyz_[fi_crd1 + inmon13 + m1];
                     xyz_sitei[1] = xyz_[fi_crd1 + inmon13 + nmon1 + m1];
@@ -341,40 +380,46 @@ void Dispersion::CalculateDispersion() {
                         size_t jnmon2 = j * nmon2;
                         size_t jnmon23 = jnmon2 * 3;
                         double c6j = c6_long_range_[fi_sites2 + j * nmon2];
-                        double c6, d6;
-                        GetC6(mon_id_[fi_mon1], mon_id_[fi_mon2], i, j, c6, d6);
+                        double c6 = c6_d6[2 * (i * ns2 + j)];
+                        double d6 = c6_d6[2 * (i * ns2 + j) + 1];
                         energy_pool[rank] +=
-                            disp6(c6, d6, c6i, c6j, xyz_sitei.data(), xyz_.data() + fi_crd2, g1.data(),
-                                  grad2_pool[rank].data(), phi_i, phi2_pool[rank].data(), nmon1, nmon2, m2init, nmon2,
-                                  i, j, 1.0, do_grads_, cutoff_, ewald_alpha_, box_, box_inverse_, &virial_pool[rank]);
+                            disp6(c6, d6, c6i, c6j, xyz_sitei, xyz_ + fi_crd2, g1,
+                                  grad2_pool.data(), phi_i, phi2_pool.data(), nmon1, nmon2, m2init, nmon2,
+                                  i, j, 1.0, do_grads_, cutoff_, ewald_alpha_, box_, box_inverse_,
+                                  calc_virial_ ? &virial_pool : 0);
                     }
-                    grad1_pool[rank][inmon13 + m1] += g1[0];
-                    grad1_pool[rank][inmon13 + nmon1 + m1] += g1[1];
-                    grad1_pool[rank][inmon13 + nmon12 + m1] += g1[2];
-                    phi1_pool[rank][inmon1 + m1] += phi_i;
+                    grad1_pool[inmon13 + m1] += g1[0];
+                    grad1_pool[inmon13 + nmon1 + m1] += g1[1];
+                    grad1_pool[inmon13 + nmon12 + m1] += g1[2];
+                    phi1_pool[inmon1 + m1] += phi_i;
                 }
             }
 
             // Compress data in Efq and phi
             for (size_t rank = 0; rank < nthreads; rank++) {
-                size_t kend1 = grad1_pool[rank].size();
-                size_t kend2 = grad2_pool[rank].size();
+                std::vector<double> &phi1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &grad1_pool = workspace_.At(kGrad1Pool, rank);
+                std::vector<double> &grad2_pool = workspace_.At(kGrad2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+                size_t kend1 = grad1_pool.size();
+                size_t kend2 = grad2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    grad_[fi_crd1 + k] += grad1_pool[rank][k];
+                    grad_[fi_crd1 + k] += grad1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    grad_[fi_crd2 + k] += grad2_pool[rank][k];
+                    grad_[fi_crd2 + k] += grad2_pool[k];
                 }
-                kend1 = phi1_pool[rank].size();
-                kend2 = phi2_pool[rank].size();
+                kend1 = phi1_pool.size();
+                kend2 = phi2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    phi_[fi_sites1 + k] += phi1_pool[rank][k];
+                    phi_[fi_sites1 + k] += phi1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    phi_[fi_sites2 + k] += phi2_pool[rank][k];
+                    phi_[fi_sites2 + k] += phi2_pool[k];
                 }
                 for (size_t k = 0; k < 9; k++) {
-                    virial_[k] += virial_pool[rank][k];
+                    virial_[k] += virial_pool[k];
                 }
                 disp_energy_ += energy_pool[rank]; 
             }
@@ -392,22 +437,31 @@ void Dispersion::CalculateDispersion() {
     }
 
     if (ewald_alpha_ > 0 && use_pbc_) {
-        helpme::PMEInstance<double> pme_solver_;
+        // The solver is kept between calls; setup is cheap if nothing changed
+        PMEInstanceD &pme_solver = pme_solver_.Get();
         // Compute the reciprocal space terms, using PME
         double A = box_[0], B = box_[4], C = box_[8];
         int grid_A = pme_grid_density_ * A;
         int grid_B = pme_grid_density_ * B;
         int grid_C = pme_grid_density_ * C;
-        pme_solver_.setup(6, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, -1, 0);
-        pme_solver_.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+        // Use the current OpenMP thread count, as in the electrostatics
+        int nthreads = 1;
+#ifdef _OPENMP
+        nthreads = omp_get_max_threads();
+#endif
+        // Setup creates the FFTW plans, and the FFTW planner is not thread safe
+#pragma omp critical(mbx_fftw_planner)
+        pme_solver.setup(6, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, -1, nthreads);
+        pme_solver.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
         // N.B. these do not make copies; they just wrap the memory with some metadata
-        auto coords = helpme::Matrix<double>(sys_xyz_.data(), natoms_, 3);
+        // helPME only reads the coordinates
+        auto coords = helpme::Matrix<double>(const_cast<double *>(sites_->GetSysXyz().data()), natoms_, 3);
         auto params = helpme::Matrix<double>(sys_c6_long_range_.data(), natoms_, 1);
         auto forces = helpme::Matrix<double>(sys_grad_.data(), natoms_, 3);
-        std::vector<double> dummy_6vec(6,0.0);
+        std::vector<double> &dummy_6vec = workspace_.Get(kRecVirial, 6);
         auto rec_virial = helpme::Matrix<double>(dummy_6vec.data(), 6, 1);
         std::fill(sys_grad_.begin(), sys_grad_.end(), 0);
-        double rec_energy = pme_solver_.computeEFVRec(0, params, coords, forces, rec_virial);
+        double rec_energy = pme_solver.computeEFVRec(0, params, coords, forces, rec_virial);
 
         // get virial
         if (calc_virial_) {
@@ -45,8 +45,10 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "tools/definitions.h"
 #include "bblock/sys_tools.h"
 #include "tools/math_tools.h"
+#include "tools/workspace.h"
+#include "tools/site_store.h"
 
-//#include "helpme.h"
+#include "potential/electrostatics/helpme.h"
 
 namespace disp {
 
@@ -65,6 +67,22 @@ class Dispersion {
     void SetNewParameters(const std::vector<double> &xyz, bool do_grads, const double cutoff,
                           const std::vector<double> &box);
 
+    /**
+     * @brief Sets the new coordinates from a store shared with other terms.
+     *
+     * The store must hold the atoms of the monomers given in Initialize, and
+     * is not copied, so it has to be alive until GetDispersion returns. The
+     * gradients of GetDispersion are then added at the first indexes of the
+     * store instead of in the order of the atoms.
+     *
+     * @param[in] sites Coordinates of the atoms
+     * @param[in] do_grads If true, the gradients will be computed
+     * @param[in] cutoff Cutoff of the real space interactions
+     * @param[in] box Box of the system, empty if not periodic
+     */
+    void SetNewParameters(const tools::SiteStore &sites, bool do_grads, const double cutoff,
+                          const std::vector<double> &box);
+
     /**
      * @brief Sets the Ewald attenuation parameter (in units of 1/Angstrom)
      *
@@ -93,14 +111,24 @@ class Dispersion {
      */
     void SetCutoff(double cutoff);
 
+    /**
+     * @brief Gets the number of times the scratch buffers had to grow
+     *
+     * @return Number of times the scratch buffers grew since initialization
+     */
+    size_t GetNumBufferResizes() const { return workspace_.GetNumBufferResizes(); }
+
    private:
     void ReorderData();
+    void SetUpPairParameters();
     void CalculateDispersion();
 
-    // System xyz, not ordered XYZ. xyzxyz...(mon1)xyzxyz...(mon2) ...
-    std::vector<double> sys_xyz_;
-    // System xyz, ordered XYZ. xx..yy..zz(mon1) xx..yy..zz(mon2) ...
-    std::vector<double> xyz_;
+    // Coordinates given to SetNewParameters as a vector, xyzxyz...(mon1)xyzxyz...(mon2) ...
+    tools::SiteStore own_sites_;
+    // Store the coordinates are read from, own_sites_ or a shared one
+    const tools::SiteStore *sites_ = 0;
+    // System xyz, ordered XYZ. xx..yy..zz(mon1) xx..yy..zz(mon2) ..., from sites_
+    const double *xyz_ = 0;
     // Name of the monomers (h2o, f...)
     std::vector<std::string> mon_id_;
     // Number of sites of each mon
@@ -112,6 +140,14 @@ class Dispersion {
     // Vector that contains all different monomer types and the number of
     // monomers of each type.
     std::vector<std::pair<std::string, size_t> > mon_type_count_;
+    // Excluded pairs 1-2, 1-3 and 1-4 of each monomer type
+    std::vector<excluded_set_type> exc12_;
+    std::vector<excluded_set_type> exc13_;
+    std::vector<excluded_set_type> exc14_;
+    // C6 and d6 of every pair of sites, for each pair of monomer types.
+    // pair_c6_d6_[mt1 * ntypes + mt2][2 * (i * ns2 + j)] is the C6 between site i
+    // of type mt1 and site j of type mt2, and the next element is the d6.
+    std::vector<std::vector<double> > pair_c6_d6_;
 
     // Bool that if true will perform the gradients calculation.
     bool do_grads_;
@@ -149,6 +185,10 @@ class Dispersion {
     double pme_grid_density_ = 0;
     // PME spline order
     int pme_spline_order_ = 0;
+    // PME solver, kept between calls
+    tools::Persistent<PMEInstanceD> pme_solver_;
+    // Scratch buffers reused between calls
+    tools::Workspace workspace_;
 };
 
 }  // namespace disp
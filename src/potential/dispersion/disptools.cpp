@@ -33,6 +33,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "potential/dispersion/disptools.h"
+#include "tools/cpu_dispatch.h"
 #include <string>
 #include <vector>
 
@@ -67,6 +68,47 @@ double tang_toennies(int n, const double& x) {
 
 //----------------------------------------------------------------------------//
 
+TangToenniesTable::TangToenniesTable(const double xmax, const double dx) {
+    size_t n = static_cast<size_t>(std::ceil(xmax / dx));
+    dx_ = dx;
+    inv_dx_ = 1.0 / dx;
+    nintervals_ = n;
+
+    // Analytic values at the grid points: f_6, f_6' = x^6 exp(-x) / 6! and f_6''
+    std::vector<double> f(n + 1), df(n + 1), d2f(n + 1);
+    for (size_t k = 0; k <= n; k++) {
+        double x = k * dx;
+        double x5 = std::pow(x, 5);
+        f[k] = tang_toennies(6, x);
+        df[k] = if6 * x5 * x * std::exp(-x);
+        d2f[k] = if6 * (6.0 - x) * x5 * std::exp(-x);
+    }
+
+    // Cubic Hermite interpolants on each interval, plus a constant one at the end
+    coef_ = std::vector<double>(8 * (n + 1), 0.0);
+    for (size_t k = 0; k < n; k++) {
+        double *c = coef_.data() + 8 * k;
+        c[0] = f[k];
+        c[1] = df[k];
+        c[2] = (3.0 * (f[k + 1] - f[k]) * inv_dx_ - 2.0 * df[k] - df[k + 1]) * inv_dx_;
+        c[3] = (2.0 * (f[k] - f[k + 1]) * inv_dx_ + df[k] + df[k + 1]) * inv_dx_ * inv_dx_;
+        c[4] = df[k];
+        c[5] = d2f[k];
+        c[6] = (3.0 * (df[k + 1] - df[k]) * inv_dx_ - 2.0 * d2f[k] - d2f[k + 1]) * inv_dx_;
+        c[7] = (2.0 * (df[k] - df[k + 1]) * inv_dx_ + d2f[k] + d2f[k + 1]) * inv_dx_ * inv_dx_;
+    }
+    coef_[8 * n] = 1.0;
+}
+
+//----------------------------------------------------------------------------//
+
+const TangToenniesTable& GetTangToenniesTable() {
+    static const TangToenniesTable table;
+    return table;
+}
+
+//----------------------------------------------------------------------------//
+
 /* Block commented since C8 is not used for now.
 
 double disp68(const double& C6, const double& d6,
@@ -145,27 +187,36 @@ double disp68(const double& C6, const double& d6,
 
 //----------------------------------------------------------------------------//
 
-double disp6(const double C6, const double d6, const double c6i, const double c6j, const double* p1, const double* xyz2,
-             double* grad1, double* grad2, double& phi1, double* phi2, const size_t nmon1, const size_t nmon2,
-             const size_t start2, const size_t end2, const size_t atom_index1, const size_t atom_index2,
-             const double disp_scale_factor, bool do_grads, const double cutoff, const double ewald_alpha,
-             const std::vector<double>& box, const std::vector<double>& box_inverse,std::vector<double> *virial) {
-    double disp = 0.0;
-    double disp_lr_below_cutoff = 0.0;
-
+// Body of disp6, inlined in one variant per instruction set.
+// Without kVirial the virial accumulations are compiled out.
+template <bool kVirial>
+static MBX_ALWAYS_INLINE double disp6_kernel(const double C6, const double d6, const double c6i, const double c6j,
+                                             const double* p1, const double* xyz2, double* grad1, double* grad2,
+                                             double& phi1, double* phi2, const size_t nmon1, const size_t nmon2,
+                                             const size_t start2, const size_t end2, const size_t atom_index1,
+                                             const size_t atom_index2, const double disp_scale_factor, bool do_grads,
+                                             const double cutoff, const double ewald_alpha,
+                                             const std::vector<double>& box, const std::vector<double>& box_inverse,
+                                             std::vector<double> *virial) {
     size_t nmon22 = nmon2 * 2;
 
     size_t shift_phi = atom_index2 * nmon2;
     size_t shift2 = shift_phi * 3;
 
     bool use_pbc = box.size();
-    double g1[3], g2[3 * nmon2];
-    std::fill(g1, g1 + 3, 0.0);
+    double g2[3 * nmon2];
     std::fill(g2, g2 + 3 * nmon2, 0.0);
-    //    #pragma simd
     const double* boxinv = box_inverse.data();
     const double* boxptr = box.data();
+    const TangToenniesTable& tt_table = GetTangToenniesTable();
+
+    // Everything accumulated over the j sites is kept in scalars so that the
+    // loop below can be vectorized over nv
     double dispersion_energy = 0;
+    double phi_i = 0;
+    double g1x = 0, g1y = 0, g1z = 0;
+    double vxx = 0, vxy = 0, vxz = 0, vyy = 0, vyz = 0, vzz = 0;
+#pragma omp simd reduction(+ : dispersion_energy, phi_i, g1x, g1y, g1z, vxx, vxy, vxz, vyy, vyz, vzz)
     for (size_t nv = start2; nv < end2; nv++) {
         double dx = p1[0] - xyz2[shift2 + nv];
         double dy = p1[1] - xyz2[nmon2 + shift2 + nv];
@@ -193,18 +244,16 @@ double disp6(const double C6, const double d6, const double c6i, const double c6
         const double inv_r6 = inv_rsq * inv_rsq * inv_rsq;
 
         // Update phi for long range interactions
-        // phi1 is a double value passed by reference
+        // phi_i is accumulated and added to phi1 at the end
         // phi2 is a double array
 
-        phi1 -= c6j * inv_r6;
+        phi_i -= c6j * inv_r6;
         phi2[shift_phi + nv] -= c6i * inv_r6;
         // If using cutoff, check for distances and get proper dispersion
         if (r <= cutoff) {
             const double d6r = d6 * r;
-            const double tt6 = disp::tang_toennies(6, d6r);
-
-            const double inv_rsq = 1.0 / rsq;
-            const double inv_r6 = inv_rsq * inv_rsq * inv_rsq;
+            double tt6, dtt6;
+            tt_table.Eval(d6r, tt6, dtt6);
 
             // Intermediates used in the dispersion PME terms
             double ar2 = ewald_alpha * ewald_alpha * rsq;
@@ -233,7 +282,8 @@ double disp6(const double C6, const double d6, const double c6i, const double c6
             dispersion_energy -= pair_energy;
 
             if (do_grads) {
-                const double e6term_grad = 6 * e6 * inv_rsq - C6 * std::pow(d6, 7) * if6 * std::exp(-d6r) / r;
+                // d(tt6)/dr = d6 * dtt6, with dtt6 = (d6 r)^6 exp(-d6 r) / 6!
+                const double e6term_grad = 6 * e6 * inv_rsq - C6 * d6 * dtt6 * inv_r6 / r;
                 const double c6term_grad = 6 * c6term * inv_rsq;
                 const double pmeterm_grad =
                     6 * c6i * c6j * (1 - (1 + ar2 + ar4 / 2 + ar6 / 6) * expterm) * inv_r6 * inv_rsq;
@@ -241,51 +291,80 @@ double disp6(const double C6, const double d6, const double c6i, const double c6
                 const double c6grad = c6sw * c6term_grad - c6sw_grad * c6term / r;
                 const double grad = disp_scale_factor * (ttgrad + c6grad) - pmeterm_grad;
 
-                g1[0] += dx * grad;
+                g1x += dx * grad;
                 g2[nv] -= dx * grad;
 
-                g1[1] += dy * grad;
+                g1y += dy * grad;
                 g2[nmon2 + nv] -= dy * grad;
 
-                g1[2] += dz * grad;
+                g1z += dz * grad;
                 g2[nmon22 + nv] -= dz * grad;
 
+                //  update the virial for the atom pair
+                if (kVirial) {
+                    vxx -= dx * dx * grad;
+                    vxy -= dx * dy * grad;
+                    vxz -= dx * dz * grad;
 
-                if (virial != 0 ) {
+                    vyy -= dy * dy * grad;
+                    vyz -= dy * dz * grad;
 
-                    (*virial)[0] -= dx* dx * grad; //  update the virial for the atom pair
-                    (*virial)[1] -= dx* dy * grad; 
-                    (*virial)[2] -= dx* dz * grad; 
-
-                    (*virial)[4] -= dy* dy * grad; 
-                    (*virial)[5] -= dy* dz * grad; 
-
-                    (*virial)[8] -= dz* dz * grad; 
-
-                    (*virial)[3] = (*virial)[1];
-                    (*virial)[6] = (*virial)[2];
-                    (*virial)[7] = (*virial)[5];
-                
+                    vzz -= dz * dz * grad;
                 }
-
             }
         }
     }
 
+    phi1 += phi_i;
+
     if (do_grads) {
-        grad1[0] += g1[0];
-        grad1[1] += g1[1];
-        grad1[2] += g1[2];
+        grad1[0] += g1x;
+        grad1[1] += g1y;
+        grad1[2] += g1z;
         for (size_t i = start2; i < end2; i++) {
             grad2[shift2 + i] += g2[i];
             grad2[shift2 + nmon2 + i] += g2[nmon2 + i];
             grad2[shift2 + nmon22 + i] += g2[nmon22 + i];
         }
+
+        if (kVirial) {
+            (*virial)[0] += vxx;
+            (*virial)[1] += vxy;
+            (*virial)[2] += vxz;
+
+            (*virial)[4] += vyy;
+            (*virial)[5] += vyz;
+
+            (*virial)[8] += vzz;
+
+            (*virial)[3] = (*virial)[1];
+            (*virial)[6] = (*virial)[2];
+            (*virial)[7] = (*virial)[5];
+        }
     }
 
     return dispersion_energy;
 }
 
+double disp6(const double C6, const double d6, const double c6i, const double c6j, const double* p1, const double* xyz2,
+             double* grad1, double* grad2, double& phi1, double* phi2, const size_t nmon1, const size_t nmon2,
+             const size_t start2, const size_t end2, const size_t atom_index1, const size_t atom_index2,
+             const double disp_scale_factor, bool do_grads, const double cutoff, const double ewald_alpha,
+             const std::vector<double>& box, const std::vector<double>& box_inverse,std::vector<double> *virial) {
+    if (virial != 0) {
+        return tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+            return disp6_kernel<true>(C6, d6, c6i, c6j, p1, xyz2, grad1, grad2, phi1, phi2, nmon1, nmon2, start2,
+                                      end2, atom_index1, atom_index2, disp_scale_factor, do_grads, cutoff,
+                                      ewald_alpha, box, box_inverse, virial);
+        });
+    }
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+        return disp6_kernel<false>(C6, d6, c6i, c6j, p1, xyz2, grad1, grad2, phi1, phi2, nmon1, nmon2, start2, end2,
+                                   atom_index1, atom_index2, disp_scale_factor, do_grads, cutoff, ewald_alpha, box,
+                                   box_inverse, virial);
+    });
+}
+
 void GetC6(std::string mon_id1, std::string mon_id2, size_t index1, size_t index2, double& out_C6, double& out_d6) {
     // Order the two monomer names and corresponding xyz
     bool swaped = false;
@@ -39,6 +39,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <vector>
 
 #include "tools/math_tools.h"
 
@@ -63,6 +64,60 @@ const double if8 = 1.0 / disp::factorial<8>();
 
 double tang_toennies(int n, const double& x);
 
+//----------------------------------------------------------------------------//
+
+/**
+ * @brief Tabulated Tang-Toennies damping function of order 6.
+ *
+ * Stores, for each interval of a uniform grid in x = d6 * r, the cubic Hermite
+ * interpolants of f_6(x) and of df_6/dx, built from the analytic values and
+ * derivatives at the grid points. Past the end of the grid f_6 = 1 and its
+ * derivative is zero to machine precision, which is what an extra constant
+ * interval at the end of the table returns.
+ */
+class TangToenniesTable {
+   public:
+    /**
+     * @brief Builds the table.
+     *
+     * @param[in] xmax Largest tabulated value of d6 * r
+     * @param[in] dx Grid spacing
+     */
+    TangToenniesTable(const double xmax = 50.0, const double dx = 0.02);
+
+    /**
+     * @brief Evaluates the damping function and its derivative.
+     *
+     * @param[in] x Argument of the damping function, d6 * r (>= 0)
+     * @param[out] tt Value of f_6(x)
+     * @param[out] dtt Value of df_6/dx
+     */
+    inline void Eval(const double x, double& tt, double& dtt) const {
+        const double s = std::min(x * inv_dx_, nintervals_);
+        const size_t k = static_cast<size_t>(s);
+        const double t = x - k * dx_;
+        const double* c = coef_.data() + 8 * k;
+        tt = ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+        dtt = ((c[7] * t + c[6]) * t + c[5]) * t + c[4];
+    }
+
+   private:
+    // Grid spacing and its inverse
+    double dx_;
+    double inv_dx_;
+    // Number of tabulated intervals
+    double nintervals_;
+    // Polynomial coefficients in (x - x_k) of f_6 and df_6/dx, 8 per interval
+    std::vector<double> coef_;
+};
+
+/**
+ * @brief Returns the table shared by all the dispersion kernels.
+ *
+ * The table is built the first time this function is called.
+ */
+const TangToenniesTable& GetTangToenniesTable();
+
 //  double disp68(const double& C6, const double& d6,
 //                const double& C8, const double& d8,
 //                const double* p1, const double* p2,
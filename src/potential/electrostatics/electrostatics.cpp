@@ -39,6 +39,8 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 //#define PRINT_TERMS
 
 #include <iomanip>
+#include <algorithm>
+#include <limits>
 #ifdef DEBUG
 #include <iostream>
 #endif
@@ -56,9 +58,108 @@ namespace elec {
 
 const double PIQSRT = sqrt(M_PI);
 
-void Electrostatics::SetCutoff(double cutoff) { cutoff_ = cutoff; }
+// Ids of the scratch buffers kept in workspace_
+enum ElecBuffer {
+    kEfq1Pool = 0,
+    kEfq2Pool,
+    kPhi1Pool,
+    kPhi2Pool,
+    kVirialPool,
+    kXyzSitej,
+    kChgSitej,
+    kPhiSitej,
+    kEfqSitej,
+    kVirialSitej,
+    kEfd1Pool,
+    kEfd2Pool,
+    kGrad1Pool,
+    kGrad2Pool,
+    kCgTs2v,
+    kCgRv,
+    kCgPv,
+    kCgRnew,
+    kMuOld,
+    kPmeResult,
+    kPmeVirial,
+    kPmeMultipoles,
+    kMuSitej,
+    kEfdSitej,
+    kGradSitej,
+    kTreeResult,
+    kTholeIntra,
+    kTensorSitej,
+    kEfdTensorPool,
+    kExtSources,
+    kExtPoints,
+    kExtParams,
+    kExtRecResult,
+    kExtField,
+    kNumElecBuffers
+};
+
+namespace {
+
+typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<double, kdtutils::PointCloud<double>>,
+                                            kdtutils::PointCloud<double>, 3 /* dim */>
+    SiteTree;
+
+// Applies the minimum image convention to the displacement d, in the same
+// way as the field kernels
+void MinimumImage(const std::vector<double> &box, const std::vector<double> &box_inverse, double *d) {
+    double f[3];
+    for (size_t k = 0; k < 3; k++) {
+        f[k] = box_inverse[3 * k] * d[0] + box_inverse[3 * k + 1] * d[1] + box_inverse[3 * k + 2] * d[2];
+        f[k] -= std::floor(f[k] + 0.5);
+    }
+    for (size_t k = 0; k < 3; k++) d[k] = box[3 * k] * f[0] + box[3 * k + 1] * f[1] + box[3 * k + 2] * f[2];
+}
+
+// Brings the points xyzxyz... inside the unit cell
+void WrapIntoCell(const std::vector<double> &box, const std::vector<double> &box_inverse, std::vector<double> &xyz) {
+    for (size_t i = 0; i < xyz.size(); i += 3) {
+        double *r = &xyz[i];
+        double f[3];
+        for (size_t k = 0; k < 3; k++) {
+            f[k] = box_inverse[3 * k] * r[0] + box_inverse[3 * k + 1] * r[1] + box_inverse[3 * k + 2] * r[2];
+            f[k] -= std::floor(f[k]);
+        }
+        for (size_t k = 0; k < 3; k++) r[k] = box[3 * k] * f[0] + box[3 * k + 1] * f[1] + box[3 * k + 2] * f[2];
+    }
+}
+
+// Copies ncomp components of site j of the monomers in neigh, which are stored
+// with a stride of nmon starting at v[start], to the first ncomp * nneigh
+// elements of out, also with one block per component.
+void GatherNeighbors(const double *v, size_t ncomp, size_t nmon, const size_t *neigh, size_t nneigh,
+                     size_t fi_mon, std::vector<double> &out) {
+    for (size_t c = 0; c < ncomp; c++) {
+        for (size_t ind = 0; ind < nneigh; ind++) {
+            out[c * nneigh + ind] = v[c * nmon + neigh[ind] - fi_mon];
+        }
+    }
+}
+
+// Adds back to v the values gathered with GatherNeighbors
+void ScatterNeighbors(const std::vector<double> &in, size_t ncomp, size_t nmon, const size_t *neigh, size_t nneigh,
+                      size_t fi_mon, double *v) {
+    for (size_t c = 0; c < ncomp; c++) {
+        for (size_t ind = 0; ind < nneigh; ind++) {
+            v[c * nmon + neigh[ind] - fi_mon] += in[c * nneigh + ind];
+        }
+    }
+}
+
+}  // namespace
+
+void Electrostatics::SetCutoff(double cutoff) {
+    cutoff_ = cutoff;
+    dipole_tensor_built_ = false;
+}
 
-void Electrostatics::SetEwaldAlpha(double alpha) { ewald_alpha_ = alpha; }
+void Electrostatics::SetEwaldAlpha(double alpha) {
+    ewald_alpha_ = alpha;
+    dipole_tensor_built_ = false;
+}
 
 void Electrostatics::SetEwaldGridDensity(double density) { pme_grid_density_ = density; }
 
@@ -68,6 +169,61 @@ void Electrostatics::SetDipoleTolerance(double tol) { tolerance_ = tol; }
 
 void Electrostatics::SetDipoleMaxIt(size_t maxit) { maxit_ = maxit;}
 
+void Electrostatics::SetTreecode(double theta, double near_radius) {
+    if (theta < 0.0 || theta >= 1.0) {
+        std::string text = "The opening angle of the treecode must be in [0, 1). Got " + std::to_string(theta);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (near_radius <= 0.0) {
+        std::string text = "The near field radius of the treecode must be positive. Got " + std::to_string(near_radius);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    treecode_theta_ = theta;
+    treecode_radius_ = near_radius;
+}
+
+void Electrostatics::SetDipoleTensor(double max_memory_mb) {
+    dipole_tensor_max_mb_ = max_memory_mb;
+    dipole_tensor_built_ = false;
+    dipole_tensor_too_large_ = false;
+}
+
+void Electrostatics::SetExternalCharges(const std::vector<double> &xyz, const std::vector<double> &chg) {
+    if (xyz.size() != 3 * chg.size()) {
+        std::string text = "Expected 3 coordinates per external charge. Got " + std::to_string(xyz.size()) +
+                           " coordinates for " + std::to_string(chg.size()) + " charges.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    ext_xyz_ = xyz;
+    ext_chg_ = chg;
+    has_energy_ = false;
+}
+
+size_t Electrostatics::GetDipoleTensorSize() const { return dipole_tensor_built_ ? dipole_tensor_size_ : 0; }
+
+void Electrostatics::SetPairList(const std::vector<size_t> &pairs) {
+    use_pair_list_ = pairs.size();
+    if (!use_pair_list_) return;
+
+    // Count the neighbors of each monomer and store them as a compressed list
+    neighbor_start_.assign(nmon_total_ + 1, 0);
+    for (size_t k = 0; k < pairs.size(); k += 2) {
+        neighbor_start_[std::min(pairs[k], pairs[k + 1]) + 1]++;
+    }
+    for (size_t m = 0; m < nmon_total_; m++) {
+        neighbor_start_[m + 1] += neighbor_start_[m];
+    }
+    neighbors_.resize(pairs.size() / 2);
+    std::vector<size_t> next(neighbor_start_.begin(), neighbor_start_.end() - 1);
+    for (size_t k = 0; k < pairs.size(); k += 2) {
+        size_t m1 = std::min(pairs[k], pairs[k + 1]);
+        neighbors_[next[m1]++] = std::max(pairs[k], pairs[k + 1]);
+    }
+    for (size_t m = 0; m < nmon_total_; m++) {
+        std::sort(neighbors_.begin() + neighbor_start_[m], neighbors_.begin() + neighbor_start_[m + 1]);
+    }
+}
+
 void Electrostatics::Initialize(const std::vector<double> &chg, const std::vector<double> &chg_grad,
                                 const std::vector<double> &polfac, const std::vector<double> &pol,
                                 const std::vector<double> &sys_xyz, const std::vector<std::string> &mon_id,
@@ -89,6 +245,7 @@ void Electrostatics::Initialize(const std::vector<double> &chg, const std::vecto
     sites_ = sites;
     first_ind_ = first_ind;
     mon_type_count_ = mon_type_count;
+    systools::GetExcludedByType(mon_type_count_, exc12_, exc13_, exc14_);
     do_grads_ = do_grads;
     tolerance_ = tolerance;
     maxit_ = maxit;
@@ -96,6 +253,13 @@ void Electrostatics::Initialize(const std::vector<double> &chg, const std::vecto
     box_ = box;
     use_pbc_ = box.size();
     cutoff_ = 1000.0;
+    treecode_theta_ = 0.0;
+    treecode_radius_ = 9.0;
+    use_pair_list_ = false;
+    dipole_tensor_max_mb_ = 0.0;
+    dipole_tensor_built_ = false;
+    dipole_tensor_too_large_ = false;
+    dipole_tensor_size_ = 0;
 
     // Initialize other variables
     nsites_ = sys_chg_.size();
@@ -146,12 +310,47 @@ void Electrostatics::Initialize(const std::vector<double> &chg, const std::vecto
     sys_mol_perm_mu_ = std::vector<double>(3*nmon_total_,0.0);
     sys_mol_mu_ = std::vector<double>(3*nmon_total_,0.0);
     
-    calc_virial_ = true;
-    if (do_grads == false) {
-        calc_virial_=false;
+    // Scratch buffers are sized in the first energy call
+    workspace_ = tools::Workspace(kNumElecBuffers);
+    field_pool_.clear();
+    field_pool_maxnmon_ = 0;
+    field_pool_resizes_ = 0;
+}
+
+size_t Electrostatics::GetNumBufferResizes() const {
+    return workspace_.GetNumBufferResizes() + field_pool_resizes_;
+}
+
+void Electrostatics::SetUpFieldPool(size_t nthreads, size_t maxnmon) {
+    workspace_.SetNumThreads(nthreads);
+    if (field_pool_.size() < nthreads || field_pool_maxnmon_ != maxnmon) {
+        field_pool_ = std::vector<ElectricFieldHolder>(nthreads, ElectricFieldHolder(maxnmon));
+        field_pool_maxnmon_ = maxnmon;
+        field_pool_resizes_++;
     }
 }
 
+PMEInstanceD &Electrostatics::GetPMESolver() {
+    PMEInstanceD &pme_solver = pme_solver_.Get();
+    // Compute the reciprocal space terms, using PME
+    double A = box_[0], B = box_[4], C = box_[8];
+    int grid_A = pme_grid_density_ * A;
+    int grid_B = pme_grid_density_ * B;
+    int grid_C = pme_grid_density_ * C;
+    // Spread, FFT and gather with the current OpenMP thread count. helPME
+    // only picks the count up on its first setup if it is given as 0.
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    // Both calls are cheap if nothing changed since the previous step
+    // Setup creates the FFTW plans, and the FFTW planner is not thread safe
+#pragma omp critical(mbx_fftw_planner)
+    pme_solver.setup(1, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, 1, nthreads);
+    pme_solver.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+    return pme_solver;
+}
+
 void Electrostatics::SetNewParameters(const std::vector<double> &xyz, const std::vector<double> &chg,
                                       const std::vector<double> &chg_grad, const std::vector<double> &pol,
                                       const std::vector<double> &polfac, const std::string dip_method,
@@ -166,6 +365,9 @@ void Electrostatics::SetNewParameters(const std::vector<double> &xyz, const std:
     box_ = box;
     use_pbc_ = box.size();
     cutoff_ = cutoff;
+    // The dipole tensors are rebuilt for the new geometry
+    dipole_tensor_built_ = false;
+    dipole_tensor_too_large_ = false;
     if (use_pbc_) box_inverse_ = InvertUnitCell(box_);
 
     size_t nsites3 = nsites_ * 3;
@@ -239,6 +441,43 @@ void Electrostatics::ReorderData() {
     }
 }
 
+void Electrostatics::SetUpTreecode() {
+    // Pairs of sites of the same monomer must all be in the near field, where
+    // the exclusions are applied
+    size_t fi_mon = 0;
+    size_t fi_crd = 0;
+    double max_d2 = 0.0;
+    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+        size_t ns = sites_[fi_mon];
+        size_t nmon = mon_type_count_[mt].second;
+        for (size_t i = 0; i < ns; i++) {
+            for (size_t j = i + 1; j < ns; j++) {
+                for (size_t m = 0; m < nmon; m++) {
+                    double d2 = 0.0;
+                    for (size_t dim = 0; dim < 3; dim++) {
+                        double d = xyz_[fi_crd + 3 * i * nmon + dim * nmon + m] -
+                                   xyz_[fi_crd + 3 * j * nmon + dim * nmon + m];
+                        d2 += d * d;
+                    }
+                    max_d2 = std::max(max_d2, d2);
+                }
+            }
+        }
+        fi_mon += nmon;
+        fi_crd += nmon * ns * 3;
+    }
+    if (max_d2 >= treecode_radius_ * treecode_radius_) {
+        std::string text = "Two sites of the same monomer are " + std::to_string(std::sqrt(max_d2)) +
+                           " Angstrom apart, more than the treecode near field radius " +
+                           std::to_string(treecode_radius_);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // The direct loops only do the near field
+    cutoff_ = treecode_radius_;
+    treecode_.Build(sys_xyz_, treecode_radius_, treecode_theta_);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PERMANENT ELECTRIC FIELD ////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -246,7 +485,6 @@ void Electrostatics::ReorderData() {
 void Electrostatics::CalculatePermanentElecField() {
     // Max number of monomers
     size_t maxnmon = mon_type_count_.back().second;
-    ElectricFieldHolder elec_field(maxnmon);
 
     // Parallelization
     size_t nthreads = 1;
@@ -258,6 +496,14 @@ void Electrostatics::CalculatePermanentElecField() {
     }
 #endif
 
+    SetUpFieldPool(nthreads, maxnmon);
+    ElectricFieldHolder &elec_field = field_pool_[0];
+
+    // With the treecode, the loops below only do the near field, and visit
+    // only the monomer pairs in the pair list if there is one
+    if (UseTreecode()) SetUpTreecode();
+    bool near_list = use_pair_list_ && UseTreecode();
+
     // This part looks at sites inside the same monomer
     // Reset first indexes
     size_t fi_mon = 0;
@@ -273,11 +519,6 @@ void Electrostatics::CalculatePermanentElecField() {
     std::fill(phi_.begin(), phi_.end(), 0);
     std::fill(Efq_.begin(), Efq_.end(), 0);
 
-    // Excluded sets
-    excluded_set_type exc12;
-    excluded_set_type exc13;
-    excluded_set_type exc14;
-
     // Loop over each monomer type
     for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
         size_t ns = sites_[fi_mon];
@@ -285,7 +526,9 @@ void Electrostatics::CalculatePermanentElecField() {
         size_t nmon2 = 2 * nmon;
 
         // Obtain excluded pairs for monomer type mt
-        systools::GetExcluded(mon_id_[fi_mon], exc12, exc13, exc14);
+        const excluded_set_type &exc12 = exc12_[mt];
+        const excluded_set_type &exc13 = exc13_[mt];
+        const excluded_set_type &exc14 = exc14_[mt];
 
         // Loop over each pair of sites
         for (size_t i = 0; i < ns - 1; i++) {
@@ -315,7 +558,8 @@ void Electrostatics::CalculatePermanentElecField() {
                                                       chg_.data() + fi_sites, chg_.data() + fi_sites, m, m, m + 1, nmon,
                                                       nmon, i, j, Ai, Asqsqi, aCC_, aCC1_4_, g34_, &ex, &ey, &ez, &phi1,
                                                       phi_.data() + fi_sites, Efq_.data() + fi_crd, elec_scale_factor,
-                                                      ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_, &virial_);
+                                                      ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_,
+                                                      calc_virial_ ? &virial_ : 0);
                     phi_[fi_sites + inmon + m] += phi1;
                     Efq_[fi_crd + inmon3 + m] += ex;
                     Efq_[fi_crd + inmon3 + nmon + m] += ey;
@@ -362,19 +606,19 @@ void Electrostatics::CalculatePermanentElecField() {
             // TODO add neighbour list here
             // Loop over all pair of sites
 
-            std::vector<std::shared_ptr<ElectricFieldHolder>> field_pool;
-            std::vector<std::vector<double>> Efq_1_pool;
-            std::vector<std::vector<double>> Efq_2_pool;
-            std::vector<std::vector<double>> phi_1_pool;
-            std::vector<std::vector<double>> phi_2_pool;
-            std::vector<std::vector<double>> virial_pool;
+            // Per thread accumulators, retrieved with workspace_.At() below
             for (size_t i = 0; i < nthreads; i++) {
-                field_pool.push_back(std::make_shared<ElectricFieldHolder>(maxnmon));
-                Efq_1_pool.push_back(std::vector<double>(nmon1 * ns1 * 3, 0.0));
-                Efq_2_pool.push_back(std::vector<double>(nmon2 * ns2 * 3, 0.0));
-                phi_1_pool.push_back(std::vector<double>(nmon1 * ns1, 0.0));
-                phi_2_pool.push_back(std::vector<double>(nmon2 * ns2, 0.0));
-                virial_pool.push_back(std::vector<double>(9, 0.0));
+                workspace_.Get(kEfq1Pool, nmon1 * ns1 * 3, i);
+                workspace_.Get(kEfq2Pool, nmon2 * ns2 * 3, i);
+                workspace_.Get(kPhi1Pool, nmon1 * ns1, i);
+                workspace_.Get(kPhi2Pool, nmon2 * ns2, i);
+                workspace_.Get(kVirialPool, 9, i);
+                // Room for all the sites j, so that the threads do not grow them in the loop
+                workspace_.Reserve(kXyzSitej, 3 * nmon2, i);
+                workspace_.Reserve(kChgSitej, nmon2, i);
+                workspace_.Reserve(kPhiSitej, nmon2, i);
+                workspace_.Reserve(kEfqSitej, 3 * nmon2, i);
+                workspace_.Reserve(kVirialSitej, 9, i);
             }
 
 #ifdef _OPENMP
@@ -385,21 +629,34 @@ void Electrostatics::CalculatePermanentElecField() {
 #ifdef _OPENMP
                 rank = omp_get_thread_num();
 #endif
-                std::shared_ptr<ElectricFieldHolder> local_field = field_pool[rank];
+                ElectricFieldHolder *local_field = &field_pool_[rank];
+                std::vector<double> &Efq_1_pool = workspace_.At(kEfq1Pool, rank);
+                std::vector<double> &Efq_2_pool = workspace_.At(kEfq2Pool, rank);
+                std::vector<double> &phi_1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi_2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                 size_t m2init = same ? m1 + 1 : 0;
                 double ex_thread = 0.0;
                 double ey_thread = 0.0;
                 double ez_thread = 0.0;
                 double phi1_thread = 0.0;
+
+                // With a pair list, only the neighbors of m1 of type mt2 are visited.
+                // They are stored with indexes larger than m1, so "same" needs no check.
+                const size_t *neigh_begin = 0;
+                size_t nneigh = 0;
+                if (near_list) {
+                    const size_t *first = neighbors_.data() + neighbor_start_[fi_mon1 + m1];
+                    const size_t *last = neighbors_.data() + neighbor_start_[fi_mon1 + m1 + 1];
+                    neigh_begin = std::lower_bound(first, last, fi_mon2);
+                    nneigh = std::lower_bound(neigh_begin, last, fi_mon2 + nmon2) - neigh_begin;
+                    if (nneigh == 0) continue;
+                }
+
                 for (size_t i = 0; i < ns1; i++) {
                     size_t inmon1 = i * nmon1;
                     size_t inmon13 = inmon1 * 3;
 
-                    std::vector<double> xyz_sitei(3);
-                    xyz_sitei[0] = xyz_[fi_crd1 + inmon13 + m1];
-                    xyz_sitei[1] = xyz_[fi_crd1 + inmon13 + nmon1 + m1];
-                    xyz_sitei[2] = xyz_[fi_crd1 + inmon13 + 2 * nmon1 + m1];
-
                     for (size_t j = 0; j < ns2; j++) {
                         size_t jnmon2 = j * nmon2;
                         size_t jnmon23 = jnmon2 * 3;
@@ -408,26 +665,34 @@ void Electrostatics::CalculatePermanentElecField() {
                         // What we are going to do here is to get all sites j of all m2
                         // that are close to site i of the monomer m1 we are looking at
                         size_t start_j = fi_crd2 + jnmon23;
-                        size_t size_j = nmon2 - m2init;
-                        std::vector<double> xyz_sitej(3 * size_j);
-                        // Copy x
-                        std::copy(xyz_.begin() + start_j + m2init, xyz_.begin() + start_j + nmon2, xyz_sitej.begin());
-                        // Copy y
-                        std::copy(xyz_.begin() + start_j + nmon2 + m2init, xyz_.begin() + start_j + 2 * nmon2,
-                                  xyz_sitej.begin() + size_j);
-                        // Copy y
-                        std::copy(xyz_.begin() + start_j + 2 * nmon2 + m2init, xyz_.begin() + start_j + 3 * nmon2,
-                                  xyz_sitej.begin() + 2 * size_j);
+                        size_t size_j = near_list ? nneigh : nmon2 - m2init;
+                        std::vector<double> &xyz_sitej = workspace_.Get(kXyzSitej, 3 * size_j, rank);
 
                         // Vector that will tell the original position of the new sites
-                        std::vector<double> chg_sitej(size_j);
-                        std::vector<double> phi_sitej(size_j, 0.0);
-                        std::vector<double> Efq_sitej(3 * size_j, 0.0);
+                        std::vector<double> &chg_sitej = workspace_.Get(kChgSitej, size_j, rank);
+                        std::vector<double> &phi_sitej = workspace_.Get(kPhiSitej, size_j, rank);
+                        std::vector<double> &Efq_sitej = workspace_.Get(kEfqSitej, 3 * size_j, rank);
                         // declare temporary virial for each pair
-                        std::vector<double> virial_thread(9,0.0);
+                        std::vector<double> &virial_thread = workspace_.Get(kVirialSitej, 9, rank);
 
-                        std::copy(chg_.begin() + fi_sites2 + nmon2 * j + m2init,
-                                  chg_.begin() + fi_sites2 + nmon2 * (j + 1), chg_sitej.begin());
+                        if (near_list) {
+                            GatherNeighbors(xyz_.data() + start_j, 3, nmon2, neigh_begin, nneigh, fi_mon2, xyz_sitej);
+                            GatherNeighbors(chg_.data() + fi_sites2 + jnmon2, 1, nmon2, neigh_begin, nneigh,
+                                            fi_mon2, chg_sitej);
+                        } else {
+                            // Copy x
+                            std::copy(xyz_.begin() + start_j + m2init, xyz_.begin() + start_j + nmon2,
+                                      xyz_sitej.begin());
+                            // Copy y
+                            std::copy(xyz_.begin() + start_j + nmon2 + m2init, xyz_.begin() + start_j + 2 * nmon2,
+                                      xyz_sitej.begin() + size_j);
+                            // Copy y
+                            std::copy(xyz_.begin() + start_j + 2 * nmon2 + m2init,
+                                      xyz_.begin() + start_j + 3 * nmon2, xyz_sitej.begin() + 2 * size_j);
+
+                            std::copy(chg_.begin() + fi_sites2 + nmon2 * j + m2init,
+                                      chg_.begin() + fi_sites2 + nmon2 * (j + 1), chg_sitej.begin());
+                        }
 
                         // Check if A = 0 and call the proper field calculation
                         double A = polfac_[fi_sites1 + i] * polfac_[fi_sites2 + j];
@@ -446,7 +711,7 @@ void Electrostatics::CalculatePermanentElecField() {
                             xyz_.data() + fi_crd1, xyz_sitej.data(), chg_.data() + fi_sites1, chg_sitej.data(), m1, 0,
                             size_j, nmon1, size_j, i, 0, Ai, Asqsqi, aCC_, aCC1_4_, g34_, &ex_thread, &ey_thread,
                             &ez_thread, &phi1_thread, phi_sitej.data(), Efq_sitej.data(), elec_scale_factor,
-                            ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_, &virial_thread);
+                            ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_, calc_virial_ ? &virial_thread : 0);
                         //                        local_field->CalcPermanentElecField(
                         //                            xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, chg_.data() +
                         //                            fi_sites1, chg_.data() + fi_sites2, m1, m2init, nmon2, nmon1,
@@ -455,45 +720,57 @@ void Electrostatics::CalculatePermanentElecField() {
                         //                            Efq_2_pool[rank].data());
 
                         // Put proper data in field and electric field of j
-                        for (size_t ind = 0; ind < size_j; ind++) {
-                            phi_2_pool[rank][jnmon2 + m2init + ind] += phi_sitej[ind];
-                            for (size_t dim = 0; dim < 3; dim++) {
-                                Efq_2_pool[rank][jnmon23 + nmon2 * dim + m2init + ind] += Efq_sitej[dim * size_j + ind];
+                        if (near_list) {
+                            ScatterNeighbors(phi_sitej, 1, nmon2, neigh_begin, nneigh, fi_mon2,
+                                             phi_2_pool.data() + jnmon2);
+                            ScatterNeighbors(Efq_sitej, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                             Efq_2_pool.data() + jnmon23);
+                        } else {
+                            for (size_t ind = 0; ind < size_j; ind++) {
+                                phi_2_pool[jnmon2 + m2init + ind] += phi_sitej[ind];
+                                for (size_t dim = 0; dim < 3; dim++) {
+                                    Efq_2_pool[jnmon23 + nmon2 * dim + m2init + ind] += Efq_sitej[dim * size_j + ind];
+                                }
                             }
                         }
 
-                        phi_1_pool[rank][inmon1 + m1] += phi1_thread;
-                        Efq_1_pool[rank][inmon13 + m1] += ex_thread;
-                        Efq_1_pool[rank][inmon13 + nmon1 + m1] += ey_thread;
-                        Efq_1_pool[rank][inmon13 + nmon12 + m1] += ez_thread;
+                        phi_1_pool[inmon1 + m1] += phi1_thread;
+                        Efq_1_pool[inmon13 + m1] += ex_thread;
+                        Efq_1_pool[inmon13 + nmon1 + m1] += ey_thread;
+                        Efq_1_pool[inmon13 + nmon12 + m1] += ez_thread;
 
                         // update virial_pool from virial_threads
                         for (size_t k = 0; k <9 ; k++) {
-                            virial_pool[rank][k] += virial_thread[k];
+                            virial_pool[k] += virial_thread[k];
                         }
                     }
                 }
             }
             // Compress data in Efq and phi
             for (size_t rank = 0; rank < nthreads; rank++) {
-                size_t kend1 = Efq_1_pool[rank].size();
-                size_t kend2 = Efq_2_pool[rank].size();
+                std::vector<double> &Efq_1_pool = workspace_.At(kEfq1Pool, rank);
+                std::vector<double> &Efq_2_pool = workspace_.At(kEfq2Pool, rank);
+                std::vector<double> &phi_1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi_2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+                size_t kend1 = Efq_1_pool.size();
+                size_t kend2 = Efq_2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    Efq_[fi_crd1 + k] += Efq_1_pool[rank][k];
+                    Efq_[fi_crd1 + k] += Efq_1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    Efq_[fi_crd2 + k] += Efq_2_pool[rank][k];
+                    Efq_[fi_crd2 + k] += Efq_2_pool[k];
                 }
-                kend1 = phi_1_pool[rank].size();
-                kend2 = phi_2_pool[rank].size();
+                kend1 = phi_1_pool.size();
+                kend2 = phi_2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    phi_[fi_sites1 + k] += phi_1_pool[rank][k];
+                    phi_[fi_sites1 + k] += phi_1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    phi_[fi_sites2 + k] += phi_2_pool[rank][k];
+                    phi_[fi_sites2 + k] += phi_2_pool[k];
                 }
                 for (size_t k = 0; k < 9; k++) {
-                    virial_[k] += virial_pool[rank][k];
+                    virial_[k] += virial_pool[k];
                 }
             }
             // Update first indexes
@@ -508,20 +785,13 @@ void Electrostatics::CalculatePermanentElecField() {
     }
 
     if (ewald_alpha_ > 0 && use_pbc_) {
-        helpme::PMEInstance<double> pme_solver_;
-        // Compute the reciprocal space terms, using PME
-        double A = box_[0], B = box_[4], C = box_[8];
-        int grid_A = pme_grid_density_ * A;
-        int grid_B = pme_grid_density_ * B;
-        int grid_C = pme_grid_density_ * C;
-        pme_solver_.setup(1, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, 1, 0);
-        pme_solver_.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+        PMEInstanceD &pme_solver = GetPMESolver();
         // N.B. these do not make copies; they just wrap the memory with some metadata
         auto coords = helpme::Matrix<double>(sys_xyz_.data(), nsites_, 3);
         auto charges = helpme::Matrix<double>(sys_chg_.data(), nsites_, 1);
         auto result = helpme::Matrix<double>(rec_phi_and_field_.data(), nsites_, 4);
         std::fill(rec_phi_and_field_.begin(), rec_phi_and_field_.end(), 0);
-        pme_solver_.computePRec(0, charges, coords, coords, 1, result);
+        pme_solver.computePRec(0, charges, coords, coords, 1, result);
 
         // Resort phi from system order
         fi_mon = 0;
@@ -550,6 +820,33 @@ void Electrostatics::CalculatePermanentElecField() {
             ++phi_ptr;
         }
     }
+
+    if (UseTreecode()) {
+        // Far field of the charges, in system order
+        std::vector<double> &result = workspace_.Get(kTreeResult, 4 * nsites_);
+        treecode_.ComputePotential(sys_chg_.data(), 0, 1, result);
+
+        // Resort phi from system order
+        fi_mon = 0;
+        fi_sites = 0;
+        for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+            size_t ns = sites_[fi_mon];
+            size_t nmon = mon_type_count_[mt].second;
+            for (size_t m = 0; m < nmon; m++) {
+                size_t mns = m * ns;
+                for (size_t i = 0; i < ns; i++) {
+                    size_t inmon = i * nmon;
+                    const double *result_ptr = result.data() + 4 * (fi_sites + mns + i);
+                    phi_[fi_sites + inmon + m] += result_ptr[0];
+                    Efq_[3 * fi_sites + 3 * inmon + 0 * nmon + m] -= result_ptr[1];
+                    Efq_[3 * fi_sites + 3 * inmon + 1 * nmon + m] -= result_ptr[2];
+                    Efq_[3 * fi_sites + 3 * inmon + 2 * nmon + m] -= result_ptr[3];
+                }
+            }
+            fi_mon += nmon;
+            fi_sites += nmon * ns;
+        }
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -697,13 +994,13 @@ void Electrostatics::CalculateDipolesCG() {
     }
 #endif
 
-    std::vector<double> ts2v(nsites3);
+    std::vector<double> &ts2v = workspace_.Get(kCgTs2v, nsites3);
 
     DipolesCGIteration(mu_, ts2v);
 
-    std::vector<double> rv(nsites3);
-    std::vector<double> pv(nsites3);
-    std::vector<double> r_new(nsites3);
+    std::vector<double> &rv = workspace_.Get(kCgRv, nsites3);
+    std::vector<double> &pv = workspace_.Get(kCgPv, nsites3);
+    std::vector<double> &r_new = workspace_.Get(kCgRnew, nsites3);
 
     //#   ifdef _OPENMP
     //#     pragma omp parallel for schedule(static)
@@ -764,7 +1061,7 @@ void Electrostatics::CalculateDipolesCG() {
             pv[i] = r_new[i] + betak * pv[i];
         }
         rvrv = rvrv_new;
-        rv = r_new;
+        std::swap(rv, r_new);
         iter++;
     }
 
@@ -844,6 +1141,56 @@ void Electrostatics::SetAspcParameters(size_t k) {
 
 void Electrostatics::ResetAspcHistory() { hist_num_aspc_ = 0; }
 
+void Electrostatics::PermuteMonomers(const std::vector<size_t> &perm) {
+    ResetAspcHistory();
+    if (mu_.size() != 3 * nsites_) return;
+
+    // mu_ is stored by site and component with the monomer index last,
+    // sys_xyz_ and sys_chg_ by monomer
+    std::vector<double> mu(mu_);
+    std::vector<double> xyz(sys_xyz_);
+    std::vector<double> chg(sys_chg_);
+    size_t fi_mon = 0;
+    size_t fi_sites = 0;
+    size_t fi_crd = 0;
+    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+        size_t ns = sites_[fi_mon];
+        size_t nmon = mon_type_count_[mt].second;
+        for (size_t m = 0; m < nmon; m++) {
+            size_t old = perm[fi_mon + m] - fi_mon;
+            for (size_t k = 0; k < 3 * ns; k++) {
+                mu_[fi_crd + k * nmon + m] = mu[fi_crd + k * nmon + old];
+            }
+            std::copy(xyz.begin() + fi_crd + 3 * ns * old, xyz.begin() + fi_crd + 3 * ns * (old + 1),
+                      sys_xyz_.begin() + fi_crd + 3 * ns * m);
+            std::copy(chg.begin() + fi_sites + ns * old, chg.begin() + fi_sites + ns * (old + 1),
+                      sys_chg_.begin() + fi_sites + ns * m);
+        }
+        fi_mon += nmon;
+        fi_sites += nmon * ns;
+        fi_crd += nmon * ns * 3;
+    }
+}
+
+size_t Electrostatics::GetDipoleHistory(std::vector<double> &mu, std::vector<double> &mu_hist) {
+    mu = mu_;
+    mu_hist = mu_hist_;
+    return hist_num_aspc_;
+}
+
+void Electrostatics::SetDipoleHistory(const std::vector<double> &mu, const std::vector<double> &mu_hist,
+                                      size_t hist_num) {
+    if (mu.size() != mu_.size() || mu_hist.size() != mu_hist_.size() || hist_num > k_aspc_ + 2) {
+        std::string text = "Dipole history does not match the system: mu(" + std::to_string(mu.size()) + " vs " +
+                           std::to_string(mu_.size()) + "), mu_hist(" + std::to_string(mu_hist.size()) + " vs " +
+                           std::to_string(mu_hist_.size()) + "), steps(" + std::to_string(hist_num) + ")";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    std::copy(mu.begin(), mu.end(), mu_.begin());
+    std::copy(mu_hist.begin(), mu_hist.end(), mu_hist_.begin());
+    hist_num_aspc_ = hist_num;
+}
+
 void Electrostatics::CalculateDipolesAspc() {
     if (hist_num_aspc_ < k_aspc_ + 2) {
         // TODO do we want to allow iteration?
@@ -877,7 +1224,8 @@ void Electrostatics::CalculateDipolesAspc() {
         size_t fi_sites = 0;
         double alpha = 0.8;
         double alpha_i = 0.2;
-        std::vector<double> mu_old = mu_;
+        std::vector<double> &mu_old = workspace_.Get(kMuOld, mu_.size());
+        std::copy(mu_.begin(), mu_.end(), mu_old.begin());
         for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
             size_t ns = sites_[fi_mon];
             size_t nmon = mon_type_count_[mt].second;
@@ -921,7 +1269,7 @@ void Electrostatics::CalculateDipolesAspc() {
     }  // end if (hist_num_aspc_ < k_aspc_ + 2)
 }
 
-void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<double> &out_v) {
+void Electrostatics::BuildDipoleTensor() {
     // Parallelization
     size_t nthreads = 1;
 #ifdef _OPENMP
@@ -934,16 +1282,257 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
 
     // Max number of monomers
     size_t maxnmon = mon_type_count_.back().second;
-    ElectricFieldHolder elec_field(maxnmon);
+    SetUpFieldPool(nthreads, maxnmon);
+    bool near_list = use_pair_list_ && UseTreecode();
+
+    // Each thread keeps the rows it builds. The capacity of the blocks is kept
+    // between geometries.
+    dipole_tensor_.resize(nthreads);
+    for (size_t rank = 0; rank < nthreads; rank++) {
+        dipole_tensor_[rank].rows.clear();
+        dipole_tensor_[rank].cols.clear();
+        dipole_tensor_[rank].values.clear();
+    }
+    const size_t pair_bytes = sizeof(size_t) + 6 * sizeof(double);
+    const size_t max_pairs = static_cast<size_t>(dipole_tensor_max_mb_ * 1024 * 1024 / pair_bytes);
+    size_t npairs = 0;
+    bool too_large = false;
 
-    std::fill(out_v.begin(), out_v.end(), 0);
-    double *in_ptr = in_v.data();
-    double aDD = 0.0;
+    size_t fi_mon1 = 0;
+    size_t fi_sites1 = 0;
+    size_t fi_crd1 = 0;
+    for (size_t mt1 = 0; mt1 < mon_type_count_.size(); mt1++) {
+        size_t ns1 = sites_[fi_mon1];
+        size_t nmon1 = mon_type_count_[mt1].second;
+
+        // aDD of the pairs of sites of the same monomer
+        std::vector<double> &aDD_intra = workspace_.Get(kTholeIntra, ns1 * ns1);
+        const excluded_set_type &exc12 = exc12_[mt1];
+        const excluded_set_type &exc13 = exc13_[mt1];
+        const excluded_set_type &exc14 = exc14_[mt1];
+        for (size_t i = 0; i < ns1; i++) {
+            for (size_t j = i + 1; j < ns1; j++) {
+                bool is12 = systools::IsExcluded(exc12, i, j);
+                bool is13 = systools::IsExcluded(exc13, i, j);
+                bool is14 = systools::IsExcluded(exc14, i, j);
+                aDD_intra[i * ns1 + j] = systools::GetAdd(is12, is13, is14, mon_id_[fi_mon1]);
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for (size_t m1 = 0; m1 < nmon1; m1++) {
+            bool stop;
+#pragma omp atomic read
+            stop = too_large;
+            if (stop) continue;
+
+            int rank = 0;
+#ifdef _OPENMP
+            rank = omp_get_thread_num();
+#endif
+            ElectricFieldHolder *local_field = &field_pool_[rank];
+            DipoleTensorBlock &block = dipole_tensor_[rank];
+            size_t added = block.cols.size();
+
+            // Keeps the tensors of the pairs within the cutoff. The others are zero.
+            auto add_pairs = [&block](const std::vector<double> &t, size_t n, size_t col0, size_t col_step,
+                                      const size_t *neigh, size_t fi_mon2) {
+                for (size_t k = 0; k < n; k++) {
+                    const double *tk = t.data() + 6 * k;
+                    if (tk[0] == 0 && tk[1] == 0 && tk[2] == 0 && tk[3] == 0 && tk[4] == 0 && tk[5] == 0) continue;
+                    block.cols.push_back(col0 + (neigh ? neigh[k] - fi_mon2 : k * col_step));
+                    block.values.insert(block.values.end(), tk, tk + 6);
+                }
+            };
+            // Closes the row of site i with the columns added since the previous row
+            auto close_row = [&block](size_t site, size_t stride, size_t col_stride) {
+                size_t begin = block.rows.empty() ? 0 : block.rows.back().end;
+                if (block.cols.size() > begin) block.rows.push_back({site, stride, col_stride, block.cols.size()});
+            };
+
+            for (size_t i = 0; i < ns1; i++) {
+                size_t row = fi_crd1 + 3 * i * nmon1 + m1;
+
+                // Sites of the same monomer
+                for (size_t j = i + 1; j < ns1; j++) {
+                    // Both induced dipoles are always zero
+                    if (pol_[fi_sites1 + i] == 0 && pol_[fi_sites1 + j] == 0) continue;
+                    double A = polfac_[fi_sites1 + i] * polfac_[fi_sites1 + j];
+                    double Asqsqi = BIGNUM;
+                    if (A > constants::EPS) {
+                        double Ai = 1 / std::pow(A, 1.0 / 6.0);
+                        Asqsqi = Ai * Ai * Ai * Ai;
+                    }
+                    std::vector<double> &t = workspace_.Get(kTensorSitej, 6, rank);
+                    local_field->CalcDipoleTensor(xyz_.data() + fi_crd1, xyz_.data() + fi_crd1, m1, m1, m1 + 1, nmon1,
+                                                  nmon1, i, j, Asqsqi, aDD_intra[i * ns1 + j], t.data(), ewald_alpha_,
+                                                  use_pbc_, box_, box_inverse_, cutoff_);
+                    add_pairs(t, 1, fi_crd1 + 3 * j * nmon1 + m1, 0, 0, 0);
+                }
+                close_row(row, nmon1, nmon1);
+
+                // Other monomers. aDD intermolecular is always 0.055
+                size_t fi_mon2 = fi_mon1;
+                size_t fi_sites2 = fi_sites1;
+                size_t fi_crd2 = fi_crd1;
+                for (size_t mt2 = mt1; mt2 < mon_type_count_.size(); mt2++) {
+                    size_t ns2 = sites_[fi_mon2];
+                    size_t nmon2 = mon_type_count_[mt2].second;
+                    size_t m2init = mt1 == mt2 ? m1 + 1 : 0;
+
+                    // With a pair list, only the neighbors of m1 of type mt2 are visited
+                    const size_t *neigh_begin = 0;
+                    size_t nneigh = 0;
+                    if (near_list) {
+                        const size_t *first = neighbors_.data() + neighbor_start_[fi_mon1 + m1];
+                        const size_t *last = neighbors_.data() + neighbor_start_[fi_mon1 + m1 + 1];
+                        neigh_begin = std::lower_bound(first, last, fi_mon2);
+                        nneigh = std::lower_bound(neigh_begin, last, fi_mon2 + nmon2) - neigh_begin;
+                    }
+
+                    for (size_t j = 0; j < ns2 && (!near_list || nneigh); j++) {
+                        if (pol_[fi_sites1 + i] == 0 && pol_[fi_sites2 + j] == 0) continue;
+                        double A = polfac_[fi_sites1 + i] * polfac_[fi_sites2 + j];
+                        double Asqsqi = BIGNUM;
+                        if (A > constants::EPS) {
+                            double Ai = 1 / std::pow(A, 1.0 / 6.0);
+                            Asqsqi = Ai * Ai * Ai * Ai;
+                        }
+                        size_t jnmon23 = 3 * j * nmon2;
+                        if (near_list) {
+                            std::vector<double> &xyz_sitej = workspace_.Get(kXyzSitej, 3 * nneigh, rank);
+                            std::vector<double> &t = workspace_.Get(kTensorSitej, 6 * nneigh, rank);
+                            GatherNeighbors(xyz_.data() + fi_crd2 + jnmon23, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                            xyz_sitej);
+                            local_field->CalcDipoleTensor(xyz_.data() + fi_crd1, xyz_sitej.data(), m1, 0, nneigh,
+                                                          nmon1, nneigh, i, 0, Asqsqi, 0.055, t.data(), ewald_alpha_,
+                                                          use_pbc_, box_, box_inverse_, cutoff_);
+                            add_pairs(t, nneigh, fi_crd2 + jnmon23, 0, neigh_begin, fi_mon2);
+                        } else if (m2init < nmon2) {
+                            std::vector<double> &t = workspace_.Get(kTensorSitej, 6 * (nmon2 - m2init), rank);
+                            local_field->CalcDipoleTensor(xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, m1, m2init,
+                                                          nmon2, nmon1, nmon2, i, j, Asqsqi, 0.055, t.data(),
+                                                          ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_);
+                            add_pairs(t, nmon2 - m2init, fi_crd2 + jnmon23 + m2init, 1, 0, 0);
+                        }
+                    }
+                    close_row(row, nmon1, nmon2);
+
+                    fi_mon2 += nmon2;
+                    fi_sites2 += nmon2 * ns2;
+                    fi_crd2 += nmon2 * ns2 * 3;
+                }
+            }
+
+            // Stop everybody once the limit is reached
+            added = block.cols.size() - added;
+            size_t total;
+#pragma omp atomic capture
+            total = npairs += added;
+            if (total > max_pairs) {
+#pragma omp atomic write
+                too_large = true;
+            }
+        }
+
+        fi_mon1 += nmon1;
+        fi_sites1 += nmon1 * ns1;
+        fi_crd1 += nmon1 * ns1 * 3;
+    }
+
+    if (too_large) {
+        // Free the memory and use the matrix-free loops until the geometry changes
+        std::vector<DipoleTensorBlock>().swap(dipole_tensor_);
+        dipole_tensor_too_large_ = true;
+        return;
+    }
+    dipole_tensor_size_ = npairs;
+    dipole_tensor_built_ = true;
+}
+
+void Electrostatics::SparseDipoleField(double *in_ptr, std::vector<double> &out_v) {
+    // Parallelization
+    size_t nthreads = 1;
+#ifdef _OPENMP
+#pragma omp parallel  // omp_get_num_threads() needs to be inside
+                      // parallel region to get number of threads
+    {
+        if (omp_get_thread_num() == 0) nthreads = omp_get_num_threads();
+    }
+#endif
+    workspace_.SetNumThreads(nthreads);
+    for (size_t rank = 0; rank < nthreads; rank++) workspace_.Get(kEfdTensorPool, out_v.size(), rank);
+
+    // Each block is done by one thread. The field on the column sites goes to
+    // the accumulator of the thread.
+#pragma omp parallel for schedule(static, 1)
+    for (size_t b = 0; b < dipole_tensor_.size(); b++) {
+        int rank = 0;
+#ifdef _OPENMP
+        rank = omp_get_thread_num();
+#endif
+        double *field = workspace_.At(kEfdTensorPool, rank).data();
+        const DipoleTensorBlock &block = dipole_tensor_[b];
+        const size_t *cols = block.cols.data();
+        const double *t = block.values.data();
+        size_t k = 0;
+        for (size_t r = 0; r < block.rows.size(); r++) {
+            const DipoleTensorRow &row = block.rows[r];
+            const size_t i = row.site;
+            const size_t si = row.stride;
+            const size_t sj = row.col_stride;
+            const double mux1 = in_ptr[i];
+            const double muy1 = in_ptr[i + si];
+            const double muz1 = in_ptr[i + 2 * si];
+            double ex = 0.0;
+            double ey = 0.0;
+            double ez = 0.0;
+            for (; k < row.end; k++, t += 6) {
+                const size_t j = cols[k];
+                const double mux2 = in_ptr[j];
+                const double muy2 = in_ptr[j + sj];
+                const double muz2 = in_ptr[j + 2 * sj];
+                ex += t[0] * mux2 + t[1] * muy2 + t[2] * muz2;
+                ey += t[1] * mux2 + t[3] * muy2 + t[4] * muz2;
+                ez += t[2] * mux2 + t[4] * muy2 + t[5] * muz2;
+                field[j] += t[0] * mux1 + t[1] * muy1 + t[2] * muz1;
+                field[j + sj] += t[1] * mux1 + t[3] * muy1 + t[4] * muz1;
+                field[j + 2 * sj] += t[2] * mux1 + t[4] * muy1 + t[5] * muz1;
+            }
+            field[i] += ex;
+            field[i + si] += ey;
+            field[i + 2 * si] += ez;
+        }
+    }
+
+    // Add the fields of all threads
+    const size_t n = out_v.size();
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < n; k++) {
+        double e = 0.0;
+        for (size_t rank = 0; rank < nthreads; rank++) e += workspace_.At(kEfdTensorPool, rank)[k];
+        out_v[k] += e;
+    }
+}
+
+void Electrostatics::DirectDipoleField(double *in_ptr, std::vector<double> &out_v) {
+    // Parallelization
+    size_t nthreads = 1;
+#ifdef _OPENMP
+#pragma omp parallel  // omp_get_num_threads() needs to be inside
+                      // parallel region to get number of threads
+    {
+        if (omp_get_thread_num() == 0) nthreads = omp_get_num_threads();
+    }
+#endif
 
-    // Excluded sets
-    excluded_set_type exc12;
-    excluded_set_type exc13;
-    excluded_set_type exc14;
+    // Max number of monomers
+    size_t maxnmon = mon_type_count_.back().second;
+    SetUpFieldPool(nthreads, maxnmon);
+    ElectricFieldHolder &elec_field = field_pool_[0];
+
+    double aDD = 0.0;
+    bool near_list = use_pair_list_ && UseTreecode();
 
     // Auxiliary variables
     double ex = 0.0;
@@ -962,7 +1551,9 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
         size_t nmon = mon_type_count_[mt].second;
         size_t nmon2 = 2 * nmon;
         // Get excluded pairs for this monomer
-        systools::GetExcluded(mon_id_[fi_mon], exc12, exc13, exc14);
+        const excluded_set_type &exc12 = exc12_[mt];
+        const excluded_set_type &exc13 = exc13_[mt];
+        const excluded_set_type &exc14 = exc14_[mt];
         for (size_t i = 0; i < ns - 1; i++) {
             size_t inmon3 = 3 * i * nmon;
             for (size_t j = i + 1; j < ns; j++) {
@@ -1021,13 +1612,14 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
             bool same = (mt1 == mt2);
             // TODO add neighbour list here
             // Prepare for parallelization
-            std::vector<std::shared_ptr<ElectricFieldHolder>> field_pool;
-            std::vector<std::vector<double>> Efd_1_pool;
-            std::vector<std::vector<double>> Efd_2_pool;
+            // Per thread accumulators, retrieved with workspace_.At() below
             for (size_t i = 0; i < nthreads; i++) {
-                field_pool.push_back(std::make_shared<ElectricFieldHolder>(maxnmon));
-                Efd_1_pool.push_back(std::vector<double>(nmon1 * ns1 * 3, 0.0));
-                Efd_2_pool.push_back(std::vector<double>(nmon2 * ns2 * 3, 0.0));
+                workspace_.Get(kEfd1Pool, nmon1 * ns1 * 3, i);
+                workspace_.Get(kEfd2Pool, nmon2 * ns2 * 3, i);
+                // Room for all the sites j, so that the threads do not grow them in the loop
+                workspace_.Reserve(kXyzSitej, 3 * nmon2, i);
+                workspace_.Reserve(kMuSitej, 3 * nmon2, i);
+                workspace_.Reserve(kEfdSitej, 3 * nmon2, i);
             }
 
 // Parallel loop
@@ -1037,11 +1629,25 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
 #ifdef _OPENMP
                 rank = omp_get_thread_num();
 #endif
-                std::shared_ptr<ElectricFieldHolder> local_field = field_pool[rank];
+                ElectricFieldHolder *local_field = &field_pool_[rank];
+                std::vector<double> &Efd_1_pool = workspace_.At(kEfd1Pool, rank);
+                std::vector<double> &Efd_2_pool = workspace_.At(kEfd2Pool, rank);
                 size_t m2init = same ? m1 + 1 : 0;
                 double ex_thread = 0.0;
                 double ey_thread = 0.0;
                 double ez_thread = 0.0;
+
+                // With a pair list, only the neighbors of m1 of type mt2 are visited
+                const size_t *neigh_begin = 0;
+                size_t nneigh = 0;
+                if (near_list) {
+                    const size_t *first = neighbors_.data() + neighbor_start_[fi_mon1 + m1];
+                    const size_t *last = neighbors_.data() + neighbor_start_[fi_mon1 + m1 + 1];
+                    neigh_begin = std::lower_bound(first, last, fi_mon2);
+                    nneigh = std::lower_bound(neigh_begin, last, fi_mon2 + nmon2) - neigh_begin;
+                    if (nneigh == 0) continue;
+                }
+
                 for (size_t i = 0; i < ns1; i++) {
                     size_t inmon13 = 3 * nmon1 * i;
                     for (size_t j = 0; j < ns2; j++) {
@@ -1056,26 +1662,46 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
                             Ai = BIGNUM;
                             Asqsqi = Ai;
                         }
-                        local_field->CalcDipoleElecField(
-                            xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, in_ptr + fi_crd1, in_ptr + fi_crd2, m1,
-                            m2init, nmon2, nmon1, nmon2, i, j, Asqsqi, aDD, Efd_2_pool[rank].data(), &ex_thread,
-                            &ey_thread, &ez_thread, ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_);
-                        Efd_1_pool[rank][inmon13 + m1] += ex_thread;
-                        Efd_1_pool[rank][inmon13 + nmon1 + m1] += ey_thread;
-                        Efd_1_pool[rank][inmon13 + nmon12 + m1] += ez_thread;
+                        if (near_list) {
+                            // Gather site j of the neighbors and call the kernel on them
+                            size_t jnmon23 = 3 * j * nmon2;
+                            std::vector<double> &xyz_sitej = workspace_.Get(kXyzSitej, 3 * nneigh, rank);
+                            std::vector<double> &mu_sitej = workspace_.Get(kMuSitej, 3 * nneigh, rank);
+                            std::vector<double> &Efd_sitej = workspace_.Get(kEfdSitej, 3 * nneigh, rank);
+                            GatherNeighbors(xyz_.data() + fi_crd2 + jnmon23, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                            xyz_sitej);
+                            GatherNeighbors(in_ptr + fi_crd2 + jnmon23, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                            mu_sitej);
+                            local_field->CalcDipoleElecField(
+                                xyz_.data() + fi_crd1, xyz_sitej.data(), in_ptr + fi_crd1, mu_sitej.data(), m1, 0,
+                                nneigh, nmon1, nneigh, i, 0, Asqsqi, aDD, Efd_sitej.data(), &ex_thread, &ey_thread,
+                                &ez_thread, ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_);
+                            ScatterNeighbors(Efd_sitej, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                             Efd_2_pool.data() + jnmon23);
+                        } else {
+                            local_field->CalcDipoleElecField(
+                                xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, in_ptr + fi_crd1, in_ptr + fi_crd2, m1,
+                                m2init, nmon2, nmon1, nmon2, i, j, Asqsqi, aDD, Efd_2_pool.data(), &ex_thread,
+                                &ey_thread, &ez_thread, ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_);
+                        }
+                        Efd_1_pool[inmon13 + m1] += ex_thread;
+                        Efd_1_pool[inmon13 + nmon1 + m1] += ey_thread;
+                        Efd_1_pool[inmon13 + nmon12 + m1] += ez_thread;
                     }
                 }
             }
 
             // Compress data in Efd
             for (size_t rank = 0; rank < nthreads; rank++) {
-                size_t kend1 = Efd_1_pool[rank].size();
-                size_t kend2 = Efd_2_pool[rank].size();
+                std::vector<double> &Efd_1_pool = workspace_.At(kEfd1Pool, rank);
+                std::vector<double> &Efd_2_pool = workspace_.At(kEfd2Pool, rank);
+                size_t kend1 = Efd_1_pool.size();
+                size_t kend2 = Efd_2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    out_v[fi_crd1 + k] += Efd_1_pool[rank][k];
+                    out_v[fi_crd1 + k] += Efd_1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    out_v[fi_crd2 + k] += Efd_2_pool[rank][k];
+                    out_v[fi_crd2 + k] += Efd_2_pool[k];
                 }
             }
             // Update first indexes
@@ -1088,6 +1714,23 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
         fi_sites1 += nmon1 * ns1;
         fi_crd1 += nmon1 * ns1 * 3;
     }
+}
+
+void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<double> &out_v) {
+    std::fill(out_v.begin(), out_v.end(), 0);
+    double *in_ptr = in_v.data();
+
+    // Real space part. The tensors are built in the first call for each geometry.
+    if (dipole_tensor_max_mb_ > 0 && !dipole_tensor_built_ && !dipole_tensor_too_large_) BuildDipoleTensor();
+    if (dipole_tensor_built_) {
+        SparseDipoleField(in_ptr, out_v);
+    } else {
+        DirectDipoleField(in_ptr, out_v);
+    }
+
+    size_t fi_mon = 0;
+    size_t fi_sites = 0;
+    size_t fi_crd = 0;
 
     if (ewald_alpha_ > 0 && use_pbc_) {
         // Sort the dipoles to the order helPME expects (for now)
@@ -1099,6 +1742,9 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
             size_t ns = sites_[fi_mon];
             size_t nmon = mon_type_count_[mt].second;
             size_t nmon2 = nmon * 2;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
             for (size_t m = 0; m < nmon; m++) {
                 size_t mns = m * ns;
                 size_t mns3 = mns * 3;
@@ -1114,20 +1760,13 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
             fi_crd += nmon * ns * 3;
         }
 
-        helpme::PMEInstance<double> pme_solver_;
-        // Compute the reciprocal space terms, using PME
-        double A = box_[0], B = box_[4], C = box_[8];
-        int grid_A = pme_grid_density_ * A;
-        int grid_B = pme_grid_density_ * B;
-        int grid_C = pme_grid_density_ * C;
-        pme_solver_.setup(1, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, 1, 0);
-        pme_solver_.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+        PMEInstanceD &pme_solver = GetPMESolver();
         // N.B. these do not make copies; they just wrap the memory with some metadata
         auto coords = helpme::Matrix<double>(sys_xyz_.data(), nsites_, 3);
         auto dipoles = helpme::Matrix<double>(sys_mu_.data(), nsites_, 3);
         auto result = helpme::Matrix<double>(sys_Efd_.data(), nsites_, 3);
         std::fill(sys_Efd_.begin(), sys_Efd_.end(), 0.0);
-        pme_solver_.computePRec(-1, dipoles, coords, coords, -1, result);
+        pme_solver.computePRec(-1, dipoles, coords, coords, -1, result);
 
         // Resort field from system order
         fi_mon = 0;
@@ -1135,6 +1774,9 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
         for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
             size_t ns = sites_[fi_mon];
             size_t nmon = mon_type_count_[mt].second;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
             for (size_t m = 0; m < nmon; m++) {
                 size_t mns = m * ns;
                 for (size_t i = 0; i < ns; i++) {
@@ -1156,13 +1798,61 @@ void Electrostatics::ComputeDipoleField(std::vector<double> &in_v, std::vector<d
             ++e_ptr;
         }
     }
+
+    if (UseTreecode()) {
+        // Sort the dipoles to the order of the treecode
+        fi_mon = 0;
+        fi_crd = 0;
+        for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+            size_t ns = sites_[fi_mon];
+            size_t nmon = mon_type_count_[mt].second;
+            size_t nmon2 = nmon * 2;
+            for (size_t m = 0; m < nmon; m++) {
+                size_t mns = m * ns;
+                size_t mns3 = mns * 3;
+                for (size_t i = 0; i < ns; i++) {
+                    size_t inmon = i * nmon;
+                    size_t inmon3 = 3 * inmon;
+                    sys_mu_[fi_crd + mns3 + 3 * i] = in_ptr[inmon3 + m + fi_crd];
+                    sys_mu_[fi_crd + mns3 + 3 * i + 1] = in_ptr[inmon3 + m + fi_crd + nmon];
+                    sys_mu_[fi_crd + mns3 + 3 * i + 2] = in_ptr[inmon3 + m + fi_crd + nmon2];
+                }
+            }
+            fi_mon += nmon;
+            fi_crd += nmon * ns * 3;
+        }
+
+        // Far field of the dipoles
+        std::vector<double> &result = workspace_.Get(kTreeResult, 4 * nsites_);
+        treecode_.ComputePotential(0, sys_mu_.data(), 1, result);
+
+        // Resort field from system order
+        fi_mon = 0;
+        fi_sites = 0;
+        for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+            size_t ns = sites_[fi_mon];
+            size_t nmon = mon_type_count_[mt].second;
+            for (size_t m = 0; m < nmon; m++) {
+                size_t mns = m * ns;
+                for (size_t i = 0; i < ns; i++) {
+                    size_t inmon = i * nmon;
+                    const double *result_ptr = result.data() + 4 * (fi_sites + mns + i);
+                    out_v[3 * fi_sites + 3 * inmon + 0 * nmon + m] -= result_ptr[1];
+                    out_v[3 * fi_sites + 3 * inmon + 1 * nmon + m] -= result_ptr[2];
+                    out_v[3 * fi_sites + 3 * inmon + 2 * nmon + m] -= result_ptr[3];
+                }
+            }
+            fi_mon += nmon;
+            fi_sites += nmon * ns;
+        }
+    }
 }
 
 void Electrostatics::CalculateDipolesIterative() {
     // Permanent electric field is computed
     // Now start computation of dipole through iteration
     double eps = 1.0E+50;
-    std::vector<double> mu_old(3 * nsites_, 0.0);
+    std::vector<double> &mu_old = workspace_.Get(kMuOld, 3 * nsites_);
     size_t iter = 0;
 
     while (true) {
@@ -1235,6 +1925,12 @@ void Electrostatics::CalculateDipolesIterative() {
 void Electrostatics::CalculateElecEnergy() {
     Eperm_ = 0.0;
     for (size_t i = 0; i < nsites_; i++) Eperm_ += phi_[i] * chg_[i];
+    // The interaction with the external charges, which are in phi_, is not
+    // shared with another site of the system
+    if (!ext_chg_.empty()) {
+        const std::vector<double> &ext = workspace_.At(kExtField);
+        for (size_t i = 0; i < nsites_; i++) Eperm_ += ext[10 * i] * sys_chg_[i];
+    }
     Eperm_ *= 0.5 * constants::COULOMB;
 
     // Induced Electrostatic energy (chg-dip, dip-dip, pol)
@@ -1248,11 +1944,10 @@ void Electrostatics::CalculateElecEnergy() {
 
 void Electrostatics::CalculateGradients(std::vector<double> &grad) {
     // Reset grad
-    grad_ = std::vector<double>(3 * nsites_, 0.0);
+    std::fill(grad_.begin(), grad_.end(), 0.0);
 
     // Max number of monomers
     size_t maxnmon = mon_type_count_.back().second;
-    ElectricFieldHolder elec_field(maxnmon);
 
     // Parallelization
     size_t nthreads = 1;
@@ -1264,10 +1959,8 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
     }
 #endif
 
-    // Excluded sets
-    excluded_set_type exc12;
-    excluded_set_type exc13;
-    excluded_set_type exc14;
+    SetUpFieldPool(nthreads, maxnmon);
+    ElectricFieldHolder &elec_field = field_pool_[0];
 
     // Auxiliary variables
     double ex = 0.0;
@@ -1276,7 +1969,7 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
     double phi1 = 0.0;
 
     double aDD = 0.0;
-    size_t nsites3 = 3 * nsites_;
+    bool near_list = use_pair_list_ && UseTreecode();
 
     // Chg-Chg interactions
     size_t fi_mon = 0;
@@ -1301,6 +1994,10 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
         fi_crd += nmon * ns * 3;
     }
 
+    // Dipoles in the field of the external charges. The charges of the
+    // sites already felt it above, since it is part of Efq_.
+    if (!ext_chg_.empty()) ExternalChargeGradients();
+
     // Intramonomer dipole-dipole
     fi_mon = 0;
     fi_sites = 0;
@@ -1310,7 +2007,9 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
         size_t ns = sites_[fi_mon];
         size_t nmon = mon_type_count_[mt].second;
         size_t nmon2 = nmon * 2;
-        systools::GetExcluded(mon_id_[fi_mon], exc12, exc13, exc14);
+        const excluded_set_type &exc12 = exc12_[mt];
+        const excluded_set_type &exc13 = exc13_[mt];
+        const excluded_set_type &exc14 = exc14_[mt];
         for (size_t i = 0; i < ns - 1; i++) {
             size_t inmon = i * nmon;
             size_t inmon3 = 3 * inmon;
@@ -1339,7 +2038,8 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
                                                   chg_.data() + fi_sites, mu_.data() + fi_crd, mu_.data() + fi_crd, m,
                                                   m, m + 1, nmon, nmon, i, j, aDD, aCD_, Asqsqi, &ex, &ey, &ez, &phi1,
                                                   phi_.data() + fi_sites, grad_.data() + fi_crd, elec_scale_factor,
-                                                  ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_, &virial_);
+                                                  ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_,
+                                                  calc_virial_ ? &virial_ : 0);
                     phi_[fi_sites + inmon + m] += phi1;
                     grad_[fi_crd + inmon3 + m] += ex;
                     grad_[fi_crd + inmon3 + nmon + m] += ey;
@@ -1373,19 +2073,19 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
             size_t nmon2 = mon_type_count_[mt2].second;
             bool same = (mt1 == mt2);
             // TODO add neighbour list here
-            std::vector<std::shared_ptr<ElectricFieldHolder>> field_pool;
-            std::vector<std::vector<double>> grad_1_pool;
-            std::vector<std::vector<double>> grad_2_pool;
-            std::vector<std::vector<double>> phi_1_pool;
-            std::vector<std::vector<double>> phi_2_pool;
-            std::vector<std::vector<double>> virial_pool;
+            // Per thread accumulators, retrieved with workspace_.At() below
             for (size_t i = 0; i < nthreads; i++) {
-                field_pool.push_back(std::make_shared<ElectricFieldHolder>(maxnmon));
-                grad_1_pool.push_back(std::vector<double>(nmon1 * ns1 * 3, 0.0));
-                grad_2_pool.push_back(std::vector<double>(nmon2 * ns2 * 3, 0.0));
-                phi_1_pool.push_back(std::vector<double>(nmon1 * ns1, 0.0));
-                phi_2_pool.push_back(std::vector<double>(nmon2 * ns2, 0.0));
-                virial_pool.push_back(std::vector<double>(9, 0.0));
+                workspace_.Get(kGrad1Pool, nmon1 * ns1 * 3, i);
+                workspace_.Get(kGrad2Pool, nmon2 * ns2 * 3, i);
+                workspace_.Get(kPhi1Pool, nmon1 * ns1, i);
+                workspace_.Get(kPhi2Pool, nmon2 * ns2, i);
+                workspace_.Get(kVirialPool, 9, i);
+                // Room for all the sites j, so that the threads do not grow them in the loop
+                workspace_.Reserve(kXyzSitej, 3 * nmon2, i);
+                workspace_.Reserve(kChgSitej, nmon2, i);
+                workspace_.Reserve(kMuSitej, 3 * nmon2, i);
+                workspace_.Reserve(kPhiSitej, nmon2, i);
+                workspace_.Reserve(kGradSitej, 3 * nmon2, i);
             }
 #pragma omp parallel for schedule(dynamic)
             for (size_t m1 = 0; m1 < nmon1; m1++) {
@@ -1393,12 +2093,29 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
 #ifdef _OPENMP
                 rank = omp_get_thread_num();
 #endif
-                std::shared_ptr<ElectricFieldHolder> local_field = field_pool[rank];
+                ElectricFieldHolder *local_field = &field_pool_[rank];
+                std::vector<double> &grad_1_pool = workspace_.At(kGrad1Pool, rank);
+                std::vector<double> &grad_2_pool = workspace_.At(kGrad2Pool, rank);
+                std::vector<double> &phi_1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi_2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
                 size_t m2init = same ? m1 + 1 : 0;
                 double ex_thread = 0.0;
                 double ey_thread = 0.0;
                 double ez_thread = 0.0;
                 double phi1_thread = 0.0;
+
+                // With a pair list, only the neighbors of m1 of type mt2 are visited
+                const size_t *neigh_begin = 0;
+                size_t nneigh = 0;
+                if (near_list) {
+                    const size_t *first = neighbors_.data() + neighbor_start_[fi_mon1 + m1];
+                    const size_t *last = neighbors_.data() + neighbor_start_[fi_mon1 + m1 + 1];
+                    neigh_begin = std::lower_bound(first, last, fi_mon2);
+                    nneigh = std::lower_bound(neigh_begin, last, fi_mon2 + nmon2) - neigh_begin;
+                    if (nneigh == 0) continue;
+                }
+
                 for (size_t i = 0; i < ns1; i++) {
                     size_t inmon1 = i * nmon1;
                     size_t inmon13 = 3 * inmon1;
@@ -1414,39 +2131,71 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
                             Ai = BIGNUM;
                             Asqsqi = Ai;
                         }
-                        local_field->CalcElecFieldGrads(
-                            xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, chg_.data() + fi_sites1,
-                            chg_.data() + fi_sites2, mu_.data() + fi_crd1, mu_.data() + fi_crd2, m1, m2init, nmon2,
-                            nmon1, nmon2, i, j, aDD, aCD_, Asqsqi, &ex_thread, &ey_thread, &ez_thread, &phi1_thread,
-                            phi_2_pool[rank].data(), grad_2_pool[rank].data(), 1, ewald_alpha_, use_pbc_, box_,
-                            box_inverse_, cutoff_, &virial_pool[rank]);
-                        grad_1_pool[rank][inmon13 + m1] += ex_thread;
-                        grad_1_pool[rank][inmon13 + nmon1 + m1] += ey_thread;
-                        grad_1_pool[rank][inmon13 + nmon12 + m1] += ez_thread;
-                        phi_1_pool[rank][inmon1 + m1] += phi1_thread;
+                        if (near_list) {
+                            // Gather site j of the neighbors and call the kernel on them
+                            size_t jnmon2 = j * nmon2;
+                            size_t jnmon23 = 3 * jnmon2;
+                            std::vector<double> &xyz_sitej = workspace_.Get(kXyzSitej, 3 * nneigh, rank);
+                            std::vector<double> &chg_sitej = workspace_.Get(kChgSitej, nneigh, rank);
+                            std::vector<double> &mu_sitej = workspace_.Get(kMuSitej, 3 * nneigh, rank);
+                            std::vector<double> &phi_sitej = workspace_.Get(kPhiSitej, nneigh, rank);
+                            std::vector<double> &grad_sitej = workspace_.Get(kGradSitej, 3 * nneigh, rank);
+                            GatherNeighbors(xyz_.data() + fi_crd2 + jnmon23, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                            xyz_sitej);
+                            GatherNeighbors(chg_.data() + fi_sites2 + jnmon2, 1, nmon2, neigh_begin, nneigh,
+                                            fi_mon2, chg_sitej);
+                            GatherNeighbors(mu_.data() + fi_crd2 + jnmon23, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                            mu_sitej);
+                            local_field->CalcElecFieldGrads(
+                                xyz_.data() + fi_crd1, xyz_sitej.data(), chg_.data() + fi_sites1, chg_sitej.data(),
+                                mu_.data() + fi_crd1, mu_sitej.data(), m1, 0, nneigh, nmon1, nneigh, i, 0, aDD, aCD_,
+                                Asqsqi, &ex_thread, &ey_thread, &ez_thread, &phi1_thread, phi_sitej.data(),
+                                grad_sitej.data(), 1, ewald_alpha_, use_pbc_, box_, box_inverse_, cutoff_,
+                                calc_virial_ ? &virial_pool : 0);
+                            ScatterNeighbors(phi_sitej, 1, nmon2, neigh_begin, nneigh, fi_mon2,
+                                             phi_2_pool.data() + jnmon2);
+                            ScatterNeighbors(grad_sitej, 3, nmon2, neigh_begin, nneigh, fi_mon2,
+                                             grad_2_pool.data() + jnmon23);
+                        } else {
+                            local_field->CalcElecFieldGrads(
+                                xyz_.data() + fi_crd1, xyz_.data() + fi_crd2, chg_.data() + fi_sites1,
+                                chg_.data() + fi_sites2, mu_.data() + fi_crd1, mu_.data() + fi_crd2, m1, m2init,
+                                nmon2, nmon1, nmon2, i, j, aDD, aCD_, Asqsqi, &ex_thread, &ey_thread, &ez_thread,
+                                &phi1_thread, phi_2_pool.data(), grad_2_pool.data(), 1, ewald_alpha_, use_pbc_,
+                                box_, box_inverse_, cutoff_, calc_virial_ ? &virial_pool : 0);
+                        }
+                        grad_1_pool[inmon13 + m1] += ex_thread;
+                        grad_1_pool[inmon13 + nmon1 + m1] += ey_thread;
+                        grad_1_pool[inmon13 + nmon12 + m1] += ez_thread;
+                        phi_1_pool[inmon1 + m1] += phi1_thread;
                     }
                 }
             }
             // Compress data in grad and phi
             for (size_t rank = 0; rank < nthreads; rank++) {
-                size_t kend1 = grad_1_pool[rank].size();
-                size_t kend2 = grad_2_pool[rank].size();
+                std::vector<double> &grad_1_pool = workspace_.At(kGrad1Pool, rank);
+                std::vector<double> &grad_2_pool = workspace_.At(kGrad2Pool, rank);
+                std::vector<double> &phi_1_pool = workspace_.At(kPhi1Pool, rank);
+                std::vector<double> &phi_2_pool = workspace_.At(kPhi2Pool, rank);
+                std::vector<double> &virial_pool = workspace_.At(kVirialPool, rank);
+                size_t kend1 = grad_1_pool.size();
+                size_t kend2 = grad_2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    grad_[fi_crd1 + k] += grad_1_pool[rank][k];
+                    grad_[fi_crd1 + k] += grad_1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    grad_[fi_crd2 + k] += grad_2_pool[rank][k];
+                    grad_[fi_crd2 + k] += grad_2_pool[k];
                 }
-                kend1 = phi_1_pool[rank].size();
-                kend2 = phi_2_pool[rank].size();
+                kend1 = phi_1_pool.size();
+                kend2 = phi_2_pool.size();
                 for (size_t k = 0; k < kend1; k++) {
-                    phi_[fi_sites1 + k] += phi_1_pool[rank][k];
+                    phi_[fi_sites1 + k] += phi_1_pool[k];
                 }
                 for (size_t k = 0; k < kend2; k++) {
-                    phi_[fi_sites2 + k] += phi_2_pool[rank][k];
+                    phi_[fi_sites2 + k] += phi_2_pool[k];
                 }
                 for (size_t k = 0; k < 9; k++) {
-                    virial_[k] += virial_pool[rank][k];
+                    virial_[k] += virial_pool[k];
                 }
             }
             // Update first indexes
@@ -1461,10 +2210,10 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
     }
 
     if (ewald_alpha_ > 0 && use_pbc_) {
-        // Sort the dipoles to the order helPME expects (for now)
-        //int fi_mon = 0;
-        //int fi_sites = 0;
-        //int fi_crd = 0;
+        // Charges and dipoles go together to helPME, as the 0 X Y Z components
+        // of an L=1 multipole, so a single pass gives the potential and its
+        // derivatives of both.
+        std::vector<double> &multipoles = workspace_.Get(kPmeMultipoles, 4 * nsites_);
         fi_mon = 0;
         fi_sites = 0;
         fi_crd = 0;
@@ -1478,10 +2227,15 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
                 for (size_t i = 0; i < ns; i++) {
                     size_t inmon = i * nmon;
                     size_t inmon3 = 3 * inmon;
+                    double *mp = &multipoles[4 * (fi_sites + mns + i)];
                     sys_chg_[fi_sites + mns + i] = chg_[fi_sites + m + inmon];
                     sys_mu_[fi_crd + mns3 + 3 * i] = mu_[inmon3 + m + fi_crd];
                     sys_mu_[fi_crd + mns3 + 3 * i + 1] = mu_[inmon3 + m + fi_crd + nmon];
                     sys_mu_[fi_crd + mns3 + 3 * i + 2] = mu_[inmon3 + m + fi_crd + nmon2];
+                    mp[0] = sys_chg_[fi_sites + mns + i];
+                    mp[1] = sys_mu_[fi_crd + mns3 + 3 * i];
+                    mp[2] = sys_mu_[fi_crd + mns3 + 3 * i + 1];
+                    mp[3] = sys_mu_[fi_crd + mns3 + 3 * i + 2];
                 }
             }
             fi_mon += nmon;
@@ -1489,46 +2243,25 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
             fi_crd += nmon * ns * 3;
         }
 
-        helpme::PMEInstance<double> pme_solver_;
-        // Compute the reciprocal space terms, using PME
-        double A = box_[0], B = box_[4], C = box_[8];
-        int grid_A = pme_grid_density_ * A;
-        int grid_B = pme_grid_density_ * B;
-        int grid_C = pme_grid_density_ * C;
-        pme_solver_.setup(1, ewald_alpha_, pme_spline_order_, grid_A, grid_B, grid_C, 1, 0);
-        pme_solver_.setLatticeVectors(A, B, C, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+        PMEInstanceD &pme_solver = GetPMESolver();
         // N.B. these do not make copies; they just wrap the memory with some metadata
         auto coords = helpme::Matrix<double>(sys_xyz_.data(), nsites_, 3);
-        auto dipoles = helpme::Matrix<double>(sys_mu_.data(), nsites_, 3);
-        auto charges = helpme::Matrix<double>(sys_chg_.data(), nsites_, 1);
-        auto result = helpme::Matrix<double>(nsites_, 10);
-        
-        if (calc_virial_) {
-            std::vector<double> trecvir(6,0.0);
-            std::vector<double> tforcevec(sys_grad_.size(), 0.0);
+        auto params = helpme::Matrix<double>(multipoles.data(), nsites_, 4);
+        auto result = helpme::Matrix<double>(workspace_.Get(kPmeResult, nsites_ * 10).data(), nsites_, 10);
 
-            auto drecvirial = helpme::Matrix<double>(trecvir.data(), 6,1);
-            auto tmpforces2  = helpme::Matrix<double>(tforcevec.data(), nsites_, 3);
-
-            double fulldummy_rec_energy = pme_solver_.computeEFVRecIsotropicInducedDipoles(0, charges, dipoles,
-                                          PMEInstanceD::PolarizationType::Mutual, coords, tmpforces2, drecvirial);
-
-            virial_[0] += (*drecvirial[0]) * constants::COULOMB;
-            virial_[1] += (*drecvirial[1]) * constants::COULOMB;
-            virial_[2] += (*drecvirial[3]) * constants::COULOMB;
-            virial_[4] += (*drecvirial[2]) * constants::COULOMB;
-            virial_[5] += (*drecvirial[4]) * constants::COULOMB;
-            virial_[8] += (*drecvirial[5]) * constants::COULOMB;
-
-            virial_[3] = virial_[1];
-            virial_[6] = virial_[2];
-            virial_[7] = virial_[5];            
+        // The reciprocal virial comes from the convolution of the same pass,
+        // plus a term of the dipoles in the total field that is added below.
+        std::vector<double> &trecvir = workspace_.Get(kPmeVirial, 6);
+        if (calc_virial_) {
+            auto drecvirial = helpme::Matrix<double>(trecvir.data(), 6, 1);
+            pme_solver.computePVRec(1, params, coords, coords, 2, result, drecvirial);
+        } else {
+            pme_solver.computePRec(1, params, coords, coords, 2, result);
         }
 
-
-        pme_solver_.computePRec(-1, dipoles, coords, coords, 2, result);
-
-        // Resort field from system order
+        // Resort field from system order. The potential and field of the
+        // charges were already used with the permanent field, so they are
+        // taken out here.
         fi_mon = 0;
         fi_sites = 0;
         fi_crd = 0;
@@ -1540,12 +2273,13 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
                 size_t mns = m * ns;
                 for (size_t i = 0; i < ns; i++) {
                     const double *result_ptr = result[fi_sites + mns + i];
+                    const double *chg_ptr = &rec_phi_and_field_[4 * (fi_sites + mns + i)];
                     const double chg = sys_chg_[fi_sites + mns + i];
                     const double *mu = &sys_mu_[fi_crd + 3 * mns + 3 * i];
-                    double Phi = result_ptr[0];
-                    double Erec_x = result_ptr[1];
-                    double Erec_y = result_ptr[2];
-                    double Erec_z = result_ptr[3];
+                    double Phi = result_ptr[0] - chg_ptr[0];
+                    double Erec_x = result_ptr[1] - chg_ptr[1];
+                    double Erec_y = result_ptr[2] - chg_ptr[2];
+                    double Erec_z = result_ptr[3] - chg_ptr[3];
                     double Erec_xx = result_ptr[4];
                     double Erec_xy = result_ptr[5];
                     double Erec_yy = result_ptr[6];
@@ -1564,47 +2298,113 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
                     grad[fi_crd + 3 * mns + 3 * i] += fac * Grad_x;
                     grad[fi_crd + 3 * mns + 3 * i + 1] += fac * Grad_y;
                     grad[fi_crd + 3 * mns + 3 * i + 2] += fac * Grad_z;
+
+                    if (calc_virial_) {
+                        trecvir[0] += result_ptr[1] * mu[0];
+                        trecvir[1] += 0.5 * (result_ptr[1] * mu[1] + result_ptr[2] * mu[0]);
+                        trecvir[2] += result_ptr[2] * mu[1];
+                        trecvir[3] += 0.5 * (result_ptr[1] * mu[2] + result_ptr[3] * mu[0]);
+                        trecvir[4] += 0.5 * (result_ptr[2] * mu[2] + result_ptr[3] * mu[1]);
+                        trecvir[5] += result_ptr[3] * mu[2];
+                    }
                 }
             }
             fi_mon += nmon;
             fi_sites += nmon * ns;
             fi_crd += nmon * ns * 3;
         }
-        // Now grid up the charges
-        result.setZero();
-        pme_solver_.computePRec(0, charges, coords, coords, -2, result);
 
-        // Resort field from system order
+        if (calc_virial_) {
+            virial_[0] += trecvir[0] * constants::COULOMB;
+            virial_[1] += trecvir[1] * constants::COULOMB;
+            virial_[2] += trecvir[3] * constants::COULOMB;
+            virial_[4] += trecvir[2] * constants::COULOMB;
+            virial_[5] += trecvir[4] * constants::COULOMB;
+            virial_[8] += trecvir[5] * constants::COULOMB;
+
+            virial_[3] = virial_[1];
+            virial_[6] = virial_[2];
+            virial_[7] = virial_[5];
+        }
+    }
+
+    if (UseTreecode()) {
+        // Sort the dipoles to the order of the treecode
         fi_mon = 0;
-        fi_sites = 0;
         fi_crd = 0;
-        fac = constants::COULOMB;
         for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
             size_t ns = sites_[fi_mon];
             size_t nmon = mon_type_count_[mt].second;
+            size_t nmon2 = nmon * 2;
             for (size_t m = 0; m < nmon; m++) {
                 size_t mns = m * ns;
+                size_t mns3 = mns * 3;
                 for (size_t i = 0; i < ns; i++) {
-                    const double *result_ptr = result[fi_sites + mns + i];
-                    const double *mu = &sys_mu_[fi_crd + 3 * mns + 3 * i];
-                    double Erec_xx = result_ptr[0];
-                    double Erec_xy = result_ptr[1];
-                    double Erec_yy = result_ptr[2];
-                    double Erec_xz = result_ptr[3];
-                    double Erec_yz = result_ptr[4];
-                    double Erec_zz = result_ptr[5];
-                    double Grad_x = Erec_xx * mu[0] + Erec_xy * mu[1] + Erec_xz * mu[2];
-                    double Grad_y = Erec_xy * mu[0] + Erec_yy * mu[1] + Erec_yz * mu[2];
-                    double Grad_z = Erec_xz * mu[0] + Erec_yz * mu[1] + Erec_zz * mu[2];
-                    grad[fi_crd + 3 * mns + 3 * i] += fac * Grad_x;
-                    grad[fi_crd + 3 * mns + 3 * i + 1] += fac * Grad_y;
-                    grad[fi_crd + 3 * mns + 3 * i + 2] += fac * Grad_z;
+                    size_t inmon = i * nmon;
+                    size_t inmon3 = 3 * inmon;
+                    sys_mu_[fi_crd + mns3 + 3 * i] = mu_[inmon3 + m + fi_crd];
+                    sys_mu_[fi_crd + mns3 + 3 * i + 1] = mu_[inmon3 + m + fi_crd + nmon];
+                    sys_mu_[fi_crd + mns3 + 3 * i + 2] = mu_[inmon3 + m + fi_crd + nmon2];
                 }
             }
             fi_mon += nmon;
-            fi_sites += nmon * ns;
             fi_crd += nmon * ns * 3;
         }
+
+        // Far field potential of the dipoles and of the charges, and their derivatives.
+        // The gradient of the charges in the field of the charges is already in grad_,
+        // since Efq_ includes the far field.
+        std::vector<double> &dip_result = workspace_.Get(kTreeResult, 10 * nsites_);
+        treecode_.ComputePotential(0, sys_mu_.data(), 2, dip_result);
+        std::vector<double> &chg_result = workspace_.Get(kPmeResult, 10 * nsites_);
+        treecode_.ComputePotential(sys_chg_.data(), 0, 2, chg_result);
+
+        fi_mon = 0;
+        fi_sites = 0;
+        double fac = constants::COULOMB;
+        for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+            size_t ns = sites_[fi_mon];
+            size_t nmon = mon_type_count_[mt].second;
+            for (size_t m = 0; m < nmon; m++) {
+                size_t mns = m * ns;
+                for (size_t i = 0; i < ns; i++) {
+                    size_t site = fi_sites + mns + i;
+                    const double *d = dip_result.data() + 10 * site;
+                    const double *c = chg_result.data() + 10 * site;
+                    const double chg = sys_chg_[site];
+                    const double *mu = &sys_mu_[3 * site];
+                    // Second derivatives of the total far field potential
+                    double d2[6];
+                    for (size_t k = 0; k < 6; k++) d2[k] = d[4 + k] + c[4 + k];
+                    double Grad_x = chg * d[1] + d2[0] * mu[0] + d2[1] * mu[1] + d2[3] * mu[2];
+                    double Grad_y = chg * d[2] + d2[1] * mu[0] + d2[2] * mu[1] + d2[4] * mu[2];
+                    double Grad_z = chg * d[3] + d2[3] * mu[0] + d2[4] * mu[1] + d2[5] * mu[2];
+                    phi_[fi_sites + i * nmon + m] += d[0];
+                    grad[3 * site] += fac * Grad_x;
+                    grad[3 * site + 1] += fac * Grad_y;
+                    grad[3 * site + 2] += fac * Grad_z;
+
+                    // Virial of the far field, from the forces on each site
+                    if (calc_virial_) {
+                        const double *x = &sys_xyz_[3 * site];
+                        Grad_x += chg * c[1];
+                        Grad_y += chg * c[2];
+                        Grad_z += chg * c[3];
+                        virial_[0] -= fac * x[0] * Grad_x;
+                        virial_[1] -= fac * x[0] * Grad_y;
+                        virial_[2] -= fac * x[0] * Grad_z;
+                        virial_[4] -= fac * x[1] * Grad_y;
+                        virial_[5] -= fac * x[1] * Grad_z;
+                        virial_[8] -= fac * x[2] * Grad_z;
+                    }
+                }
+            }
+            fi_mon += nmon;
+            fi_sites += nmon * ns;
+        }
+        virial_[3] = virial_[1];
+        virial_[6] = virial_[2];
+        virial_[7] = virial_[5];
     }
 
     ////////////////////////////////////////////////////////////////////////////////
@@ -1612,10 +2412,6 @@ void Electrostatics::CalculateGradients(std::vector<double> &grad) {
     ////////////////////////////////////////////////////////////////////////////////
 
     // Reorganize field and potential to initial order
-    std::vector<double> tmp1(nsites3, 0.0);
-    std::vector<double> tmp2(nsites_, 0.0);
-    std::vector<double> tmp3(nsites3, 0.0);
-    std::vector<double> tmp4(nsites3, 0.0);
     fi_mon = 0;
     fi_crd = 0;
     fi_sites = 0;
@@ -1780,9 +2576,215 @@ double Electrostatics::GetPermanentElectrostaticEnergy() { return Eperm_; }
 
 double Electrostatics::GetInducedElectrostaticEnergy() { return Eind_; }
 
+void Electrostatics::PotentialAtPoints(const std::vector<double> &src_xyz, const double *chg, const double *mu,
+                                       const std::vector<double> &points, int deriv_level,
+                                       std::vector<double> &result) {
+    // Same layout as the output of helPME: the potential, its derivatives
+    // x, y, z and, for deriv_level 2, xx, xy, yy, xz, yz, zz
+    size_t ncomp = deriv_level > 1 ? 10 : 4;
+    size_t nsrc = src_xyz.size() / 3;
+    size_t npoints = points.size() / 3;
+    result.assign(ncomp * npoints, 0.0);
+    if (nsrc == 0 || npoints == 0) return;
+
+    // Sources and points inside the cell, so the kd-tree with the 27 images
+    // of the sources finds all the neighbors of each point
+    std::vector<double> &src = workspace_.Get(kExtSources, 3 * nsrc);
+    std::vector<double> &pts = workspace_.Get(kExtPoints, 3 * npoints);
+    std::copy(src_xyz.begin(), src_xyz.end(), src.begin());
+    std::copy(points.begin(), points.end(), pts.begin());
+    if (use_pbc_) {
+        WrapIntoCell(box_, box_inverse_, src);
+        WrapIntoCell(box_, box_inverse_, pts);
+    }
+    kdtutils::PointCloud<double> ptc = kdtutils::XyzToCloud(src, use_pbc_, box_);
+    SiteTree tree(3 /*dim*/, ptc, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */));
+    tree.buildIndex();
+
+    // The treecode has no cutoff
+    double cutoff2 = UseTreecode() ? std::numeric_limits<double>::infinity() : cutoff_ * cutoff_;
+    double alpha = use_pbc_ ? ewald_alpha_ : 0.0;
+    double alpha2 = alpha * alpha;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+    for (size_t p = 0; p < npoints; p++) {
+        std::vector<std::pair<size_t, double>> matches;
+        nanoflann::SearchParams params;
+        params.sorted = false;
+        tree.radiusSearch(&pts[3 * p], cutoff2, matches, params);
+
+        // Each source once, whatever the image that was found
+        for (size_t k = 0; k < matches.size(); k++) matches[k].first %= nsrc;
+        std::sort(matches.begin(), matches.end());
+        double *res = &result[ncomp * p];
+        for (size_t k = 0; k < matches.size(); k++) {
+            size_t j = matches[k].first;
+            if (k > 0 && matches[k - 1].first == j) continue;
+
+            double d[3] = {points[3 * p] - src_xyz[3 * j], points[3 * p + 1] - src_xyz[3 * j + 1],
+                           points[3 * p + 2] - src_xyz[3 * j + 2]};
+            if (use_pbc_) MinimumImage(box_, box_inverse_, d);
+            double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            if (r2 > cutoff2) continue;
+
+            // Real space Ewald functions B_l(r), which are the bare 1/r^(2l+1)
+            // for alpha = 0. See W. Smith, CCP5 Newsletter 46, 18 (1998).
+            double r = std::sqrt(r2);
+            double rinv2 = 1.0 / r2;
+            double expterm = alpha > 0 ? 2 * alpha / PIQSRT * std::exp(-alpha2 * r2) : 0.0;
+            double b0 = std::erfc(alpha * r) / r;
+            double b1 = (b0 + expterm) * rinv2;
+            double b2 = (3 * b1 + 2 * alpha2 * expterm) * rinv2;
+            double b3 = (5 * b2 + 4 * alpha2 * alpha2 * expterm) * rinv2;
+
+            // Potential, gradient and hessian of the charge
+            double q = chg[j];
+            double phi = q * b0;
+            double g[3], h[6];
+            for (size_t a = 0; a < 3; a++) g[a] = -q * b1 * d[a];
+            h[0] = q * (b2 * d[0] * d[0] - b1);
+            h[1] = q * b2 * d[0] * d[1];
+            h[2] = q * (b2 * d[1] * d[1] - b1);
+            h[3] = q * b2 * d[0] * d[2];
+            h[4] = q * b2 * d[1] * d[2];
+            h[5] = q * (b2 * d[2] * d[2] - b1);
+
+            // And of the dipole
+            if (mu != 0) {
+                const double *m = mu + 3 * j;
+                double md = m[0] * d[0] + m[1] * d[1] + m[2] * d[2];
+                phi += md * b1;
+                for (size_t a = 0; a < 3; a++) g[a] += m[a] * b1 - md * b2 * d[a];
+                h[0] += md * (b3 * d[0] * d[0] - b2) - 2 * b2 * m[0] * d[0];
+                h[1] += md * b3 * d[0] * d[1] - b2 * (m[0] * d[1] + m[1] * d[0]);
+                h[2] += md * (b3 * d[1] * d[1] - b2) - 2 * b2 * m[1] * d[1];
+                h[3] += md * b3 * d[0] * d[2] - b2 * (m[0] * d[2] + m[2] * d[0]);
+                h[4] += md * b3 * d[1] * d[2] - b2 * (m[1] * d[2] + m[2] * d[1]);
+                h[5] += md * (b3 * d[2] * d[2] - b2) - 2 * b2 * m[2] * d[2];
+            }
+
+            res[0] += phi;
+            for (size_t a = 0; a < 3; a++) res[1 + a] += g[a];
+            if (deriv_level > 1) {
+                for (size_t a = 0; a < 6; a++) res[4 + a] += h[a];
+            }
+        }
+    }
+
+    // Reciprocal space part
+    if (ewald_alpha_ > 0 && use_pbc_) {
+        size_t nparams = mu != 0 ? 4 : 1;
+        std::vector<double> &src_params = workspace_.Get(kExtParams, nparams * nsrc);
+        for (size_t j = 0; j < nsrc; j++) {
+            src_params[nparams * j] = chg[j];
+            if (mu != 0) {
+                for (size_t a = 0; a < 3; a++) src_params[nparams * j + 1 + a] = mu[3 * j + a];
+            }
+        }
+        std::vector<double> &rec = workspace_.Get(kExtRecResult, ncomp * npoints);
+
+        PMEInstanceD &pme_solver = GetPMESolver();
+        // N.B. these do not make copies; they just wrap the memory with some metadata
+        auto coords = helpme::Matrix<double>(src.data(), nsrc, 3);
+        auto params = helpme::Matrix<double>(src_params.data(), nsrc, nparams);
+        auto grid_points = helpme::Matrix<double>(pts.data(), npoints, 3);
+        auto rec_result = helpme::Matrix<double>(rec.data(), npoints, ncomp);
+        pme_solver.computePRec(mu != 0 ? 1 : 0, params, coords, grid_points, deriv_level, rec_result);
+        for (size_t k = 0; k < ncomp * npoints; k++) result[k] += rec[k];
+    }
+}
+
+void Electrostatics::AddExternalField() {
+    // Potential of the external charges and its derivatives at the sites, in
+    // system order. Kept until the gradients are computed.
+    std::vector<double> &ext = workspace_.Get(kExtField, 10 * nsites_);
+    PotentialAtPoints(ext_xyz_, ext_chg_.data(), 0, sys_xyz_, 2, ext);
+
+    size_t fi_mon = 0;
+    size_t fi_sites = 0;
+    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+        size_t ns = sites_[fi_mon];
+        size_t nmon = mon_type_count_[mt].second;
+        for (size_t m = 0; m < nmon; m++) {
+            size_t mns = m * ns;
+            for (size_t i = 0; i < ns; i++) {
+                size_t inmon = i * nmon;
+                const double *ext_ptr = &ext[10 * (fi_sites + mns + i)];
+                phi_[fi_sites + inmon + m] += ext_ptr[0];
+                Efq_[3 * fi_sites + 3 * inmon + 0 * nmon + m] -= ext_ptr[1];
+                Efq_[3 * fi_sites + 3 * inmon + 1 * nmon + m] -= ext_ptr[2];
+                Efq_[3 * fi_sites + 3 * inmon + 2 * nmon + m] -= ext_ptr[3];
+            }
+        }
+        fi_mon += nmon;
+        fi_sites += nmon * ns;
+    }
+}
+
+void Electrostatics::ExternalChargeGradients() {
+    // Second derivatives of the potential of the external charges, stored by AddExternalField
+    const std::vector<double> &ext = workspace_.At(kExtField);
+
+    size_t fi_mon = 0;
+    size_t fi_sites = 0;
+    size_t fi_crd = 0;
+    for (size_t mt = 0; mt < mon_type_count_.size(); mt++) {
+        size_t ns = sites_[fi_mon];
+        size_t nmon = mon_type_count_[mt].second;
+        size_t nmon2 = nmon * 2;
+        for (size_t m = 0; m < nmon; m++) {
+            size_t mns = m * ns;
+            for (size_t i = 0; i < ns; i++) {
+                size_t inmon3 = 3 * i * nmon;
+                const double *h = &ext[10 * (fi_sites + mns + i) + 4];
+                double mux = mu_[fi_crd + inmon3 + m];
+                double muy = mu_[fi_crd + inmon3 + nmon + m];
+                double muz = mu_[fi_crd + inmon3 + nmon2 + m];
+                grad_[fi_crd + inmon3 + m] += h[0] * mux + h[1] * muy + h[3] * muz;
+                grad_[fi_crd + inmon3 + nmon + m] += h[1] * mux + h[2] * muy + h[4] * muz;
+                grad_[fi_crd + inmon3 + nmon2 + m] += h[3] * mux + h[4] * muy + h[5] * muz;
+            }
+        }
+        fi_mon += nmon;
+        fi_sites += nmon * ns;
+        fi_crd += nmon * ns * 3;
+    }
+}
+
+void Electrostatics::GetPotentialAndField(const std::vector<double> &points, std::vector<double> &phi,
+                                          std::vector<double> &field) {
+    if (!has_energy_) {
+        std::string text = "The potential and field need the induced dipoles. Compute the electrostatics for "
+                           "the current coordinates first.";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (points.size() % 3 != 0) {
+        std::string text = "Expected 3 coordinates per point. Got " + std::to_string(points.size());
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // Charges and induced dipoles of the last call, in system order
+    GetInducedDipoles();
+    std::vector<double> result;
+    PotentialAtPoints(sys_xyz_, sys_chg_.data(), sys_mu_.data(), points, 1, result);
+
+    size_t npoints = points.size() / 3;
+    phi.resize(npoints);
+    field.resize(3 * npoints);
+    for (size_t p = 0; p < npoints; p++) {
+        phi[p] = constants::COULOMB * result[4 * p];
+        for (size_t a = 0; a < 3; a++) field[3 * p + a] = -constants::COULOMB * result[4 * p + 1 + a];
+    }
+}
+
 double Electrostatics::GetElectrostatics(std::vector<double> &grad, std::vector<double> *virial) {
+    // The kernels skip the virial if it is not requested
+    calc_virial_ = virial != 0;
     std::fill(virial_.begin(), virial_.end(),0.0);
     CalculatePermanentElecField();
+    if (!ext_chg_.empty()) AddExternalField();
     CalculateDipoles();
     CalculateElecEnergy();
     if (do_grads_) CalculateGradients(grad);
@@ -49,8 +49,10 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "tools/definitions.h"
 #include "tools/constants.h"
 #include "tools/math_tools.h"
+#include "tools/workspace.h"
 #include "potential/electrostatics/gammq.h"
 #include "potential/electrostatics/fields.h"
+#include "potential/electrostatics/treecode.h"
 
 #include "kdtree/kdtree_utils.h"
 #include "helpme.h"
@@ -126,6 +128,38 @@ class Electrostatics {
      */
     void ResetAspcHistory();
 
+    /**
+     * @brief Moves the monomers to a new order
+     *
+     * The induced dipoles, coordinates and charges of the last call follow
+     * the monomers, so the dipoles, potential and field of the last call can
+     * still be queried. The ASPC history is reset.
+     * @param[in] perm The monomer that goes to position i is the one that
+     * currently is at position perm[i]. Monomers must stay in their type block.
+     */
+    void PermuteMonomers(const std::vector<size_t> &perm);
+
+    /**
+     * @brief Gets the induced dipoles of the last call and the ASPC history
+     *
+     * Both vectors are in the internal order of the class, so they can only
+     * be given back to a class with the same monomers in the same order.
+     * @param[out] mu Induced dipoles of the last call
+     * @param[out] mu_hist Dipoles stored in the ASPC history
+     * @return Number of steps stored in the history
+     */
+    size_t GetDipoleHistory(std::vector<double> &mu, std::vector<double> &mu_hist);
+
+    /**
+     * @brief Restores the induced dipoles and the ASPC history
+     *
+     * The arguments are the ones obtained with GetDipoleHistory.
+     * @param[in] mu Induced dipoles of the last call
+     * @param[in] mu_hist Dipoles stored in the ASPC history
+     * @param[in] hist_num Number of steps stored in the history
+     */
+    void SetDipoleHistory(const std::vector<double> &mu, const std::vector<double> &mu_hist, size_t hist_num);
+
     /**
      * @brief "Reinitializes" the electrostatics class.
      *
@@ -211,10 +245,106 @@ class Electrostatics {
      */
     double GetInducedElectrostaticEnergy();
 
+    /**
+     * @brief Computes the electric field generated by a set of dipoles
+     *
+     * This is the matrix-vector product done in each iteration of the
+     * induced dipoles. Both vectors are in the internal order of the class.
+     * @param[in] in_v Dipoles (3 per site)
+     * @param[out] out_v Electric field due to the dipoles (3 per site)
+     */
+    void ComputeDipoleField(std::vector<double> &in_v, std::vector<double> &out_v);
+
+    /**
+     * @brief Sets up the treecode for systems without PBC
+     *
+     * With the treecode, the direct loops only include pairs of sites closer
+     * than near_radius, where the Thole damping is computed exactly. All the
+     * other pairs are computed with a Barnes-Hut treecode, without damping
+     * and without cutoff. The near field radius must be large enough for the
+     * damping to vanish past it, and larger than any monomer.
+     * @param[in] theta Opening angle of the treecode, in (0, 1). Smaller is
+     * more accurate. 0 goes back to the direct sum.
+     * @param[in] near_radius Radius of the near field
+     */
+    void SetTreecode(double theta, double near_radius = 9.0);
+
+    /**
+     * @brief Sets the monomer pairs visited by the near field loops
+     *
+     * Only used together with the treecode. Pairs are given as consecutive
+     * monomer indexes, like the dimers of the 2B search, and must contain
+     * all the pairs with any two sites closer than the near field radius.
+     * An empty vector goes back to looping over all pairs.
+     * @param[in] pairs Monomer pairs {m1, m2, m1', m2', ...}
+     */
+    void SetPairList(const std::vector<size_t> &pairs);
+
+    /**
+     * @brief Stores the dipole interaction tensors for the induced dipole solve
+     *
+     * The geometry does not change while the dipoles are solved, so the
+     * damped real space 3x3 tensors of all the site pairs that are computed
+     * directly can be built once, in the first iteration, and the rest of
+     * the iterations become sparse matrix-vector products. Each pair takes 56
+     * bytes. If the pairs do not fit in max_memory_mb, the matrix-free loops
+     * are used until the geometry changes.
+     * @param[in] max_memory_mb Memory limit for the tensors, in MB. 0 disables them.
+     */
+    void SetDipoleTensor(double max_memory_mb);
+
+    /**
+     * @brief Gets the number of site pairs stored in the dipole tensor
+     *
+     * @return Number of stored pairs. 0 if the matrix-free loops are used
+     * for the current geometry, or if the tensor has not been built yet.
+     */
+    size_t GetDipoleTensorSize() const;
+
+    /**
+     * @brief Gets the number of times the scratch buffers had to grow
+     *
+     * Buffers are sized in the first call and reused afterwards, so this
+     * number should not change between two calls for the same system.
+     * @return Number of times the scratch buffers grew since initialization
+     */
+    size_t GetNumBufferResizes() const;
+
+    /**
+     * @brief Sets point charges that are not part of the system
+     *
+     * The external charges, such as the atoms of a QM region, add their
+     * potential and field to the permanent ones of the sites, so the induced
+     * dipoles respond to them. The energy and the gradients of the sites
+     * include the interaction of the external charges with the charges and
+     * dipoles of the system, but not the interaction between them. They use
+     * the same real space cutoff and Ewald sum as the sites, without Thole
+     * damping, and are not included in the virial.
+     * @param[in] xyz Coordinates of the external charges {x1,y1,z1,x2,...}
+     * @param[in] chg External charges. Empty to remove them.
+     */
+    void SetExternalCharges(const std::vector<double> &xyz, const std::vector<double> &chg);
+
+    /**
+     * @brief Computes the electrostatic potential and field at a set of points
+     *
+     * The potential and field are the ones of the charges and of the induced
+     * dipoles of the last call to GetElectrostatics, so the dipoles are not
+     * solved again. The sites within the cutoff of each point are found
+     * with a kd-tree and, with PBC, the reciprocal space part comes from one
+     * PME pass. The external charges are not included, so the force on an
+     * external charge is the charge times the field at its position.
+     * @param[in] points Coordinates of the points {x1,y1,z1,x2,...}. They
+     * must not coincide with a site.
+     * @param[out] phi Potential at each point, in kcal/mol/e
+     * @param[out] field Electric field at each point, in kcal/mol/(e*A)
+     */
+    void GetPotentialAndField(const std::vector<double> &points, std::vector<double> &phi,
+                              std::vector<double> &field);
+
    private:
     void CalculatePermanentElecField();
     void CalculateDipolesIterative();
-    void ComputeDipoleField(std::vector<double> &in_v, std::vector<double> &out_v);
     void CalculateDipolesCG();
     void DipolesCGIteration(std::vector<double> &in_v, std::vector<double> &out_v);
     void CalculateDipolesAspc();
@@ -224,9 +354,68 @@ class Electrostatics {
     void CalculateGradients(std::vector<double> &grad);
 
     void ReorderData();
-
-    // PME solver
-    // helpme::PMEInstance<double> pme_solver_;
+    void DirectDipoleField(double *in_ptr, std::vector<double> &out_v);
+    void BuildDipoleTensor();
+    void SparseDipoleField(double *in_ptr, std::vector<double> &out_v);
+    void SetUpTreecode();
+    bool UseTreecode() const { return treecode_theta_ > 0 && !use_pbc_; }
+    void SetUpFieldPool(size_t nthreads, size_t maxnmon);
+    void PotentialAtPoints(const std::vector<double> &src_xyz, const double *chg, const double *mu,
+                           const std::vector<double> &points, int deriv_level, std::vector<double> &result);
+    void AddExternalField();
+    void ExternalChargeGradients();
+    PMEInstanceD &GetPMESolver();
+
+    // PME solver. Kept between calls so grids and plans are only rebuilt
+    // when the box or the PME parameters change.
+    tools::Persistent<PMEInstanceD> pme_solver_;
+    // Scratch buffers reused between calls
+    tools::Workspace workspace_;
+    // Far field solver for systems without PBC
+    Treecode treecode_;
+    // Opening angle of the treecode. 0 if the direct sum is used.
+    double treecode_theta_;
+    // Pairs closer than this are done directly when the treecode is used
+    double treecode_radius_;
+    // Neighbors of each monomer with larger index, used in the near field.
+    // Neighbors of monomer m are neighbors_[neighbor_start_[m] .. neighbor_start_[m + 1]),
+    // sorted.
+    bool use_pair_list_;
+    std::vector<size_t> neighbor_start_;
+    std::vector<size_t> neighbors_;
+    // Row of the dipole tensor: pairs of site i of one monomer with the sites
+    // of the monomers of one type. site is the index of the x component of
+    // site i in the internal arrays, and stride the distance to y and z.
+    // The pairs of the row end at index end of the block.
+    struct DipoleTensorRow {
+        size_t site;
+        size_t stride;
+        size_t col_stride;
+        size_t end;
+    };
+    // Part of the dipole tensor built by one thread. For each pair, cols has
+    // the index of the x component of the other site, and values the six
+    // unique elements of the tensor (xx, xy, xz, yy, yz, zz).
+    struct DipoleTensorBlock {
+        std::vector<DipoleTensorRow> rows;
+        std::vector<size_t> cols;
+        std::vector<double> values;
+    };
+    std::vector<DipoleTensorBlock> dipole_tensor_;
+    // Memory limit of the dipole tensor in MB. 0 if not used.
+    double dipole_tensor_max_mb_;
+    // Whether the tensor has been built for the current geometry, or did
+    // not fit in the memory limit
+    bool dipole_tensor_built_;
+    bool dipole_tensor_too_large_;
+    // Number of pairs in the dipole tensor
+    size_t dipole_tensor_size_;
+    // One electric field holder per thread
+    std::vector<ElectricFieldHolder> field_pool_;
+    // Number of monomers the holders in field_pool_ were built for
+    size_t field_pool_maxnmon_;
+    // Number of times field_pool_ had to be rebuilt
+    size_t field_pool_resizes_;
     // Charges of each site. Order has to follow mon_type_count.
     std::vector<double> chg_;
     // Charges of each site. Order has to follow mon_type_count.
@@ -252,6 +441,10 @@ class Electrostatics {
     // Vector that contains all different monomer types and the number of
     // monomers of each type.
     std::vector<std::pair<std::string, size_t> > mon_type_count_;
+    // Excluded pairs 1-2, 1-3 and 1-4 of each monomer type
+    std::vector<excluded_set_type> exc12_;
+    std::vector<excluded_set_type> exc13_;
+    std::vector<excluded_set_type> exc14_;
     // Tolerance in the iterative calculation of the dipoles
     // Tolerance refers to the maximum squared difference overall the dipoles
     double tolerance_;
@@ -339,6 +532,10 @@ class Electrostatics {
     std::vector<double> virial_;
     // calculate the virial tensor ?
     bool calc_virial_;
+    // Coordinates of the external charges, xyzxyz...
+    std::vector<double> ext_xyz_;
+    // External charges
+    std::vector<double> ext_chg_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
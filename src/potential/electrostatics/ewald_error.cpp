@@ -0,0 +1,103 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "potential/electrostatics/ewald_error.h"
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "tools/custom_exceptions.h"
+
+namespace elec {
+
+namespace {
+
+// Coefficients of the expansion of the aliasing sums in powers of
+// (h alpha)^2, for assignment orders 1 to 7 (Deserno and Holm, Table I)
+const size_t kMaxSplineOrder = 7;
+const double kAliasCoefficients[kMaxSplineOrder][kMaxSplineOrder] = {
+    {2.0 / 3.0},
+    {1.0 / 50.0, 5.0 / 294.0},
+    {1.0 / 588.0, 7.0 / 1440.0, 21.0 / 3872.0},
+    {1.0 / 4320.0, 3.0 / 1936.0, 7601.0 / 2271360.0, 143.0 / 28800.0},
+    {1.0 / 23232.0, 7601.0 / 13628160.0, 143.0 / 69120.0, 517231.0 / 106536960.0, 106640677.0 / 11737571328.0},
+    {691.0 / 68140800.0, 13.0 / 57600.0, 47021.0 / 35512320.0, 9694607.0 / 2095994880.0,
+     733191589.0 / 59609088000.0, 326190917.0 / 11700633600.0},
+    {1.0 / 345600.0, 3617.0 / 35512320.0, 745739.0 / 838397952.0, 56399353.0 / 12773376000.0,
+     25091609.0 / 1560084480.0, 1755948832039.0 / 36229939200000.0, 4887769399.0 / 37838389248.0}};
+
+}  // namespace
+
+double EwaldReferenceForce(double q2, size_t nsites) { return nsites ? q2 / nsites : 0.0; }
+
+double EwaldRealSpaceError(double q2, size_t nsites, double volume, double alpha, double cutoff) {
+    if (nsites == 0) return 0.0;
+    return 2.0 * q2 * std::exp(-alpha * alpha * cutoff * cutoff) / std::sqrt(nsites * cutoff * volume);
+}
+
+double EwaldAlphaForError(double accuracy, double q2, size_t nsites, double volume, double cutoff) {
+    double x = accuracy * std::sqrt(nsites * cutoff * volume) / (2.0 * q2);
+    // Any alpha would do. Use a reasonable one instead of 0.
+    if (x >= 1.0) return (1.35 - 0.15 * std::log(accuracy)) / cutoff;
+    return std::sqrt(-std::log(x)) / cutoff;
+}
+
+double PMEReciprocalError(double q2, size_t nsites, const std::vector<double> &box, double alpha, double grid_density,
+                          size_t spline_order) {
+    if (spline_order < 1 || spline_order > kMaxSplineOrder) {
+        std::string text = "No error estimate is available for a spline order of " + std::to_string(spline_order) +
+                           ". It must be between 1 and " + std::to_string(kMaxSplineOrder) + ".";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    if (nsites == 0) return 0.0;
+
+    double sum_err2 = 0.0;
+    for (size_t d = 0; d < 3; d++) {
+        double length = box[4 * d];
+        int ngrid = grid_density * length;
+        if (ngrid < 1) return std::numeric_limits<double>::infinity();
+        double ha = alpha * length / ngrid;
+        double sum = 0.0;
+        for (size_t m = 0; m < spline_order; m++) {
+            sum += kAliasCoefficients[spline_order - 1][m] * std::pow(ha, 2.0 * m);
+        }
+        double err = q2 * std::pow(ha, static_cast<double>(spline_order)) *
+                     std::sqrt(alpha * length * std::sqrt(2.0 * M_PI) * sum / nsites) / (length * length);
+        sum_err2 += err * err;
+    }
+    return std::sqrt(sum_err2 / 3.0);
+}
+
+}  // namespace elec
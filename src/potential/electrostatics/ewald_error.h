@@ -0,0 +1,113 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef EWALD_ERROR_H
+#define EWALD_ERROR_H
+
+#include <vector>
+#include <cstddef>
+
+namespace elec {
+
+/*
+ * Estimates of the RMS error of the Ewald forces of a set of point charges.
+ * The errors are absolute, in units of the force between two unit charges
+ * 1 Angstrom apart, so they do not depend on the units of the energy.
+ * Dividing them by EwaldReferenceForce makes them relative. The induced
+ * dipoles are not included in the estimates.
+ */
+
+/**
+ * @brief Reference force of a set of charges, used to make the errors relative
+ *
+ * It is the force between two sites with the RMS charge 1 Angstrom apart,
+ * in the units of the error estimates.
+ * @param[in] q2 Sum of the squares of the charges, in e^2
+ * @param[in] nsites Number of charged sites
+ * @return Reference force
+ */
+double EwaldReferenceForce(double q2, size_t nsites);
+
+/**
+ * @brief Estimates the error of the real space part of the Ewald sum
+ *
+ * Uses the estimate of Kolafa and Perram, Mol. Sim. 9, 351 (1992).
+ * @param[in] q2 Sum of the squares of the charges, in e^2
+ * @param[in] nsites Number of charged sites
+ * @param[in] volume Volume of the box
+ * @param[in] alpha Ewald alpha
+ * @param[in] cutoff Real space cutoff
+ * @return Absolute RMS force error, in units of the force between two unit
+ * charges 1 Angstrom apart
+ */
+double EwaldRealSpaceError(double q2, size_t nsites, double volume, double alpha, double cutoff);
+
+/**
+ * @brief Gives the Ewald alpha at which the error of the real space part
+ * is the requested one
+ *
+ * Inverts EwaldRealSpaceError.
+ * @param[in] accuracy Target absolute RMS force error, in units of the force
+ * between two unit charges 1 Angstrom apart
+ * @param[in] q2 Sum of the squares of the charges, in e^2
+ * @param[in] nsites Number of charged sites
+ * @param[in] volume Volume of the box
+ * @param[in] cutoff Real space cutoff
+ * @return Ewald alpha
+ */
+double EwaldAlphaForError(double accuracy, double q2, size_t nsites, double volume, double cutoff);
+
+/**
+ * @brief Estimates the error of the reciprocal space part of the Ewald sum
+ * computed with PME
+ *
+ * Uses the estimate of Deserno and Holm, J. Chem. Phys. 109, 7694 (1998),
+ * for each of the three directions of an orthorhombic box. The number of
+ * grid points in each direction is computed as in the electrostatics, i.e.,
+ * the grid density times the box length, truncated.
+ * @param[in] q2 Sum of the squares of the charges, in e^2
+ * @param[in] nsites Number of charged sites
+ * @param[in] box Box vectors, as a 9 component vector
+ * @param[in] alpha Ewald alpha
+ * @param[in] grid_density Number of grid points per Angstrom
+ * @param[in] spline_order Order of the splines. Must be between 1 and 7.
+ * @return Absolute RMS force error, in units of the force between two unit
+ * charges 1 Angstrom apart
+ */
+double PMEReciprocalError(double q2, size_t nsites, const std::vector<double> &box, double alpha, double grid_density,
+                          size_t spline_order);
+
+}  // namespace elec
+
+#endif
@@ -33,6 +33,7 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 ******************************************************************************/
 
 #include "fields.h"
+#include "tools/cpu_dispatch.h"
 #include <iomanip>
 
 namespace elec {
@@ -55,14 +56,20 @@ ElectricFieldHolder::ElectricFieldHolder(size_t n) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, double *chg1, double *chg2,
-                                                 size_t mon1_index, size_t mon2_index_start, size_t mon2_index_end,
-                                                 size_t nmon1, size_t nmon2, size_t site_i, size_t site_j, double Ai,
-                                                 double Asqsqi, double aCC, double aCC1_4, double g34,
-                                                 double *Efqx_mon1, double *Efqy_mon1, double *Efqz_mon1, double *phi1,
-                                                 double *phi2, double *Efq2, double elec_scale_factor,
-                                                 double ewald_alpha, bool use_pbc, const std::vector<double> &box,
-                                                 const std::vector<double> &box_inverse, double cutoff, std::vector<double> *virial) {
+template <bool kVirial>
+MBX_ALWAYS_INLINE void ElectricFieldHolder::CalcPermanentElecFieldKernel(double *xyz1, double *xyz2, double *chg1,
+                                                                         double *chg2, size_t mon1_index,
+                                                                         size_t mon2_index_start, size_t mon2_index_end,
+                                                                         size_t nmon1, size_t nmon2, size_t site_i,
+                                                                         size_t site_j, double Ai, double Asqsqi,
+                                                                         double aCC, double aCC1_4, double g34,
+                                                                         double *Efqx_mon1, double *Efqy_mon1,
+                                                                         double *Efqz_mon1, double *phi1, double *phi2,
+                                                                         double *Efq2, double elec_scale_factor,
+                                                                         double ewald_alpha, bool use_pbc,
+                                                                         const std::vector<double> &box,
+                                                                         const std::vector<double> &box_inverse,
+                                                                         double cutoff, std::vector<double> *virial) {
     // Shifts that will be useful in the loops
     const size_t nmon12 = nmon1 * 2;
     const size_t nmon22 = nmon2 * 2;
@@ -91,7 +98,11 @@ void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, dou
     std::fill(v9_.begin() + mon2_index_start, v9_.begin() + mon2_index_end, 0.0);
     std::fill(v10_.begin() + mon2_index_start, v10_.begin() + mon2_index_end, 0.0);
     // temporary virial holder
-    std::fill(v11_.begin(), v11_.end(), 0.0);
+    if (kVirial) {
+        for (size_t k = 0; k < 6; k++) {
+            std::fill(v11_.begin() + k * maxnmon + mon2_index_start, v11_.begin() + k * maxnmon + mon2_index_end, 0.0);
+        }
+    }
 // Store rijx, rijy and rijz in vectors
 #pragma omp simd
     for (size_t m = mon2_index_start; m < mon2_index_end; m++) {
@@ -210,7 +221,7 @@ void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, dou
         Efq2[site_jnmon23 + nmon22 + m] -= s1r3ci * v2_[m];
         
         // update virial 
-        if (virial != 0) {
+        if (kVirial) {
 
             double dvr=chg2[site_jnmon2 + m]* chg1[site_inmon1 + mon1_index] * s1r3;
             double dvx = dvr * v0_[m];
@@ -238,7 +249,7 @@ void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, dou
         *Efqy_mon1 += v9_[m];
         *Efqz_mon1 += v10_[m];
         // condensate virial  
-        if (virial != 0) {
+        if (kVirial) {
             (*virial)[0] += v11_[0*maxnmon + m];
             (*virial)[1] += v11_[1*maxnmon + m];
             (*virial)[2] += v11_[2*maxnmon + m];
@@ -255,14 +266,44 @@ void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, dou
     }
 }
 
+void ElectricFieldHolder::CalcPermanentElecField(double *xyz1, double *xyz2, double *chg1, double *chg2,
+                                                 size_t mon1_index, size_t mon2_index_start, size_t mon2_index_end,
+                                                 size_t nmon1, size_t nmon2, size_t site_i, size_t site_j, double Ai,
+                                                 double Asqsqi, double aCC, double aCC1_4, double g34,
+                                                 double *Efqx_mon1, double *Efqy_mon1, double *Efqz_mon1, double *phi1,
+                                                 double *phi2, double *Efq2, double elec_scale_factor,
+                                                 double ewald_alpha, bool use_pbc, const std::vector<double> &box,
+                                                 const std::vector<double> &box_inverse, double cutoff, std::vector<double> *virial) {
+    if (virial != 0) {
+        tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+            CalcPermanentElecFieldKernel<true>(xyz1, xyz2, chg1, chg2, mon1_index, mon2_index_start, mon2_index_end,
+                                               nmon1, nmon2, site_i, site_j, Ai, Asqsqi, aCC, aCC1_4, g34, Efqx_mon1,
+                                               Efqy_mon1, Efqz_mon1, phi1, phi2, Efq2, elec_scale_factor, ewald_alpha,
+                                               use_pbc, box, box_inverse, cutoff, virial);
+        });
+    } else {
+        tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+            CalcPermanentElecFieldKernel<false>(xyz1, xyz2, chg1, chg2, mon1_index, mon2_index_start, mon2_index_end,
+                                                nmon1, nmon2, site_i, site_j, Ai, Asqsqi, aCC, aCC1_4, g34, Efqx_mon1,
+                                                Efqy_mon1, Efqz_mon1, phi1, phi2, Efq2, elec_scale_factor, ewald_alpha,
+                                                use_pbc, box, box_inverse, cutoff, virial);
+        });
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-void ElectricFieldHolder::CalcDipoleElecField(double *xyz1, double *xyz2, double *mu1, double *mu2, size_t mon1_index,
-                                              size_t mon2_index_start, size_t mon2_index_end, size_t nmon1,
-                                              size_t nmon2, size_t site_i, size_t site_j, double Asqsqi, double aDD,
-                                              double *Efd2, double *Efdx_mon1, double *Efdy_mon1, double *Efdz_mon1,
-                                              double ewald_alpha, bool use_pbc, const std::vector<double> &box,
-                                              const std::vector<double> &box_inverse, double cutoff) {
+MBX_ALWAYS_INLINE void ElectricFieldHolder::CalcDipoleElecFieldKernel(double *xyz1, double *xyz2, double *mu1,
+                                                                      double *mu2, size_t mon1_index,
+                                                                      size_t mon2_index_start, size_t mon2_index_end,
+                                                                      size_t nmon1, size_t nmon2, size_t site_i,
+                                                                      size_t site_j, double Asqsqi, double aDD,
+                                                                      double *Efd2, double *Efdx_mon1,
+                                                                      double *Efdy_mon1, double *Efdz_mon1,
+                                                                      double ewald_alpha, bool use_pbc,
+                                                                      const std::vector<double> &box,
+                                                                      const std::vector<double> &box_inverse,
+                                                                      double cutoff) {
     // Shifts that will be useful in the loops
     const size_t nmon12 = nmon1 * 2;
     const size_t nmon22 = nmon2 * 2;
@@ -392,16 +433,128 @@ void ElectricFieldHolder::CalcDipoleElecField(double *xyz1, double *xyz2, double
     }
 }
 
+void ElectricFieldHolder::CalcDipoleElecField(double *xyz1, double *xyz2, double *mu1, double *mu2, size_t mon1_index,
+                                              size_t mon2_index_start, size_t mon2_index_end, size_t nmon1,
+                                              size_t nmon2, size_t site_i, size_t site_j, double Asqsqi, double aDD,
+                                              double *Efd2, double *Efdx_mon1, double *Efdy_mon1, double *Efdz_mon1,
+                                              double ewald_alpha, bool use_pbc, const std::vector<double> &box,
+                                              const std::vector<double> &box_inverse, double cutoff) {
+    tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+        CalcDipoleElecFieldKernel(xyz1, xyz2, mu1, mu2, mon1_index, mon2_index_start, mon2_index_end, nmon1, nmon2,
+                                  site_i, site_j, Asqsqi, aDD, Efd2, Efdx_mon1, Efdy_mon1, Efdz_mon1, ewald_alpha,
+                                  use_pbc, box, box_inverse, cutoff);
+    });
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double *chg1, double *chg2, double *mu1,
-                                             double *mu2, size_t mon1_index, size_t mon2_index_start,
-                                             size_t mon2_index_end, size_t nmon1, size_t nmon2, size_t site_i,
-                                             size_t site_j, double aDD, double aCD, double Asqsqi, double *grdx,
-                                             double *grdy, double *grdz, double *phi1, double *phi2, double *grd2,
-                                             double elec_scale_factor, double ewald_alpha, bool use_pbc,
-                                             const std::vector<double> &box, const std::vector<double> &box_inverse,
-                                             double cutoff, std::vector<double> *virial) {
+MBX_ALWAYS_INLINE void ElectricFieldHolder::CalcDipoleTensorKernel(double *xyz1, double *xyz2, size_t mon1_index,
+                                                                   size_t mon2_index_start, size_t mon2_index_end,
+                                                                   size_t nmon1, size_t nmon2, size_t site_i,
+                                                                   size_t site_j, double Asqsqi, double aDD,
+                                                                   double *tensor, double ewald_alpha, bool use_pbc,
+                                                                   const std::vector<double> &box,
+                                                                   const std::vector<double> &box_inverse,
+                                                                   double cutoff) {
+    // Shifts that will be useful in the loops
+    const size_t nmon12 = nmon1 * 2;
+    const size_t nmon22 = nmon2 * 2;
+    const size_t site_inmon13 = nmon1 * site_i * 3;
+    const size_t site_jnmon23 = nmon2 * site_j * 3;
+
+    // Coordinates x, y and z of site i of monomer 1
+    const double xyzmon1_x = xyz1[site_inmon13 + mon1_index];
+    const double xyzmon1_y = xyz1[site_inmon13 + nmon1 + mon1_index];
+    const double xyzmon1_z = xyz1[site_inmon13 + nmon12 + mon1_index];
+
+#pragma omp simd
+    for (size_t m = mon2_index_start; m < mon2_index_end; m++) {
+        // Distances between sites i and j from mon1 and mon2
+        const double rawrijx = xyzmon1_x - xyz2[site_jnmon23 + m];
+        const double rawrijy = xyzmon1_y - xyz2[site_jnmon23 + nmon2 + m];
+        const double rawrijz = xyzmon1_z - xyz2[site_jnmon23 + nmon22 + m];
+
+        // Apply the minimum image convention via fractional coordinates
+        double minrijx, minrijy, minrijz;
+        if (use_pbc) {
+            const double fracrijx = box_inverse[0] * rawrijx + box_inverse[1] * rawrijy + box_inverse[2] * rawrijz;
+            const double fracrijy = box_inverse[3] * rawrijx + box_inverse[4] * rawrijy + box_inverse[5] * rawrijz;
+            const double fracrijz = box_inverse[6] * rawrijx + box_inverse[7] * rawrijy + box_inverse[8] * rawrijz;
+            const double minfracrijx = fracrijx - std::floor(fracrijx + 0.5);
+            const double minfracrijy = fracrijy - std::floor(fracrijy + 0.5);
+            const double minfracrijz = fracrijz - std::floor(fracrijz + 0.5);
+            minrijx = box[0] * minfracrijx + box[1] * minfracrijy + box[2] * minfracrijz;
+            minrijy = box[3] * minfracrijx + box[4] * minfracrijy + box[5] * minfracrijz;
+            minrijz = box[6] * minfracrijx + box[7] * minfracrijy + box[8] * minfracrijz;
+        }
+        const double rijx = use_pbc ? minrijx : rawrijx;
+        const double rijy = use_pbc ? minrijy : rawrijy;
+        const double rijz = use_pbc ? minrijz : rawrijz;
+
+        const double rsq = rijx * rijx + rijy * rijy + rijz * rijz;
+        const double r = std::sqrt(rsq);
+        const double ri = r < cutoff ? 1 / r : 0;
+        const double risq = ri * ri;
+        const double rsqsq = rsq * rsq;
+
+        // Same screening functions as in CalcDipoleElecField
+        double r_alpha = ewald_alpha * r;
+        double alpha_pi_term = ewald_alpha == 0 ? 0 : 1 / (std::sqrt(M_PI) * ewald_alpha);
+        double exp_alpha2_r2 = exp(-r_alpha * r_alpha);
+        double two_alpha_squared = 2.0 * ewald_alpha * ewald_alpha;
+        double bn0 = erfc(r_alpha) * ri;
+        alpha_pi_term *= two_alpha_squared;
+        double bn1 = (bn0 + alpha_pi_term * exp_alpha2_r2) * risq;
+        alpha_pi_term *= two_alpha_squared;
+        double bn2 = (3 * bn1 + alpha_pi_term * exp_alpha2_r2) * risq;
+
+        const double rA4 = rsqsq * Asqsqi;
+        const double arA4 = aDD * rA4;
+#if NO_THOLE
+        const double exp1 = 0;
+#else
+        const double exp1 = std::exp(-arA4);
+#endif
+
+        const double s1r3 = bn1 - exp1 * ri * risq;
+        const double s2r5_3 = bn2 - (3 + 4 * aDD * rA4) * exp1 * ri * risq * risq;
+
+        double *t = tensor + 6 * (m - mon2_index_start);
+        t[0] = s2r5_3 * rijx * rijx - s1r3;
+        t[1] = s2r5_3 * rijx * rijy;
+        t[2] = s2r5_3 * rijx * rijz;
+        t[3] = s2r5_3 * rijy * rijy - s1r3;
+        t[4] = s2r5_3 * rijy * rijz;
+        t[5] = s2r5_3 * rijz * rijz - s1r3;
+    }
+}
+
+void ElectricFieldHolder::CalcDipoleTensor(double *xyz1, double *xyz2, size_t mon1_index, size_t mon2_index_start,
+                                           size_t mon2_index_end, size_t nmon1, size_t nmon2, size_t site_i,
+                                           size_t site_j, double Asqsqi, double aDD, double *tensor,
+                                           double ewald_alpha, bool use_pbc, const std::vector<double> &box,
+                                           const std::vector<double> &box_inverse, double cutoff) {
+    tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+        CalcDipoleTensorKernel(xyz1, xyz2, mon1_index, mon2_index_start, mon2_index_end, nmon1, nmon2, site_i, site_j,
+                               Asqsqi, aDD, tensor, ewald_alpha, use_pbc, box, box_inverse, cutoff);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <bool kVirial>
+MBX_ALWAYS_INLINE void ElectricFieldHolder::CalcElecFieldGradsKernel(double *xyz1, double *xyz2, double *chg1,
+                                                                     double *chg2, double *mu1, double *mu2,
+                                                                     size_t mon1_index, size_t mon2_index_start,
+                                                                     size_t mon2_index_end, size_t nmon1, size_t nmon2,
+                                                                     size_t site_i, size_t site_j, double aDD,
+                                                                     double aCD, double Asqsqi, double *grdx,
+                                                                     double *grdy, double *grdz, double *phi1,
+                                                                     double *phi2, double *grd2,
+                                                                     double elec_scale_factor, double ewald_alpha,
+                                                                     bool use_pbc, const std::vector<double> &box,
+                                                                     const std::vector<double> &box_inverse,
+                                                                     double cutoff, std::vector<double> *virial) {
     // Shifts that will be useful in the loops
     const size_t nmon12 = nmon1 * 2;
     const size_t nmon22 = nmon2 * 2;
@@ -422,7 +575,12 @@ void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double
     std::fill(v1_.begin() + mon2_index_start, v1_.begin() + mon2_index_end, 0.0);
     std::fill(v2_.begin() + mon2_index_start, v2_.begin() + mon2_index_end, 0.0);
     std::fill(v3_.begin() + mon2_index_start, v3_.begin() + mon2_index_end, 0.0);
-    std::fill(v11_.begin(), v11_.end(), 0.0); // holders for the virial during vectorized loop
+    if (kVirial) {
+        // holders for the virial during vectorized loop
+        for (size_t k = 0; k < 6; k++) {
+            std::fill(v11_.begin() + k * maxnmon + mon2_index_start, v11_.begin() + k * maxnmon + mon2_index_end, 0.0);
+        }
+    }
 
 #pragma omp simd
     for (size_t m = mon2_index_start; m < mon2_index_end; m++) {
@@ -625,7 +783,7 @@ void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double
         grd2[site_jnmon23 + nmon22 + m] -= gz;
 
         // update virial
-        if (virial != 0) {
+        if (kVirial) {
 
             v11_[0*maxnmon + m] = -rijx*v0_[m]*constants::COULOMB;
             v11_[1*maxnmon + m] = -rijx*v1_[m]*constants::COULOMB;
@@ -650,7 +808,7 @@ void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double
         *grdz += v2_[m];
         *phi1 += v3_[m];
         // condensate virial  
-        if (virial != 0) {
+        if (kVirial) {
             (*virial)[0] += v11_[0*maxnmon + m];
             (*virial)[1] += v11_[1*maxnmon + m];
             (*virial)[2] += v11_[2*maxnmon + m];
@@ -668,6 +826,31 @@ void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double
     }
 }
 
+void ElectricFieldHolder::CalcElecFieldGrads(double *xyz1, double *xyz2, double *chg1, double *chg2, double *mu1,
+                                             double *mu2, size_t mon1_index, size_t mon2_index_start,
+                                             size_t mon2_index_end, size_t nmon1, size_t nmon2, size_t site_i,
+                                             size_t site_j, double aDD, double aCD, double Asqsqi, double *grdx,
+                                             double *grdy, double *grdz, double *phi1, double *phi2, double *grd2,
+                                             double elec_scale_factor, double ewald_alpha, bool use_pbc,
+                                             const std::vector<double> &box, const std::vector<double> &box_inverse,
+                                             double cutoff, std::vector<double> *virial) {
+    if (virial != 0) {
+        tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+            CalcElecFieldGradsKernel<true>(xyz1, xyz2, chg1, chg2, mu1, mu2, mon1_index, mon2_index_start,
+                                           mon2_index_end, nmon1, nmon2, site_i, site_j, aDD, aCD, Asqsqi, grdx, grdy,
+                                           grdz, phi1, phi2, grd2, elec_scale_factor, ewald_alpha, use_pbc, box,
+                                           box_inverse, cutoff, virial);
+        });
+    } else {
+        tools::RunDispatched([&]() MBX_INLINE_LAMBDA {
+            CalcElecFieldGradsKernel<false>(xyz1, xyz2, chg1, chg2, mu1, mu2, mon1_index, mon2_index_start,
+                                            mon2_index_end, nmon1, nmon2, site_i, site_j, aDD, aCD, Asqsqi, grdx, grdy,
+                                            grdz, phi1, phi2, grd2, elec_scale_factor, ewald_alpha, use_pbc, box,
+                                            box_inverse, cutoff, virial);
+        });
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 }  // namespace elec
@@ -77,6 +77,7 @@ derived.
 #include "potential/electrostatics/gammq.h"
 #include "tools/constants.h"
 #include "tools/definitions.h"
+#include "tools/cpu_dispatch.h"
 
 namespace elec {
 
@@ -146,6 +147,27 @@ class ElectricFieldHolder {
                              const std::vector<double> &box_inverse,  // The inverse lattice vectors
                              double cutoff);                          // The real space cutoff for pairs
 
+    // Computes the dipole interaction tensors of the same pairs as
+    // CalcDipoleElecField, so that the field on site i of mon1 is T * mu2
+    // and the field on site j of mon2 is T * mu1. For each mon2 the six
+    // unique elements xx, xy, xz, yy, yz, zz are stored contiguously
+    // starting at tensor[6 * (m - mon2_index_start)].
+
+    void CalcDipoleTensor(double *xyz1, double *xyz2,              // Coordinates of mon type 1 and 2
+                          size_t mon1_index,                       // Mon 1 index
+                          size_t mon2_index_start,                 // Mon 2 initial index
+                          size_t mon2_index_end,                   // Mon 2 final index
+                          size_t nmon1, size_t nmon2,              // # monomers of types 1 and 2
+                          size_t site_i, size_t site_j,            // Site # i of mon1 and # j of mon 2
+                          double Asqsqi,                           // (polfac[i] * polfac[j])^4 inverted
+                          double aDD,                              // Thole damping aDD (dipole - dipole)
+                          double *tensor,                          // Output tensors
+                          double ewald_alpha,                      // Ewald attenuation paramter
+                          bool use_pbc,                            // Whether to enforce periodic boundary conditions
+                          const std::vector<double> &box,          // The lattice vectors
+                          const std::vector<double> &box_inverse,  // The inverse lattice vectors
+                          double cutoff);                          // The real space cutoff for pairs
+
     ////////////////////////////////////////////////////////////////////////////////
     // GRADIENTS AND ADD DIPOLE CONTRIBUTIONS TO POTENTIAL /////////////////////////
     ////////////////////////////////////////////////////////////////////////////////
@@ -183,6 +205,45 @@ class ElectricFieldHolder {
     ////////////////////////////////////////////////////////////////////////////////
 
    private:
+    // Bodies of the kernels above. Each one is inlined in one variant per
+    // instruction set, selected at run time (see tools/cpu_dispatch.h).
+    // kVirial = false compiles out the virial accumulation
+    template <bool kVirial>
+    MBX_ALWAYS_INLINE void CalcPermanentElecFieldKernel(double *xyz1, double *xyz2, double *chg1, double *chg2,
+                                                        size_t mon1_index, size_t mon2_index_start,
+                                                        size_t mon2_index_end, size_t nmon1, size_t nmon2,
+                                                        size_t site_i, size_t site_j, double Ai, double Asqsqi,
+                                                        double aCC, double aCC1_4, double g34, double *Efqx_mon1,
+                                                        double *Efqy_mon1, double *Efqz_mon1, double *phi1,
+                                                        double *phi2, double *Efq2, double elec_scale_factor,
+                                                        double ewald_alpha, bool use_pbc,
+                                                        const std::vector<double> &box,
+                                                        const std::vector<double> &box_inverse, double cutoff,
+                                                        std::vector<double> *virial);
+    MBX_ALWAYS_INLINE void CalcDipoleElecFieldKernel(double *xyz1, double *xyz2, double *mu1, double *mu2,
+                                                     size_t mon1_index, size_t mon2_index_start, size_t mon2_index_end,
+                                                     size_t nmon1, size_t nmon2, size_t site_i, size_t site_j,
+                                                     double Asqsqi, double aDD, double *Efd2, double *Efdx_mon1,
+                                                     double *Efdy_mon1, double *Efdz_mon1, double ewald_alpha,
+                                                     bool use_pbc, const std::vector<double> &box,
+                                                     const std::vector<double> &box_inverse, double cutoff);
+    MBX_ALWAYS_INLINE void CalcDipoleTensorKernel(double *xyz1, double *xyz2, size_t mon1_index,
+                                                  size_t mon2_index_start, size_t mon2_index_end, size_t nmon1,
+                                                  size_t nmon2, size_t site_i, size_t site_j, double Asqsqi, double aDD,
+                                                  double *tensor, double ewald_alpha, bool use_pbc,
+                                                  const std::vector<double> &box,
+                                                  const std::vector<double> &box_inverse, double cutoff);
+    template <bool kVirial>
+    MBX_ALWAYS_INLINE void CalcElecFieldGradsKernel(double *xyz1, double *xyz2, double *chg1, double *chg2, double *mu1,
+                                                    double *mu2, size_t mon1_index, size_t mon2_index_start,
+                                                    size_t mon2_index_end, size_t nmon1, size_t nmon2, size_t site_i,
+                                                    size_t site_j, double aDD, double aCD, double Asqsqi, double *grdx,
+                                                    double *grdy, double *grdz, double *phi1, double *phi2,
+                                                    double *grd2, double elec_scale_factor, double ewald_alpha,
+                                                    bool use_pbc, const std::vector<double> &box,
+                                                    const std::vector<double> &box_inverse, double cutoff,
+                                                    std::vector<double> *virial);
+
     // Maximum number of monomers that can be in system
     // For now, is set to the largest number. Later can be set to
     // the maximum number of monomers we will evaluate at once.
@@ -0,0 +1,355 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "potential/electrostatics/treecode.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "tools/custom_exceptions.h"
+
+namespace elec {
+
+Treecode::Treecode() : nsites_(0), near_radius_(0.0), theta_(0.0), order_expansion_(0) {}
+
+void Treecode::SetUpTerms(size_t max_degree) {
+    size_t dim = max_degree + 1;
+    std::vector<int> index(dim * dim * dim, -1);
+    terms_.clear();
+    nterms_.clear();
+    for (size_t n = 0; n <= max_degree; n++) {
+        for (int kx = n; kx >= 0; kx--) {
+            for (int ky = n - kx; ky >= 0; ky--) {
+                int kz = n - kx - ky;
+                index[(kx * dim + ky) * dim + kz] = terms_.size() / 3;
+                terms_.push_back(kx);
+                terms_.push_back(ky);
+                terms_.push_back(kz);
+            }
+        }
+        nterms_.push_back(terms_.size() / 3);
+    }
+
+    size_t nterms = terms_.size() / 3;
+    up_.assign(3 * nterms, -1);
+    down_.assign(3 * nterms, -1);
+    down2_.assign(3 * nterms, -1);
+    for (size_t t = 0; t < nterms; t++) {
+        int k[3] = {terms_[3 * t], terms_[3 * t + 1], terms_[3 * t + 2]};
+        size_t n = k[0] + k[1] + k[2];
+        for (size_t d = 0; d < 3; d++) {
+            int kd[3] = {k[0], k[1], k[2]};
+            if (n < max_degree) {
+                kd[d] = k[d] + 1;
+                up_[3 * t + d] = index[(kd[0] * dim + kd[1]) * dim + kd[2]];
+            }
+            if (k[d] >= 1) {
+                kd[d] = k[d] - 1;
+                down_[3 * t + d] = index[(kd[0] * dim + kd[1]) * dim + kd[2]];
+            }
+            if (k[d] >= 2) {
+                kd[d] = k[d] - 2;
+                down2_[3 * t + d] = index[(kd[0] * dim + kd[1]) * dim + kd[2]];
+            }
+        }
+    }
+}
+
+void Treecode::Build(const std::vector<double> &xyz, double near_radius, double theta, size_t order,
+                     size_t leaf_size) {
+    if (theta <= 0.0 || theta >= 1.0) {
+        std::string text = "The opening angle of the treecode must be in (0, 1). Got " + std::to_string(theta);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    xyz_ = xyz;
+    nsites_ = xyz.size() / 3;
+    near_radius_ = near_radius;
+    theta_ = theta;
+    leaf_size = std::max(leaf_size, size_t(1));
+    // Second derivatives of the potential need two more degrees than the moments
+    if (order != order_expansion_ || terms_.empty()) {
+        order_expansion_ = order;
+        SetUpTerms(order + 2);
+    }
+
+    order_.resize(nsites_);
+    for (size_t i = 0; i < nsites_; i++) order_[i] = i;
+    nodes_.clear();
+    if (nsites_ == 0) return;
+
+    Node root;
+    root.begin = 0;
+    root.end = nsites_;
+    root.first_child = 0;
+    root.num_children = 0;
+    nodes_.push_back(root);
+
+    // Nodes are split in breadth first order, so the children of a node are contiguous
+    std::vector<size_t> tmp(nsites_);
+    for (size_t n = 0; n < nodes_.size(); n++) {
+        size_t begin = nodes_[n].begin;
+        size_t end = nodes_[n].end;
+
+        // Center of the bounding box and radius of the node
+        double lo[3], hi[3];
+        for (size_t d = 0; d < 3; d++) lo[d] = hi[d] = xyz_[3 * order_[begin] + d];
+        for (size_t p = begin + 1; p < end; p++) {
+            const double *x = xyz_.data() + 3 * order_[p];
+            for (size_t d = 0; d < 3; d++) {
+                lo[d] = std::min(lo[d], x[d]);
+                hi[d] = std::max(hi[d], x[d]);
+            }
+        }
+        double radius2 = 0.0;
+        for (size_t d = 0; d < 3; d++) nodes_[n].center[d] = 0.5 * (lo[d] + hi[d]);
+        for (size_t p = begin; p < end; p++) {
+            const double *x = xyz_.data() + 3 * order_[p];
+            double dx = x[0] - nodes_[n].center[0];
+            double dy = x[1] - nodes_[n].center[1];
+            double dz = x[2] - nodes_[n].center[2];
+            radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+        }
+        nodes_[n].radius = std::sqrt(radius2);
+
+        // Leaves. Sites on top of each other are not split any further.
+        if (end - begin <= leaf_size || radius2 < 1E-20) continue;
+
+        // Sort the sites of the node by octant
+        size_t count[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (size_t p = begin; p < end; p++) {
+            const double *x = xyz_.data() + 3 * order_[p];
+            size_t oct = (x[0] > nodes_[n].center[0]) + 2 * (x[1] > nodes_[n].center[1]) +
+                         4 * (x[2] > nodes_[n].center[2]);
+            count[oct]++;
+        }
+        size_t start[8];
+        start[0] = begin;
+        for (size_t o = 1; o < 8; o++) start[o] = start[o - 1] + count[o - 1];
+        size_t next[8];
+        std::copy(start, start + 8, next);
+        for (size_t p = begin; p < end; p++) {
+            const double *x = xyz_.data() + 3 * order_[p];
+            size_t oct = (x[0] > nodes_[n].center[0]) + 2 * (x[1] > nodes_[n].center[1]) +
+                         4 * (x[2] > nodes_[n].center[2]);
+            tmp[next[oct]++] = order_[p];
+        }
+        std::copy(tmp.begin() + begin, tmp.begin() + end, order_.begin() + begin);
+
+        nodes_[n].first_child = nodes_.size();
+        for (size_t o = 0; o < 8; o++) {
+            if (count[o] == 0) continue;
+            Node child;
+            child.begin = start[o];
+            child.end = start[o] + count[o];
+            child.first_child = 0;
+            child.num_children = 0;
+            nodes_.push_back(child);
+            nodes_[n].num_children++;
+        }
+    }
+}
+
+void Treecode::ComputeMoments(const double *chg, const double *mu) {
+    size_t nmom = nterms_[order_expansion_];
+    size_t np = order_expansion_ + 1;
+    moments_.assign(nodes_.size() * nmom, 0.0);
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<double> px(np), py(np), pz(np);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (size_t n = 0; n < nodes_.size(); n++) {
+            double *mom = moments_.data() + n * nmom;
+            const double *c = nodes_[n].center;
+            for (size_t p = nodes_[n].begin; p < nodes_[n].end; p++) {
+                size_t s = order_[p];
+                const double *x = xyz_.data() + 3 * s;
+                px[0] = py[0] = pz[0] = 1.0;
+                for (size_t k = 1; k < np; k++) {
+                    px[k] = px[k - 1] * (x[0] - c[0]);
+                    py[k] = py[k - 1] * (x[1] - c[1]);
+                    pz[k] = pz[k - 1] * (x[2] - c[2]);
+                }
+                double q = chg ? chg[s] : 0.0;
+                const double *m = mu ? mu + 3 * s : 0;
+                for (size_t t = 0; t < nmom; t++) {
+                    int kx = terms_[3 * t];
+                    int ky = terms_[3 * t + 1];
+                    int kz = terms_[3 * t + 2];
+                    double v = q * px[kx] * py[ky] * pz[kz];
+                    if (m) {
+                        if (kx) v += m[0] * kx * px[kx - 1] * py[ky] * pz[kz];
+                        if (ky) v += m[1] * ky * px[kx] * py[ky - 1] * pz[kz];
+                        if (kz) v += m[2] * kz * px[kx] * py[ky] * pz[kz - 1];
+                    }
+                    mom[t] += v;
+                }
+            }
+        }
+    }
+}
+
+void Treecode::ComputeCoefficients(const double *r, size_t nterms, double *a) const {
+    double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+    double r2i = 1.0 / r2;
+    a[0] = std::sqrt(r2i);
+    for (size_t t = 1; t < nterms; t++) {
+        double n = terms_[3 * t] + terms_[3 * t + 1] + terms_[3 * t + 2];
+        double s1 = 0.0;
+        double s2 = 0.0;
+        for (size_t d = 0; d < 3; d++) {
+            if (down_[3 * t + d] >= 0) s1 += r[d] * a[down_[3 * t + d]];
+            if (down2_[3 * t + d] >= 0) s2 += a[down2_[3 * t + d]];
+        }
+        a[t] = ((2 * n - 1) * s1 - (n - 1) * s2) * r2i / n;
+    }
+}
+
+void Treecode::ComputePotential(const double *chg, const double *mu, int deriv_level, std::vector<double> &result) {
+    if (deriv_level != 1 && deriv_level != 2) {
+        std::string text = "Treecode derivative level must be 1 or 2. Got " + std::to_string(deriv_level);
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    size_t ncomp = deriv_level == 1 ? 4 : 10;
+    result.assign(ncomp * nsites_, 0.0);
+    if (nsites_ == 0 || (!chg && !mu)) return;
+
+    ComputeMoments(chg, mu);
+
+    size_t nmom = nterms_[order_expansion_];
+    size_t ncoef = nterms_[order_expansion_ + deriv_level];
+    double near2 = near_radius_ * near_radius_;
+    // Pairs of dimensions of the second derivatives, in the order of helPME
+    const size_t d2pairs[6][2] = {{0, 0}, {0, 1}, {1, 1}, {0, 2}, {1, 2}, {2, 2}};
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<size_t> stack;
+        std::vector<double> a(ncoef);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+        for (size_t i = 0; i < nsites_; i++) {
+            const double *x = xyz_.data() + 3 * i;
+            double *res = result.data() + ncomp * i;
+            stack.clear();
+            stack.push_back(0);
+            while (stack.size()) {
+                const Node &node = nodes_[stack.back()];
+                const double *mom = moments_.data() + stack.back() * nmom;
+                stack.pop_back();
+                double r[3] = {x[0] - node.center[0], x[1] - node.center[1], x[2] - node.center[2]};
+                double dist = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+
+                // All the sites of the node are in the near field
+                if (dist + node.radius <= near_radius_) continue;
+
+                if (dist - node.radius > near_radius_ && node.radius < theta_ * dist) {
+                    // Multipole expansion of the node
+                    ComputeCoefficients(r, ncoef, a.data());
+                    for (size_t t = 0; t < nmom; t++) {
+                        double m = mom[t];
+                        if (m == 0.0) continue;
+                        const int *k = terms_.data() + 3 * t;
+                        const int *up = up_.data() + 3 * t;
+                        res[0] += a[t] * m;
+                        for (size_t d = 0; d < 3; d++) res[1 + d] -= (k[d] + 1) * a[up[d]] * m;
+                        if (deriv_level == 2) {
+                            for (size_t p = 0; p < 6; p++) {
+                                size_t d = d2pairs[p][0];
+                                size_t e = d2pairs[p][1];
+                                double fac = (k[d] + 1) * (k[e] + (d == e) + 1);
+                                res[4 + p] += fac * a[up_[3 * up[d] + e]] * m;
+                            }
+                        }
+                    }
+                } else if (node.num_children == 0) {
+                    // Leaf. Sites one by one.
+                    for (size_t p = node.begin; p < node.end; p++) {
+                        size_t j = order_[p];
+                        double rx = x[0] - xyz_[3 * j];
+                        double ry = x[1] - xyz_[3 * j + 1];
+                        double rz = x[2] - xyz_[3 * j + 2];
+                        double r2 = rx * rx + ry * ry + rz * rz;
+                        if (r2 <= near2) continue;
+                        double ri = 1.0 / std::sqrt(r2);
+                        double ri2 = ri * ri;
+                        double ri3 = ri * ri2;
+                        double ri5 = ri3 * ri2;
+                        double q = chg ? chg[j] : 0.0;
+                        double mx = 0.0, my = 0.0, mz = 0.0;
+                        if (mu) {
+                            mx = mu[3 * j];
+                            my = mu[3 * j + 1];
+                            mz = mu[3 * j + 2];
+                        }
+                        double mr = mx * rx + my * ry + mz * rz;
+                        res[0] += q * ri + mr * ri3;
+                        res[1] += -q * rx * ri3 + mx * ri3 - 3 * mr * rx * ri5;
+                        res[2] += -q * ry * ri3 + my * ri3 - 3 * mr * ry * ri5;
+                        res[3] += -q * rz * ri3 + mz * ri3 - 3 * mr * rz * ri5;
+                        if (deriv_level == 2) {
+                            const double rv[3] = {rx, ry, rz};
+                            const double mv[3] = {mx, my, mz};
+                            double ri7 = ri5 * ri2;
+                            for (size_t p2 = 0; p2 < 6; p2++) {
+                                size_t d = d2pairs[p2][0];
+                                size_t e = d2pairs[p2][1];
+                                double delta = d == e ? 1.0 : 0.0;
+                                res[4 + p2] += q * (3 * rv[d] * rv[e] * ri5 - delta * ri3) -
+                                               3 * (mv[d] * rv[e] + mv[e] * rv[d]) * ri5 - 3 * mr * delta * ri5 +
+                                               15 * mr * rv[d] * rv[e] * ri7;
+                            }
+                        }
+                    }
+                } else {
+                    for (size_t c = 0; c < node.num_children; c++) stack.push_back(node.first_child + c);
+                }
+            }
+        }
+    }
+}
+
+}  // namespace elec
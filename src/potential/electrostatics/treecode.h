@@ -0,0 +1,135 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef TREECODE_H
+#define TREECODE_H
+
+#include <vector>
+#include <cstddef>
+
+namespace elec {
+
+/**
+ * @class Treecode
+ * @brief Barnes-Hut treecode for the far field of charges and point dipoles
+ * without periodic boundary conditions.
+ *
+ * The sites are sorted into an octree. Each node stores the Cartesian
+ * multipole moments of its charges and dipoles about its center, up to a
+ * given order. The potential at a site is the sum over all the sites that are
+ * further than the near field radius. A node contributes through its
+ * multipole expansion when it lies entirely outside the near field radius and
+ * its radius is smaller than theta times its distance to the site. Otherwise
+ * its children are visited, and the sites of a leaf are added one by one.
+ * Sites within the near field radius are skipped, and must be done directly.
+ * The interactions are plain Coulomb: no damping is applied.
+ *
+ * The Taylor coefficients of 1/r are obtained with the recurrence of
+ * Duan and Krasny, J. Comput. Chem. 22, 184 (2001).
+ */
+class Treecode {
+   public:
+    Treecode();
+
+    /**
+     * @brief Builds the octree for a set of sites
+     *
+     * @param[in] xyz Coordinates of the sites, xyzxyz...
+     * @param[in] near_radius Pairs closer than this are not included
+     * @param[in] theta Opening angle. Smaller is more accurate and slower.
+     * @param[in] order Order of the multipole expansions
+     * @param[in] leaf_size Maximum number of sites in a leaf
+     */
+    void Build(const std::vector<double> &xyz, double near_radius, double theta, size_t order = 6,
+               size_t leaf_size = 16);
+
+    /**
+     * @brief Computes the potential, and its derivatives, at every site
+     *
+     * The result follows the convention of helPME. For every site it has the
+     * potential, then the first derivatives (x, y, z) and, if deriv_level is
+     * 2, the second derivatives (xx, xy, yy, xz, yz, zz). The field is minus
+     * the first derivatives.
+     * @param[in] chg Charge of each site, or a null pointer if there are none
+     * @param[in] mu Dipole of each site, xyzxyz..., or a null pointer if there are none
+     * @param[in] deriv_level 1 or 2
+     * @param[out] result Values at each site, 4 or 10 per site, in the order of xyz
+     */
+    void ComputePotential(const double *chg, const double *mu, int deriv_level, std::vector<double> &result);
+
+    /**
+     * @return Number of sites of the last build
+     */
+    size_t GetNumSites() const { return nsites_; }
+
+   private:
+    struct Node {
+        // Center of the expansion
+        double center[3];
+        // Largest distance from the center to a site of the node
+        double radius;
+        // Sites of the node are order_[begin .. end)
+        size_t begin, end;
+        // Children are nodes_[first_child .. first_child + num_children)
+        size_t first_child, num_children;
+    };
+
+    void SetUpTerms(size_t max_degree);
+    void ComputeMoments(const double *chg, const double *mu);
+    void ComputeCoefficients(const double *r, size_t nterms, double *a) const;
+
+    // Coordinates of the sites, xyzxyz...
+    std::vector<double> xyz_;
+    size_t nsites_;
+    // Sites sorted by node
+    std::vector<size_t> order_;
+    std::vector<Node> nodes_;
+    double near_radius_;
+    double theta_;
+    size_t order_expansion_;
+    // Multi indexes (kx, ky, kz) of the Taylor terms, sorted by degree.
+    // Terms with degree <= order_expansion_ are the moments.
+    std::vector<int> terms_;
+    // Index of the term k + e_d, k - e_d and k - 2 e_d, for each term k and
+    // dimension d. -1 if it does not exist.
+    std::vector<int> up_, down_, down2_;
+    // Number of terms with degree <= n, for each n
+    std::vector<size_t> nterms_;
+    // Multipole moments, nterms_[order_expansion_] per node
+    std::vector<double> moments_;
+};
+
+}  // namespace elec
+
+#endif
@@ -0,0 +1,606 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "potential/neural_networks/nn_model.h"
+#include "tools/cpu_dispatch.h"
+#include "tools/custom_exceptions.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdint.h>
+
+/**
+ * @file nn_model.cpp
+ * @brief Implementation of the neural network model of a 2b or 3b energy
+ */
+
+namespace nn {
+
+namespace {
+
+const char kFileMagic[] = "MBNN";
+const uint32_t kFileVersion = 1;
+
+// Number of clusters transposed and evaluated together, and number of
+// columns of the block kept in registers by the matrix products
+const size_t kBlock = 64;
+const size_t kTile = 8;
+
+// Monomer pairs of the switching functions: (0,1) for dimers,
+// (0,1), (0,2) and (1,2) for trimers
+const size_t kMonPairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+
+template <typename T>
+void ReadValue(std::ifstream &in, const std::string &file, T &value) {
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        std::string text = "Neural network file " + file + " is truncated";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+}
+
+void ReadValues(std::ifstream &in, const std::string &file, size_t n, std::vector<double> &v) {
+    v.resize(n);
+    if (n > 0 && !in.read(reinterpret_cast<char *>(v.data()), n * sizeof(double))) {
+        std::string text = "Neural network file " + file + " is truncated";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+}
+
+template <typename T>
+void WriteValue(std::ofstream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void WriteValues(std::ofstream &out, const std::vector<double> &v) {
+    out.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(double));
+}
+
+// Same switching function as the polynomials, with its derivative in g
+MBX_ALWAYS_INLINE double Switch(double r, double r_inner, double r_outer, double &g) {
+    if (r >= r_outer) {
+        g = 0.0;
+        return 0.0;
+    } else if (r > r_inner) {
+        const double t1 = M_PI / (r_outer - r_inner);
+        const double x = (r - r_inner) * t1;
+        g = -std::sin(x) * t1 / 2.0;
+        return (1.0 + std::cos(x)) / 2.0;
+    }
+    g = 0.0;
+    return 1.0;
+}
+
+// out[o][c] = b[o] + sum_i w[o * ws_o + i * ws_i] * in[i][c] for the kBlock
+// columns c of a block. ws_o = nin, ws_i = 1 is the product by the weights of
+// a layer and ws_o = 1, ws_i = nout the product by their transpose. Four rows
+// and kTile columns of out are accumulated at a time.
+MBX_ALWAYS_INLINE void BlockGemm(const double *w, size_t ws_o, size_t ws_i, const double *b, size_t nin, size_t nout,
+                                 const double *in, double *out) {
+    size_t o = 0;
+    for (; o + 4 <= nout; o += 4) {
+        const double *w0 = w + o * ws_o;
+        const double *w1 = w0 + ws_o;
+        const double *w2 = w1 + ws_o;
+        const double *w3 = w2 + ws_o;
+        const double b0 = b ? b[o] : 0.0;
+        const double b1 = b ? b[o + 1] : 0.0;
+        const double b2 = b ? b[o + 2] : 0.0;
+        const double b3 = b ? b[o + 3] : 0.0;
+        for (size_t c0 = 0; c0 < kBlock; c0 += kTile) {
+            double acc0[kTile], acc1[kTile], acc2[kTile], acc3[kTile];
+            for (size_t t = 0; t < kTile; t++) {
+                acc0[t] = b0;
+                acc1[t] = b1;
+                acc2[t] = b2;
+                acc3[t] = b3;
+            }
+            for (size_t i = 0; i < nin; i++) {
+                const double *xi = in + i * kBlock + c0;
+                const double a0 = w0[i * ws_i];
+                const double a1 = w1[i * ws_i];
+                const double a2 = w2[i * ws_i];
+                const double a3 = w3[i * ws_i];
+                for (size_t t = 0; t < kTile; t++) {
+                    acc0[t] += a0 * xi[t];
+                    acc1[t] += a1 * xi[t];
+                    acc2[t] += a2 * xi[t];
+                    acc3[t] += a3 * xi[t];
+                }
+            }
+            double *out0 = out + o * kBlock + c0;
+            for (size_t t = 0; t < kTile; t++) {
+                out0[t] = acc0[t];
+                out0[kBlock + t] = acc1[t];
+                out0[2 * kBlock + t] = acc2[t];
+                out0[3 * kBlock + t] = acc3[t];
+            }
+        }
+    }
+    for (; o < nout; o++) {
+        const double *w0 = w + o * ws_o;
+        const double b0 = b ? b[o] : 0.0;
+        for (size_t c0 = 0; c0 < kBlock; c0 += kTile) {
+            double acc0[kTile];
+            for (size_t t = 0; t < kTile; t++) acc0[t] = b0;
+            for (size_t i = 0; i < nin; i++) {
+                const double *xi = in + i * kBlock + c0;
+                const double a0 = w0[i * ws_i];
+                for (size_t t = 0; t < kTile; t++) acc0[t] += a0 * xi[t];
+            }
+            double *out0 = out + o * kBlock + c0;
+            for (size_t t = 0; t < kTile; t++) out0[t] = acc0[t];
+        }
+    }
+}
+
+// Distances of the atom pair (a, b) for all the columns of a block
+// of transposed coordinates
+MBX_ALWAYS_INLINE void BlockDistances(const double *x, size_t a, size_t b, double *r) {
+    const double *xa = x + 3 * a * kBlock;
+    const double *xb = x + 3 * b * kBlock;
+    for (size_t c = 0; c < kBlock; c++) {
+        const double dx = xa[c] - xb[c];
+        const double dy = xa[kBlock + c] - xb[kBlock + c];
+        const double dz = xa[2 * kBlock + c] - xb[2 * kBlock + c];
+        r[c] = std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+}
+
+// Adds f[c] * (x_a - x_b) to the gradient of a, and subtracts it from b
+MBX_ALWAYS_INLINE void BlockPairGradient(const double *x, size_t a, size_t b, const double *f, double *gx) {
+    for (size_t d = 0; d < 3; d++) {
+        const double *xa = x + (3 * a + d) * kBlock;
+        const double *xb = x + (3 * b + d) * kBlock;
+        double *ga = gx + (3 * a + d) * kBlock;
+        double *gb = gx + (3 * b + d) * kBlock;
+        for (size_t c = 0; c < kBlock; c++) {
+            const double g = f[c] * (xa[c] - xb[c]);
+            ga[c] += g;
+            gb[c] -= g;
+        }
+    }
+}
+
+}  // namespace
+
+NNModel::NNModel(const std::string &file) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    if (!in) {
+        std::string text = "Could not open the neural network file " + file;
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    char magic[sizeof(kFileMagic) - 1];
+    uint32_t version = 0;
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kFileMagic)) {
+        std::string text = "File " + file + " is not a neural network file";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    ReadValue(in, file, version);
+    if (version != kFileVersion) {
+        std::string text = "Neural network file " + file + " has version " + std::to_string(version) +
+                           ", but only version " + std::to_string(kFileVersion) + " is supported";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    uint32_t nmon;
+    ReadValue(in, file, nmon);
+    if (nmon < 2 || nmon > 3) {
+        std::string text = "Neural network file " + file + " has " + std::to_string(nmon) +
+                           " monomers. Only dimers and trimers are supported";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    size_t natoms = 0;
+    for (size_t k = 0; k < nmon; k++) {
+        uint32_t len, nat;
+        ReadValue(in, file, len);
+        std::string id(len, ' ');
+        if (len > 0 && !in.read(&id[0], len)) {
+            std::string text = "Neural network file " + file + " is truncated";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        ReadValue(in, file, nat);
+        if (nat == 0) {
+            std::string text = "Monomer " + id + " of the neural network file " + file + " has no atoms";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        mon_ids_.push_back(id);
+        nats_.push_back(nat);
+        natoms += nat;
+    }
+    ReadValue(in, file, r_inner_);
+    ReadValue(in, file, r_outer_);
+
+    pair_class_.resize(natoms * (natoms - 1) / 2);
+    for (size_t p = 0; p < pair_class_.size(); p++) {
+        int32_t cls;
+        ReadValue(in, file, cls);
+        pair_class_[p] = cls;
+    }
+
+    uint32_t nbasis;
+    ReadValue(in, file, nbasis);
+    ReadValues(in, file, nbasis, eta_);
+    ReadValues(in, file, nbasis, rs_);
+
+    int nclass = *std::max_element(pair_class_.begin(), pair_class_.end()) + 1;
+    size_t nin = std::max(nclass, 0) * nbasis;
+    ReadValues(in, file, nin, mean_);
+    ReadValues(in, file, nin, scale_);
+
+    uint32_t nlayers;
+    ReadValue(in, file, nlayers);
+    for (size_t l = 0; l < nlayers; l++) {
+        uint32_t nout, activation;
+        ReadValue(in, file, nout);
+        ReadValue(in, file, activation);
+        NNLayer layer;
+        layer.nin = nin;
+        layer.nout = nout;
+        layer.activation = static_cast<NNActivation>(activation);
+        ReadValues(in, file, layer.nin * layer.nout, layer.w);
+        ReadValues(in, file, layer.nout, layer.b);
+        layers_.push_back(layer);
+        nin = nout;
+    }
+
+    Setup();
+}
+
+NNModel::NNModel(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats, double r_inner,
+                 double r_outer, const std::vector<int> &pair_class, const std::vector<double> &eta,
+                 const std::vector<double> &rs, const std::vector<double> &mean, const std::vector<double> &scale,
+                 const std::vector<NNLayer> &layers)
+    : mon_ids_(mon_ids),
+      nats_(nats),
+      r_inner_(r_inner),
+      r_outer_(r_outer),
+      pair_class_(pair_class),
+      eta_(eta),
+      rs_(rs),
+      mean_(mean),
+      scale_(scale),
+      layers_(layers) {
+    Setup();
+}
+
+void NNModel::Setup() {
+    if (mon_ids_.size() < 2 || mon_ids_.size() > 3 || nats_.size() != mon_ids_.size()) {
+        std::string text = "A neural network model needs the ids and number of atoms of 2 or 3 monomers";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    natoms_ = 0;
+    first_atom_.clear();
+    for (size_t k = 0; k < nats_.size(); k++) {
+        if (nats_[k] == 0) {
+            std::string text = "Monomer " + mon_ids_[k] + " of the neural network model has no atoms";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        first_atom_.push_back(natoms_);
+        natoms_ += nats_[k];
+    }
+
+    if (r_inner_ < 0.0 || r_outer_ <= r_inner_) {
+        std::string text = "The radii of the switching function of the neural network model (" +
+                           std::to_string(r_inner_) + ", " + std::to_string(r_outer_) + ") are not valid";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    if (pair_class_.size() != natoms_ * (natoms_ - 1) / 2) {
+        std::string text = "The neural network model has " + std::to_string(pair_class_.size()) +
+                           " pair classes, but the cluster has " + std::to_string(natoms_ * (natoms_ - 1) / 2) +
+                           " pairs of atoms";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    int max_class = *std::max_element(pair_class_.begin(), pair_class_.end());
+    if (max_class < 0 || *std::min_element(pair_class_.begin(), pair_class_.end()) < -1) {
+        std::string text = "The pair classes of the neural network model must be -1 (not used) or 0 or larger, "
+                           "and at least one pair must be used";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    nclass_ = max_class + 1;
+
+    pairs_.clear();
+    size_t p = 0;
+    for (size_t a = 0; a < natoms_; a++) {
+        for (size_t b = a + 1; b < natoms_; b++, p++) {
+            if (pair_class_[p] < 0) continue;
+            pairs_.push_back(a);
+            pairs_.push_back(b);
+            pairs_.push_back(pair_class_[p]);
+        }
+    }
+
+    size_t nin = nclass_ * eta_.size();
+    if (eta_.empty() || rs_.size() != eta_.size() || mean_.size() != nin || scale_.size() != nin) {
+        std::string text = "The neural network model needs the same number of exponents and centers of the basis "
+                           "functions (" + std::to_string(eta_.size()) + " and " + std::to_string(rs_.size()) +
+                           "), and a mean and a scale for each of the " + std::to_string(nin) + " descriptors";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    if (layers_.empty() || layers_.back().nout != 1) {
+        std::string text = "The last layer of the neural network model must have a single output";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    act_offset_.assign(1, 0);
+    max_width_ = nin;
+    for (size_t l = 0; l < layers_.size(); l++) {
+        const NNLayer &layer = layers_[l];
+        if (layer.nin != nin || layer.w.size() != layer.nin * layer.nout || layer.b.size() != layer.nout ||
+            layer.nout == 0) {
+            std::string text = "Layer " + std::to_string(l) + " of the neural network model does not match " +
+                               std::to_string(nin) + " inputs, or its weights or biases have the wrong size";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        if (layer.activation != NNActivation::kLinear && layer.activation != NNActivation::kTanh) {
+            std::string text = "Layer " + std::to_string(l) + " of the neural network model has an unknown activation";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        act_offset_.push_back(act_offset_.back() + nin);
+        nin = layer.nout;
+        max_width_ = std::max(max_width_, nin);
+    }
+    act_offset_.push_back(act_offset_.back() + nin);
+
+    // Coordinates and gradients, distances, switching functions with their
+    // derivatives and distances, activations and two buffers for the backpropagation
+    size_t npm = nats_.size() == 2 ? 1 : 3;
+    scratch_size_ = kBlock * (6 * natoms_ + 2 + 2 * npm + act_offset_.back() + 2 * max_width_);
+}
+
+void NNModel::Write(const std::string &file) const {
+    std::ofstream out(file.c_str(), std::ios::binary);
+    out.write(kFileMagic, sizeof(kFileMagic) - 1);
+    WriteValue(out, kFileVersion);
+    WriteValue(out, static_cast<uint32_t>(mon_ids_.size()));
+    for (size_t k = 0; k < mon_ids_.size(); k++) {
+        WriteValue(out, static_cast<uint32_t>(mon_ids_[k].size()));
+        out.write(mon_ids_[k].data(), mon_ids_[k].size());
+        WriteValue(out, static_cast<uint32_t>(nats_[k]));
+    }
+    WriteValue(out, r_inner_);
+    WriteValue(out, r_outer_);
+    for (size_t p = 0; p < pair_class_.size(); p++) WriteValue(out, static_cast<int32_t>(pair_class_[p]));
+    WriteValue(out, static_cast<uint32_t>(eta_.size()));
+    WriteValues(out, eta_);
+    WriteValues(out, rs_);
+    WriteValues(out, mean_);
+    WriteValues(out, scale_);
+    WriteValue(out, static_cast<uint32_t>(layers_.size()));
+    for (size_t l = 0; l < layers_.size(); l++) {
+        WriteValue(out, static_cast<uint32_t>(layers_[l].nout));
+        WriteValue(out, static_cast<uint32_t>(layers_[l].activation));
+        WriteValues(out, layers_[l].w);
+        WriteValues(out, layers_[l].b);
+    }
+
+    if (!out) {
+        std::string text = "Could not write the neural network file " + file;
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+}
+
+template <bool kGrad>
+MBX_ALWAYS_INLINE double NNModel::EvalBatch(size_t n, const double *const xyz[], double *const grad[],
+                                            std::vector<double> *virial, double *scratch) const {
+    const size_t nmon = nats_.size();
+    const size_t npm = nmon == 2 ? 1 : 3;
+    const size_t nbasis = eta_.size();
+    const size_t nlayers = layers_.size();
+
+    double *x = scratch;
+    double *gx = x + 3 * natoms_ * kBlock;
+    double *r = gx + 3 * natoms_ * kBlock;
+    double *sw = r + kBlock;
+    double *dsw = sw + kBlock;
+    double *rm = dsw + npm * kBlock;
+    double *act = rm + npm * kBlock;
+    double *delta = act + act_offset_.back() * kBlock;
+
+    double energy = 0.0;
+    size_t idx[kBlock];
+    size_t next = 0;
+    while (next < n) {
+        // Next block of clusters with a non zero switching function
+        size_t nc = 0;
+        for (; next < n && nc < kBlock; next++) {
+            double rr[3], s[3], g[3];
+            for (size_t p = 0; p < npm; p++) {
+                const size_t m1 = kMonPairs[p][0];
+                const size_t m2 = kMonPairs[p][1];
+                const double *x1 = xyz[m1] + 3 * nats_[m1] * next;
+                const double *x2 = xyz[m2] + 3 * nats_[m2] * next;
+                const double dx = x1[0] - x2[0];
+                const double dy = x1[1] - x2[1];
+                const double dz = x1[2] - x2[2];
+                rr[p] = std::sqrt(dx * dx + dy * dy + dz * dz);
+                s[p] = Switch(rr[p], r_inner_, r_outer_, g[p]);
+            }
+            double s_tot = s[0];
+            if (npm == 1) {
+                dsw[nc] = g[0];
+            } else {
+                s_tot = s[0] * s[1] + s[0] * s[2] + s[1] * s[2];
+                dsw[nc] = g[0] * (s[1] + s[2]);
+                dsw[kBlock + nc] = g[1] * (s[0] + s[2]);
+                dsw[2 * kBlock + nc] = g[2] * (s[0] + s[1]);
+            }
+            if (s_tot == 0.0) continue;
+            for (size_t p = 0; p < npm; p++) rm[p * kBlock + nc] = rr[p];
+            sw[nc] = s_tot;
+            idx[nc] = next;
+            nc++;
+        }
+        if (nc == 0) break;
+
+        // The rest of the block repeats the first cluster with a zero switch
+        for (size_t c = nc; c < kBlock; c++) {
+            idx[c] = idx[0];
+            sw[c] = 0.0;
+            for (size_t p = 0; p < npm; p++) {
+                dsw[p * kBlock + c] = 0.0;
+                rm[p * kBlock + c] = rm[p * kBlock];
+            }
+        }
+
+        // Transpose the coordinates: x of atom 0 of all the clusters, then y, z, atom 1...
+        for (size_t k = 0; k < nmon; k++) {
+            const size_t stride = 3 * nats_[k];
+            for (size_t j = 0; j < stride; j++) {
+                double *xj = x + (3 * first_atom_[k] + j) * kBlock;
+                for (size_t c = 0; c < kBlock; c++) xj[c] = xyz[k][stride * idx[c] + j];
+            }
+        }
+
+        // Descriptors, shifted and scaled
+        double *desc = act;
+        std::fill(desc, desc + act_offset_[1] * kBlock, 0.0);
+        for (size_t p = 0; p < pairs_.size(); p += 3) {
+            BlockDistances(x, pairs_[p], pairs_[p + 1], r);
+            double *dp = desc + pairs_[p + 2] * nbasis * kBlock;
+            for (size_t b = 0; b < nbasis; b++) {
+                const double eta = eta_[b];
+                const double rs = rs_[b];
+                for (size_t c = 0; c < kBlock; c++) {
+                    const double t = r[c] - rs;
+                    dp[b * kBlock + c] += std::exp(-eta * t * t);
+                }
+            }
+        }
+        for (size_t f = 0; f < act_offset_[1]; f++) {
+            const double mean = mean_[f];
+            const double scale = scale_[f];
+            for (size_t c = 0; c < kBlock; c++) desc[f * kBlock + c] = (desc[f * kBlock + c] - mean) * scale;
+        }
+
+        // Dense layers
+        for (size_t l = 0; l < nlayers; l++) {
+            const NNLayer &layer = layers_[l];
+            double *out = act + act_offset_[l + 1] * kBlock;
+            BlockGemm(layer.w.data(), layer.nin, 1, layer.b.data(), layer.nin, layer.nout,
+                      act + act_offset_[l] * kBlock, out);
+            if (layer.activation == NNActivation::kTanh) {
+                for (size_t i = 0; i < layer.nout * kBlock; i++) out[i] = std::tanh(out[i]);
+            }
+        }
+        const double *e = act + act_offset_[nlayers] * kBlock;
+        for (size_t c = 0; c < nc; c++) energy += sw[c] * e[c];
+
+        if (!kGrad) continue;
+
+        // Backpropagation of sw * e to the descriptors
+        double *dcur = delta;
+        double *dnext = delta + max_width_ * kBlock;
+        std::copy(sw, sw + kBlock, dcur);
+        for (size_t l = nlayers; l-- > 0;) {
+            const NNLayer &layer = layers_[l];
+            if (layer.activation == NNActivation::kTanh) {
+                const double *out = act + act_offset_[l + 1] * kBlock;
+                for (size_t i = 0; i < layer.nout * kBlock; i++) dcur[i] *= 1.0 - out[i] * out[i];
+            }
+            BlockGemm(layer.w.data(), 1, layer.nin, 0, layer.nout, layer.nin, dcur, dnext);
+            std::swap(dcur, dnext);
+        }
+
+        // Gradients of the atoms from the descriptors
+        std::fill(gx, gx + 3 * natoms_ * kBlock, 0.0);
+        for (size_t p = 0; p < pairs_.size(); p += 3) {
+            const size_t a = pairs_[p];
+            const size_t b = pairs_[p + 1];
+            const size_t f0 = pairs_[p + 2] * nbasis;
+            BlockDistances(x, a, b, r);
+            double dedr[kBlock];
+            std::fill(dedr, dedr + kBlock, 0.0);
+            for (size_t k = 0; k < nbasis; k++) {
+                const double eta = eta_[k];
+                const double rs = rs_[k];
+                const double scale = scale_[f0 + k];
+                const double *dk = dcur + (f0 + k) * kBlock;
+                for (size_t c = 0; c < kBlock; c++) {
+                    const double t = r[c] - rs;
+                    dedr[c] -= 2.0 * eta * t * scale * dk[c] * std::exp(-eta * t * t);
+                }
+            }
+            for (size_t c = 0; c < kBlock; c++) dedr[c] /= r[c];
+            BlockPairGradient(x, a, b, dedr, gx);
+        }
+
+        // Gradients of the first atoms from the switching functions
+        for (size_t p = 0; p < npm; p++) {
+            double f[kBlock];
+            for (size_t c = 0; c < kBlock; c++) f[c] = e[c] * dsw[p * kBlock + c] / rm[p * kBlock + c];
+            BlockPairGradient(x, first_atom_[kMonPairs[p][0]], first_atom_[kMonPairs[p][1]], f, gx);
+        }
+
+        // Add the gradients to the clusters, and their virial
+        for (size_t k = 0; k < nmon; k++) {
+            const size_t stride = 3 * nats_[k];
+            for (size_t j = 0; j < stride; j++) {
+                const double *gj = gx + (3 * first_atom_[k] + j) * kBlock;
+                for (size_t c = 0; c < nc; c++) grad[k][stride * idx[c] + j] += gj[c];
+            }
+        }
+        if (virial != 0) {
+            for (size_t a = 0; a < natoms_; a++) {
+                for (size_t i = 0; i < 3; i++) {
+                    const double *xi = x + (3 * a + i) * kBlock;
+                    for (size_t j = 0; j < 3; j++) {
+                        const double *gj = gx + (3 * a + j) * kBlock;
+                        double v = 0.0;
+                        for (size_t c = 0; c < nc; c++) v += xi[c] * gj[c];
+                        (*virial)[3 * i + j] -= v;
+                    }
+                }
+            }
+        }
+    }
+
+    return energy;
+}
+
+double NNModel::Eval(size_t n, const double *const xyz[], double *const grad[], std::vector<double> *virial,
+                     std::vector<double> &scratch) const {
+    if (scratch.size() < scratch_size_) scratch.resize(scratch_size_);
+    double *buffer = scratch.data();
+    if (grad != 0) {
+        return tools::RunDispatched(
+            [&]() MBX_INLINE_LAMBDA { return EvalBatch<true>(n, xyz, grad, virial, buffer); });
+    }
+    return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return EvalBatch<false>(n, xyz, grad, virial, buffer); });
+}
+
+}  // namespace nn
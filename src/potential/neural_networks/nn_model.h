@@ -0,0 +1,231 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef NN_MODEL_H
+#define NN_MODEL_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @file nn_model.h
+ * @brief Neural network model of the 2b or 3b energy of a type of cluster
+ */
+
+/**
+ * @namespace nn
+ * @brief Neural network many-body terms
+ */
+namespace nn {
+
+/**
+ * Activation function applied to the outputs of a layer
+ */
+enum class NNActivation : int { kLinear = 0, kTanh = 1 };
+
+/**
+ * @struct NNLayer
+ * @brief Dense layer out = activation(w * in + b)
+ */
+struct NNLayer {
+    /// Number of inputs
+    size_t nin;
+    /// Number of outputs
+    size_t nout;
+    /// Activation of the outputs
+    NNActivation activation;
+    /// Weights, nout rows of nin elements
+    std::vector<double> w;
+    /// Biases, nout elements
+    std::vector<double> b;
+};
+
+/**
+ * @class NNModel
+ * @brief Energy of a dimer or trimer type as a feed forward network
+ *
+ * The input of the network is a set of radial descriptors of the cluster.
+ * The pairs of atoms of the cluster are split in classes (e.g. intermolecular
+ * O-O, O-H and H-H of a water dimer), and for each class c and basis
+ * function k the descriptor is
+ *     D[c,k] = sum_{pairs ab in c} exp(-eta_k (r_ab - rs_k)^2)
+ * which does not change when equivalent atoms or monomers are swapped, as
+ * long as the classes are chosen accordingly. The descriptors are shifted
+ * and scaled, (D - mean) * scale, and passed through the dense layers. The
+ * last layer has a single output, the energy of the cluster (kcal/mol),
+ * which is multiplied by the same switching functions as the polynomials
+ * of the first atoms of the monomers: s(r12) for dimers and
+ * s(r12) s(r13) + s(r12) s(r23) + s(r13) s(r23) for trimers, with
+ * s(r) = (1 + cos(pi (r - r_inner) / (r_outer - r_inner))) / 2.
+ *
+ * Clusters are evaluated in batches, with the layout of e2b::get_2b_energy
+ * and e3b::get_3b_energy: the coordinates of monomer k of all the clusters
+ * one after the other. Blocks of clusters are transposed so that each
+ * descriptor, activation and gradient is contiguous across the block, and
+ * the layers are applied as matrix-matrix products over the whole block.
+ *
+ * The binary file (little endian) contains, in order:
+ * - the 4 characters "MBNN" and the version (uint32, 1)
+ * - the number of monomers n (uint32, 2 or 3)
+ * - for each monomer, the length of its id (uint32), the id and its number of atoms (uint32)
+ * - r_inner and r_outer (double, Angstrom)
+ * - the class of each pair of atoms a < b of the cluster (int32, -1 if the pair is not used),
+ *   with the atoms numbered in monomer order
+ * - the number of basis functions (uint32), their eta and then their rs (double)
+ * - the mean and the scale of each descriptor (double), in the order D[c,k] = D[c * nbasis + k]
+ * - the number of layers (uint32) and, for each layer, its number of outputs (uint32),
+ *   its activation (uint32, see NNActivation), its weights and its biases (double)
+ */
+class NNModel {
+   public:
+    /**
+     * Reads a model from a binary file.
+     * @param[in] file Path of the file. Throws CUException if it cannot be read or is not valid
+     */
+    NNModel(const std::string &file);
+
+    /**
+     * Creates a model from its parameters (see the class description).
+     * Throws CUException if they are not consistent.
+     * @param[in] mon_ids Ids of the monomers of the cluster
+     * @param[in] nats Number of atoms of each monomer
+     * @param[in] r_inner Inner radius of the switching function
+     * @param[in] r_outer Outer radius of the switching function
+     * @param[in] pair_class Class of each pair of atoms of the cluster, -1 if the pair is not used
+     * @param[in] eta Exponents of the basis functions
+     * @param[in] rs Centers of the basis functions
+     * @param[in] mean Mean of each descriptor
+     * @param[in] scale Scale of each descriptor
+     * @param[in] layers Dense layers, the last one with a single output
+     */
+    NNModel(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats, double r_inner, double r_outer,
+            const std::vector<int> &pair_class, const std::vector<double> &eta, const std::vector<double> &rs,
+            const std::vector<double> &mean, const std::vector<double> &scale, const std::vector<NNLayer> &layers);
+
+    /**
+     * Writes the model to a binary file that the file constructor can read.
+     * @param[in] file Path of the file
+     */
+    void Write(const std::string &file) const;
+
+    /**
+     * Gets the ids of the monomers of the cluster, in the order of the model
+     * @return Monomer ids
+     */
+    const std::vector<std::string> &GetMonomerIds() const { return mon_ids_; }
+
+    /**
+     * Gets the number of atoms of each monomer
+     * @return Number of atoms of each monomer
+     */
+    const std::vector<size_t> &GetNumAtoms() const { return nats_; }
+
+    /**
+     * Gets the outer radius of the switching function. Clusters with the
+     * first atoms of the monomers further apart have zero energy.
+     * @return Outer radius in Angstrom
+     */
+    double GetCutoff() const { return r_outer_; }
+
+    /**
+     * Gets the size of the scratch buffer that Eval needs
+     * @return Number of doubles
+     */
+    size_t GetScratchSize() const { return scratch_size_; }
+
+    /**
+     * Gets the energy of a batch of clusters, and adds its gradients.
+     * @param[in] n Number of clusters
+     * @param[in] xyz Coordinates of each monomer, in the order of GetMonomerIds(). xyz[k] has
+     * 3 * nats[k] coordinates per cluster
+     * @param[in,out] grad Gradients of each monomer, same layout as xyz. The gradients are added.
+     * If it is null, only the energy is computed
+     * @param[in,out] virial If not null, the virial of the clusters is added to its 9 elements
+     * @param[in,out] scratch Scratch buffer. Resized if it is too small
+     * @return Sum of the energies of the clusters
+     */
+    double Eval(size_t n, const double *const xyz[], double *const grad[], std::vector<double> *virial,
+                std::vector<double> &scratch) const;
+
+   private:
+    /**
+     * Checks the parameters and sets the pair list and the size of the scratch buffer.
+     */
+    void Setup();
+
+    /**
+     * Evaluates a batch. Defined in the translation unit, where it is inlined
+     * in one variant per instruction set.
+     */
+    template <bool kGrad>
+    double EvalBatch(size_t n, const double *const xyz[], double *const grad[], std::vector<double> *virial,
+                     double *scratch) const;
+
+    /// Monomer ids
+    std::vector<std::string> mon_ids_;
+    /// Number of atoms of each monomer
+    std::vector<size_t> nats_;
+    /// Index of the first atom of each monomer in the cluster
+    std::vector<size_t> first_atom_;
+    /// Total number of atoms of the cluster
+    size_t natoms_;
+    /// Radii of the switching function
+    double r_inner_;
+    double r_outer_;
+    /// Class of each pair of atoms a < b, -1 if not used
+    std::vector<int> pair_class_;
+    /// Number of pair classes
+    size_t nclass_;
+    /// Atoms and class of the pairs that are used, three per pair
+    std::vector<size_t> pairs_;
+    /// Basis functions
+    std::vector<double> eta_;
+    std::vector<double> rs_;
+    /// Normalization of the descriptors
+    std::vector<double> mean_;
+    std::vector<double> scale_;
+    /// Dense layers
+    std::vector<NNLayer> layers_;
+    /// Offset of the activations of each layer in the scratch buffer, the last one being the total
+    std::vector<size_t> act_offset_;
+    /// Largest width of the network
+    size_t max_width_;
+    /// Number of doubles needed in the scratch buffer
+    size_t scratch_size_;
+};
+
+}  // namespace nn
+
+#endif
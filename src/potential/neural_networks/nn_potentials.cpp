@@ -0,0 +1,135 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "potential/neural_networks/nn_potentials.h"
+#include "tools/custom_exceptions.h"
+
+#include <algorithm>
+
+/**
+ * @file nn_potentials.cpp
+ * @brief Implementation of the set of neural network models
+ */
+
+namespace nn {
+
+const size_t NNClusterModel::kNone;
+
+void NNPotentials::SetModels(const std::vector<std::string> &files) {
+    NNPotentials potentials;
+    for (size_t i = 0; i < files.size(); i++) potentials.AddModel(NNModel(files[i]), files[i]);
+    models_.swap(potentials.models_);
+    files_.swap(potentials.files_);
+}
+
+void NNPotentials::AddModel(const NNModel &model, const std::string &file) {
+    if (Index(model.GetMonomerIds()) != models_.size()) {
+        std::string ids;
+        for (size_t k = 0; k < model.GetMonomerIds().size(); k++) ids += " " + model.GetMonomerIds()[k];
+        std::string text = "There is already a neural network model for the cluster" + ids;
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+    models_.push_back(model);
+    files_.push_back(file);
+}
+
+size_t NNPotentials::Index(const std::vector<std::string> &mon_ids) const {
+    for (size_t i = 0; i < models_.size(); i++) {
+        const std::vector<std::string> &ids = models_[i].GetMonomerIds();
+        if (ids.size() == mon_ids.size() && std::is_permutation(ids.begin(), ids.end(), mon_ids.begin())) return i;
+    }
+    return models_.size();
+}
+
+const NNModel *NNPotentials::Find(const std::vector<std::string> &mon_ids) const {
+    size_t i = Index(mon_ids);
+    return i < models_.size() ? &models_[i] : 0;
+}
+
+const NNModel *NNPotentials::Find(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats) const {
+    const NNModel *model = Find(mon_ids);
+    if (model == 0) return 0;
+
+    // Monomers with the same id have the same number of atoms
+    const std::vector<std::string> &ids = model->GetMonomerIds();
+    for (size_t j = 0; j < mon_ids.size(); j++) {
+        size_t k = std::find(ids.begin(), ids.end(), mon_ids[j]) - ids.begin();
+        if (model->GetNumAtoms()[k] != nats[j]) {
+            std::string text = "The neural network model for the monomer " + mon_ids[j] + " takes " +
+                               std::to_string(model->GetNumAtoms()[k]) + " atoms, but the monomer has " +
+                               std::to_string(nats[j]);
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+    }
+    return model;
+}
+
+double NNPotentials::GetCutoff(const std::vector<std::string> &mon_ids) const {
+    const NNModel *model = Find(mon_ids);
+    return model ? model->GetCutoff() : 0.0;
+}
+
+NNClusterModel NNPotentials::GetClusterModel(const std::vector<std::string> &mon_ids,
+                                             const std::vector<size_t> &nats) const {
+    NNClusterModel cluster_model = {NNClusterModel::kNone, {0, 0, 0}};
+    if (Find(mon_ids, nats) == 0) return cluster_model;
+    cluster_model.index = Index(mon_ids);
+
+    // Each monomer of the batch goes to the first free monomer of the model with its id
+    const std::vector<std::string> &ids = models_[cluster_model.index].GetMonomerIds();
+    for (size_t k = 0; k < ids.size(); k++) {
+        size_t j = 0;
+        while (std::find(cluster_model.order, cluster_model.order + k, j) != cluster_model.order + k ||
+               mon_ids[j] != ids[k]) {
+            j++;
+        }
+        cluster_model.order[k] = j;
+    }
+    return cluster_model;
+}
+
+double NNPotentials::Eval(const NNClusterModel &cluster_model, size_t n, const double *const xyz[],
+                          double *const grad[], std::vector<double> *virial, std::vector<double> &scratch) const {
+    const NNModel &model = models_[cluster_model.index];
+    const size_t nmon = model.GetMonomerIds().size();
+    const double *model_xyz[3];
+    double *model_grad[3];
+    for (size_t k = 0; k < nmon; k++) {
+        model_xyz[k] = xyz[cluster_model.order[k]];
+        model_grad[k] = grad != 0 ? grad[cluster_model.order[k]] : 0;
+    }
+    return model.Eval(n, model_xyz, grad != 0 ? model_grad : 0, virial, scratch);
+}
+
+}  // namespace nn
@@ -0,0 +1,178 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef NN_POTENTIALS_H
+#define NN_POTENTIALS_H
+
+#include <string>
+#include <vector>
+
+#include "potential/neural_networks/nn_model.h"
+
+/**
+ * @file nn_potentials.h
+ * @brief Set of neural network models used for the 2b and 3b energies
+ */
+
+namespace nn {
+
+/**
+ * @struct NNClusterModel
+ * @brief Model of a cluster type, with the monomers of the batches of the
+ * system mapped to the monomers of the model
+ *
+ * The model is referred to by its index, not by a pointer, so copies of the
+ * NNPotentials and of the objects that hold these stay valid.
+ */
+struct NNClusterModel {
+    /// Index of cluster types without model
+    static const size_t kNone = static_cast<size_t>(-1);
+    /// Index of the model in its NNPotentials, or kNone
+    size_t index;
+    /// Monomer k of the model is monomer order[k] of the batch
+    size_t order[3];
+};
+
+/**
+ * @class NNPotentials
+ * @brief Neural network models registered for the dimers and trimers of a system
+ *
+ * The 2b and 3b terms of the system look up each type of dimer and trimer
+ * here before calling the polynomials. A cluster type with a model uses it
+ * instead of its polynomial, in the same batches.
+ */
+class NNPotentials {
+   public:
+    /**
+     * Replaces the models by the ones in the files given. Throws CUException
+     * if a file cannot be read, or if two models are for the same cluster
+     * type. The models are not changed in that case.
+     * @param[in] files Paths of the model files (see NNModel)
+     */
+    void SetModels(const std::vector<std::string> &files);
+
+    /**
+     * Adds a model. Throws CUException if there is already a model for
+     * the same cluster type.
+     * @param[in] model Model
+     * @param[in] file Path of the file of the model, as returned by GetFiles()
+     */
+    void AddModel(const NNModel &model, const std::string &file = "");
+
+    /**
+     * Gets the files of the models
+     * @return Paths of the files of the models
+     */
+    const std::vector<std::string> &GetFiles() const { return files_; }
+
+    /**
+     * Gets if there are no models
+     * @return True if there are no models
+     */
+    bool Empty() const { return models_.empty(); }
+
+    /**
+     * Gets the model of a cluster type
+     * @param[in] mon_ids Ids of the monomers of the cluster, in any order
+     * @return Model of the cluster type, or 0 if there is none
+     */
+    const NNModel *Find(const std::vector<std::string> &mon_ids) const;
+
+    /**
+     * Gets the model of a cluster type, and checks that it takes monomers
+     * with the given numbers of atoms. Throws CUException if it does not.
+     * @param[in] mon_ids Ids of the monomers of the cluster, in any order
+     * @param[in] nats Number of atoms of each monomer, in the order of mon_ids
+     * @return Model of the cluster type, or 0 if there is none
+     */
+    const NNModel *Find(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats) const;
+
+    /**
+     * Gets the outer radius of the model of a cluster type
+     * @param[in] mon_ids Ids of the monomers of the cluster, in any order
+     * @return Outer radius of the model, or 0 if there is no model
+     */
+    double GetCutoff(const std::vector<std::string> &mon_ids) const;
+
+    /**
+     * Gets the model of a cluster type for batches with the monomers in the
+     * order given, which does not need to be the one of the model. Done once
+     * per cluster type, so the batches do not look the model up. Throws
+     * CUException if the numbers of atoms do not match (see Find).
+     * @param[in] mon_ids Ids of the monomers of the batches
+     * @param[in] nats Number of atoms of each monomer, in the order of mon_ids
+     * @return Model of the cluster type. Its index is NNClusterModel::kNone if there is none.
+     */
+    NNClusterModel GetClusterModel(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats) const;
+
+    /**
+     * Gets the model of a cluster type
+     * @param[in] cluster_model Cluster type with a model, from GetClusterModel
+     * @return Model
+     */
+    const NNModel &GetModel(const NNClusterModel &cluster_model) const { return models_[cluster_model.index]; }
+
+    /**
+     * Gets the energy of a batch of clusters with the model of their type,
+     * and adds its gradients. Takes the arguments in the order of the
+     * monomers of the batch.
+     * @param[in] cluster_model Cluster type with a model, from GetClusterModel
+     * @param[in] n Number of clusters
+     * @param[in] xyz Coordinates of each monomer of the clusters
+     * @param[in,out] grad Gradients of each monomer, or null to compute only the energy
+     * @param[in,out] virial If not null, the virial is added to it
+     * @param[in,out] scratch Scratch buffer, of GetModel(cluster_model).GetScratchSize()
+     * doubles to avoid resizing it
+     * @return Sum of the energies of the clusters
+     */
+    double Eval(const NNClusterModel &cluster_model, size_t n, const double *const xyz[], double *const grad[],
+                std::vector<double> *virial, std::vector<double> &scratch) const;
+
+   private:
+    /**
+     * Gets the index of the model of a cluster type
+     * @param[in] mon_ids Ids of the monomers of the cluster, in any order
+     * @return Index of the model in models_, or models_.size() if there is none
+     */
+    size_t Index(const std::vector<std::string> &mon_ids) const;
+
+    /// Models
+    std::vector<NNModel> models_;
+    /// Files of the models
+    std::vector<std::string> files_;
+};
+
+}  // namespace nn
+
+#endif
@@ -0,0 +1,581 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+/**
+ * @file mbx-bench.cpp
+ * @brief Benchmark driver for MBX
+ *
+ * Runs four suites on generated workloads:
+ * - terms: timing of each term of the energy (1b, 2b, 3b, dispersion,
+ *   buckingham, electrostatics) and of the total energy, with and
+ *   without gradients.
+ * - kernels: microbenchmarks of the 1b/2b/3b water polynomials,
+ *   gammq, the dipole field used in the induced dipole iterations
+ *   (matrix-free and with stored dipole tensors),
+ *   the reciprocal space PME and the cluster search.
+ * - scaling: total energy, electrostatics and dispersion with gradients
+ *   for a list of thread counts. In periodic workloads the last two
+ *   include the reciprocal space PME, which runs on the same threads.
+ * - locality: total energy, 2b and dispersion with gradients on shuffled
+ *   workloads, with the monomers in input order and sorted in space
+ *   (reorder_frequency). Run it under e.g.
+ *   `perf stat -e cache-misses,LLC-load-misses` once per order
+ *   (--workloads and --sizes narrow it down) to see the miss counts.
+ *
+ * Results are written as json (default) or csv, one record per
+ * measurement, so they can be compared between builds. The instruction
+ * set used by the hot kernels (see tools/cpu_dispatch.h) is printed at
+ * start and stored in the json output; --cpu-path forces a lower one.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "json/json.h"
+#include "bblock/system.h"
+#include "bblock/sys_tools.h"
+#include "potential/1b/energy1b.h"
+#include "potential/2b/energy2b.h"
+#include "potential/3b/energy3b.h"
+#include "potential/electrostatics/electrostatics.h"
+#include "potential/electrostatics/gammq.h"
+#include "tools/cpu_dispatch.h"
+#include "tools/custom_exceptions.h"
+
+#include "workloads.h"
+
+namespace {
+
+struct Options {
+    std::vector<std::string> suites = {"terms", "kernels", "scaling", "locality"};
+    std::vector<std::string> families = {"water", "ions", "mixture", "cluster"};
+    std::vector<size_t> sizes = {256, 512};
+    std::vector<size_t> threads;
+    size_t reps = 3;
+    uint64_t seed = 2019;
+    std::string format = "json";
+    std::string output;
+    std::string config;
+    std::string cpu_path;
+};
+
+struct Result {
+    std::string suite;
+    std::string workload;
+    size_t nmon;
+    std::string name;
+    size_t threads;
+    size_t reps;
+    double min_ms;
+    double mean_ms;
+    double stddev_ms;
+    // Energy (or any other checksum) of the last repetition
+    double value;
+};
+
+size_t MaxThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void SetThreads(size_t n) {
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+}
+
+// Times reps calls of f after a warm-up call
+template <typename F>
+Result Time(const std::string &suite, const std::string &workload, size_t nmon, const std::string &name,
+            size_t reps, F f) {
+    Result r;
+    r.suite = suite;
+    r.workload = workload;
+    r.nmon = nmon;
+    r.name = name;
+    r.threads = MaxThreads();
+    r.reps = reps;
+    r.value = f();
+
+    std::vector<double> t(reps);
+    for (size_t i = 0; i < reps; i++) {
+        auto t1 = std::chrono::steady_clock::now();
+        r.value = f();
+        auto t2 = std::chrono::steady_clock::now();
+        t[i] = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    r.min_ms = t[0];
+    double sum = 0.0;
+    for (size_t i = 0; i < reps; i++) {
+        r.min_ms = std::min(r.min_ms, t[i]);
+        sum += t[i];
+    }
+    r.mean_ms = sum / reps;
+    double var = 0.0;
+    for (size_t i = 0; i < reps; i++) var += (t[i] - r.mean_ms) * (t[i] - r.mean_ms);
+    r.stddev_ms = reps > 1 ? std::sqrt(var / (reps - 1)) : 0.0;
+
+    std::cerr << std::setw(8) << suite << std::setw(16) << workload << std::setw(24) << name << std::setw(4)
+              << r.threads << std::setw(14) << std::fixed << std::setprecision(3) << r.min_ms << " ms\n";
+    return r;
+}
+
+nlohmann::json Config(const bench::Workload &w, const Options &opt) {
+    nlohmann::json j = bench::DefaultConfig(w);
+    if (opt.config.size()) {
+        std::ifstream ifs(opt.config);
+        if (!ifs) {
+            std::string text = "Could not open the json file " + opt.config;
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        nlohmann::json user;
+        ifs >> user;
+        // The box is part of the workload, everything else can be overwritten
+        for (auto it = user["MBX"].begin(); it != user["MBX"].end(); ++it) {
+            if (it.key() != "box") j["MBX"][it.key()] = it.value();
+        }
+    }
+    return j;
+}
+
+void RunTerms(const Options &opt, std::vector<Result> &results) {
+    for (size_t f = 0; f < opt.families.size(); f++) {
+        for (size_t s = 0; s < opt.sizes.size(); s++) {
+            bench::Workload w = bench::MakeWorkload(opt.families[f], opt.sizes[s], opt.seed);
+            bblock::System sys;
+            bench::BuildSystem(w, Config(w, opt), sys);
+            const size_t n = opt.sizes[s];
+
+            for (int g = 0; g < 2; g++) {
+                const bool grads = g;
+                const std::string sfx = grads ? "_grad" : "_nograd";
+                results.push_back(Time("terms", w.name, n, "1b" + sfx, opt.reps,
+                                       [&]() { return sys.OneBodyEnergy(grads); }));
+                results.push_back(Time("terms", w.name, n, "2b" + sfx, opt.reps,
+                                       [&]() { return sys.TwoBodyEnergy(grads); }));
+                results.push_back(Time("terms", w.name, n, "3b" + sfx, opt.reps,
+                                       [&]() { return sys.ThreeBodyEnergy(grads); }));
+                results.push_back(Time("terms", w.name, n, "dispersion" + sfx, opt.reps,
+                                       [&]() { return sys.Dispersion(grads); }));
+                results.push_back(Time("terms", w.name, n, "buckingham" + sfx, opt.reps,
+                                       [&]() { return sys.Buckingham(grads); }));
+                results.push_back(Time("terms", w.name, n, "electrostatics" + sfx, opt.reps,
+                                       [&]() { return sys.Electrostatics(grads); }));
+                results.push_back(Time("terms", w.name, n, "energy" + sfx, opt.reps,
+                                       [&]() { return sys.Energy(grads); }));
+            }
+        }
+    }
+}
+
+void RunKernels(const Options &opt, std::vector<Result> &results) {
+    // All kernels are run on water boxes, so the site order of the system
+    // is the same as the input order
+    for (size_t s = 0; s < opt.sizes.size(); s++) {
+        const size_t n = opt.sizes[s];
+        bench::Workload w = bench::WaterBox(n, opt.seed);
+        nlohmann::json config = Config(w, opt);
+        bblock::System sys;
+        bench::BuildSystem(w, config, sys);
+
+        const std::vector<double> box = sys.GetBox();
+        const bool use_pbc = box.size();
+        const double cutoff2b = sys.Get2bCutoff();
+        const double cutoff3b = sys.Get3bCutoff();
+        const std::vector<double> xyz = sys.GetXyz();
+        const std::vector<double> real_xyz = sys.GetRealXyz();
+        std::vector<size_t> first_index(n);
+        for (size_t i = 0; i < n; i++) first_index[i] = 4 * i;
+
+        // Cluster search
+        std::vector<size_t> dimers, trimers;
+        results.push_back(Time("kernels", w.name, n, "cluster_search_2b", opt.reps, [&]() {
+            dimers.clear();
+            trimers.clear();
+            systools::AddClusters(2, cutoff2b, 0, n, n, use_pbc, box, xyz, first_index, dimers, trimers);
+            return static_cast<double>(dimers.size() / 2);
+        }));
+        std::vector<size_t> dimers_2b = dimers;
+        results.push_back(Time("kernels", w.name, n, "cluster_search_3b", opt.reps, [&]() {
+            dimers.clear();
+            trimers.clear();
+            systools::AddClusters(3, cutoff3b, 0, n, n, use_pbc, box, xyz, first_index, dimers, trimers);
+            return static_cast<double>(trimers.size() / 3);
+        }));
+        std::vector<size_t> trimers_3b = trimers;
+
+        // Polynomials. One batch of (at most) max_n_eval clusters,
+        // as they are called inside the system.
+        const size_t nmon_1b = std::min<size_t>(n, config["MBX"]["max_n_eval_1b"].get<size_t>());
+        std::vector<double> xyz_1b(real_xyz.begin(), real_xyz.begin() + 9 * nmon_1b);
+        std::vector<double> grad_1b(xyz_1b.size());
+        results.push_back(Time("kernels", w.name, nmon_1b, "poly_1b_h2o_grad", opt.reps, [&]() {
+            bool good = true;
+            return e1b::get_1b_energy("h2o", nmon_1b, xyz_1b, grad_1b, good);
+        }));
+
+        const size_t nd = std::min<size_t>(dimers_2b.size() / 2, config["MBX"]["max_n_eval_2b"].get<size_t>());
+        std::vector<double> xyz1(9 * nd), xyz2(9 * nd), grad1(9 * nd), grad2(9 * nd);
+        for (size_t d = 0; d < nd; d++) {
+            std::copy(real_xyz.begin() + 9 * dimers_2b[2 * d], real_xyz.begin() + 9 * dimers_2b[2 * d] + 9,
+                      xyz1.begin() + 9 * d);
+            std::copy(real_xyz.begin() + 9 * dimers_2b[2 * d + 1], real_xyz.begin() + 9 * dimers_2b[2 * d + 1] + 9,
+                      xyz2.begin() + 9 * d);
+        }
+        if (use_pbc && nd) systools::GetCloseDimerImage(box, 3, 3, nd, xyz1.data(), xyz2.data());
+        results.push_back(Time("kernels", w.name, nd, "poly_2b_h2o_nograd", opt.reps,
+                               [&]() { return e2b::get_2b_energy("h2o", "h2o", nd, xyz1, xyz2); }));
+        results.push_back(Time("kernels", w.name, nd, "poly_2b_h2o_grad", opt.reps,
+                               [&]() { return e2b::get_2b_energy("h2o", "h2o", nd, xyz1, xyz2, grad1, grad2); }));
+
+        const size_t nt = std::min<size_t>(trimers_3b.size() / 3, config["MBX"]["max_n_eval_3b"].get<size_t>());
+        std::vector<double> txyz1(9 * nt), txyz2(9 * nt), txyz3(9 * nt), tgrad1(9 * nt), tgrad2(9 * nt),
+            tgrad3(9 * nt);
+        for (size_t t = 0; t < nt; t++) {
+            std::copy(real_xyz.begin() + 9 * trimers_3b[3 * t], real_xyz.begin() + 9 * trimers_3b[3 * t] + 9,
+                      txyz1.begin() + 9 * t);
+            std::copy(real_xyz.begin() + 9 * trimers_3b[3 * t + 1], real_xyz.begin() + 9 * trimers_3b[3 * t + 1] + 9,
+                      txyz2.begin() + 9 * t);
+            std::copy(real_xyz.begin() + 9 * trimers_3b[3 * t + 2], real_xyz.begin() + 9 * trimers_3b[3 * t + 2] + 9,
+                      txyz3.begin() + 9 * t);
+        }
+        if (use_pbc && nt) systools::GetCloseTrimerImage(box, 3, 3, 3, nt, txyz1.data(), txyz2.data(), txyz3.data());
+        results.push_back(Time("kernels", w.name, nt, "poly_3b_h2o_nograd", opt.reps,
+                               [&]() { return e3b::get_3b_energy("h2o", "h2o", "h2o", nt, txyz1, txyz2, txyz3); }));
+        results.push_back(Time("kernels", w.name, nt, "poly_3b_h2o_grad", opt.reps, [&]() {
+            return e3b::get_3b_energy("h2o", "h2o", "h2o", nt, txyz1, txyz2, txyz3, tgrad1, tgrad2, tgrad3);
+        }));
+
+        // Incomplete gamma function, as used in the Thole damping
+        const size_t ngammq = 100000;
+        results.push_back(Time("kernels", w.name, ngammq, "gammq", opt.reps, [&]() {
+            double sum = 0.0;
+            for (size_t i = 0; i < ngammq; i++) sum += elec::gammq(0.75, 10.0 * i / ngammq);
+            return sum;
+        }));
+
+        // Dipole field (one matrix-vector product of the induced dipole
+        // iterations), on a standalone electrostatics object that shares
+        // the setup of the system
+        const size_t nsites = 4 * n;
+        std::vector<size_t> sites(n, 4);
+        std::vector<std::string> mon_id(n, "h2o");
+        std::vector<std::pair<std::string, size_t> > mon_type_count(1, std::make_pair(std::string("h2o"), n));
+        std::vector<double> chg = sys.GetCharges();
+        std::vector<double> chg_grad(27 * n, 0.0);
+        std::vector<double> pol = sys.GetPolarizabilities();
+        std::vector<double> polfac = sys.GetPolarizabilityFactors();
+        double alpha, grid_density;
+        size_t spline_order;
+        sys.GetEwaldParamsElectrostatics(alpha, grid_density, spline_order);
+
+        elec::Electrostatics elec;
+        elec.Initialize(chg, chg_grad, polfac, pol, xyz, mon_id, sites, first_index, mon_type_count, false,
+                        sys.GetDipoleTolerance(), sys.GetMaxIterationsDipoles(), sys.GetDipoleMethod(), box);
+        elec.SetCutoff(cutoff2b);
+        elec.SetEwaldAlpha(alpha);
+        elec.SetEwaldGridDensity(grid_density);
+        elec.SetEwaldSplineOrder(spline_order);
+
+        bench::Rng rng(opt.seed);
+        std::vector<double> mu(3 * nsites), efd(3 * nsites);
+        for (size_t i = 0; i < mu.size(); i++) mu[i] = 0.1 * (rng.Uniform() - 0.5);
+        results.push_back(Time("kernels", w.name, n, "dipole_field", opt.reps, [&]() {
+            elec.ComputeDipoleField(mu, efd);
+            double sum = 0.0;
+            for (size_t i = 0; i < efd.size(); i++) sum += efd[i];
+            return sum;
+        }));
+
+        // Same product with the stored dipole tensors, and the cost of
+        // building them (done once per step, in the first product)
+        results.push_back(Time("kernels", w.name, n, "dipole_tensor_build", opt.reps, [&]() {
+            elec.SetDipoleTensor(4096.0);
+            elec.ComputeDipoleField(mu, efd);
+            return static_cast<double>(elec.GetDipoleTensorSize());
+        }));
+        results.push_back(Time("kernels", w.name, n, "dipole_field_tensor", opt.reps, [&]() {
+            elec.ComputeDipoleField(mu, efd);
+            double sum = 0.0;
+            for (size_t i = 0; i < efd.size(); i++) sum += efd[i];
+            return sum;
+        }));
+
+        // Reciprocal space PME of the permanent charges
+        if (use_pbc) {
+            std::vector<double> pme_xyz(xyz);
+            std::vector<double> pme_result(4 * nsites);
+            const double a = box[0];
+            const double b = box[4];
+            const double c = box[8];
+            results.push_back(Time("kernels", w.name, n, "pme_charges", opt.reps, [&]() {
+                helpme::PMEInstance<double> pme_solver;
+                int grid_a = grid_density * a;
+                int grid_b = grid_density * b;
+                int grid_c = grid_density * c;
+                pme_solver.setup(1, alpha, spline_order, grid_a, grid_b, grid_c, 1, MaxThreads());
+                pme_solver.setLatticeVectors(a, b, c, 90, 90, 90, PMEInstanceD::LatticeType::XAligned);
+                auto coords = helpme::Matrix<double>(pme_xyz.data(), nsites, 3);
+                auto charges = helpme::Matrix<double>(chg.data(), nsites, 1);
+                auto result = helpme::Matrix<double>(pme_result.data(), nsites, 4);
+                std::fill(pme_result.begin(), pme_result.end(), 0.0);
+                pme_solver.computePRec(0, charges, coords, coords, 1, result);
+                double sum = 0.0;
+                for (size_t i = 0; i < nsites; i++) sum += chg[i] * pme_result[4 * i];
+                return sum;
+            }));
+        }
+    }
+}
+
+void RunScaling(const Options &opt, std::vector<Result> &results) {
+    std::vector<size_t> threads = opt.threads;
+    if (threads.empty()) {
+        for (size_t t = 1; t < MaxThreads(); t *= 2) threads.push_back(t);
+        threads.push_back(MaxThreads());
+    }
+
+#ifndef _OPENMP
+    std::cerr << "**WARNING** mbx-bench was compiled without OpenMP. Scaling will only use 1 thread.\n";
+    threads = {1};
+#endif
+
+    const size_t max_threads = MaxThreads();
+    for (size_t f = 0; f < opt.families.size(); f++) {
+        for (size_t s = 0; s < opt.sizes.size(); s++) {
+            bench::Workload w = bench::MakeWorkload(opt.families[f], opt.sizes[s], opt.seed);
+            bblock::System sys;
+            bench::BuildSystem(w, Config(w, opt), sys);
+            for (size_t t = 0; t < threads.size(); t++) {
+                SetThreads(threads[t]);
+                results.push_back(Time("scaling", w.name, opt.sizes[s], "energy_grad", opt.reps,
+                                       [&]() { return sys.Energy(true); }));
+                results.push_back(Time("scaling", w.name, opt.sizes[s], "electrostatics_grad", opt.reps,
+                                       [&]() { return sys.Electrostatics(true); }));
+                results.push_back(Time("scaling", w.name, opt.sizes[s], "dispersion_grad", opt.reps,
+                                       [&]() { return sys.Dispersion(true); }));
+            }
+            SetThreads(max_threads);
+        }
+    }
+}
+
+void RunLocality(const Options &opt, std::vector<Result> &results) {
+    for (size_t f = 0; f < opt.families.size(); f++) {
+        for (size_t s = 0; s < opt.sizes.size(); s++) {
+            bench::Workload w = bench::Shuffle(bench::MakeWorkload(opt.families[f], opt.sizes[s], opt.seed), opt.seed);
+            const size_t n = opt.sizes[s];
+            for (int sorted = 0; sorted < 2; sorted++) {
+                // Sorted once at setup. The timed calls are far from the
+                // next reordering.
+                nlohmann::json config = Config(w, opt);
+                config["MBX"]["reorder_frequency"] = sorted ? 1000000 : 0;
+                bblock::System sys;
+                bench::BuildSystem(w, config, sys);
+
+                const std::string sfx = sorted ? "_sorted" : "_input_order";
+                results.push_back(Time("locality", w.name, n, "2b_grad" + sfx, opt.reps,
+                                       [&]() { return sys.TwoBodyEnergy(true); }));
+                results.push_back(Time("locality", w.name, n, "dispersion_grad" + sfx, opt.reps,
+                                       [&]() { return sys.Dispersion(true); }));
+                results.push_back(Time("locality", w.name, n, "energy_grad" + sfx, opt.reps,
+                                       [&]() { return sys.Energy(true); }));
+            }
+        }
+    }
+}
+
+template <typename T>
+std::vector<T> ParseList(const std::string &s) {
+    std::vector<T> v;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::stringstream is(item);
+        T x;
+        if (!(is >> x)) {
+            std::string text = "Could not parse \"" + item + "\" in the list \"" + s + "\"";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        v.push_back(x);
+    }
+    return v;
+}
+
+void Usage(const char *name) {
+    std::cerr << "Usage: " << name << " [options]\n"
+              << "  --suites LIST     terms,kernels,scaling,locality (default: all)\n"
+              << "  --workloads LIST  water,ions,mixture,cluster (default: all)\n"
+              << "  --sizes LIST      number of monomers, e.g. 256,4096,32768 (default: 256,512)\n"
+              << "  --threads LIST    thread counts for the scaling suite (default: powers of 2)\n"
+              << "  --reps N          timed repetitions after one warm-up call (default: 3)\n"
+              << "  --seed N          seed of the workload generator (default: 2019)\n"
+              << "  --format FMT      json or csv (default: json)\n"
+              << "  --output FILE     write results to FILE instead of stdout\n"
+              << "  --config FILE     mbx.json whose MBX options overwrite the defaults\n"
+              << "  --cpu-path PATH   generic, sse4.2, avx2 or avx512 (default: detected, or MBX_CPU_PATH)\n";
+}
+
+void Write(const Options &opt, const std::vector<Result> &results, std::ostream &os) {
+    if (opt.format == "csv") {
+        os << "suite,workload,nmon,name,threads,reps,min_ms,mean_ms,stddev_ms,value\n";
+        os << std::setprecision(10);
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            os << r.suite << "," << r.workload << "," << r.nmon << "," << r.name << "," << r.threads << ","
+               << r.reps << "," << r.min_ms << "," << r.mean_ms << "," << r.stddev_ms << "," << r.value << "\n";
+        }
+        return;
+    }
+
+    nlohmann::json j;
+    j["seed"] = opt.seed;
+    j["max_threads"] = MaxThreads();
+#ifdef _OPENMP
+    j["openmp"] = true;
+#else
+    j["openmp"] = false;
+#endif
+    j["cpu_path"] = tools::CpuPathName(tools::GetCpuPath());
+    j["cpu_path_detected"] = tools::CpuPathName(tools::DetectCpuPath());
+    j["results"] = nlohmann::json::array();
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        nlohmann::json jr;
+        jr["suite"] = r.suite;
+        jr["workload"] = r.workload;
+        jr["nmon"] = r.nmon;
+        jr["name"] = r.name;
+        jr["threads"] = r.threads;
+        jr["reps"] = r.reps;
+        jr["min_ms"] = r.min_ms;
+        jr["mean_ms"] = r.mean_ms;
+        jr["stddev_ms"] = r.stddev_ms;
+        jr["value"] = r.value;
+        j["results"].push_back(jr);
+    }
+    os << std::setw(2) << j << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help") {
+                Usage(argv[0]);
+                return 0;
+            }
+            if (i + 1 >= argc) {
+                Usage(argv[0]);
+                return 1;
+            }
+            std::string val = argv[++i];
+            if (arg == "--suites") {
+                opt.suites = ParseList<std::string>(val);
+            } else if (arg == "--workloads") {
+                opt.families = ParseList<std::string>(val);
+            } else if (arg == "--sizes") {
+                opt.sizes = ParseList<size_t>(val);
+            } else if (arg == "--threads") {
+                opt.threads = ParseList<size_t>(val);
+            } else if (arg == "--reps") {
+                opt.reps = std::max<size_t>(1, std::stoul(val));
+            } else if (arg == "--seed") {
+                opt.seed = std::stoull(val);
+            } else if (arg == "--format") {
+                opt.format = val;
+            } else if (arg == "--output") {
+                opt.output = val;
+            } else if (arg == "--config") {
+                opt.config = val;
+            } else if (arg == "--cpu-path") {
+                opt.cpu_path = val;
+            } else {
+                Usage(argv[0]);
+                return 1;
+            }
+        }
+
+        if (opt.cpu_path.size()) tools::SetCpuPath(tools::CpuPathFromName(opt.cpu_path));
+        std::cerr << "cpu path: " << tools::CpuPathName(tools::GetCpuPath())
+                  << " (detected: " << tools::CpuPathName(tools::DetectCpuPath()) << ")\n";
+
+        std::vector<Result> results;
+        for (size_t i = 0; i < opt.suites.size(); i++) {
+            if (opt.suites[i] == "terms") {
+                RunTerms(opt, results);
+            } else if (opt.suites[i] == "kernels") {
+                RunKernels(opt, results);
+            } else if (opt.suites[i] == "scaling") {
+                RunScaling(opt, results);
+            } else if (opt.suites[i] == "locality") {
+                RunLocality(opt, results);
+            } else {
+                std::string text = "Unknown suite " + opt.suites[i] + ". Use terms, kernels, scaling or locality.";
+                throw CUException(__func__, __FILE__, __LINE__, text);
+            }
+        }
+
+        if (opt.output.size()) {
+            std::ofstream ofs(opt.output);
+            Write(opt, results, ofs);
+        } else {
+            Write(opt, results, std::cout);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << " ** Error ** : " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
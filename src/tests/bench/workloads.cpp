@@ -0,0 +1,331 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "workloads.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+#include "tools/custom_exceptions.h"
+
+/**
+ * @file workloads.cpp
+ * @brief Implementation of the benchmark workload generators
+ */
+
+namespace bench {
+
+namespace {
+
+// Volume per molecule of liquid water at 1 g/cm^3 (A^3)
+const double kWaterVolume = 29.9;
+// Lattice spacing used for the mixtures (A). Large enough for co2.
+const double kMixtureSpacing = 4.0;
+
+// Geometry of a single monomer, with the first atom at the origin
+void MonomerTemplate(const std::string &id, std::vector<double> &xyz, std::vector<std::string> &atoms) {
+    if (id == "h2o") {
+        // r(OH) = 0.9572 A, HOH = 104.52 deg
+        xyz = {0.0, 0.0, 0.0, 0.756950, 0.585882, 0.0, -0.756950, 0.585882, 0.0};
+        atoms = {"O", "H", "H"};
+    } else if (id == "co2") {
+        // r(CO) = 1.16 A, linear
+        xyz = {0.0, 0.0, 0.0, 0.0, 0.0, 1.16, 0.0, 0.0, -1.16};
+        atoms = {"C", "O", "O"};
+    } else if (id == "ch4") {
+        // r(CH) = 1.09 A, tetrahedral
+        const double a = 1.09 / std::sqrt(3.0);
+        xyz = {0.0, 0.0, 0.0, a, a, a, a, -a, -a, -a, a, -a, -a, -a, a};
+        atoms = {"C", "H", "H", "H", "H"};
+    } else if (id == "nh3") {
+        // r(NH) = 1.012 A, HNH = 106.7 deg
+        const double rho = 0.937527;
+        const double h = 0.381018;
+        const double c = std::cos(2.0 * M_PI / 3.0);
+        const double s = std::sin(2.0 * M_PI / 3.0);
+        xyz = {0.0, 0.0, 0.0, rho, 0.0, -h, rho * c, rho * s, -h, rho * c, -rho * s, -h};
+        atoms = {"N", "H", "H", "H"};
+    } else if (id == "li" || id == "na" || id == "k" || id == "rb" || id == "cs" || id == "f" || id == "cl" ||
+               id == "br" || id == "i" || id == "ar") {
+        xyz = {0.0, 0.0, 0.0};
+        std::string name = id;
+        name[0] = std::toupper(name[0]);
+        atoms = {name};
+    } else {
+        std::string text = "No benchmark template for monomer id " + id;
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+}
+
+// Appends a randomly rotated copy of monomer id centered at (cx, cy, cz)
+void AddMonomer(const std::string &id, double cx, double cy, double cz, Rng &rng, Workload &w) {
+    std::vector<double> xyz;
+    std::vector<std::string> atoms;
+    MonomerTemplate(id, xyz, atoms);
+
+    // Uniform random rotation from a random unit quaternion
+    const double u1 = rng.Uniform();
+    const double u2 = 2.0 * M_PI * rng.Uniform();
+    const double u3 = 2.0 * M_PI * rng.Uniform();
+    const double qx = std::sqrt(1.0 - u1) * std::sin(u2);
+    const double qy = std::sqrt(1.0 - u1) * std::cos(u2);
+    const double qz = std::sqrt(u1) * std::sin(u3);
+    const double qw = std::sqrt(u1) * std::cos(u3);
+
+    const double r[9] = {1.0 - 2.0 * (qy * qy + qz * qz), 2.0 * (qx * qy - qz * qw), 2.0 * (qx * qz + qy * qw),
+                         2.0 * (qx * qy + qz * qw), 1.0 - 2.0 * (qx * qx + qz * qz), 2.0 * (qy * qz - qx * qw),
+                         2.0 * (qx * qz - qy * qw), 2.0 * (qy * qz + qx * qw), 1.0 - 2.0 * (qx * qx + qy * qy)};
+
+    const size_t nat = atoms.size();
+    for (size_t i = 0; i < nat; i++) {
+        const double *p = xyz.data() + 3 * i;
+        w.xyz.push_back(cx + r[0] * p[0] + r[1] * p[1] + r[2] * p[2]);
+        w.xyz.push_back(cy + r[3] * p[0] + r[4] * p[1] + r[5] * p[2]);
+        w.xyz.push_back(cz + r[6] * p[0] + r[7] * p[1] + r[8] * p[2]);
+        w.atoms.push_back(atoms[i]);
+    }
+    w.mon_ids.push_back(id);
+    w.nat.push_back(nat);
+}
+
+// Returns the centers of nmon randomly chosen sites of a simple cubic
+// lattice with the given spacing, and sets the cubic box that contains it
+std::vector<double> LatticeSites(size_t nmon, double spacing, Rng &rng, std::vector<double> &box) {
+    size_t ncell = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(nmon)) - 1E-9));
+    if (ncell == 0) ncell = 1;
+    const size_t nsites = ncell * ncell * ncell;
+
+    std::vector<size_t> order(nsites);
+    for (size_t i = 0; i < nsites; i++) order[i] = i;
+    for (size_t i = nsites - 1; i > 0; i--) std::swap(order[i], order[rng.Index(i + 1)]);
+    std::sort(order.begin(), order.begin() + nmon);
+
+    std::vector<double> centers;
+    centers.reserve(3 * nmon);
+    for (size_t n = 0; n < nmon; n++) {
+        const size_t i = order[n];
+        centers.push_back((i % ncell + 0.5) * spacing);
+        centers.push_back(((i / ncell) % ncell + 0.5) * spacing);
+        centers.push_back((i / (ncell * ncell) + 0.5) * spacing);
+    }
+
+    const double l = ncell * spacing;
+    box = {l, 0.0, 0.0, 0.0, l, 0.0, 0.0, 0.0, l};
+    return centers;
+}
+
+std::string Suffix(size_t nmon) { return "-" + std::to_string(nmon); }
+
+}  // namespace
+
+Rng::Rng(uint64_t seed) : engine_(seed) {}
+
+double Rng::Uniform() { return (engine_() >> 11) * (1.0 / 9007199254740992.0); }
+
+size_t Rng::Index(size_t n) { return static_cast<size_t>(engine_() % n); }
+
+Workload WaterBox(size_t nmon, uint64_t seed) {
+    Rng rng(seed);
+    Workload w;
+    w.name = "water" + Suffix(nmon);
+    std::vector<double> c = LatticeSites(nmon, std::cbrt(kWaterVolume), rng, w.box);
+    for (size_t i = 0; i < nmon; i++) AddMonomer("h2o", c[3 * i], c[3 * i + 1], c[3 * i + 2], rng, w);
+    return w;
+}
+
+Workload IonSolution(size_t nmon, size_t npairs, const std::string &cation, const std::string &anion,
+                     uint64_t seed) {
+    if (2 * npairs > nmon) {
+        std::string text = "Too many ion pairs (" + std::to_string(npairs) + ") for " + std::to_string(nmon) +
+                           " monomers";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    Rng rng(seed);
+    Workload w;
+    w.name = cation + anion + Suffix(nmon);
+    std::vector<double> c = LatticeSites(nmon, std::cbrt(kWaterVolume), rng, w.box);
+
+    // The lattice sites are already in random order, so the ions can take
+    // evenly spaced positions in that list
+    std::vector<std::string> ids(nmon, "h2o");
+    const size_t stride = nmon / (2 * npairs + 1);
+    for (size_t p = 0; p < 2 * npairs; p++) ids[(p + 1) * stride] = (p % 2 == 0) ? cation : anion;
+
+    for (size_t i = 0; i < nmon; i++) AddMonomer(ids[i], c[3 * i], c[3 * i + 1], c[3 * i + 2], rng, w);
+    return w;
+}
+
+Workload Mixture(size_t nmon, const std::vector<double> &fractions, uint64_t seed) {
+    const std::vector<std::string> species = {"h2o", "co2", "ch4", "nh3"};
+    if (fractions.size() != species.size()) {
+        std::string text = "Mixture needs " + std::to_string(species.size()) + " molar fractions";
+        throw CUException(__func__, __FILE__, __LINE__, text);
+    }
+
+    // Number of monomers of each species. Water takes the remainder.
+    std::vector<std::string> ids;
+    ids.reserve(nmon);
+    for (size_t s = 1; s < species.size(); s++) {
+        size_t n = static_cast<size_t>(std::floor(fractions[s] * nmon + 0.5));
+        for (size_t i = 0; i < n && ids.size() < nmon; i++) ids.push_back(species[s]);
+    }
+    while (ids.size() < nmon) ids.push_back("h2o");
+
+    Rng rng(seed);
+    for (size_t i = nmon - 1; i > 0; i--) std::swap(ids[i], ids[rng.Index(i + 1)]);
+
+    Workload w;
+    w.name = "mixture" + Suffix(nmon);
+    std::vector<double> c = LatticeSites(nmon, kMixtureSpacing, rng, w.box);
+    for (size_t i = 0; i < nmon; i++) AddMonomer(ids[i], c[3 * i], c[3 * i + 1], c[3 * i + 2], rng, w);
+    return w;
+}
+
+Workload WaterCluster(size_t nmon, uint64_t seed) {
+    Rng rng(seed);
+    Workload w;
+    w.name = "cluster" + Suffix(nmon);
+
+    // Take the lattice points closest to the center of a cube that is
+    // large enough to contain the sphere
+    const double spacing = std::cbrt(kWaterVolume);
+    const long ncell = static_cast<long>(std::ceil(std::cbrt(2.0 * nmon))) + 2;
+    const double center = 0.5 * (ncell - 1);
+    std::vector<std::pair<double, size_t> > sites;
+    for (long i = 0; i < ncell * ncell * ncell; i++) {
+        const double dx = i % ncell - center;
+        const double dy = (i / ncell) % ncell - center;
+        const double dz = i / (ncell * ncell) - center;
+        sites.push_back(std::make_pair(dx * dx + dy * dy + dz * dz, static_cast<size_t>(i)));
+    }
+    std::sort(sites.begin(), sites.end());
+
+    for (size_t n = 0; n < nmon; n++) {
+        const long i = sites[n].second;
+        AddMonomer("h2o", (i % ncell - center) * spacing, ((i / ncell) % ncell - center) * spacing,
+                   (i / (ncell * ncell) - center) * spacing, rng, w);
+    }
+    return w;
+}
+
+Workload Shuffle(const Workload &w, uint64_t seed) {
+    Rng rng(seed);
+    const size_t nmon = w.mon_ids.size();
+    std::vector<size_t> order(nmon);
+    for (size_t i = 0; i < nmon; i++) order[i] = i;
+    // Fisher-Yates with our own generator, so the result is portable
+    for (size_t i = nmon; i > 1; i--) std::swap(order[i - 1], order[rng.Index(i)]);
+
+    std::vector<size_t> first(nmon, 0);
+    for (size_t i = 1; i < nmon; i++) first[i] = first[i - 1] + w.nat[i - 1];
+
+    Workload s;
+    s.name = w.name + "-shuffled";
+    s.box = w.box;
+    for (size_t k = 0; k < nmon; k++) {
+        size_t i = order[k];
+        s.mon_ids.push_back(w.mon_ids[i]);
+        s.nat.push_back(w.nat[i]);
+        s.atoms.insert(s.atoms.end(), w.atoms.begin() + first[i], w.atoms.begin() + first[i] + w.nat[i]);
+        s.xyz.insert(s.xyz.end(), w.xyz.begin() + 3 * first[i], w.xyz.begin() + 3 * (first[i] + w.nat[i]));
+    }
+    return s;
+}
+
+Workload MakeWorkload(const std::string &family, size_t nmon, uint64_t seed) {
+    if (family == "water") {
+        return WaterBox(nmon, seed);
+    } else if (family == "ions") {
+        // Roughly 1 M NaCl
+        return IonSolution(nmon, std::max<size_t>(1, nmon / 55), "na", "cl", seed);
+    } else if (family == "mixture") {
+        return Mixture(nmon, {0.55, 0.15, 0.15, 0.15}, seed);
+    } else if (family == "cluster") {
+        return WaterCluster(nmon, seed);
+    }
+
+    std::string text = "Unknown workload family " + family + ". Use water, ions, mixture or cluster.";
+    throw CUException(__func__, __FILE__, __LINE__, text);
+}
+
+nlohmann::json DefaultConfig(const Workload &w) {
+    const bool pbc = w.box.size();
+    nlohmann::json j;
+    j["MBX"]["box"] = w.box;
+    j["MBX"]["twobody_cutoff"] = pbc ? 9.0 : 100.0;
+    j["MBX"]["threebody_cutoff"] = 6.5;
+    j["MBX"]["max_n_eval_1b"] = 1000;
+    j["MBX"]["max_n_eval_2b"] = 1000;
+    j["MBX"]["max_n_eval_3b"] = 1000;
+    // A tolerance typical of MD runs instead of the default 1E-16
+    j["MBX"]["dipole_tolerance"] = 1E-8;
+    j["MBX"]["dipole_method"] = "cg";
+    j["MBX"]["dipole_tensor_memory"] = 0.0;
+    j["MBX"]["dipole_max_it"] = 100;
+    j["MBX"]["alpha_ewald_disp"] = pbc ? 0.6 : 0.0;
+    j["MBX"]["grid_density_disp"] = 2.5;
+    j["MBX"]["spline_order_disp"] = 6;
+    j["MBX"]["alpha_ewald_elec"] = pbc ? 0.6 : 0.0;
+    j["MBX"]["grid_density_elec"] = 2.5;
+    j["MBX"]["spline_order_elec"] = 6;
+    j["MBX"]["cutoff_elec"] = 0.0;
+    j["MBX"]["ewald_accuracy_elec"] = 0.0;
+    j["MBX"]["elec_treecode_theta"] = 0.0;
+    j["MBX"]["elec_treecode_radius"] = 9.0;
+    j["MBX"]["elec_threads"] = 0;
+    j["MBX"]["compute_virial"] = true;
+    j["MBX"]["ttm_pairs"] = nlohmann::json::array();
+    j["MBX"]["ignore_2b_poly"] = nlohmann::json::array();
+    j["MBX"]["ignore_3b_poly"] = nlohmann::json::array();
+    j["MBX"]["nn_models"] = nlohmann::json::array();
+    j["MBX"]["reorder_frequency"] = 0;
+    return j;
+}
+
+void BuildSystem(const Workload &w, const nlohmann::json &config, bblock::System &sys) {
+    size_t count = 0;
+    for (size_t i = 0; i < w.mon_ids.size(); i++) {
+        std::vector<double> xyz(w.xyz.begin() + 3 * count, w.xyz.begin() + 3 * (count + w.nat[i]));
+        std::vector<std::string> atoms(w.atoms.begin() + count, w.atoms.begin() + count + w.nat[i]);
+        sys.AddMonomer(xyz, atoms, w.mon_ids[i]);
+        count += w.nat[i];
+    }
+
+    sys.Initialize();
+    sys.SetUpFromJson(config);
+}
+
+}  // namespace bench
@@ -0,0 +1,190 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef BENCH_WORKLOADS_H
+#define BENCH_WORKLOADS_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+#include "bblock/system.h"
+
+/**
+ * @file workloads.h
+ * @brief Generators for the reproducible systems used by mbx-bench
+ */
+
+/**
+ * @namespace bench
+ * @brief Benchmark workloads and helpers used by mbx-bench
+ */
+namespace bench {
+
+/**
+ * @brief Portable pseudo random number generator
+ *
+ * Wraps std::mt19937_64, whose output sequence is fixed by the standard,
+ * and converts to doubles by hand. The standard distributions are
+ * implementation defined, so they are avoided to make sure that the same
+ * seed produces the same workload with any compiler.
+ */
+class Rng {
+   public:
+    explicit Rng(uint64_t seed);
+
+    /**
+     * @brief Uniform number in [0,1)
+     */
+    double Uniform();
+
+    /**
+     * @brief Uniform integer in [0,n)
+     */
+    size_t Index(size_t n);
+
+   private:
+    std::mt19937_64 engine_;
+};
+
+/**
+ * @brief Plain description of a benchmark system
+ *
+ * Coordinates are the real atoms of all monomers, one after the other,
+ * in the same layout that System::AddMonomer expects.
+ */
+struct Workload {
+    // Name of the workload, including its size
+    std::string name;
+    // Monomer ids
+    std::vector<std::string> mon_ids;
+    // Atom names of all monomers
+    std::vector<std::string> atoms;
+    // Number of atoms of each monomer
+    std::vector<size_t> nat;
+    // Real coordinates of all atoms
+    std::vector<double> xyz;
+    // Box (empty for gas phase)
+    std::vector<double> box;
+};
+
+/**
+ * @brief Cubic box of water at (or slightly below) liquid density
+ *
+ * Molecules are placed on a simple cubic lattice with random orientations.
+ * @param[in] nmon Number of water molecules
+ * @param[in] seed Seed of the random number generator
+ * @return The workload
+ */
+Workload WaterBox(size_t nmon, uint64_t seed);
+
+/**
+ * @brief Cubic box of water with dissolved ion pairs
+ *
+ * @param[in] nmon Total number of monomers (water + ions)
+ * @param[in] npairs Number of cation/anion pairs
+ * @param[in] cation Monomer id of the cation (e.g. "na")
+ * @param[in] anion Monomer id of the anion (e.g. "cl")
+ * @param[in] seed Seed of the random number generator
+ * @return The workload
+ */
+Workload IonSolution(size_t nmon, size_t npairs, const std::string &cation, const std::string &anion,
+                     uint64_t seed);
+
+/**
+ * @brief Cubic box with a mixture of h2o, co2, ch4 and nh3
+ *
+ * @param[in] nmon Total number of monomers
+ * @param[in] fractions Molar fractions of h2o, co2, ch4 and nh3 (in this order)
+ * @param[in] seed Seed of the random number generator
+ * @return The workload
+ */
+Workload Mixture(size_t nmon, const std::vector<double> &fractions, uint64_t seed);
+
+/**
+ * @brief Gas phase (approximately spherical) water cluster
+ *
+ * @param[in] nmon Number of water molecules
+ * @param[in] seed Seed of the random number generator
+ * @return The workload
+ */
+Workload WaterCluster(size_t nmon, uint64_t seed);
+
+/**
+ * @brief Same workload with the monomers in random order
+ *
+ * The generators place the monomers in lattice order, which is already
+ * close to a spatial order. Real inputs (e.g. from an equilibrated
+ * trajectory) are not.
+ * @param[in] w The workload
+ * @param[in] seed Seed of the random number generator
+ * @return The shuffled workload, named as w with the suffix "-shuffled"
+ */
+Workload Shuffle(const Workload &w, uint64_t seed);
+
+/**
+ * @brief Returns a workload given its family name
+ *
+ * Known families are "water", "ions", "mixture" and "cluster".
+ * @param[in] family Name of the family
+ * @param[in] nmon Number of monomers
+ * @param[in] seed Seed of the random number generator
+ * @return The workload
+ */
+Workload MakeWorkload(const std::string &family, size_t nmon, uint64_t seed);
+
+/**
+ * @brief Default MBX configuration used for a workload
+ *
+ * Gives the same values that SetUpFromJson would use by default, but
+ * with all the keys defined, so the output is not polluted by warnings.
+ * @param[in] w The workload
+ * @return The json object to be passed to System::SetUpFromJson
+ */
+nlohmann::json DefaultConfig(const Workload &w);
+
+/**
+ * @brief Fills a system with the monomers of a workload and initializes it
+ *
+ * @param[in] w The workload
+ * @param[in] config MBX configuration (see DefaultConfig)
+ * @param[out] sys The system. Must be empty.
+ */
+void BuildSystem(const Workload &w, const nlohmann::json &config, bblock::System &sys);
+
+}  // namespace bench
+
+#endif  // BENCH_WORKLOADS_H
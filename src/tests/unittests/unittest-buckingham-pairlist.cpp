@@ -0,0 +1,126 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "potential/buckingham/buckingham.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-10;
+
+TEST_CASE("Test the tabulated Buckingham repulsion and its pair list") {
+    // Two fluorides and eight waters on a grid, in system order (types contiguous)
+    std::vector<double> water = {0.0, 0.0, 0.0, 0.7570, 0.5860, 0.0, -0.7570, 0.5860, 0.0};
+    std::vector<double> xyz = {0.1, 0.2, 0.3, 3.1, 2.9, 3.2};
+    std::vector<std::string> mon_id = {"f", "f"};
+    std::vector<size_t> num_atoms = {1, 1};
+    for (size_t i = 0; i < 8; i++) {
+        double shift[3] = {2.8 * (i % 2) - 1.2, 2.7 * ((i / 2) % 2) + 1.4, 3.0 * (i / 4) - 1.3};
+        for (size_t k = 0; k < 9; k++) xyz.push_back(water[k] + shift[k % 3]);
+        mon_id.push_back("h2o");
+        num_atoms.push_back(3);
+    }
+    std::vector<std::pair<std::string, size_t> > mon_type_count = {{"f", 2}, {"h2o", 8}};
+    std::vector<std::pair<std::string, std::string> > buck_pairs = {{"f", "h2o"}};
+    double cutoff = 9.0;
+
+    buck::Buckingham buck;
+    buck.Initialize(xyz, mon_id, num_atoms, mon_type_count, true, {});
+    buck.SetNewParameters(xyz, buck_pairs, true, cutoff, {});
+    std::vector<double> grad_ref(xyz.size(), 0.0);
+    double energy_ref = buck.GetRepulsion(grad_ref);
+
+    SECTION("Exponential table") {
+        const buck::ExpTable &table = buck::GetExpTable();
+        double max_rel_err = 0.0;
+        for (size_t k = 0; k <= 60000; k++) {
+            double x = 0.001 * k + 1.0E-4 * (k % 7);
+            max_rel_err = std::max(max_rel_err, std::fabs(table.Eval(x) / std::exp(-x) - 1.0));
+        }
+        REQUIRE(max_rel_err < TOL);
+    }
+
+    SECTION("Energy matches the analytic exponential") {
+        double energy = 0.0;
+        for (size_t m1 = 0; m1 < 2; m1++) {
+            for (size_t m2 = 2; m2 < mon_id.size(); m2++) {
+                for (size_t j = 0; j < 3; j++) {
+                    const double *p1 = xyz.data() + 3 * m1;
+                    const double *p2 = xyz.data() + 3 * (2 + 3 * (m2 - 2) + j);
+                    double r = std::sqrt((p1[0] - p2[0]) * (p1[0] - p2[0]) + (p1[1] - p2[1]) * (p1[1] - p2[1]) +
+                                         (p1[2] - p2[2]) * (p1[2] - p2[2]));
+                    double a, b, g;
+                    buck::GetBuckParams("f", "h2o", 0, j, buck_pairs, a, b);
+                    energy += switch_function(r, cutoff - 1.0, cutoff, g) * a * std::exp(-b * r);
+                }
+            }
+        }
+        REQUIRE(energy_ref == Approx(energy).epsilon(TOL));
+    }
+
+    SECTION("Pair list with all pairs gives the same energy and gradients") {
+        std::vector<size_t> pairs;
+        for (size_t m1 = 0; m1 < mon_id.size(); m1++) {
+            for (size_t m2 = m1 + 1; m2 < mon_id.size(); m2++) {
+                pairs.push_back(m2);
+                pairs.push_back(m1);
+            }
+        }
+        buck.SetPairList(pairs);
+        buck.SetNewParameters(xyz, buck_pairs, true, cutoff, {});
+        std::vector<double> grad(xyz.size(), 0.0);
+        double energy = buck.GetRepulsion(grad);
+        REQUIRE(energy == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(grad, grad_ref, TOL));
+    }
+
+    SECTION("Pair list skips the pairs not listed") {
+        // Only the first fluoride with the first water
+        buck.SetPairList({0, 2});
+        buck.SetNewParameters(xyz, buck_pairs, true, cutoff, {});
+        std::vector<double> grad(xyz.size(), 0.0);
+        double energy = buck.GetRepulsion(grad);
+
+        std::vector<double> xyz_pair(xyz.begin(), xyz.begin() + 3);
+        xyz_pair.insert(xyz_pair.end(), xyz.begin() + 6, xyz.begin() + 15);
+        buck::Buckingham buck_pair;
+        buck_pair.Initialize(xyz_pair, {"f", "h2o"}, {1, 3}, {{"f", 1}, {"h2o", 1}}, true, {});
+        buck_pair.SetNewParameters(xyz_pair, buck_pairs, true, cutoff, {});
+        std::vector<double> grad_pair(xyz_pair.size(), 0.0);
+        REQUIRE(energy == Approx(buck_pair.GetRepulsion(grad_pair)).margin(TOL));
+    }
+}
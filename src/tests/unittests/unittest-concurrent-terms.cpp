@@ -0,0 +1,98 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+constexpr double TOL = 1E-8;
+
+TEST_CASE("Electrostatics computed at the same time as the other terms") {
+    SETUP_H2O_5_BR_1
+
+    bblock::System my_system;
+    my_system.AddMonomers(real_coords, atom_names, monomer_names, n_atoms_vector);
+    my_system.Initialize();
+
+    nlohmann::json j;
+    j["MBX"]["box"] = std::vector<double>{20.0, 0.0, 0.0, 0.0, 20.0, 0.0, 0.0, 0.0, 20.0};
+    j["MBX"]["twobody_cutoff"] = 9.0;
+    j["MBX"]["threebody_cutoff"] = 6.5;
+    j["MBX"]["alpha_ewald_elec"] = 0.6;
+    j["MBX"]["alpha_ewald_disp"] = 0.6;
+    j["MBX"]["dipole_method"] = "cg";
+    my_system.SetUpFromJson(j);
+
+    double energy_ref = my_system.Energy(true);
+    std::vector<double> grad_ref = my_system.GetRealGrads();
+    std::vector<double> virial_ref = my_system.GetVirial();
+
+#ifdef _OPENMP
+    // The electrostatics need threads left for the rest
+    int nthreads = omp_get_max_threads();
+    omp_set_num_threads(3);
+#endif
+
+    SECTION("Same results") {
+        for (size_t elec_threads = 1; elec_threads < 3; elec_threads++) {
+            my_system.SetElectrostaticsThreads(elec_threads);
+            REQUIRE(my_system.GetElectrostaticsThreads() == elec_threads);
+            // Twice, so the second call reuses the PME solvers
+            for (size_t n = 0; n < 2; n++) {
+                double energy = my_system.Energy(true);
+                REQUIRE(energy == Approx(energy_ref).margin(TOL));
+                REQUIRE(VectorsAreEqual(my_system.GetRealGrads(), grad_ref, TOL));
+                REQUIRE(VectorsAreEqual(my_system.GetVirial(), virial_ref, TOL));
+            }
+        }
+    }
+
+    SECTION("Not enough threads") {
+        // As many threads as the electrostatics: the terms go one after the other
+        my_system.SetElectrostaticsThreads(3);
+        REQUIRE(my_system.Energy(true) == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(my_system.GetRealGrads(), grad_ref, TOL));
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+#endif
+}
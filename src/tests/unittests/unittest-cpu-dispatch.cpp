@@ -0,0 +1,92 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "tools/cpu_dispatch.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <vector>
+
+constexpr double TOL = 1E-8;
+
+TEST_CASE("Names of the cpu paths") {
+    std::vector<tools::CpuPath> paths = {tools::CpuPath::kGeneric, tools::CpuPath::kSse42, tools::CpuPath::kAvx2,
+                                         tools::CpuPath::kAvx512};
+    for (size_t i = 0; i < paths.size(); i++) {
+        REQUIRE(tools::CpuPathFromName(tools::CpuPathName(paths[i])) == paths[i]);
+    }
+    REQUIRE_THROWS(tools::CpuPathFromName("avx9000"));
+}
+
+TEST_CASE("Paths are limited to the ones supported") {
+    tools::CpuPath active = tools::GetCpuPath();
+    tools::CpuPath detected = tools::DetectCpuPath();
+    REQUIRE(active <= detected);
+
+    REQUIRE(tools::SetCpuPath(tools::CpuPath::kAvx512) == detected);
+    REQUIRE(tools::GetCpuPath() == detected);
+    REQUIRE(tools::SetCpuPath(tools::CpuPath::kGeneric) == tools::CpuPath::kGeneric);
+    REQUIRE(tools::GetCpuPath() == tools::CpuPath::kGeneric);
+
+    tools::SetCpuPath(active);
+}
+
+TEST_CASE("Every path gives the same energy") {
+    SETUP_H2O_5_BR_1
+
+    bblock::System my_system;
+    my_system.AddMonomers(real_coords, atom_names, monomer_names, n_atoms_vector);
+    my_system.Initialize();
+
+    tools::CpuPath active = tools::GetCpuPath();
+
+    // 1b, 2b and 3b polynomials, dispersion and electrostatics
+    tools::SetCpuPath(tools::CpuPath::kGeneric);
+    double energy_ref = my_system.Energy(true);
+    std::vector<double> grad_ref = my_system.GetRealGrads();
+    std::vector<double> virial_ref = my_system.GetVirial();
+
+    int detected = static_cast<int>(tools::DetectCpuPath());
+    for (int path = 1; path <= detected; path++) {
+        REQUIRE(tools::SetCpuPath(static_cast<tools::CpuPath>(path)) == static_cast<tools::CpuPath>(path));
+        double energy = my_system.Energy(true);
+        REQUIRE(energy == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(my_system.GetRealGrads(), grad_ref, TOL));
+        REQUIRE(VectorsAreEqual(my_system.GetVirial(), virial_ref, TOL));
+    }
+
+    tools::SetCpuPath(active);
+}
@@ -0,0 +1,76 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "potential/dispersion/disptools.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-10;
+
+TEST_CASE("Test the tabulated Tang-Toennies damping function") {
+    const disp::TangToenniesTable &table = disp::GetTangToenniesTable();
+
+    SECTION("Damping function and derivative match the analytic form") {
+        double max_err = 0.0;
+        double max_derr = 0.0;
+        for (size_t k = 0; k <= 70000; k++) {
+            double x = 0.001 * k + 1.0E-4 * (k % 7);
+            double tt, dtt;
+            table.Eval(x, tt, dtt);
+            double tt_ref = disp::tang_toennies(6, x);
+            double dtt_ref = disp::if6 * std::pow(x, 6) * std::exp(-x);
+            max_err = std::max(max_err, std::fabs(tt - tt_ref));
+            max_derr = std::max(max_derr, std::fabs(dtt - dtt_ref));
+        }
+        REQUIRE(max_err < TOL);
+        REQUIRE(max_derr < TOL);
+    }
+
+    SECTION("Damped C6 energy of an O-O water pair matches the analytic form") {
+        double c6 = 2.373212214147944e+02;
+        double d6 = 9.295485815062264e+00;
+        for (size_t k = 0; k <= 1000; k++) {
+            double r = 1.0 + 0.008 * k;
+            double tt, dtt;
+            table.Eval(d6 * r, tt, dtt);
+            double e = c6 * tt / std::pow(r, 6);
+            double e_ref = c6 * disp::tang_toennies(6, d6 * r) / std::pow(r, 6);
+            REQUIRE(e == Approx(e_ref).margin(TOL));
+        }
+    }
+}
@@ -0,0 +1,142 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "catch.hpp"
+
+#include "bblock/system.h"
+#include "potential/electrostatics/ewald_error.h"
+#include "tools/constants.h"
+#include "setup_h2o_256_pbc.h"
+
+#include <vector>
+#include <cmath>
+
+TEST_CASE("Test the Ewald error estimates.") {
+    std::vector<double> box = {20.0, 0.0, 0.0, 0.0, 25.0, 0.0, 0.0, 0.0, 30.0};
+    double volume = 20.0 * 25.0 * 30.0;
+    // 500 waters with TIP3P charges
+    size_t nsites = 1500;
+    double q2 = 500 * (0.834 * 0.834 + 2 * 0.417 * 0.417);
+
+    SECTION("Reference force") { REQUIRE(elec::EwaldReferenceForce(q2, nsites) == Approx(q2 / nsites)); }
+
+    SECTION("Real space") {
+        double alpha = elec::EwaldAlphaForError(1E-5, q2, nsites, volume, 9.0);
+        REQUIRE(elec::EwaldRealSpaceError(q2, nsites, volume, alpha, 9.0) == Approx(1E-5));
+        REQUIRE(elec::EwaldRealSpaceError(q2, nsites, volume, alpha * 1.1, 9.0) < 1E-5);
+        REQUIRE(elec::EwaldAlphaForError(1E-5, q2, nsites, volume, 12.0) < alpha);
+    }
+
+    SECTION("Reciprocal space") {
+        double err = elec::PMEReciprocalError(q2, nsites, box, 0.3, 1.0, 5);
+        REQUIRE(elec::PMEReciprocalError(q2, nsites, box, 0.3, 1.5, 5) < err);
+        REQUIRE(elec::PMEReciprocalError(q2, nsites, box, 0.3, 1.0, 6) < err);
+        REQUIRE(elec::PMEReciprocalError(q2, nsites, box, 0.4, 1.0, 5) > err);
+        REQUIRE_THROWS(elec::PMEReciprocalError(q2, nsites, box, 0.3, 1.0, 8));
+    }
+}
+
+TEST_CASE("Test the tuning of the Ewald electrostatics.") {
+    SETUP_H2O_256_PBC
+
+    // A quarter of the waters is enough, and keeps the trials short
+    bblock::System my_sys;
+    for (size_t i = 0; i < n_monomers / 4; i++) {
+        std::vector<double> xyz(coords.begin() + 3 * n_at * i, coords.begin() + 3 * n_at * (i + 1));
+        std::vector<std::string> ats(atom_names.begin() + i * n_at, atom_names.begin() + (i + 1) * n_at);
+        my_sys.AddMonomer(xyz, ats, monomer_names[i]);
+    }
+    my_sys.Initialize();
+
+    // Reference with errors well below the target
+    my_sys.SetPBC(box);
+    my_sys.SetDipoleMethod("cg");
+    my_sys.Set2bCutoff(9.0);
+    my_sys.SetEwaldElectrostatics(0.5, 4.0, 8);
+    my_sys.Electrostatics(true);
+    std::vector<double> ref_grad = my_sys.GetRealGrads();
+    std::vector<double> ref_mu = my_sys.GetInducedDipoles();
+
+    double accuracy = 1E-4;
+    nlohmann::json j;
+    j["MBX"]["box"] = box;
+    j["MBX"]["twobody_cutoff"] = 9.0;
+    j["MBX"]["dipole_method"] = "cg";
+    j["MBX"]["ewald_accuracy_elec"] = accuracy;
+    my_sys.SetUpFromJson(j);
+
+    double alpha, grid_density;
+    size_t spline_order;
+    my_sys.GetEwaldParamsElectrostatics(alpha, grid_density, spline_order);
+    double cutoff = my_sys.GetElectrostaticsCutoff();
+
+    // The tuning is done only once, so there are no sections here
+    REQUIRE(cutoff <= 9.0);
+    REQUIRE(spline_order >= 4);
+    REQUIRE(spline_order <= 7);
+    nlohmann::json j_out = my_sys.GetJsonConfig();
+    double cutoff_json = j_out["MBX"]["cutoff_elec"];
+    double alpha_json = j_out["MBX"]["alpha_ewald_elec"];
+    double grid_density_json = j_out["MBX"]["grid_density_elec"];
+    size_t spline_order_json = j_out["MBX"]["spline_order_elec"];
+    REQUIRE(cutoff_json == cutoff);
+    REQUIRE(alpha_json == alpha);
+    REQUIRE(grid_density_json == grid_density);
+    REQUIRE(spline_order_json == spline_order);
+
+    // The trials do not leave their dipoles
+    REQUIRE(VectorsAreEqual(my_sys.GetInducedDipoles(), ref_mu));
+
+    my_sys.Electrostatics(true);
+    std::vector<double> grad = my_sys.GetRealGrads();
+    double err2 = 0.0;
+    for (size_t i = 0; i < grad.size(); i++) err2 += (grad[i] - ref_grad[i]) * (grad[i] - ref_grad[i]);
+    double rms = std::sqrt(err2 / (grad.size() / 3));
+
+    // The accuracy is relative to the force between two sites with the RMS charge
+    std::vector<double> chg = my_sys.GetCharges();
+    double q2 = 0.0;
+    size_t ncharged = 0;
+    for (size_t i = 0; i < chg.size(); i++) {
+        if (chg[i] == 0) continue;
+        q2 += chg[i] * chg[i];
+        ncharged++;
+    }
+    double ref_force = constants::COULOMB * q2 / ncharged;
+
+    // The estimates are for the charges only, so allow some margin
+    REQUIRE(rms / ref_force < 3 * accuracy);
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <vector>
+
+constexpr double TOL = 1E-5;
+constexpr double GRAD_TOL = 1E-4;
+
+// Builds the system of setup_h2o_5_br_1, in a box if pbc is true, and returns
+// two points close to it
+void SetUpSystem(bblock::System &my_system, bool pbc, std::vector<double> &points) {
+    SETUP_H2O_5_BR_1
+
+    my_system.AddMonomers(real_coords, atom_names, monomer_names, n_atoms_vector);
+    my_system.Initialize();
+
+    nlohmann::json j;
+    if (pbc) {
+        j["MBX"]["box"] = std::vector<double>{20.0, 0.0, 0.0, 0.0, 20.0, 0.0, 0.0, 0.0, 20.0};
+        j["MBX"]["alpha_ewald_elec"] = 0.6;
+        // A coarse grid is enough to compare with finite differences
+        j["MBX"]["grid_density_elec"] = 1.0;
+    }
+    j["MBX"]["twobody_cutoff"] = 9.0;
+    j["MBX"]["dipole_method"] = "cg";
+    j["MBX"]["dipole_tolerance"] = 1E-16;
+    my_system.SetUpFromJson(j);
+
+    double center[3] = {0.0, 0.0, 0.0};
+    size_t nat = real_coords.size() / 3;
+    for (size_t i = 0; i < nat; i++) {
+        for (size_t k = 0; k < 3; k++) center[k] += real_coords[3 * i + k] / nat;
+    }
+    points = {center[0] + 4.5, center[1] + 0.5, center[2] - 1.0, center[0] - 1.0, center[1] - 4.0, center[2] + 3.0};
+}
+
+void CheckExternalCharges(bool pbc) {
+    bblock::System my_system;
+    std::vector<double> points;
+    SetUpSystem(my_system, pbc, points);
+    std::vector<double> phi, field;
+
+    SECTION("The potential needs a previous energy call") {
+        REQUIRE_THROWS(my_system.GetElectrostaticPotentialAndField(points, phi, field));
+        REQUIRE_THROWS(my_system.SetExternalCharges(points, {1.0}));
+    }
+
+    SECTION("Potential is the derivative of the energy with respect to an external charge") {
+        my_system.Electrostatics(false);
+        my_system.GetElectrostaticPotentialAndField(points, phi, field);
+        REQUIRE(phi.size() == 2);
+        REQUIRE(field.size() == 6);
+
+        double dq = 1E-3;
+        for (size_t p = 0; p < 2; p++) {
+            std::vector<double> xyz(points.begin() + 3 * p, points.begin() + 3 * p + 3);
+            my_system.SetExternalCharges(xyz, {dq});
+            double plus_energy = my_system.Electrostatics(false);
+            my_system.SetExternalCharges(xyz, {-dq});
+            double minus_energy = my_system.Electrostatics(false);
+            REQUIRE(phi[p] == Approx((plus_energy - minus_energy) / (2 * dq)).margin(TOL));
+        }
+
+        // Without external charges the potential goes back to the original one
+        my_system.SetExternalCharges({}, {});
+        my_system.Electrostatics(false);
+        std::vector<double> phi2, field2;
+        my_system.GetElectrostaticPotentialAndField(points, phi2, field2);
+        REQUIRE(VectorsAreEqual(phi2, phi, TOL));
+    }
+
+    SECTION("Field is minus the gradient of the potential") {
+        my_system.Electrostatics(false);
+        my_system.GetElectrostaticPotentialAndField(points, phi, field);
+
+        double step = 1E-4;
+        for (size_t k = 0; k < points.size(); k++) {
+            std::vector<double> shifted = points;
+            std::vector<double> phi_plus, phi_minus, unused;
+            shifted[k] += step;
+            my_system.GetElectrostaticPotentialAndField(shifted, phi_plus, unused);
+            shifted[k] -= 2 * step;
+            my_system.GetElectrostaticPotentialAndField(shifted, phi_minus, unused);
+            double fd_field = -(phi_plus[k / 3] - phi_minus[k / 3]) / (2 * step);
+            REQUIRE(field[k] == Approx(fd_field).margin(TOL));
+        }
+    }
+
+    SECTION("Gradients with external charges") {
+        std::vector<double> chg = {0.4, -0.8};
+        my_system.SetExternalCharges(points, chg);
+        my_system.Electrostatics(true);
+        std::vector<double> grad = my_system.GetRealGrads();
+        std::vector<double> real_xyz = my_system.GetRealXyz();
+
+        double step = 1E-4;
+        for (size_t k = 0; k < real_xyz.size(); k++) {
+            real_xyz[k] += step;
+            my_system.SetRealXyz(real_xyz);
+            double plus_energy = my_system.Electrostatics(false);
+            real_xyz[k] -= 2 * step;
+            my_system.SetRealXyz(real_xyz);
+            double minus_energy = my_system.Electrostatics(false);
+            real_xyz[k] += step;
+            my_system.SetRealXyz(real_xyz);
+            REQUIRE(grad[k] == Approx((plus_energy - minus_energy) / (2 * step)).margin(GRAD_TOL));
+        }
+
+        // The gradient on each external charge comes from the field at its position
+        my_system.Electrostatics(false);
+        my_system.GetElectrostaticPotentialAndField(points, phi, field);
+        for (size_t k = 0; k < points.size(); k++) {
+            std::vector<double> shifted = points;
+            shifted[k] += step;
+            my_system.SetExternalCharges(shifted, chg);
+            double plus_energy = my_system.Electrostatics(false);
+            shifted[k] -= 2 * step;
+            my_system.SetExternalCharges(shifted, chg);
+            double minus_energy = my_system.Electrostatics(false);
+            REQUIRE(-chg[k / 3] * field[k] == Approx((plus_energy - minus_energy) / (2 * step)).margin(GRAD_TOL));
+        }
+    }
+}
+
+TEST_CASE("External charges and potential at points without PBC") { CheckExternalCharges(false); }
+
+TEST_CASE("External charges and potential at points with PBC") { CheckExternalCharges(true); }
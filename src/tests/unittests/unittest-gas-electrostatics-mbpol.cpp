@@ -35,12 +35,16 @@ SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
 #include "testutils.h"
 
 #include "electrostatics.h"
+#include "bblock/system.h"
+#include "bblock/sys_tools.h"
 #include "setup_h2o_3.h"
 
 #include <vector>
 #include <iostream>
 #include <iomanip>
 #include <random>
+#include <cmath>
+#include <algorithm>
 
 constexpr double TOL = 1E-6;
 
@@ -77,3 +81,213 @@ TEST_CASE("Test the electrostatics class for mbpol (gas phase).") {
         }
     }
 }
+
+TEST_CASE("Test the stored dipole tensors of the induced dipoles.") {
+    SETUP_H2O_3
+    std::vector<double> ref_forces(3 * n_sites);
+    elec::Electrostatics ref;
+    ref.Initialize(charges, chg_grad, polfac, pol, coords, monomer_names, sites, first_ind, mon_type_count, true,
+                   1E-16, 100, "cg", std::vector<double>{});
+    double ref_energy = ref.GetElectrostatics(ref_forces);
+
+    for (std::string method : {"iter", "cg"}) {
+        SECTION("Same energy and forces with " + method) {
+            elec::Electrostatics elec;
+            elec.Initialize(charges, chg_grad, polfac, pol, coords, monomer_names, sites, first_ind, mon_type_count,
+                            true, 1E-16, 100, method, std::vector<double>{});
+            elec.SetDipoleTensor(1.0);
+            std::vector<double> forces(3 * n_sites);
+            double energy = elec.GetElectrostatics(forces);
+            // 6 pairs in each water and 15 for each pair of waters. The pair of
+            // M-sites is left out since they have no induced dipoles.
+            REQUIRE(elec.GetDipoleTensorSize() == 3 * 6 + 3 * 15);
+            REQUIRE(energy == Approx(ref_energy).margin(TOL));
+            for (size_t i = 0; i < forces.size(); i++) REQUIRE(forces[i] == Approx(ref_forces[i]).margin(TOL));
+        }
+    }
+
+    SECTION("Matrix-free above the memory limit") {
+        elec::Electrostatics elec;
+        elec.Initialize(charges, chg_grad, polfac, pol, coords, monomer_names, sites, first_ind, mon_type_count, true,
+                        1E-16, 100, "cg", std::vector<double>{});
+        elec.SetDipoleTensor(1E-4);
+        std::vector<double> forces(3 * n_sites);
+        double energy = elec.GetElectrostatics(forces);
+        REQUIRE(elec.GetDipoleTensorSize() == 0);
+        REQUIRE(energy == Approx(ref_energy).margin(TOL));
+    }
+
+    SECTION("Ewald real space") {
+        std::vector<double> box{8.0, 0.0, 0.0, 0.0, 8.0, 0.0, 0.0, 0.0, 8.0};
+        std::vector<double> energies;
+        std::vector<std::vector<double>> forces(2, std::vector<double>(3 * n_sites));
+        for (size_t k = 0; k < 2; k++) {
+            elec::Electrostatics elec;
+            elec.Initialize(charges, chg_grad, polfac, pol, coords, monomer_names, sites, first_ind, mon_type_count,
+                            true, 1E-16, 100, "cg", box);
+            elec.SetEwaldAlpha(0.6);
+            elec.SetCutoff(3.5);
+            elec.SetDipoleTensor(k);
+            energies.push_back(elec.GetElectrostatics(forces[k]));
+        }
+        REQUIRE(energies[1] == Approx(energies[0]).margin(TOL));
+        for (size_t i = 0; i < forces[0].size(); i++) REQUIRE(forces[1][i] == Approx(forces[0][i]).margin(TOL));
+    }
+}
+
+TEST_CASE("Test the electrostatics treecode against the direct sum (gas phase).") {
+    // Copies of the MB-pol trimer on a 3x3x3 grid
+    SETUP_H2O_3
+    const size_t ncopies = 27;
+    const double spacing = 8.0;
+    std::vector<double> cl_xyz, cl_chg, cl_chg_grad, cl_pol, cl_polfac;
+    for (size_t c = 0; c < ncopies; c++) {
+        double shift[3] = {spacing * (c % 3), spacing * ((c / 3) % 3), spacing * (c / 9)};
+        for (size_t i = 0; i < coords.size(); i++) cl_xyz.push_back(coords[i] + shift[i % 3]);
+        cl_chg.insert(cl_chg.end(), charges.begin(), charges.end());
+        cl_chg_grad.insert(cl_chg_grad.end(), chg_grad.begin(), chg_grad.end());
+        cl_pol.insert(cl_pol.end(), pol.begin(), pol.end());
+        cl_polfac.insert(cl_polfac.end(), polfac.begin(), polfac.end());
+    }
+    const size_t cl_nmon = ncopies * n_monomers;
+    std::vector<std::string> cl_names(cl_nmon, "h2o");
+    std::vector<size_t> cl_sites(cl_nmon, 4);
+    std::vector<size_t> cl_first_ind(cl_nmon);
+    for (size_t n = 0; n < cl_nmon; n++) cl_first_ind[n] = 4 * n;
+    std::vector<std::pair<std::string, size_t>> cl_type_count{{"h2o", cl_nmon}};
+
+    // Energy and gradients of the cluster, direct or with a treecode
+    // with the given opening angle
+    auto compute = [&](double theta, bool pair_list, double tensor_mb, std::vector<double> &grad,
+                       std::vector<double> &virial) {
+        elec::Electrostatics elec;
+        elec.Initialize(cl_chg, cl_chg_grad, cl_polfac, cl_pol, cl_xyz, cl_names, cl_sites, cl_first_ind,
+                        cl_type_count, true, 1E-16, 100, "iter", std::vector<double>{});
+        elec.SetTreecode(theta);
+        elec.SetDipoleTensor(tensor_mb);
+        if (pair_list) {
+            // The kd-tree only looks at the first site of each monomer, so
+            // the near radius is extended by twice the monomer extent
+            double extent2 = 0.0;
+            for (size_t n = 0; n < cl_nmon; n++) {
+                for (size_t s = 1; s < 4; s++) {
+                    double d2 = 0.0;
+                    for (size_t a = 0; a < 3; a++) {
+                        double d = cl_xyz[3 * (4 * n + s) + a] - cl_xyz[3 * 4 * n + a];
+                        d2 += d * d;
+                    }
+                    extent2 = std::max(extent2, d2);
+                }
+            }
+            std::vector<size_t> pairs, trimers;
+            systools::AddClusters(2, 9.0 + 2.0 * std::sqrt(extent2), 0, cl_nmon, cl_nmon, false,
+                                  std::vector<double>{}, cl_xyz, cl_first_ind, pairs, trimers);
+            REQUIRE(pairs.size() < cl_nmon * (cl_nmon - 1));
+            elec.SetPairList(pairs);
+        }
+        grad.assign(cl_xyz.size(), 0.0);
+        virial.assign(9, 0.0);
+        return elec.GetElectrostatics(grad, &virial);
+    };
+
+    // Largest error of a vector relative to its largest element
+    auto max_rel_err = [](const std::vector<double> &v, const std::vector<double> &ref) {
+        double err = 0.0;
+        double norm = 0.0;
+        for (size_t i = 0; i < ref.size(); i++) {
+            err = std::max(err, std::abs(v[i] - ref[i]));
+            norm = std::max(norm, std::abs(ref[i]));
+        }
+        return err / norm;
+    };
+
+    std::vector<double> grad_ref, virial_ref;
+    double e_ref = compute(0.0, false, 0.0, grad_ref, virial_ref);
+
+    std::vector<double> grad, virial;
+    double e = compute(0.3, false, 0.0, grad, virial);
+
+    SECTION("Energy") { REQUIRE(e == Approx(e_ref).epsilon(1E-5)); }
+
+    SECTION("Gradients") { REQUIRE(max_rel_err(grad, grad_ref) < 1E-4); }
+
+    SECTION("Virial") { REQUIRE(max_rel_err(virial, virial_ref) < 1E-4); }
+
+    SECTION("Near field pair list") {
+        std::vector<double> grad_list, virial_list;
+        double e_list = compute(0.3, true, 0.0, grad_list, virial_list);
+        REQUIRE(e_list == Approx(e).epsilon(1E-12));
+        REQUIRE(max_rel_err(grad_list, grad) < 1E-10);
+        REQUIRE(e_list == Approx(e_ref).epsilon(1E-5));
+        REQUIRE(max_rel_err(grad_list, grad_ref) < 1E-4);
+    }
+
+    SECTION("Near field with stored dipole tensors") {
+        std::vector<double> grad_tensor, virial_tensor;
+        double e_tensor = compute(0.3, true, 64.0, grad_tensor, virial_tensor);
+        REQUIRE(e_tensor == Approx(e).epsilon(1E-12));
+        REQUIRE(max_rel_err(grad_tensor, grad) < 1E-10);
+    }
+
+    SECTION("Error decreases with the opening angle") {
+        std::vector<double> grad_coarse, virial_coarse;
+        double e_coarse = compute(0.7, false, 0.0, grad_coarse, virial_coarse);
+        REQUIRE(std::abs(e - e_ref) < std::abs(e_coarse - e_ref));
+        REQUIRE(max_rel_err(grad, grad_ref) < max_rel_err(grad_coarse, grad_ref));
+    }
+}
+
+TEST_CASE("Test the electrostatics treecode of the system against the direct sum (gas phase).") {
+    // Copies of the MB-pol trimer on a 3x3x3 grid, without the M-sites
+    SETUP_H2O_3
+    const size_t ncopies = 27;
+    const double spacing = 8.0;
+    std::vector<double> real_xyz;
+    std::vector<std::string> real_atoms;
+    for (size_t c = 0; c < ncopies; c++) {
+        double shift[3] = {spacing * (c % 3), spacing * ((c / 3) % 3), spacing * (c / 9)};
+        for (size_t n = 0; n < n_monomers; n++) {
+            for (size_t i = 0; i < 9; i++) real_xyz.push_back(coords[12 * n + i] + shift[i % 3]);
+            real_atoms.insert(real_atoms.end(), {"O", "H", "H"});
+        }
+    }
+    const size_t cl_nmon = ncopies * n_monomers;
+
+    // Electrostatic energy and gradients of the cluster with the given
+    // opening angle, set through the json configuration
+    auto compute = [&](double theta, std::vector<double> &grad) {
+        bblock::System my_system;
+        my_system.AddMonomers(real_xyz, real_atoms, std::vector<std::string>(cl_nmon, "h2o"),
+                              std::vector<size_t>(cl_nmon, 3));
+        my_system.Initialize();
+
+        nlohmann::json j;
+        j["MBX"]["dipole_method"] = "iter";
+        j["MBX"]["dipole_tolerance"] = 1E-16;
+        j["MBX"]["elec_treecode_theta"] = theta;
+        j["MBX"]["elec_treecode_radius"] = 9.0;
+        my_system.SetUpFromJson(j);
+
+        double theta_sys, near_radius;
+        my_system.GetElectrostaticsTreecode(theta_sys, near_radius);
+        REQUIRE(theta_sys == theta);
+        REQUIRE(near_radius == 9.0);
+
+        std::vector<double> virial;
+        grad.clear();
+        return my_system.TermsEnergy({"electrostatics"}, true, grad, virial);
+    };
+
+    std::vector<double> grad_ref, grad;
+    double e_ref = compute(0.0, grad_ref);
+    double e = compute(0.3, grad);
+
+    REQUIRE(e == Approx(e_ref).epsilon(1E-5));
+    double err = 0.0;
+    double norm = 0.0;
+    for (size_t i = 0; i < grad_ref.size(); i++) {
+        err = std::max(err, std::abs(grad[i] - grad_ref[i]));
+        norm = std::max(norm, std::abs(grad_ref[i]));
+    }
+    REQUIRE(err < 1E-4 * norm);
+}
@@ -401,6 +401,63 @@ TEST_CASE("Test tetramer virial contributions") {
 
 }
 
+TEST_CASE("Test disabling the virial") {
+    SETUP_H2O_4_VIRIAL
+
+    bblock::System my_system;
+
+    // Add monomers to the system
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        std::vector<double> xyz(real_coords.begin() + 3 * count,
+                                real_coords.begin() + 3 * count + 3 * n_atoms_vector[i]);
+        std::vector<std::string> ats(atom_names.begin() + count, atom_names.begin() + count + n_atoms_vector[i]);
+        std::string monid = monomer_names[i];
+        my_system.AddMonomer(xyz, ats, monid);
+        count += n_atoms_vector[i];
+    }
+
+    // Initialize the system to fill in the information
+    my_system.Initialize();
+    my_system.SetPBC(box);
+    my_system.Set2bCutoff(9.0);
+    my_system.SetEwald(0.542237671769889, 2.5, 6);
+    my_system.SetEwaldDispersion(0.5, 2.5, 6);
+
+    REQUIRE(my_system.GetComputeVirial());
+
+    double energy_ref = my_system.Energy(true);
+    std::vector<double> grad_ref = my_system.GetGrads();
+    std::vector<double> virial_ref = my_system.GetVirial();
+
+    my_system.SetComputeVirial(false);
+    REQUIRE_FALSE(my_system.GetComputeVirial());
+
+    SECTION("Energy and gradients do not change") {
+        double energy = my_system.Energy(true);
+        std::vector<double> grad = my_system.GetGrads();
+        std::vector<double> my_virial = my_system.GetVirial();
+
+        REQUIRE(energy == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(grad, grad_ref, TOL));
+        for (size_t i = 0; i < 9; i++) {
+            REQUIRE(my_virial[i] == 0.0);
+        }
+    }
+
+    SECTION("Enabling the virial again") {
+        my_system.Energy(true);
+        my_system.SetComputeVirial(true);
+        double energy = my_system.Energy(true);
+        std::vector<double> my_virial = my_system.GetVirial();
+
+        REQUIRE(energy == Approx(energy_ref).margin(TOL));
+        for (size_t i = 0; i < 9; i++) {
+            REQUIRE(my_virial[i] == Approx(virial_ref[i]).margin(TOL));
+        }
+    }
+}
+
 
 
 
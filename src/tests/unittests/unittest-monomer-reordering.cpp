@@ -0,0 +1,141 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "bblock/sys_tools.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-6;
+
+TEST_CASE("Spatial order of the monomers") {
+    // Two types, one site per monomer. The h2o block is given in reverse
+    // order along x, so the curve must reverse it.
+    std::vector<std::pair<std::string, size_t> > mon_type_count = {{"br", 1}, {"h2o", 4}};
+    std::vector<double> xyz = {0.0, 0.0, 0.0, 3.0, 0.0, 0.0, 2.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    std::vector<size_t> first_index = {0, 1, 2, 3, 4};
+
+    SECTION("No box") {
+        std::vector<size_t> perm = systools::SpatialOrder(mon_type_count, xyz, first_index, {});
+        std::vector<size_t> expected = {0, 4, 3, 2, 1};
+        REQUIRE(VectorsAreEqual(perm, expected));
+    }
+
+    SECTION("Positions are folded into the box") {
+        // Monomer 1 is one box length away from x = 0.5
+        xyz[3] = 10.5;
+        std::vector<double> box = {10.0, 0.0, 0.0, 0.0, 10.0, 0.0, 0.0, 0.0, 10.0};
+        std::vector<size_t> perm = systools::SpatialOrder(mon_type_count, xyz, first_index, box);
+        std::vector<size_t> expected = {0, 4, 1, 3, 2};
+        REQUIRE(VectorsAreEqual(perm, expected));
+    }
+
+    SECTION("Size mismatch throws") {
+        first_index.pop_back();
+        REQUIRE_THROWS(systools::SpatialOrder(mon_type_count, xyz, first_index, {}));
+    }
+}
+
+TEST_CASE("Reordering the monomers does not change the results") {
+    SETUP_H2O_5_BR_1
+
+    // Add the monomers in reverse order, so the spatial order differs
+    // from the input order
+    std::vector<size_t> first_atom(n_monomers, 0);
+    for (size_t i = 1; i < n_monomers; i++) first_atom[i] = first_atom[i - 1] + n_atoms_vector[i - 1];
+
+    bblock::System ref_system, sorted_system, resorted_system;
+    std::vector<double> input_xyz;
+    for (size_t k = 0; k < n_monomers; k++) {
+        size_t i = n_monomers - 1 - k;
+        std::vector<double> xyz(real_coords.begin() + 3 * first_atom[i],
+                                real_coords.begin() + 3 * (first_atom[i] + n_atoms_vector[i]));
+        std::vector<std::string> ats(atom_names.begin() + first_atom[i],
+                                     atom_names.begin() + first_atom[i] + n_atoms_vector[i]);
+        ref_system.AddMonomer(xyz, ats, monomer_names[i]);
+        sorted_system.AddMonomer(xyz, ats, monomer_names[i]);
+        resorted_system.AddMonomer(xyz, ats, monomer_names[i]);
+        input_xyz.insert(input_xyz.end(), xyz.begin(), xyz.end());
+    }
+
+    ref_system.Initialize();
+    sorted_system.SetMonomerReordering(1);
+    sorted_system.Initialize();
+    resorted_system.Initialize();
+
+    double energy_ref = ref_system.Energy(true);
+    std::vector<double> grad_ref = ref_system.GetRealGrads();
+
+    SECTION("Sorted at initialization") {
+        REQUIRE(sorted_system.GetMonomerReordering() == 1);
+        REQUIRE(VectorsAreEqual(sorted_system.GetRealXyz(), input_xyz, TOL));
+        for (size_t i = 0; i < n_monomers; i++) {
+            REQUIRE(sorted_system.GetFirstInd(i) == ref_system.GetFirstInd(i));
+            REQUIRE(sorted_system.GetMonId(i) == ref_system.GetMonId(i));
+        }
+
+        // Reordered again in every call
+        for (size_t n = 0; n < 3; n++) {
+            REQUIRE(sorted_system.Energy(true) == Approx(energy_ref).margin(TOL));
+            REQUIRE(VectorsAreEqual(sorted_system.GetRealGrads(), grad_ref, TOL));
+        }
+    }
+
+    SECTION("Sorted after initialization") {
+        resorted_system.Energy(true);
+        std::vector<double> mu_ref = resorted_system.GetInducedDipoles();
+        std::vector<double> point = {10.0, 0.0, 0.0};
+        std::vector<double> phi_ref, field_ref, phi, field;
+        resorted_system.GetElectrostaticPotentialAndField(point, phi_ref, field_ref);
+
+        resorted_system.SetMonomerReordering(2);
+        REQUIRE(VectorsAreEqual(resorted_system.GetRealXyz(), input_xyz, TOL));
+        REQUIRE(VectorsAreEqual(resorted_system.GetRealGrads(), grad_ref, TOL));
+
+        // The dipoles of the last call follow the monomers
+        REQUIRE(VectorsAreEqual(resorted_system.GetInducedDipoles(), mu_ref, TOL));
+        resorted_system.GetElectrostaticPotentialAndField(point, phi, field);
+        REQUIRE(VectorsAreEqual(phi, phi_ref, TOL));
+        REQUIRE(VectorsAreEqual(field, field_ref, TOL));
+
+        REQUIRE(resorted_system.Energy(true) == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(resorted_system.GetRealGrads(), grad_ref, TOL));
+    }
+}
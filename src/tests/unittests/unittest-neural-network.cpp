@@ -0,0 +1,420 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "potential/neural_networks/nn_model.h"
+#include "potential/neural_networks/nn_potentials.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <random>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+
+constexpr double TOL = 1E-10;
+
+// Random model of a cluster. elements gives the element of each atom of the
+// cluster; the pairs are classified by their two elements and by being
+// intra or intermolecular.
+nn::NNModel MakeModel(const std::vector<std::string> &mon_ids, const std::vector<size_t> &nats,
+                      const std::vector<int> &elements, double r_inner, double r_outer, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+    std::vector<size_t> monomer;
+    for (size_t k = 0; k < nats.size(); k++) monomer.insert(monomer.end(), nats[k], k);
+
+    std::vector<int> keys;
+    std::vector<int> pair_class;
+    for (size_t a = 0; a < elements.size(); a++) {
+        for (size_t b = a + 1; b < elements.size(); b++) {
+            int key = 100 * (monomer[a] == monomer[b]) + 10 * std::min(elements[a], elements[b]) +
+                      std::max(elements[a], elements[b]);
+            size_t c = std::find(keys.begin(), keys.end(), key) - keys.begin();
+            if (c == keys.size()) keys.push_back(key);
+            pair_class.push_back(c);
+        }
+    }
+
+    std::vector<double> eta = {0.5, 1.0, 2.0};
+    std::vector<double> rs = {1.0, 2.5, 4.0};
+    size_t nin = keys.size() * eta.size();
+    std::vector<double> mean(nin), scale(nin);
+    for (size_t f = 0; f < nin; f++) {
+        mean[f] = 0.2 * uniform(gen);
+        scale[f] = 1.0 + 0.5 * uniform(gen);
+    }
+
+    // Two hidden layers, the second one not a multiple of the row blocking
+    std::vector<size_t> widths = {nin, 12, 7, 1};
+    std::vector<nn::NNLayer> layers;
+    for (size_t l = 0; l + 1 < widths.size(); l++) {
+        nn::NNLayer layer;
+        layer.nin = widths[l];
+        layer.nout = widths[l + 1];
+        layer.activation = l + 2 < widths.size() ? nn::NNActivation::kTanh : nn::NNActivation::kLinear;
+        for (size_t i = 0; i < layer.nin * layer.nout; i++) layer.w.push_back(uniform(gen) / std::sqrt(layer.nin));
+        for (size_t i = 0; i < layer.nout; i++) layer.b.push_back(0.1 * uniform(gen));
+        layers.push_back(layer);
+    }
+
+    return nn::NNModel(mon_ids, nats, r_inner, r_outer, pair_class, eta, rs, mean, scale, layers);
+}
+
+// Coordinates of the water monomers of the h2o_5_br_1 cluster
+std::vector<std::vector<double> > Waters() {
+    SETUP_H2O_5_BR_1
+    std::vector<std::vector<double> > waters;
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        if (monomer_names[i] == "h2o") {
+            waters.push_back(std::vector<double>(real_coords.begin() + 3 * count,
+                                                 real_coords.begin() + 3 * count + 9));
+        }
+        count += n_atoms_vector[i];
+    }
+    return waters;
+}
+
+// Energy of a batch, and its gradients by central finite differences
+double FiniteDifferences(const nn::NNModel &model, size_t n, std::vector<std::vector<double> > &xyz,
+                         std::vector<std::vector<double> > &grad) {
+    std::vector<double> scratch;
+    std::vector<const double *> x(xyz.size());
+    for (size_t k = 0; k < xyz.size(); k++) x[k] = xyz[k].data();
+
+    const double h = 1E-5;
+    grad.resize(xyz.size());
+    for (size_t k = 0; k < xyz.size(); k++) {
+        grad[k].assign(xyz[k].size(), 0.0);
+        for (size_t i = 0; i < xyz[k].size(); i++) {
+            const double x0 = xyz[k][i];
+            xyz[k][i] = x0 + h;
+            double ep = model.Eval(n, x.data(), 0, 0, scratch);
+            xyz[k][i] = x0 - h;
+            double em = model.Eval(n, x.data(), 0, 0, scratch);
+            xyz[k][i] = x0;
+            grad[k][i] = (ep - em) / (2 * h);
+        }
+    }
+    return model.Eval(n, x.data(), 0, 0, scratch);
+}
+
+// Checks the gradients and virial of a batch of clusters against finite differences
+void CheckGradients(const nn::NNModel &model, size_t n, std::vector<std::vector<double> > &xyz) {
+    std::vector<std::vector<double> > grad_ref;
+    double e_ref = FiniteDifferences(model, n, xyz, grad_ref);
+
+    std::vector<double> scratch;
+    std::vector<const double *> x(xyz.size());
+    std::vector<std::vector<double> > grad(xyz.size());
+    std::vector<double *> g(xyz.size());
+    for (size_t k = 0; k < xyz.size(); k++) {
+        x[k] = xyz[k].data();
+        grad[k].assign(xyz[k].size(), 0.0);
+        g[k] = grad[k].data();
+    }
+    std::vector<double> virial(9, 0.0);
+    double e = model.Eval(n, x.data(), g.data(), &virial, scratch);
+
+    REQUIRE(e == Approx(e_ref).margin(TOL));
+    for (size_t k = 0; k < xyz.size(); k++) REQUIRE(VectorsAreEqual(grad[k], grad_ref[k], 1E-7));
+
+    std::vector<double> virial_ref(9, 0.0);
+    for (size_t k = 0; k < xyz.size(); k++) {
+        for (size_t a = 0; a < xyz[k].size() / 3; a++) {
+            for (size_t i = 0; i < 3; i++) {
+                for (size_t j = 0; j < 3; j++) virial_ref[3 * i + j] -= xyz[k][3 * a + i] * grad[k][3 * a + j];
+            }
+        }
+    }
+    REQUIRE(VectorsAreEqual(virial, virial_ref, TOL));
+}
+
+TEST_CASE("Test the neural network model of a dimer") {
+    std::vector<std::vector<double> > waters = Waters();
+    nn::NNModel model = MakeModel({"h2o", "h2o"}, {3, 3}, {0, 1, 1, 0, 1, 1}, 3.0, 5.5, 1);
+
+    // All the water dimers, some of them in the switching region
+    std::vector<std::vector<double> > xyz(2);
+    size_t nd = 0;
+    for (size_t i = 0; i < waters.size(); i++) {
+        for (size_t j = i + 1; j < waters.size(); j++) {
+            xyz[0].insert(xyz[0].end(), waters[i].begin(), waters[i].end());
+            xyz[1].insert(xyz[1].end(), waters[j].begin(), waters[j].end());
+            nd++;
+        }
+    }
+    const double *x[2] = {xyz[0].data(), xyz[1].data()};
+    std::vector<double> scratch;
+    double energy = model.Eval(nd, x, 0, 0, scratch);
+    REQUIRE(energy != 0.0);
+
+    SECTION("Gradients and virial") { CheckGradients(model, nd, xyz); }
+
+    SECTION("Batches of several blocks") {
+        // 15 copies of the dimers, more than two blocks of clusters
+        const size_t ncopies = 15;
+        std::vector<std::vector<double> > big(2);
+        for (size_t c = 0; c < ncopies; c++) {
+            for (size_t k = 0; k < 2; k++) big[k].insert(big[k].end(), xyz[k].begin(), xyz[k].end());
+        }
+        std::vector<std::vector<double> > grad(2, std::vector<double>(big[0].size(), 0.0));
+        const double *xb[2] = {big[0].data(), big[1].data()};
+        double *gb[2] = {grad[0].data(), grad[1].data()};
+        REQUIRE(model.Eval(ncopies * nd, xb, gb, 0, scratch) == Approx(ncopies * energy).margin(TOL));
+
+        std::vector<std::vector<double> > grad1(2, std::vector<double>(xyz[0].size(), 0.0));
+        double *g1[2] = {grad1[0].data(), grad1[1].data()};
+        model.Eval(nd, x, g1, 0, scratch);
+        for (size_t k = 0; k < 2; k++) {
+            std::vector<double> last(grad[k].end() - grad1[k].size(), grad[k].end());
+            REQUIRE(VectorsAreEqual(last, grad1[k], TOL));
+        }
+    }
+
+    SECTION("Swapping the monomers") {
+        const double *xs[2] = {xyz[1].data(), xyz[0].data()};
+        REQUIRE(model.Eval(nd, xs, 0, 0, scratch) == Approx(energy).margin(TOL));
+    }
+
+    SECTION("Clusters out of range") {
+        std::vector<std::vector<double> > far(xyz);
+        for (size_t i = 0; i < far[1].size(); i += 3) far[1][i] += 20.0;
+        const double *xf[2] = {far[0].data(), far[1].data()};
+        REQUIRE(model.Eval(nd, xf, 0, 0, scratch) == 0.0);
+    }
+
+    SECTION("Binary file") {
+        const std::string file = "unittest-nn-2b.nn";
+        model.Write(file);
+        nn::NNModel read(file);
+        REQUIRE(read.GetMonomerIds() == model.GetMonomerIds());
+        REQUIRE(read.GetCutoff() == model.GetCutoff());
+        REQUIRE(read.Eval(nd, x, 0, 0, scratch) == energy);
+
+        // Truncated file
+        std::ifstream in(file.c_str(), std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        std::ofstream out(file.c_str(), std::ios::binary);
+        out.write(content.data(), content.size() - 8);
+        out.close();
+        REQUIRE_THROWS(nn::NNModel(file));
+
+        std::remove(file.c_str());
+        REQUIRE_THROWS(nn::NNModel(file));
+        REQUIRE_THROWS(nn::NNModel("unittest-main.cpp"));
+    }
+
+    SECTION("Inconsistent parameters") {
+        REQUIRE_THROWS(MakeModel({"h2o", "h2o"}, {3, 3}, {0, 1, 1, 0, 1, 1}, 5.5, 3.0, 1));
+        REQUIRE_THROWS(MakeModel({"h2o"}, {3}, {0, 1, 1}, 3.0, 5.5, 1));
+        std::vector<nn::NNLayer> layers(1);
+        layers[0].nin = 3;
+        layers[0].nout = 2;
+        layers[0].activation = nn::NNActivation::kLinear;
+        layers[0].w.assign(6, 0.0);
+        layers[0].b.assign(2, 0.0);
+        REQUIRE_THROWS(nn::NNModel({"h2o", "br"}, {3, 1}, 3.0, 5.5, {-1, -1, 0, -1, 0, 0}, {1.0}, {1.0}, {0.0},
+                                   {1.0}, layers));
+    }
+}
+
+TEST_CASE("Test the neural network model of a trimer") {
+    std::vector<std::vector<double> > waters = Waters();
+    std::vector<int> elements = {0, 1, 1, 0, 1, 1, 0, 1, 1};
+    nn::NNModel model = MakeModel({"h2o", "h2o", "h2o"}, {3, 3, 3}, elements, 2.5, 4.5, 2);
+
+    std::vector<std::vector<double> > xyz(3);
+    size_t nt = 0;
+    for (size_t i = 0; i < waters.size(); i++) {
+        for (size_t j = i + 1; j < waters.size(); j++) {
+            for (size_t k = j + 1; k < waters.size(); k++) {
+                xyz[0].insert(xyz[0].end(), waters[i].begin(), waters[i].end());
+                xyz[1].insert(xyz[1].end(), waters[j].begin(), waters[j].end());
+                xyz[2].insert(xyz[2].end(), waters[k].begin(), waters[k].end());
+                nt++;
+            }
+        }
+    }
+    const double *x[3] = {xyz[0].data(), xyz[1].data(), xyz[2].data()};
+    std::vector<double> scratch;
+    REQUIRE(model.Eval(nt, x, 0, 0, scratch) != 0.0);
+
+    CheckGradients(model, nt, xyz);
+}
+
+TEST_CASE("Test the registration of neural network models") {
+    std::vector<std::vector<double> > waters = Waters();
+    nn::NNModel model = MakeModel({"h2o", "br"}, {3, 1}, {0, 1, 1, 2}, 3.0, 5.5, 3);
+
+    nn::NNPotentials potentials;
+    REQUIRE(potentials.Empty());
+    potentials.AddModel(model, "h2o-br.nn");
+    REQUIRE_THROWS(potentials.AddModel(model));
+    REQUIRE(potentials.Find({"br", "h2o"}) != 0);
+    REQUIRE(potentials.Find({"h2o", "h2o"}) == 0);
+    REQUIRE(potentials.Find({"br", "h2o"}, {1, 3}) != 0);
+    REQUIRE_THROWS(potentials.Find({"br", "h2o"}, {1, 4}));
+    REQUIRE(potentials.GetCutoff({"br", "h2o"}) == Approx(5.5).margin(TOL));
+    REQUIRE(potentials.GetCutoff({"br", "br"}) == 0.0);
+    REQUIRE(potentials.GetFiles() == std::vector<std::string>(1, "h2o-br.nn"));
+
+    // The batch can have the monomers in any order
+    std::vector<double> br = {0.5, -0.5, 2.0};
+    std::vector<double> scratch;
+    std::vector<double> gw(9, 0.0), gb(3, 0.0), gw2(9, 0.0), gb2(3, 0.0);
+    const double *x_model[2] = {waters[0].data(), br.data()};
+    double *g_model[2] = {gw.data(), gb.data()};
+    const double *x_swap[2] = {br.data(), waters[0].data()};
+    double *g_swap[2] = {gb2.data(), gw2.data()};
+    double e = model.Eval(1, x_model, g_model, 0, scratch);
+    nn::NNClusterModel cluster_model = potentials.GetClusterModel({"br", "h2o"}, {1, 3});
+    REQUIRE(&potentials.GetModel(cluster_model) == potentials.Find({"br", "h2o"}));
+    REQUIRE(potentials.Eval(cluster_model, 1, x_swap, g_swap, 0, scratch) == Approx(e).margin(TOL));
+    REQUIRE(VectorsAreEqual(gw2, gw, TOL));
+    REQUIRE(VectorsAreEqual(gb2, gb, TOL));
+    REQUIRE(potentials.GetClusterModel({"h2o", "h2o"}, {3, 3}).index == nn::NNClusterModel::kNone);
+
+    REQUIRE_THROWS(potentials.SetModels({"unittest-nn-missing.nn"}));
+    REQUIRE(potentials.GetFiles().size() == 1);
+}
+
+TEST_CASE("Test the neural network models in the system") {
+    SETUP_H2O_5_BR_1
+
+    bblock::System my_system;
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        std::vector<double> xyz(real_coords.begin() + 3 * count,
+                                real_coords.begin() + 3 * count + 3 * n_atoms_vector[i]);
+        std::vector<std::string> ats(atom_names.begin() + count, atom_names.begin() + count + n_atoms_vector[i]);
+        my_system.AddMonomer(xyz, ats, monomer_names[i]);
+        count += n_atoms_vector[i];
+    }
+    my_system.Initialize();
+
+    // Only the water clusters, with the models
+    my_system.Set2bIgnorePoly({{"br", "h2o"}});
+    my_system.Set3bIgnorePoly({{"br", "h2o", "h2o"}});
+    nn::NNModel model2b = MakeModel({"h2o", "h2o"}, {3, 3}, {0, 1, 1, 0, 1, 1}, 3.0, 5.5, 4);
+    nn::NNModel model3b = MakeModel({"h2o", "h2o", "h2o"}, {3, 3, 3}, {0, 1, 1, 0, 1, 1, 0, 1, 1}, 2.5, 4.5, 5);
+    std::vector<std::string> files = {"unittest-nn-2b.nn", "unittest-nn-3b.nn"};
+    model2b.Write(files[0]);
+    model3b.Write(files[1]);
+    my_system.SetNNModels(files);
+    REQUIRE(my_system.GetNNModels() == files);
+
+    // Reference: every water dimer and trimer evaluated on its own
+    std::vector<size_t> first_atom;
+    count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        if (monomer_names[i] == "h2o") first_atom.push_back(count);
+        count += n_atoms_vector[i];
+    }
+    std::vector<double> scratch;
+    double e2b_ref = 0.0;
+    double e3b_ref = 0.0;
+    std::vector<double> grad2b_ref(real_coords.size(), 0.0);
+    std::vector<double> grad3b_ref(real_coords.size(), 0.0);
+    for (size_t i = 0; i < first_atom.size(); i++) {
+        for (size_t j = i + 1; j < first_atom.size(); j++) {
+            const double *x[2] = {&real_coords[3 * first_atom[i]], &real_coords[3 * first_atom[j]]};
+            double *g[2] = {&grad2b_ref[3 * first_atom[i]], &grad2b_ref[3 * first_atom[j]]};
+            e2b_ref += model2b.Eval(1, x, g, 0, scratch);
+            for (size_t k = j + 1; k < first_atom.size(); k++) {
+                const double *x3[3] = {x[0], x[1], &real_coords[3 * first_atom[k]]};
+                double *g3[3] = {&grad3b_ref[3 * first_atom[i]], &grad3b_ref[3 * first_atom[j]],
+                                 &grad3b_ref[3 * first_atom[k]]};
+                e3b_ref += model3b.Eval(1, x3, g3, 0, scratch);
+            }
+        }
+    }
+    REQUIRE(e2b_ref != 0.0);
+    REQUIRE(e3b_ref != 0.0);
+
+    std::vector<double> grad, virial;
+    REQUIRE(my_system.TermsEnergy({"2b"}, true, grad, virial) == Approx(e2b_ref).margin(1E-8));
+    REQUIRE(VectorsAreEqual(grad, grad2b_ref, 1E-8));
+
+    grad.clear();
+    virial.clear();
+    REQUIRE(my_system.TermsEnergy({"3b"}, true, grad, virial) == Approx(e3b_ref).margin(1E-8));
+    REQUIRE(VectorsAreEqual(grad, grad3b_ref, 1E-8));
+    REQUIRE(my_system.TermsEnergy({"3b"}, false, grad, virial) == Approx(e3b_ref).margin(1E-8));
+
+    // The scratch of the models comes from the workspace of the system
+    size_t nresizes = my_system.GetNumBufferResizes();
+    my_system.TermsEnergy({"2b", "3b"}, true, grad, virial);
+    REQUIRE(my_system.GetNumBufferResizes() == nresizes);
+
+    // A copy of the system does not depend on the models of the original
+    std::vector<bblock::System> copies;
+    {
+        bblock::System original(my_system);
+        copies.push_back(original);
+        original.SetNNModels({});
+    }
+    grad.clear();
+    REQUIRE(copies[0].TermsEnergy({"2b"}, true, grad, virial) == Approx(e2b_ref).margin(1E-8));
+    REQUIRE(VectorsAreEqual(grad, grad2b_ref, 1E-8));
+    grad.clear();
+    REQUIRE(copies[0].TermsEnergy({"3b"}, true, grad, virial) == Approx(e3b_ref).margin(1E-8));
+
+    REQUIRE_THROWS(my_system.SetNNModels({files[0], files[0]}));
+    REQUIRE(my_system.GetNNModels() == files);
+
+    // A model with a different number of atoms than the monomers of the system
+    std::string wrong_file = "unittest-nn-wrong.nn";
+    MakeModel({"br", "h2o"}, {1, 4}, {2, 0, 1, 1, 3}, 3.0, 5.5, 6).Write(wrong_file);
+    REQUIRE_THROWS(my_system.SetNNModels({files[0], wrong_file}));
+    REQUIRE(my_system.GetNNModels() == files);
+    REQUIRE(my_system.TermsEnergy({"2b"}, false, grad, virial) == Approx(e2b_ref).margin(1E-8));
+
+    // Checked at the initialization if the models are set before
+    bblock::System wrong_system;
+    wrong_system.AddMonomers(real_coords, atom_names, monomer_names, n_atoms_vector);
+    wrong_system.SetNNModels({wrong_file});
+    REQUIRE_THROWS(wrong_system.Initialize());
+
+    std::remove(files[0].c_str());
+    std::remove(files[1].c_str());
+    std::remove(wrong_file.c_str());
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "potential/2b/energy2b.h"
+#include "potential/3b/energy3b.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-12;
+
+TEST_CASE("Test the outer radius of the polynomials") {
+    SECTION("Two body") {
+        REQUIRE(e2b::get_2b_cutoff("h2o", "h2o") == Approx(6.5).margin(TOL));
+        REQUIRE(e2b::get_2b_cutoff("co2", "co2") == Approx(9.0).margin(TOL));
+        REQUIRE(e2b::get_2b_cutoff("ar", "cs") == Approx(8.0).margin(TOL));
+
+        // The order of the monomers does not matter
+        std::vector<std::string> ions = {"f", "cl", "br", "i", "li", "na", "k", "rb", "cs"};
+        for (size_t i = 0; i < ions.size(); i++) {
+            double r = e2b::get_2b_cutoff(ions[i], "h2o");
+            REQUIRE(r > 0.0);
+            REQUIRE(e2b::get_2b_cutoff("h2o", ions[i]) == Approx(r).margin(TOL));
+        }
+        REQUIRE(e2b::get_2b_cutoff("ch4", "h2o") == Approx(e2b::get_2b_cutoff("h2o", "ch4")).margin(TOL));
+
+        // No polynomial
+        REQUIRE(e2b::get_2b_cutoff("dummy", "h2o") == 0.0);
+    }
+
+    SECTION("Three body") {
+        REQUIRE(e3b::get_3b_cutoff("h2o", "h2o", "h2o") == Approx(4.5).margin(TOL));
+
+        // The order of the monomers does not matter
+        double r = e3b::get_3b_cutoff("cs", "h2o", "h2o");
+        REQUIRE(r > 0.0);
+        REQUIRE(e3b::get_3b_cutoff("h2o", "cs", "h2o") == Approx(r).margin(TOL));
+        REQUIRE(e3b::get_3b_cutoff("h2o", "h2o", "cs") == Approx(r).margin(TOL));
+        REQUIRE(e3b::get_3b_cutoff("h2o", "ch4", "h2o") == Approx(8.0).margin(TOL));
+
+        // No polynomial
+        REQUIRE(e3b::get_3b_cutoff("h2o", "h2o", "dummy") == 0.0);
+    }
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "tools/site_store.h"
+#include "potential/dispersion/dispersion.h"
+#include "potential/buckingham/buckingham.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-12;
+
+TEST_CASE("Test the site store shared by dispersion and buckingham") {
+    // Three waters and a fluoride, in system order (types contiguous). Each
+    // water also has a virtual site (OHHM), which is not in the store.
+    std::vector<double> water = {0.0, 0.0, 0.0, 0.7570, 0.5860, 0.0, -0.7570, 0.5860, 0.0, 0.0, 0.2, 0.0};
+    std::vector<double> sys_xyz;
+    std::vector<double> real_xyz;
+    std::vector<size_t> first_index;
+    std::vector<size_t> num_atoms = {3, 3, 3, 1};
+    std::vector<std::string> mon_id = {"h2o", "h2o", "h2o", "f"};
+    for (size_t m = 0; m < 3; m++) {
+        first_index.push_back(sys_xyz.size() / 3);
+        double shift[3] = {2.9 * m, 0.3 * m, -0.2 * m};
+        for (size_t k = 0; k < 12; k++) sys_xyz.push_back(water[k] + shift[k % 3]);
+        real_xyz.insert(real_xyz.end(), sys_xyz.end() - 12, sys_xyz.end() - 3);
+    }
+    first_index.push_back(sys_xyz.size() / 3);
+    std::vector<double> fluoride = {1.4, 2.6, 0.4};
+    sys_xyz.insert(sys_xyz.end(), fluoride.begin(), fluoride.end());
+    real_xyz.insert(real_xyz.end(), fluoride.begin(), fluoride.end());
+    std::vector<std::pair<std::string, size_t> > mon_type_count = {{"h2o", 3}, {"f", 1}};
+
+    tools::SiteStore sites;
+    sites.SetLayout(mon_type_count, num_atoms, first_index);
+    sites.Gather(sys_xyz.data());
+
+    SECTION("Layout and round trip") {
+        REQUIRE(sites.GetNumSites() == 10);
+        REQUIRE(VectorsAreEqual(sites.GetSysXyz(), real_xyz, TOL));
+        // x of the oxygens of the three waters, then their y
+        const std::vector<double> &xyz = sites.GetXyz();
+        for (size_t m = 0; m < 3; m++) {
+            REQUIRE(xyz[m] == real_xyz[9 * m]);
+            REQUIRE(xyz[3 + m] == real_xyz[9 * m + 1]);
+        }
+        std::vector<double> back(sys_xyz.size(), 0.0);
+        sites.ScatterAdd(xyz.data(), back.data());
+        for (size_t m = 0; m < 4; m++) {
+            for (size_t k = 0; k < 3 * num_atoms[m]; k++) {
+                REQUIRE(back[3 * first_index[m] + k] == sys_xyz[3 * first_index[m] + k]);
+            }
+        }
+        // The virtual sites are not touched
+        for (size_t m = 0; m < 3; m++) {
+            REQUIRE(back[3 * first_index[m] + 9] == 0.0);
+        }
+    }
+
+    SECTION("Dispersion reads the shared store") {
+        std::vector<double> c6_lr(10, 0.0);
+        disp::Dispersion disp_vec, disp_store;
+        disp_vec.Initialize(c6_lr, real_xyz, mon_id, num_atoms, mon_type_count, true, {});
+        disp_store.Initialize(c6_lr, real_xyz, mon_id, num_atoms, mon_type_count, true, {});
+        disp_vec.SetNewParameters(real_xyz, true, 9.0, {});
+        disp_store.SetNewParameters(sites, true, 9.0, {});
+
+        std::vector<double> grad_vec(real_xyz.size(), 0.0);
+        std::vector<double> grad_store(sys_xyz.size(), 0.0);
+        double e_vec = disp_vec.GetDispersion(grad_vec);
+        double e_store = disp_store.GetDispersion(grad_store);
+        REQUIRE(e_vec != 0.0);
+        REQUIRE(e_store == Approx(e_vec).margin(TOL));
+
+        std::vector<double> grad_back(real_xyz.size(), 0.0);
+        size_t count = 0;
+        for (size_t m = 0; m < 4; m++) {
+            for (size_t k = 0; k < 3 * num_atoms[m]; k++) grad_back[count + k] = grad_store[3 * first_index[m] + k];
+            count += 3 * num_atoms[m];
+        }
+        REQUIRE(VectorsAreEqual(grad_back, grad_vec, TOL));
+    }
+
+    SECTION("Buckingham reads the shared store") {
+        std::vector<std::pair<std::string, std::string> > buck_pairs = {{"f", "h2o"}};
+        buck::Buckingham buck_vec, buck_store;
+        buck_vec.Initialize(real_xyz, mon_id, num_atoms, mon_type_count, true, {});
+        buck_store.Initialize(real_xyz, mon_id, num_atoms, mon_type_count, true, {});
+        buck_vec.SetNewParameters(real_xyz, buck_pairs, true, 9.0, {});
+        buck_store.SetNewParameters(sites, buck_pairs, true, 9.0, {});
+
+        std::vector<double> grad_vec(real_xyz.size(), 0.0);
+        std::vector<double> grad_store(sys_xyz.size(), 0.0);
+        double e_vec = buck_vec.GetRepulsion(grad_vec);
+        double e_store = buck_store.GetRepulsion(grad_store);
+        REQUIRE(e_vec != 0.0);
+        REQUIRE(e_store == Approx(e_vec).margin(TOL));
+        REQUIRE(grad_store[3 * first_index[3]] == Approx(grad_vec[27]).margin(TOL));
+    }
+}
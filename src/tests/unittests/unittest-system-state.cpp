@@ -0,0 +1,125 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+constexpr double TOL = 1E-10;
+
+TEST_CASE("Saving and restoring the state of the system") {
+    SETUP_H2O_5_BR_1
+
+    // Add the monomers in reverse order, so the spatial order differs
+    // from the input order
+    std::vector<size_t> first_atom(n_monomers, 0);
+    for (size_t i = 1; i < n_monomers; i++) first_atom[i] = first_atom[i - 1] + n_atoms_vector[i - 1];
+
+    bblock::System run_system, restart_system, other_system;
+    std::vector<double> input_xyz;
+    for (size_t k = 0; k < n_monomers; k++) {
+        size_t i = n_monomers - 1 - k;
+        std::vector<double> xyz(real_coords.begin() + 3 * first_atom[i],
+                                real_coords.begin() + 3 * (first_atom[i] + n_atoms_vector[i]));
+        std::vector<std::string> ats(atom_names.begin() + first_atom[i],
+                                     atom_names.begin() + first_atom[i] + n_atoms_vector[i]);
+        run_system.AddMonomer(xyz, ats, monomer_names[i]);
+        restart_system.AddMonomer(xyz, ats, monomer_names[i]);
+        // One monomer less
+        if (k > 0) other_system.AddMonomer(xyz, ats, monomer_names[i]);
+        input_xyz.insert(input_xyz.end(), xyz.begin(), xyz.end());
+    }
+
+    run_system.Initialize();
+    restart_system.Initialize();
+    other_system.Initialize();
+
+    nlohmann::json j;
+    j["MBX"]["dipole_method"] = "aspc";
+    j["MBX"]["reorder_frequency"] = 3;
+    run_system.SetUpFromJson(j);
+
+    // Small deterministic trajectory
+    auto frame = [&input_xyz](size_t step) {
+        std::vector<double> xyz = input_xyz;
+        for (size_t i = 0; i < xyz.size(); i++) xyz[i] += 0.01 * std::sin(0.7 * step + 1.3 * i);
+        return xyz;
+    };
+
+    // Enough steps to fill the ASPC history
+    size_t nsteps = 10;
+    for (size_t n = 0; n < nsteps; n++) {
+        run_system.SetRealXyz(frame(n));
+        run_system.Energy(true);
+    }
+    std::string state = run_system.GetState();
+
+    SECTION("Restored run follows the original one") {
+        restart_system.SetState(state);
+        REQUIRE(restart_system.GetState() == state);
+        REQUIRE(restart_system.GetDipoleMethod() == "aspc");
+        REQUIRE(restart_system.GetMonomerReordering() == 3);
+
+        for (size_t n = nsteps; n < nsteps + 4; n++) {
+            run_system.SetRealXyz(frame(n));
+            restart_system.SetRealXyz(frame(n));
+            double e_run = run_system.Energy(true);
+            double e_restart = restart_system.Energy(true);
+            REQUIRE(e_restart == Approx(e_run).margin(TOL));
+            REQUIRE(VectorsAreEqual(restart_system.GetRealGrads(), run_system.GetRealGrads(), TOL));
+            REQUIRE(VectorsAreEqual(restart_system.GetInducedDipoles(), run_system.GetInducedDipoles(), TOL));
+        }
+    }
+
+    SECTION("Saved to a file") {
+        std::string path = "unittest-system-state.bin";
+        run_system.SaveState(path);
+        restart_system.LoadState(path);
+        std::remove(path.c_str());
+        REQUIRE(restart_system.GetState() == state);
+    }
+
+    SECTION("Bad states are rejected") {
+        REQUIRE_THROWS(other_system.SetState(state));
+        REQUIRE_THROWS(restart_system.SetState(state.substr(0, state.size() - 8)));
+        REQUIRE_THROWS(restart_system.SetState("MBXSTATE"));
+        REQUIRE_THROWS(restart_system.LoadState("not_existing_file.bin"));
+    }
+}
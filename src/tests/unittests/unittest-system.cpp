@@ -250,15 +250,24 @@ TEST_CASE("Test the system class.") {
                     {"dipole_tolerance" , 1E-016},
                     {"dipole_max_it"    , 100},
                     {"dipole_method"    , "cg"},
+                    {"dipole_tensor_memory" , 0.0},
                     {"alpha_ewald_elec" , 0.0},
                     {"grid_density_elec",  2.5},
                     {"spline_order_elec",  6},
+                    {"cutoff_elec",  0.0},
+                    {"ewald_accuracy_elec",  0.0},
+                    {"elec_treecode_theta",  0.0},
+                    {"elec_treecode_radius",  9.0},
+                    {"elec_threads",  0},
+                    {"compute_virial",  true},
                     {"alpha_ewald_disp" , 0.0},
                     {"grid_density_disp",  2.5},
                     {"spline_order_disp",  6},
                     {"ttm_pairs" , nlohmann::json::array()},
                     {"ignore_2b_poly" , nlohmann::json::array()},
-                    {"ignore_3b_poly" , nlohmann::json::array()}
+                    {"ignore_3b_poly" , nlohmann::json::array()},
+                    {"nn_models" , nlohmann::json::array()},
+                    {"reorder_frequency" , 0}
                 }
             } ,
             {
@@ -293,15 +302,22 @@ TEST_CASE("Test the system class.") {
         j["MBX"]["dipole_tolerance"] = 1E-14;
         j["MBX"]["dipole_max_it"] = 150;
         j["MBX"]["dipole_method"] = "iter";
+        j["MBX"]["dipole_tensor_memory"] = 512.0;
         j["MBX"]["alpha_ewald_elec" ] = 0.01;
         j["MBX"]["grid_density_elec"] = 2.8;
         j["MBX"]["spline_order_elec"] = 5;
+        j["MBX"]["cutoff_elec"] = 8.0;
+        j["MBX"]["elec_treecode_theta"] = 0.4;
+        j["MBX"]["elec_treecode_radius"] = 8.0;
+        j["MBX"]["elec_threads"] = 2;
+        j["MBX"]["compute_virial"] = false;
         j["MBX"]["alpha_ewald_disp"] = 0.01;
         j["MBX"]["grid_density_disp"] = 2.7;
         j["MBX"]["spline_order_disp"] = 4;
         j["MBX"]["ttm_pairs"] = nlohmann::json::array({{"h2o","i"},{"cs","h2o"}});
         j["MBX"]["ignore_2b_poly"] = nlohmann::json::array({{"h2o","i"},{"cs","h2o"}});
         j["MBX"]["ignore_3b_poly"] = nlohmann::json::array({{"h2o","i"},{"cs","h2o"}});
+        j["MBX"]["reorder_frequency"] = 10;
         
         // Write the new json file
         std::ofstream off("mbx_mod.json");
@@ -327,6 +343,9 @@ TEST_CASE("Test the system class.") {
             double cutoff3b = my_system.Get3bCutoff();
             REQUIRE(cutoff3b == j["MBX"]["threebody_cutoff"]);
 
+            size_t reorder_frequency = my_system.GetMonomerReordering();
+            REQUIRE(reorder_frequency == j["MBX"]["reorder_frequency"]);
+
             size_t neval1b = my_system.GetMaxEval1b();
             REQUIRE(neval1b == j["MBX"]["max_n_eval_1b"]);
 
@@ -345,6 +364,9 @@ TEST_CASE("Test the system class.") {
             std::string dipole_method = my_system.GetDipoleMethod();
             REQUIRE(dipole_method == j["MBX"]["dipole_method"]);
 
+            double dipole_tensor_memory = my_system.GetDipoleTensorMemory();
+            REQUIRE(dipole_tensor_memory == j["MBX"]["dipole_tensor_memory"]);
+
             double alpha = 0.0;
             double grid = 0.0;
             size_t spline = 0;
@@ -353,6 +375,20 @@ TEST_CASE("Test the system class.") {
             REQUIRE(grid == j["MBX"]["grid_density_elec"]);
             REQUIRE(spline == j["MBX"]["spline_order_elec"]);
 
+            double cutoff_elec = my_system.GetElectrostaticsCutoff();
+            REQUIRE(cutoff_elec == j["MBX"]["cutoff_elec"]);
+
+            double theta, near_radius;
+            my_system.GetElectrostaticsTreecode(theta, near_radius);
+            REQUIRE(theta == j["MBX"]["elec_treecode_theta"]);
+            REQUIRE(near_radius == j["MBX"]["elec_treecode_radius"]);
+
+            size_t elec_threads_json = j["MBX"]["elec_threads"];
+            REQUIRE(my_system.GetElectrostaticsThreads() == elec_threads_json);
+
+            bool compute_virial_json = j["MBX"]["compute_virial"];
+            REQUIRE(my_system.GetComputeVirial() == compute_virial_json);
+
             my_system.GetEwaldParamsDispersion(alpha, grid, spline);
             REQUIRE(alpha == j["MBX"]["alpha_ewald_disp"]);
             REQUIRE(grid == j["MBX"]["grid_density_disp"]);
@@ -366,6 +402,9 @@ TEST_CASE("Test the system class.") {
 
             std::vector<std::vector<std::string> > ignore3b = my_system.Get3bIgnorePoly();
             REQUIRE(ignore3b == j["MBX"]["ignore_3b_poly"]);
+
+            std::vector<std::string> nn_models = my_system.GetNNModels();
+            REQUIRE(nn_models == j["MBX"]["nn_models"]);
         }
 
         // Set back the defaults
@@ -426,6 +465,33 @@ TEST_CASE("Test the system class.") {
         }
     }
 
+    SECTION("Pointer accessors") {
+        // Bromide is stored before the waters, so the orders differ
+        REQUIRE(!my_system.IsInputOrder());
+
+        std::vector<double> xyz(coords.size());
+        my_system.GetXyz(xyz.data());
+        REQUIRE(VectorsAreEqual(xyz, coords, TOL));
+
+        std::vector<double> real_xyz(real_coords.size());
+        for (size_t i = 0; i < real_coords.size(); i++) real_xyz[i] = real_coords[i] + 1.0;
+        my_system.SetRealXyz(real_xyz.data());
+        std::vector<double> new_real_xyz(real_coords.size());
+        my_system.GetRealXyz(new_real_xyz.data());
+        REQUIRE(VectorsAreEqual(real_xyz, new_real_xyz, TOL));
+
+        my_system.SetXyz(coords.data());
+        REQUIRE(VectorsAreEqual(my_system.GetXyz(), coords, TOL));
+
+        my_system.Energy(true);
+        std::vector<double> grads(coords.size());
+        std::vector<double> real_grads(real_coords.size());
+        my_system.GetGrads(grads.data());
+        my_system.GetRealGrads(real_grads.data());
+        REQUIRE(VectorsAreEqual(grads, my_system.GetGrads(), TOL));
+        REQUIRE(VectorsAreEqual(real_grads, my_system.GetRealGrads(), TOL));
+    }
+
     SECTION("Initialize()") {
         SECTION("Initialize an already initialized system") {
             bool system_cannot_be_initialized = false;
@@ -525,6 +591,67 @@ TEST_CASE("Test the system class.") {
     //   REQUIRE( == Approx(finiteDifferenceForce).margin(TOL));
 }
 
+TEST_CASE("Test the input order fast path of the system.") {
+    // Ions have no virtual sites, and a single type keeps the input order
+    std::vector<double> xyz = {0.0, 0.0, 0.0, 4.0, 0.5, 0.0, 0.0, 4.5, 1.0};
+    bblock::System my_system;
+    for (size_t i = 0; i < 3; i++) {
+        std::vector<double> mon_xyz(xyz.begin() + 3 * i, xyz.begin() + 3 * i + 3);
+        my_system.AddMonomer(mon_xyz, {"Cl"}, "cl");
+    }
+    my_system.Initialize();
+
+    REQUIRE(my_system.IsInputOrder());
+
+    std::vector<double> new_xyz(xyz.size());
+    for (size_t i = 0; i < xyz.size(); i++) new_xyz[i] = xyz[i] - 0.5;
+    my_system.SetRealXyz(new_xyz.data());
+    REQUIRE(VectorsAreEqual(my_system.GetRealXyz(), new_xyz, TOL));
+
+    my_system.Energy(true);
+    std::vector<double> grads(xyz.size());
+    my_system.GetRealGrads(grads.data());
+    REQUIRE(VectorsAreEqual(grads, my_system.GetRealGrads(), TOL));
+}
+
+TEST_CASE("Test the bulk construction of the system.") {
+    // Create the bromide -- water system
+    SETUP_H2O_5_BR_1
+
+    // All monomers at once
+    bblock::System bulk_system;
+    bulk_system.AddMonomers(real_coords, atom_names, monomer_names, n_atoms_vector);
+    bulk_system.Initialize();
+
+    // One monomer at a time
+    bblock::System my_system;
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        std::vector<double> xyz(real_coords.begin() + 3 * count,
+                                real_coords.begin() + 3 * count + 3 * n_atoms_vector[i]);
+        std::vector<std::string> ats(atom_names.begin() + count, atom_names.begin() + count + n_atoms_vector[i]);
+        my_system.AddMonomer(xyz, ats, monomer_names[i]);
+        count += n_atoms_vector[i];
+    }
+    my_system.Initialize();
+
+    SECTION("Same system") {
+        REQUIRE(VectorsAreEqual(bulk_system.GetXyz(), my_system.GetXyz(), TOL));
+        REQUIRE(VectorsAreEqual(bulk_system.GetAtomNames(), my_system.GetAtomNames()));
+        REQUIRE(VectorsAreEqual(bulk_system.GetRealXyz(), real_coords, TOL));
+        REQUIRE(bulk_system.Energy(false) == Approx(my_system.Energy(false)).margin(TOL));
+    }
+
+    SECTION("Inconsistent sizes") {
+        bblock::System bad_system;
+        std::vector<size_t> nat = n_atoms_vector;
+        nat.back()++;
+        REQUIRE_THROWS(bad_system.AddMonomers(real_coords, atom_names, monomer_names, nat));
+        nat.pop_back();
+        REQUIRE_THROWS(bad_system.AddMonomers(real_coords, atom_names, monomer_names, nat));
+    }
+}
+
 TEST_CASE("Test energy from system") {
     // Create the bromide -- water system
     SETUP_H2O_5_BR_1
@@ -728,6 +855,19 @@ TEST_CASE("Test energy from system") {
                 REQUIRE(all_grad[degreeOfFreedom] == Approx(finiteDifferenceForce).margin(TOL));
             }
         }
+
+        SECTION("Induced dipoles are invariant under translation") {
+            std::vector<double> mu = my_system.GetInducedDipoles();
+            REQUIRE(mu.size() == all_xyz.size());
+
+            for (size_t i = 0; i < all_xyz.size(); i++) all_xyz[i] += 1.5;
+            my_system.SetXyz(all_xyz);
+            my_system.Electrostatics(false);
+            std::vector<double> mu_shifted = my_system.GetInducedDipoles();
+            for (size_t i = 0; i < mu.size(); i++) {
+                REQUIRE(mu_shifted[i] == Approx(mu[i]).margin(TOL));
+            }
+        }
     }
 
     SECTION("Total Energy") {
@@ -161,6 +161,32 @@ TEST_CASE("Test the system tools functions (no PBC).") {
             }
             REQUIRE(atoms_vector_not_matching_monomer_size);
         }
+
+        SECTION("Interleaved types with the same count") {
+            // Types with the same number of monomers keep the order in
+            // which they first appear
+            std::vector<std::string> mons = {"cl", "na", "h2o", "na", "cl", "h2o", "h2o"};
+            std::vector<size_t> sites = {1, 1, 4, 1, 1, 4, 4};
+            std::vector<size_t> nats = {1, 1, 3, 1, 1, 3, 3};
+            std::vector<size_t> original2current2;
+            std::vector<std::pair<size_t, size_t>> orginal_order2;
+            std::vector<std::pair<size_t, size_t>> orginal_order_realSites2;
+            std::vector<std::pair<std::string, size_t>> mon_type_count2 = systools::OrderMonomers(
+                mons, sites, nats, original2current2, orginal_order2, orginal_order_realSites2);
+
+            std::vector<std::pair<std::string, size_t>> expected_count = {{"cl", 2}, {"na", 2}, {"h2o", 3}};
+            std::vector<std::string> expected_mons = {"cl", "cl", "na", "na", "h2o", "h2o", "h2o"};
+            std::vector<size_t> expected_o2c = {0, 2, 4, 3, 1, 5, 6};
+            std::vector<std::pair<size_t, size_t>> expected_order = {{0, 0}, {4, 7}, {1, 1}, {3, 6},
+                                                                     {2, 2}, {5, 8}, {6, 12}};
+            std::vector<std::pair<size_t, size_t>> expected_order_real = {{0, 0}, {4, 6}, {1, 1}, {3, 5},
+                                                                          {2, 2}, {5, 7}, {6, 10}};
+            REQUIRE(VectorsAreEqual(mon_type_count2, expected_count));
+            REQUIRE(VectorsAreEqual(mons, expected_mons));
+            REQUIRE(VectorsAreEqual(original2current2, expected_o2c));
+            REQUIRE(VectorsAreEqual(orginal_order2, expected_order));
+            REQUIRE(VectorsAreEqual(orginal_order_realSites2, expected_order_real));
+        }
     }
 
     SECTION("Test the thole damping retrievement") {
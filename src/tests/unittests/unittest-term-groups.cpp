@@ -0,0 +1,114 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+constexpr double TOL = 1E-6;
+
+TEST_CASE("Test the evaluation of groups of terms.") {
+    SETUP_H2O_5_BR_1
+
+    bblock::System my_system;
+
+    // Add monomers to the system
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        std::vector<double> xyz(real_coords.begin() + 3 * count,
+                                real_coords.begin() + 3 * count + 3 * n_atoms_vector[i]);
+        std::vector<std::string> ats(atom_names.begin() + count, atom_names.begin() + count + n_atoms_vector[i]);
+        std::string monid = monomer_names[i];
+        my_system.AddMonomer(xyz, ats, monid);
+        count += n_atoms_vector[i];
+    }
+
+    // Initialize the system to fill in the information
+    my_system.Initialize();
+
+    // Reference: all terms at once
+    double energy_ref = my_system.Energy(true);
+    std::vector<double> grad_ref = my_system.GetRealGrads();
+    std::vector<double> virial_ref = my_system.GetVirial();
+
+    my_system.SetTermGroup("fast", {"1b", "2b", "buckingham"});
+    my_system.SetTermGroup("slow", {"3b", "dispersion", "electrostatics"});
+
+    SECTION("Fast + slow groups give the total energy, gradients and virial") {
+        double e_fast = my_system.GroupEnergy("fast", true);
+        double e_slow = my_system.GroupEnergy("slow", true);
+
+        REQUIRE(e_fast + e_slow == Approx(energy_ref).margin(TOL));
+        REQUIRE(my_system.GetGroupEnergy("fast") == Approx(e_fast).margin(TOL));
+
+        std::vector<double> g_fast = my_system.GetGroupRealGrads("fast");
+        std::vector<double> g_slow = my_system.GetGroupRealGrads("slow");
+        std::vector<double> g_sum(g_fast.size());
+        for (size_t i = 0; i < g_sum.size(); i++) g_sum[i] = g_fast[i] + g_slow[i];
+        REQUIRE(VectorsAreEqual(g_sum, grad_ref, TOL));
+
+        std::vector<double> v_fast = my_system.GetGroupVirial("fast");
+        std::vector<double> v_slow = my_system.GetGroupVirial("slow");
+        std::vector<double> v_sum(9);
+        for (size_t i = 0; i < 9; i++) v_sum[i] = v_fast[i] + v_slow[i];
+        REQUIRE(VectorsAreEqual(v_sum, virial_ref, TOL));
+    }
+
+    SECTION("Group evaluation does not modify the state of the system") {
+        my_system.GroupEnergy("fast", true);
+        REQUIRE(VectorsAreEqual(my_system.GetRealGrads(), grad_ref, TOL));
+        REQUIRE(VectorsAreEqual(my_system.GetVirial(), virial_ref, TOL));
+    }
+
+    SECTION("Terms evaluated into a caller buffer") {
+        std::vector<double> grad;
+        std::vector<double> virial;
+        double e = my_system.TermsEnergy({"1b", "2b", "buckingham"}, true, grad, virial);
+        e += my_system.TermsEnergy({"3b", "dispersion", "electrostatics"}, true, grad, virial);
+
+        REQUIRE(e == Approx(energy_ref).margin(TOL));
+        REQUIRE(VectorsAreEqual(grad, grad_ref, TOL));
+        REQUIRE(VectorsAreEqual(virial, virial_ref, TOL));
+    }
+
+    SECTION("Invalid terms and groups throw") {
+        REQUIRE_THROWS(my_system.SetTermGroup("bad", {"4b"}));
+        REQUIRE_THROWS(my_system.GroupEnergy("undefined", true));
+    }
+}
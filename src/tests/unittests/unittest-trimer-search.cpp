@@ -0,0 +1,116 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/sys_tools.h"
+
+#include <vector>
+#include <array>
+#include <set>
+#include <cmath>
+
+TEST_CASE("Test the trimer search against all the triplets") {
+    // 60 monomers on a jittered grid, the first 20 of type 0 and the rest of type 1
+    size_t nmon = 60;
+    double side = 12.0;
+    std::vector<double> xyz;
+    std::vector<size_t> first_index, mon_type;
+    for (size_t i = 0; i < nmon; i++) {
+        xyz.push_back(3.0 * (i % 4) + 0.37 * std::sin(1.3 * i));
+        xyz.push_back(3.0 * ((i / 4) % 4) + 0.41 * std::cos(2.1 * i));
+        xyz.push_back(3.0 * (i / 16) + 0.29 * std::sin(0.7 * i + 1.0));
+        first_index.push_back(i);
+        mon_type.push_back(i < 20 ? 0 : 1);
+    }
+    std::vector<double> box = {side, 0.0, 0.0, 0.0, side, 0.0, 0.0, 0.0, side};
+
+    // Different cutoff for each sorted combination of types
+    std::vector<double> cutoffs = {4.5, 0.0, 4.0, 3.5, 0.0, 0.0, 0.0, 5.0};
+
+    for (size_t pbc = 0; pbc < 2; pbc++) {
+        auto dist2 = [&](size_t a, size_t b) {
+            double r2 = 0.0;
+            for (size_t k = 0; k < 3; k++) {
+                double d = xyz[3 * a + k] - xyz[3 * b + k];
+                if (pbc) d -= side * std::round(d / side);
+                r2 += d * d;
+            }
+            return r2;
+        };
+
+        std::set<std::array<size_t, 3> > expected;
+        for (size_t i = 0; i < nmon; i++) {
+            for (size_t j = i + 1; j < nmon; j++) {
+                for (size_t k = j + 1; k < nmon; k++) {
+                    double rc = cutoffs[(mon_type[i] * 2 + mon_type[j]) * 2 + mon_type[k]];
+                    size_t nclose = (dist2(i, j) < rc * rc) + (dist2(i, k) < rc * rc) + (dist2(j, k) < rc * rc);
+                    if (nclose >= 2) expected.insert({{i, j, k}});
+                }
+            }
+        }
+
+        SECTION("All the trimers are found once, grouped by type") {
+            std::vector<size_t> trimers;
+            systools::AddTrimers(cutoffs, mon_type, 2, 0, nmon, nmon, pbc, box, xyz, first_index, trimers);
+
+            std::set<std::array<size_t, 3> > found;
+            size_t last_key = 0;
+            for (size_t t = 0; t < trimers.size(); t += 3) {
+                REQUIRE(trimers[t] < trimers[t + 1]);
+                REQUIRE(trimers[t + 1] < trimers[t + 2]);
+                size_t key = (mon_type[trimers[t]] * 2 + mon_type[trimers[t + 1]]) * 2 + mon_type[trimers[t + 2]];
+                REQUIRE(key >= last_key);
+                last_key = key;
+                found.insert({{trimers[t], trimers[t + 1], trimers[t + 2]}});
+            }
+            REQUIRE(found.size() == trimers.size() / 3);
+            REQUIRE(found == expected);
+        }
+
+        SECTION("A range of first monomers finds their trimers") {
+            std::vector<size_t> trimers;
+            systools::AddTrimers(cutoffs, mon_type, 2, 10, 30, nmon, pbc, box, xyz, first_index, trimers);
+
+            size_t nexpected = 0;
+            for (auto it = expected.begin(); it != expected.end(); ++it) {
+                if ((*it)[0] >= 10 && (*it)[0] < 30) nexpected++;
+            }
+            REQUIRE(trimers.size() == 3 * nexpected);
+            for (size_t t = 0; t < trimers.size(); t += 3) {
+                REQUIRE(expected.count({{trimers[t], trimers[t + 1], trimers[t + 2]}}) == 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,127 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "testutils.h"
+
+#include "bblock/system.h"
+#include "setup_h2o_5_br_1.h"
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+constexpr double TOL = 1E-6;
+
+// Counts every heap allocation of the test executable
+static std::atomic<size_t> num_allocations(0);
+
+void *operator new(size_t size) {
+    num_allocations++;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+TEST_CASE("Test the reuse of scratch buffers between energy calls.") {
+    SETUP_H2O_5_BR_1
+
+    bblock::System my_system;
+
+    // Add monomers to the system
+    size_t count = 0;
+    for (size_t i = 0; i < n_monomers; i++) {
+        std::vector<double> xyz(real_coords.begin() + 3 * count,
+                                real_coords.begin() + 3 * count + 3 * n_atoms_vector[i]);
+        std::vector<std::string> ats(atom_names.begin() + count, atom_names.begin() + count + n_atoms_vector[i]);
+        std::string monid = monomer_names[i];
+        my_system.AddMonomer(xyz, ats, monid);
+        count += n_atoms_vector[i];
+    }
+
+    // Initialize the system to fill in the information
+    my_system.Initialize();
+
+    // First call sizes the buffers
+    double energy_first = my_system.Energy(true);
+    std::vector<double> grad_first = my_system.GetRealGrads();
+    size_t nresizes = my_system.GetNumBufferResizes();
+
+    SECTION("Second call does not grow the workspace") {
+        double energy_second = my_system.Energy(true);
+        REQUIRE(my_system.GetNumBufferResizes() == nresizes);
+        REQUIRE(energy_second == Approx(energy_first).margin(TOL));
+        REQUIRE(VectorsAreEqual(my_system.GetRealGrads(), grad_first, TOL));
+    }
+
+    SECTION("Moving the atoms does not grow the workspace") {
+        std::vector<double> xyz = my_system.GetRealXyz();
+        for (size_t i = 0; i < xyz.size(); i++) xyz[i] += 0.01 * (i % 3);
+        my_system.SetRealXyz(xyz);
+        my_system.Energy(true);
+        my_system.Energy(false);
+        REQUIRE(my_system.GetNumBufferResizes() == nresizes);
+    }
+
+    SECTION("Second call of the pair terms does not allocate") {
+        // The neighbor searches and the polynomials still allocate, so only
+        // the terms that go through the workspace are checked
+        for (size_t do_grads = 0; do_grads < 2; do_grads++) {
+            my_system.Electrostatics(do_grads);
+            my_system.Dispersion(do_grads);
+            my_system.Buckingham(do_grads);
+
+            size_t n0 = num_allocations;
+            my_system.Electrostatics(do_grads);
+            size_t nelec = num_allocations - n0;
+
+            n0 = num_allocations;
+            my_system.Dispersion(do_grads);
+            size_t ndisp = num_allocations - n0;
+
+            n0 = num_allocations;
+            my_system.Buckingham(do_grads);
+            size_t nbuck = num_allocations - n0;
+
+            REQUIRE(nelec == 0);
+            REQUIRE(ndisp == 0);
+            REQUIRE(nbuck == 0);
+        }
+    }
+}
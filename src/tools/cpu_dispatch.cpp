@@ -0,0 +1,121 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#include "tools/cpu_dispatch.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#include "tools/custom_exceptions.h"
+
+namespace tools {
+
+namespace {
+
+// Path in use, or -1 before the first call
+std::atomic<int> active_path(-1);
+
+// Detected path, restricted by MBX_CPU_PATH
+CpuPath RequestedCpuPath() {
+    CpuPath detected = DetectCpuPath();
+    const char *env = std::getenv("MBX_CPU_PATH");
+    if (env == nullptr || env[0] == '\0') return detected;
+
+    CpuPath requested = detected;
+    try {
+        requested = CpuPathFromName(env);
+    } catch (CUException &e) {
+        std::cerr << "**WARNING** MBX_CPU_PATH=" << env << " is not a known path. Using " << CpuPathName(detected)
+                  << std::endl;
+    }
+    if (requested > detected) {
+        std::cerr << "**WARNING** MBX_CPU_PATH=" << env << " is not supported by this processor. Using "
+                  << CpuPathName(detected) << std::endl;
+        requested = detected;
+    }
+
+    return requested;
+}
+
+}  // namespace
+
+CpuPath DetectCpuPath() {
+#if MBX_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return CpuPath::kAvx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return CpuPath::kAvx2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) return CpuPath::kSse42;
+#endif
+    return CpuPath::kGeneric;
+}
+
+CpuPath GetCpuPath() {
+    int path = active_path.load(std::memory_order_relaxed);
+    if (path >= 0) return static_cast<CpuPath>(path);
+
+    // Initialized once even if the first kernels run in several threads
+    static const CpuPath initial = SetCpuPath(RequestedCpuPath());
+    return initial;
+}
+
+CpuPath SetCpuPath(CpuPath path) {
+    CpuPath detected = DetectCpuPath();
+    if (path > detected) path = detected;
+    active_path.store(static_cast<int>(path), std::memory_order_relaxed);
+    return path;
+}
+
+std::string CpuPathName(CpuPath path) {
+    switch (path) {
+        case CpuPath::kSse42:
+            return "sse4.2";
+        case CpuPath::kAvx2:
+            return "avx2";
+        case CpuPath::kAvx512:
+            return "avx512";
+        default:
+            return "generic";
+    }
+}
+
+CpuPath CpuPathFromName(const std::string &name) {
+    if (name == "generic") return CpuPath::kGeneric;
+    if (name == "sse4.2") return CpuPath::kSse42;
+    if (name == "avx2") return CpuPath::kAvx2;
+    if (name == "avx512") return CpuPath::kAvx512;
+    throw CUException(__func__, __FILE__, __LINE__, "Unknown cpu path " + name);
+}
+
+}  // namespace tools
@@ -0,0 +1,175 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef TOOLS_CPU_DISPATCH_H
+#define TOOLS_CPU_DISPATCH_H
+
+#include <string>
+
+/**
+ * @file cpu_dispatch.h
+ * @brief Run time selection of the instruction set used by the hot kernels
+ *
+ * The hot kernels (the 2b water and water-ion polynomials, electric field
+ * kernels, dispersion and the 1b water potential) are compiled once per
+ * instruction set inside the same library, and the variant that is run is
+ * chosen when the first kernel is called, from the CPUID of the processor.
+ * This allows to ship one portable build instead of a -march=native one per
+ * machine.
+ *
+ * Only kernels with a loop over the clusters are dispatched. The other
+ * generated polynomials (the 3b ones and the MB-nrg 2b ones) evaluate one
+ * dimer or trimer per call, so a wider instruction set has no loop to
+ * vectorize, and each dispatched file takes about four times as long to
+ * compile.
+ *
+ * The environment variable MBX_CPU_PATH (generic, sse4.2, avx2 or avx512)
+ * restricts the path to the one given. A path that the processor does not
+ * support is lowered to the best supported one.
+ *
+ * A kernel is made dispatchable by moving its body into an always inlined
+ * function, and calling it through RunDispatched with a lambda:
+ * @code
+ * return tools::RunDispatched([&]() MBX_INLINE_LAMBDA { return KernelBody(args); });
+ * @endcode
+ * Each variant of RunDispatched is compiled for its instruction set, so the
+ * inlined body is vectorized for it.
+ */
+
+// The dispatch needs the x86 target attributes and __builtin_cpu_supports.
+// The Intel compiler has its own mechanism for it (-ax).
+#if !defined(MBX_NO_CPU_DISPATCH) && (defined(__x86_64__) || defined(__i386__)) && !defined(__INTEL_COMPILER) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 6))
+#define MBX_CPU_DISPATCH 1
+#define MBX_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define MBX_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define MBX_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#define MBX_ALWAYS_INLINE inline __attribute__((always_inline))
+#define MBX_INLINE_LAMBDA __attribute__((always_inline))
+#else
+#define MBX_CPU_DISPATCH 0
+#define MBX_ALWAYS_INLINE inline
+#define MBX_INLINE_LAMBDA
+#endif
+
+namespace tools {
+
+/**
+ * Instruction sets the kernels are compiled for, from the least to the
+ * most capable one.
+ */
+enum class CpuPath : int { kGeneric = 0, kSse42 = 1, kAvx2 = 2, kAvx512 = 3 };
+
+/**
+ * @brief Finds the most capable path supported by the processor.
+ * @return kGeneric if the library was built without dispatch
+ */
+CpuPath DetectCpuPath();
+
+/**
+ * @brief Returns the path used by the dispatched kernels.
+ *
+ * The first call detects it and applies MBX_CPU_PATH.
+ * @return Active path
+ */
+CpuPath GetCpuPath();
+
+/**
+ * @brief Sets the path used by the dispatched kernels.
+ *
+ * Paths not supported by the processor are lowered to the detected one.
+ * Meant for benchmarks and tests; do not call it while an energy is
+ * being computed.
+ * @param[in] path Requested path
+ * @return Path that has been set
+ */
+CpuPath SetCpuPath(CpuPath path);
+
+/**
+ * @brief Name of a path, as accepted by MBX_CPU_PATH
+ * @param[in] path Path
+ * @return Name of the path
+ */
+std::string CpuPathName(CpuPath path);
+
+/**
+ * @brief Path with a given name
+ * @param[in] name Name of the path (generic, sse4.2, avx2 or avx512)
+ * @return Path with that name. Throws CUException if the name is unknown
+ */
+CpuPath CpuPathFromName(const std::string &name);
+
+#if MBX_CPU_DISPATCH
+template <typename F>
+MBX_TARGET_SSE42 auto RunSse42(F &f) -> decltype(f()) {
+    return f();
+}
+
+template <typename F>
+MBX_TARGET_AVX2 auto RunAvx2(F &f) -> decltype(f()) {
+    return f();
+}
+
+template <typename F>
+MBX_TARGET_AVX512 auto RunAvx512(F &f) -> decltype(f()) {
+    return f();
+}
+#endif
+
+/**
+ * @brief Runs a kernel compiled for the active path.
+ * @param[in] f Callable without arguments. Must be marked MBX_INLINE_LAMBDA,
+ * and everything in it that has to be vectorized must be inlined too.
+ * @return What f returns
+ */
+template <typename F>
+auto RunDispatched(F &&f) -> decltype(f()) {
+#if MBX_CPU_DISPATCH
+    switch (GetCpuPath()) {
+        case CpuPath::kAvx512:
+            return RunAvx512(f);
+        case CpuPath::kAvx2:
+            return RunAvx2(f);
+        case CpuPath::kSse42:
+            return RunSse42(f);
+        default:
+            break;
+    }
+#endif
+    return f();
+}
+
+}  // namespace tools
+
+#endif  // TOOLS_CPU_DISPATCH_H
@@ -107,7 +107,20 @@ T DotProduct(const std::vector<T> &a, const std::vector<T> &b) {
 
 std::vector<double> InvertUnitCell(const std::vector<double> &box);
 
-double switch_function(const double &r, const double &ri, const double &ro, double &g);
+inline double switch_function(const double &r, const double &ri, const double &ro, double &g) {
+    if (r > ro) {
+        g = 0.0;
+        return 0.0;
+    } else if (r > ri) {
+        const double t1 = M_PI / (ro - ri);
+        const double x = (r - ri) * t1;
+        g = -std::sin(x) * t1 / 2.0;
+        return (1.0 + std::cos(x)) / 2.0;
+    } else {
+        g = 0.0;
+        return 1.0;
+    }
+}
 
 template <typename T>
 void MatrixTimesVector(const T *A, const T *b, T *c, size_t sizeA, size_t sizeb) {
@@ -0,0 +1,174 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef TOOLS_SITE_STORE_H
+#define TOOLS_SITE_STORE_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstddef>
+
+#include "tools/custom_exceptions.h"
+
+namespace tools {
+
+/**
+ * @class SiteStore
+ * @brief Coordinates of a set of sites in the layout of the force classes.
+ *
+ * Monomers are grouped by type, in system order. Within the block of a
+ * type, the coordinates are stored as x of site 0 of all the monomers,
+ * then y, then z, then site 1, and so on:
+ * xx..yy..zz(site 0) xx..yy..zz(site 1) ... (type 0) ... (type 1) ...
+ * The store is filled from an array of sites xyzxyz... in which the sites
+ * of monomer m start at first_index[m], so several force classes can share
+ * a single transposition of the system coordinates. Arrays in the store
+ * layout (e.g. gradients) are added back with ScatterAdd.
+ */
+class SiteStore {
+   public:
+    SiteStore() : nsites_(0) {}
+
+    /**
+     * Sets the monomers of the store.
+     * @param[in] mon_type_count Monomer types and number of monomers of each type, in system order
+     * @param[in] num_sites Number of sites stored for each monomer
+     * @param[in] first_index Index of the first site of each monomer in the arrays
+     * passed to Gather and ScatterAdd
+     */
+    void SetLayout(const std::vector<std::pair<std::string, size_t> > &mon_type_count,
+                   const std::vector<size_t> &num_sites, const std::vector<size_t> &first_index) {
+        if (num_sites.size() != first_index.size()) {
+            std::string text = "Number of monomers in num_sites (" + std::to_string(num_sites.size()) +
+                               ") and first_index (" + std::to_string(first_index.size()) + ") do not match.";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        type_nmon_.clear();
+        type_nsites_.clear();
+        size_t fi_mon = 0;
+        for (size_t mt = 0; mt < mon_type_count.size(); mt++) {
+            type_nmon_.push_back(mon_type_count[mt].second);
+            type_nsites_.push_back(mon_type_count[mt].second ? num_sites[fi_mon] : 0);
+            fi_mon += mon_type_count[mt].second;
+        }
+        first_index_ = first_index;
+        nsites_ = 0;
+        for (size_t m = 0; m < num_sites.size(); m++) nsites_ += num_sites[m];
+        xyz_.assign(3 * nsites_, 0.0);
+        sys_xyz_.assign(3 * nsites_, 0.0);
+    }
+
+    /**
+     * Copies the coordinates of the stored sites.
+     * @param[in] xyz Coordinates xyzxyz... of all the sites, indexed by first_index
+     */
+    void Gather(const double *xyz) {
+        size_t fi_mon = 0;
+        size_t fi_crd = 0;
+        for (size_t mt = 0; mt < type_nmon_.size(); mt++) {
+            size_t ns = type_nsites_[mt];
+            size_t nmon = type_nmon_[mt];
+            for (size_t m = 0; m < nmon; m++) {
+                const double *src = xyz + 3 * first_index_[fi_mon + m];
+                double *dst = sys_xyz_.data() + fi_crd + 3 * m * ns;
+                for (size_t i = 0; i < ns; i++) {
+                    double *soa = xyz_.data() + fi_crd + 3 * i * nmon + m;
+                    soa[0] = dst[3 * i] = src[3 * i];
+                    soa[nmon] = dst[3 * i + 1] = src[3 * i + 1];
+                    soa[2 * nmon] = dst[3 * i + 2] = src[3 * i + 2];
+                }
+            }
+            fi_mon += nmon;
+            fi_crd += 3 * nmon * ns;
+        }
+    }
+
+    /**
+     * Adds an array in the layout of the store to an array of sites.
+     * @param[in] soa Array in the layout of the store, e.g. gradients
+     * @param[in,out] xyz Array xyzxyz... of all the sites, indexed by first_index
+     */
+    void ScatterAdd(const double *soa, double *xyz) const {
+        size_t fi_mon = 0;
+        size_t fi_crd = 0;
+        for (size_t mt = 0; mt < type_nmon_.size(); mt++) {
+            size_t ns = type_nsites_[mt];
+            size_t nmon = type_nmon_[mt];
+            for (size_t m = 0; m < nmon; m++) {
+                double *dst = xyz + 3 * first_index_[fi_mon + m];
+                for (size_t i = 0; i < ns; i++) {
+                    const double *src = soa + fi_crd + 3 * i * nmon + m;
+                    dst[3 * i] += src[0];
+                    dst[3 * i + 1] += src[nmon];
+                    dst[3 * i + 2] += src[2 * nmon];
+                }
+            }
+            fi_mon += nmon;
+            fi_crd += 3 * nmon * ns;
+        }
+    }
+
+    /**
+     * @return Coordinates in the layout of the store
+     */
+    const std::vector<double> &GetXyz() const { return xyz_; }
+
+    /**
+     * @return Coordinates of the stored sites only, xyzxyz... in system order
+     */
+    const std::vector<double> &GetSysXyz() const { return sys_xyz_; }
+
+    /**
+     * @return Number of stored sites
+     */
+    size_t GetNumSites() const { return nsites_; }
+
+   private:
+    // Number of monomers and of sites per monomer of each type
+    std::vector<size_t> type_nmon_;
+    std::vector<size_t> type_nsites_;
+    // First site of each monomer in the arrays gathered from and scattered to
+    std::vector<size_t> first_index_;
+    // Total number of stored sites
+    size_t nsites_;
+    // Coordinates in the layout of the store
+    std::vector<double> xyz_;
+    // Coordinates of the stored sites, packed in system order
+    std::vector<double> sys_xyz_;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_SITE_STORE_H
@@ -0,0 +1,187 @@
+/******************************************************************************
+Copyright 2019 The Regents of the University of California.
+All Rights Reserved.
+
+Permission to copy, modify and distribute any part of this Software for
+educational, research and non-profit purposes, without fee, and without
+a written agreement is hereby granted, provided that the above copyright
+notice, this paragraph and the following three paragraphs appear in all
+copies.
+
+Those desiring to incorporate this Software into commercial products or
+use for commercial purposes should contact the:
+Office of Innovation & Commercialization
+University of California, San Diego
+9500 Gilman Drive, Mail Code 0910
+La Jolla, CA 92093-0910
+Ph: (858) 534-5815
+FAX: (858) 534-7345
+E-MAIL: invent@ucsd.edu
+
+IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE, EVEN IF THE UNIVERSITY
+OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+THE SOFTWARE PROVIDED HEREIN IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+CALIFORNIA HAS NO OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES,
+ENHANCEMENTS, OR MODIFICATIONS. THE UNIVERSITY OF CALIFORNIA MAKES NO
+REPRESENTATIONS AND EXTENDS NO WARRANTIES OF ANY KIND, EITHER IMPLIED OR
+EXPRESS, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE, OR THAT THE USE OF THE
+SOFTWARE WILL NOT INFRINGE ANY PATENT, TRADEMARK OR OTHER RIGHTS.
+******************************************************************************/
+
+#ifndef TOOLS_WORKSPACE_H
+#define TOOLS_WORKSPACE_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <memory>
+
+#include "tools/custom_exceptions.h"
+
+namespace tools {
+
+/**
+ * @class Workspace
+ * @brief Set of scratch buffers that are kept alive between energy calls.
+ *
+ * Each thread owns a fixed number of buffers, addressed by an integer id.
+ * A buffer only reallocates when it is requested with a size larger than
+ * its current capacity, so after the first call with a given system size
+ * the buffers are reused instead of being reallocated. Every time a buffer
+ * grows it is counted, which allows tests to check that the buffers have
+ * reached a steady size. Allocations done outside of the workspace are not
+ * counted.
+ */
+class Workspace {
+   public:
+    Workspace(size_t nbuffers = 0) : nbuffers_(nbuffers) {}
+
+    /**
+     * Makes sure there is one set of buffers per thread. Must be called
+     * outside of any parallel region, before the buffers of a given rank
+     * are requested.
+     * @param[in] nthreads Number of threads that will request buffers
+     */
+    void SetNumThreads(size_t nthreads) {
+        if (threads_.size() < nthreads) {
+            threads_.resize(nthreads, ThreadBuffers(nbuffers_));
+            num_resizes_++;
+        }
+    }
+
+    /**
+     * Returns buffer id of thread rank with n elements set to value.
+     * @param[in] id Buffer id
+     * @param[in] n Number of elements
+     * @param[in] rank Thread that owns the buffer
+     * @param[in] value Value the n elements are set to
+     * @return Reference to the buffer, valid until the next call with the same id and rank
+     */
+    std::vector<double> &Get(size_t id, size_t n, size_t rank = 0, double value = 0.0) {
+        std::vector<double> &buffer = Buffer(id, rank);
+        if (n > buffer.capacity()) threads_[rank].num_grows++;
+        buffer.assign(n, value);
+        return buffer;
+    }
+
+    /**
+     * Returns buffer id of thread rank empty, but with capacity for at least
+     * n elements so it can be filled with push_back without reallocating.
+     * @param[in] id Buffer id
+     * @param[in] n Minimum capacity
+     * @param[in] rank Thread that owns the buffer
+     * @return Reference to the buffer, valid until the next call with the same id and rank
+     */
+    std::vector<double> &Reserve(size_t id, size_t n, size_t rank = 0) {
+        std::vector<double> &buffer = Buffer(id, rank);
+        buffer.clear();
+        if (n > buffer.capacity()) {
+            threads_[rank].num_grows++;
+            buffer.reserve(n);
+        }
+        return buffer;
+    }
+
+    /**
+     * Returns buffer id of thread rank as it was left by the last call to
+     * Get or Reserve. Never allocates.
+     * @param[in] id Buffer id
+     * @param[in] rank Thread that owns the buffer
+     * @return Reference to the buffer
+     */
+    std::vector<double> &At(size_t id, size_t rank = 0) { return Buffer(id, rank); }
+
+    /**
+     * Gets the number of times any of the buffers, or the set of buffers
+     * itself, had to grow since construction.
+     * @return Number of times the workspace grew
+     */
+    size_t GetNumBufferResizes() const {
+        size_t n = num_resizes_;
+        for (size_t i = 0; i < threads_.size(); i++) n += threads_[i].num_grows;
+        return n;
+    }
+
+   private:
+    struct ThreadBuffers {
+        ThreadBuffers(size_t nbuffers) : buffers(nbuffers), num_grows(0) {}
+        std::vector<std::vector<double>> buffers;
+        size_t num_grows;
+    };
+
+    std::vector<double> &Buffer(size_t id, size_t rank) {
+        if (rank >= threads_.size() || id >= nbuffers_) {
+            std::string text = "Workspace buffer " + std::to_string(id) + " of thread " + std::to_string(rank) +
+                               " does not exist. The workspace has " + std::to_string(nbuffers_) +
+                               " buffers for " + std::to_string(threads_.size()) + " threads.";
+            throw CUException(__func__, __FILE__, __LINE__, text);
+        }
+        return threads_[rank].buffers[id];
+    }
+
+    // Number of buffers per thread
+    size_t nbuffers_;
+    // Number of times the set of per thread buffers grew
+    size_t num_resizes_ = 0;
+    // Buffers of each thread
+    std::vector<ThreadBuffers> threads_;
+};
+
+/**
+ * @class Persistent
+ * @brief Owns an object that is expensive to set up and is reused between
+ * calls, such as a PME solver.
+ *
+ * The object is created on first use. Copies start empty and create their
+ * own object when needed, so a class holding a Persistent member stays
+ * copyable even if T is not, and copies never share state.
+ */
+template <typename T>
+class Persistent {
+   public:
+    Persistent() {}
+    Persistent(const Persistent &) {}
+    Persistent &operator=(const Persistent &) {
+        ptr_.reset();
+        return *this;
+    }
+
+    /**
+     * @return Reference to the owned object, created if needed
+     */
+    T &Get() {
+        if (!ptr_) ptr_.reset(new T());
+        return *ptr_;
+    }
+
+   private:
+    std::unique_ptr<T> ptr_;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_WORKSPACE_H